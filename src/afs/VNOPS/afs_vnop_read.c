@@ -395,12 +395,78 @@ out:
     return code;
 }
 
+/* Queue a background fetch of the chunk at offset, unless it is already
+ * cached or on its way.  Returns 0 if no more fetches can be queued now.
+ *
+ * This function must be called with the vnode at least read-locked, and
+ * no locks on the dcache.
+ */
+static int
+afs_PrefetchOneChunk(struct vcache *avc, afs_size_t offset,
+		     afs_ucred_t *acred, struct vrequest *areq)
+{
+    struct dcache *tdc;
+    afs_size_t j1, j2;		/* junk vbls for GetDCache to trash */
+    int fresh;
+
+    tdc = afs_GetDCache(avc, offset, areq, &j1, &j2, 2);	/* type 2 never returns 0 */
+    /*
+     * In disconnected mode, type 2 can return 0 because it doesn't
+     * make any sense to allocate a dcache we can never fill
+     */
+    if (tdc == NULL)
+	return 1;
+
+    ObtainReadLock(&tdc->lock);
+    fresh = afs_IsDCacheFresh(tdc, avc) || (tdc->dflags & DFFetching);
+    ReleaseReadLock(&tdc->lock);
+    if (fresh) {
+	afs_PutDCache(tdc);
+	return 1;
+    }
+
+    ObtainSharedLock(&tdc->mflock, 651);
+    if (tdc->mflags & DFFetchReq) {
+	ReleaseSharedLock(&tdc->mflock);
+	afs_PutDCache(tdc);
+	return 1;
+    }
+
+    /* ask the daemon to do the work */
+    UpgradeSToWLock(&tdc->mflock, 652);
+    tdc->mflags |= DFFetchReq;	/* guaranteed to be cleared by BKG or GetDCache */
+    /* the bkg daemon does an afs_PutDCache when it is done, since we don't
+     * want to wait for it to finish before doing so ourselves.
+     */
+    if (!afs_BQueueFetch(avc, acred, offset, tdc)) {
+	/* At a fetch limit, or the bkg table is full; just abort
+	 * non-important prefetching to avoid deadlocks */
+	tdc->mflags &= ~DFFetchReq;
+	ReleaseWriteLock(&tdc->mflock);
+	afs_PutDCache(tdc);
+	return 0;
+    }
+    ReleaseWriteLock(&tdc->mflock);
+    return 1;
+}
+
 /* called with the dcache entry triggering the fetch, the vcache entry involved,
  * and a vrequest for the read call.  Marks the dcache entry as having already
  * triggered a prefetch, starts the prefetch going and sets the DFFetchReq
- * flag in the prefetched block, so that the next call to read knows to wait
+ * flag in the prefetched blocks, so that the next call to read knows to wait
  * for the daemon to start doing things.
  *
+ * The number of chunks read ahead adapts to the access pattern.  Each time a
+ * read moves on to the chunk after the one that last triggered read-ahead,
+ * the window doubles, up to afs_readAhead chunks; any other move drops it
+ * back to one chunk.  Each chunk is a separate background request, so with
+ * several background daemons several chunks are fetched at once, up to the
+ * limits afs_BQueueFetch sets; only chunks that have not been asked for yet
+ * are queued.
+ *
+ * The read-ahead state in the vcache is only a hint, and is updated with
+ * the vnode read-locked; a lost update just changes how far ahead we read.
+ *
  * This function must be called with the vnode at least read-locked, and
  * no locks on the dcache, because it plays around with dcache entries.
  */
@@ -408,66 +474,59 @@ void
 afs_PrefetchChunk(struct vcache *avc, struct dcache *adc,
 		  afs_ucred_t *acred, struct vrequest *areq)
 {
-    struct dcache *tdc;
+    afs_int32 chunk, window, next, last;
     afs_size_t offset;
-    afs_size_t j1, j2;		/* junk vbls for GetDCache to trash */
 
-    offset = adc->f.chunk + 1;	/* next chunk we'll need */
-    offset = AFS_CHUNKTOBASE(offset);	/* base of next chunk */
+    chunk = adc->f.chunk;
+    offset = AFS_CHUNKTOBASE(chunk + 1);	/* base of next chunk */
     ObtainReadLock(&adc->lock);
     ObtainSharedLock(&adc->mflock, 662);
     if (offset < avc->f.m.Length && !(adc->mflags & DFNextStarted)
-	&& !afs_BBusy()) {
-	struct brequest *bp;
+	&& afs_readAhead > 0 && !afs_BBusy()) {
 
 	UpgradeSToWLock(&adc->mflock, 663);
 	adc->mflags |= DFNextStarted;	/* we've tried to prefetch for this guy */
 	ReleaseWriteLock(&adc->mflock);
 	ReleaseReadLock(&adc->lock);
 
-	tdc = afs_GetDCache(avc, offset, areq, &j1, &j2, 2);	/* type 2 never returns 0 */
-        /*
-         * In disconnected mode, type 2 can return 0 because it doesn't
-         * make any sense to allocate a dcache we can never fill
-         */
-         if (tdc == NULL)
-             return;
-
-	ObtainSharedLock(&tdc->mflock, 651);
-	if (!(tdc->mflags & DFFetchReq)) {
-	    /* ask the daemon to do the work */
-	    UpgradeSToWLock(&tdc->mflock, 652);
-	    tdc->mflags |= DFFetchReq;	/* guaranteed to be cleared by BKG or GetDCache */
-	    /* last parm (1) tells bkg daemon to do an afs_PutDCache when it is done,
-	     * since we don't want to wait for it to finish before doing so ourselves.
-	     */
-	    bp = afs_BQueue(BOP_FETCH, avc, B_DONTWAIT, 0, acred,
-			    (afs_size_t) offset, (afs_size_t) 1, tdc,
-			    (void *)0, (void *)0);
-	    if (!bp) {
-		/* Bkg table full; just abort non-important prefetching to avoid deadlocks */
-		tdc->mflags &= ~DFFetchReq;
-		ReleaseWriteLock(&tdc->mflock);
-		afs_PutDCache(tdc);
-
-		/*
-		 * DCLOCKXXX: This is a little sketchy, since someone else
-		 * could have already started a prefetch..  In practice,
-		 * this probably doesn't matter; at most it would cause an
-		 * extra slot in the BKG table to be used up when someone
-		 * prefetches this for the second time.
-		 */
-		ObtainReadLock(&adc->lock);
-		ObtainWriteLock(&adc->mflock, 664);
-		adc->mflags &= ~DFNextStarted;
-		ReleaseWriteLock(&adc->mflock);
-		ReleaseReadLock(&adc->lock);
-	    } else {
-		ReleaseWriteLock(&tdc->mflock);
-	    }
+	if (chunk == avc->raChunk + 1 && avc->raWindow > 0) {
+	    /* sequential: grow the window, and skip what is already queued */
+	    window = avc->raWindow * 2;
+	    if (window > afs_readAhead)
+		window = afs_readAhead;
+	    next = avc->raNextChunk;
+	    if (next <= chunk)
+		next = chunk + 1;
 	} else {
-	    ReleaseSharedLock(&tdc->mflock);
-	    afs_PutDCache(tdc);
+	    window = 1;
+	    next = chunk + 1;
+	}
+	last = chunk + window;
+	avc->raChunk = chunk;
+	avc->raWindow = window;
+
+	for (; next <= last; next++) {
+	    offset = AFS_CHUNKTOBASE(next);
+	    if (offset >= avc->f.m.Length)
+		break;
+	    if (!afs_PrefetchOneChunk(avc, offset, acred, areq))
+		break;
+	}
+	avc->raNextChunk = next;
+
+	if (next == chunk + 1) {
+	    /*
+	     * DCLOCKXXX: This is a little sketchy, since someone else
+	     * could have already started a prefetch..  In practice,
+	     * this probably doesn't matter; at most it would cause an
+	     * extra slot in the BKG table to be used up when someone
+	     * prefetches this for the second time.
+	     */
+	    ObtainReadLock(&adc->lock);
+	    ObtainWriteLock(&adc->mflock, 664);
+	    adc->mflags &= ~DFNextStarted;
+	    ReleaseWriteLock(&adc->mflock);
+	    ReleaseReadLock(&adc->lock);
 	}
     } else {
 	ReleaseSharedLock(&adc->mflock);
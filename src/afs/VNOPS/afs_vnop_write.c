@@ -30,6 +30,12 @@
 
 extern unsigned char *afs_indexFlags;
 
+#ifdef AFS_FBSD_ENV
+static int bkg_store_disabled = 1;
+#else
+static int bkg_store_disabled = 0;
+#endif
+
 /* Called by all write-on-close routines: regular afs_close,
  * store via background daemon and store via the
  * afs_FlushActiveVCaches routine (when CCORE is on).
@@ -193,6 +199,41 @@ afs_UFSWriteUIO(struct vcache *avc, afs_dcache_id_t *inode, struct uio *tuiop)
 }
 
 /* called on writes */
+#if !defined(AFS_VM_RDWR_ENV)
+/*
+ * Write-behind: once a writer has moved afs_writeBehind chunks past the
+ * last chunk handed to a background daemon, queue a store of the dirty
+ * chunks before the one it is writing now.  The daemon stores them when
+ * it gets the vnode lock between writes, so a sequential writer leaves
+ * only its last few chunks for close to store.  Only one write-behind
+ * store per file is queued at a time; the fileserver serializes stores
+ * to a file anyway, but stores of different files run in parallel.
+ *
+ * Called with avc write-locked.
+ */
+static void
+afs_WriteBehind(struct vcache *avc, afs_ucred_t *acred, afs_size_t filePos)
+{
+    afs_int32 chunk;
+
+    if (afs_writeBehind <= 0 || avc->wbQueued || bkg_store_disabled
+	|| AFS_IS_DISCONNECTED || AFS_NFSXLATORREQ(acred))
+	return;
+    chunk = AFS_CHUNK(filePos);
+    if (chunk < avc->wbChunk)
+	avc->wbChunk = chunk;	/* moved back; start counting again */
+    if (chunk - avc->wbChunk < afs_writeBehind)
+	return;
+    /* The daemon needs the vnode lock, so it cannot start before we are
+     * done with wbQueued and wbChunk. */
+    if (afs_BQueue(BOP_STORE_BEHIND, avc, B_DONTWAIT, 0, acred,
+		   (afs_size_t) 0, (afs_size_t) 0, NULL, NULL, NULL)) {
+	avc->wbQueued = 1;
+	avc->wbChunk = chunk;
+    }
+}
+#endif
+
 int
 afs_write(struct vcache *avc, struct uio *auio, int aio,
 	     afs_ucred_t *acred, int noLock)
@@ -387,6 +428,7 @@ afs_write(struct vcache *avc, struct uio *auio, int aio,
 		error = code;
 		break;
 	    }
+	    afs_WriteBehind(avc, acred, filePos);
 	}
 #endif
     }
@@ -453,12 +495,6 @@ afs_DoPartialWrite(struct vcache *avc, struct vrequest *areq)
     return code;
 }
 
-#ifdef AFS_FBSD_ENV
-static int bkg_store_disabled = 1;
-#else
-static int bkg_store_disabled = 0;
-#endif
-
 /* handle any closing cleanup stuff */
 int
 #if defined(AFS_SGI_ENV)
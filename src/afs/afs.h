@@ -156,6 +156,7 @@ struct dcache;
 #define AFS_LASTSTORE   4
 #define AFS_VMSYNC      8       /* sync pages but do not invalidate */
 #define AFS_NOVMSYNC    16      /* force skipping syncing vm pages; just write afs dcache data */
+#define AFS_WRITEBEHIND 32      /* only store chunks before avc->wbChunk */
 
 /* background request structure */
 #define	BPARMS		4
@@ -170,6 +171,8 @@ struct dcache;
 #endif
 #define BOP_PARTIAL_STORE 6     /* parm1 is chunk to store */
 #define BOP_INVALIDATE_SEGMENTS 7 /* no parms: just uses the 'bp->vc' vcache */
+#define BOP_FETCH_AHEAD	8	/* as BOP_FETCH, counted in the fetch limits */
+#define BOP_STORE_BEHIND 9	/* no parms: store chunks before vc->wbChunk */
 
 #define	B_DONTWAIT	1	/* On failure return; don't wait */
 
@@ -946,6 +949,13 @@ struct vcache {
     char cachingStates;			/* Caching policies for this file */
     afs_uint32 cachingTransitions;		/* # of times file has flopped between caching and not */
 
+    afs_int32 raChunk;		/* chunk that last triggered read-ahead */
+    afs_int32 raNextChunk;	/* first chunk not yet queued for read-ahead */
+    afs_int32 raWindow;		/* chunks to read ahead of raChunk */
+    afs_int32 raFetches;	/* read-ahead fetches queued or running */
+    afs_int32 wbChunk;		/* write-behind stores chunks before this */
+    afs_int32 wbQueued;		/* write-behind store queued or running */
+
 #if defined(AFS_LINUX_ENV)
     off_t next_seq_offset;	/* Next sequential offset (used by prefetch/readahead) */
 #elif defined(AFS_SUN5_ENV) || defined(AFS_SGI_ENV)
@@ -1634,6 +1634,39 @@ afs_syscall_call(long parm, long parm2, long parm3,
 	    afs_volume_ttl = parm2;
 	    code = 0;
 	}
+    } else if (parm == AFSOP_SET_READAHEAD) {
+	if (parm2 < 0 || parm2 > AFS_MAX_READAHEAD) {
+	    code = EFAULT;
+	} else {
+	    afs_readAhead = parm2;
+	    code = 0;
+	}
+    } else if (parm == AFSOP_SET_FETCHLIMITS) {
+	if (parm2 < 1 || parm2 > AFS_MAX_FETCH_LIMIT
+	    || parm3 < 1 || parm3 > AFS_MAX_FETCH_LIMIT) {
+	    code = EFAULT;
+	} else {
+	    afs_fetchPerFile = parm2;
+	    afs_fetchPerServer = parm3;
+	    code = 0;
+	}
+    } else if (parm == AFSOP_SET_WRITEBEHIND) {
+	if (parm2 < 0) {
+	    code = EFAULT;
+	} else {
+	    afs_writeBehind = parm2;
+	    code = 0;
+	}
+    } else if (parm == AFSOP_SET_DCACHEPOLICY) {
+	switch (parm2) {
+	case AFS_DCREPL_LRU:
+	case AFS_DCREPL_CLOCK:
+	    afs_dcacheReplacement = parm2;
+	    code = 0;
+	    break;
+	default:
+	    code = EINVAL;
+	}
 #ifdef AFS_SOCKPROXY_ENV
     } else if (parm == AFSOP_SOCKPROXY_HANDLER) {
 	code = sockproxy_handler(AFSKPTR(parm2), AFSKPTR(parm3));
@@ -48,6 +48,15 @@ afs_int32 afs_CheckServerDaemonStarted = 0;
 afs_int32 afs_probe_interval = DEFAULT_PROBE_INTERVAL;
 afs_int32 afs_probe_all_interval = 600;
 afs_int32 afs_preCache = 0;
+afs_int32 afs_readAhead = AFS_DEFAULT_READAHEAD;	/* max chunks to read ahead */
+afs_int32 afs_fetchPerFile = AFS_DEFAULT_FETCH_PER_FILE;
+afs_int32 afs_fetchPerServer = AFS_DEFAULT_FETCH_PER_SERVER;
+afs_int32 afs_writeBehind = 0;	/* chunks written before storing behind */
+
+/* Read-ahead fetches queued or running, by server address hash.  Servers
+ * sharing a slot share a limit, which only makes it stricter.  Protected by
+ * afs_xbrs. */
+static afs_int32 afs_srvFetches[NSERVERS];
 
 #define PROBE_WAIT() (1000 * (afs_probe_interval - ((afs_random() & 0x7fffffff) \
 		      % (afs_probe_interval/2))))
@@ -426,7 +435,8 @@ BPath(struct brequest *ab)
 
 /* size_parm 0 to the fetch is the chunk number,
  * ptr_parm 0 is the dcache entry to wakeup,
- * size_parm 1 is true iff we should release the dcache entry here.
+ * size_parm 1 is true iff we should release the dcache entry here,
+ * ptr_parm 1 is the afs_srvFetches counter for BOP_FETCH_AHEAD, if any.
  */
 static void
 BPrefetch(struct brequest *ab)
@@ -438,10 +448,10 @@ BPrefetch(struct brequest *ab)
     int code;
 
     AFS_STATCNT(BPrefetch);
+    tvc = ab->vc;
     if ((code = afs_CreateReq(&treq, ab->cred)))
-	return;
+	goto done;
     abyte = ab->size_parm[0];
-    tvc = ab->vc;
     do {
 	tdc = afs_GetDCache(tvc, abyte, treq, &offset, &len, 1);
 	if (tdc) {
@@ -467,6 +477,17 @@ BPrefetch(struct brequest *ab)
     if (ab->size_parm[1]) {
 	afs_PutDCache(tdc);	/* put this one back, too */
     }
+  done:
+    /* give back the read-ahead slots afs_BQueueFetch took, even on error */
+    if (ab->opcode == BOP_FETCH_AHEAD) {
+	afs_int32 *srvFetches = ab->ptr_parm[1];
+
+	ObtainWriteLock(&afs_xbrs, 308);
+	tvc->raFetches--;
+	if (srvFetches)
+	    (*srvFetches)--;
+	ReleaseWriteLock(&afs_xbrs);
+    }
     afs_DestroyReq(treq);
 }
 
@@ -585,6 +606,28 @@ BPartialStore(struct brequest *ab)
     afs_DestroyReq(treq);
 }
 
+/* Store the chunks a writer has moved past; see afs_WriteBehind.  A failed
+ * store leaves the chunks dirty for the next store, unless the error is
+ * permanent, in which case later writes and the close report it. */
+static void
+BStoreBehind(struct brequest *ab)
+{
+    struct vcache *tvc = ab->vc;
+    struct vrequest *treq = NULL;
+    afs_int32 code;
+
+    AFS_STATCNT(BStoreBehind);
+    ObtainWriteLock(&tvc->lock, 1210);
+    if (afs_CreateReq(&treq, ab->cred) == 0) {
+	code = afs_StoreAllSegments(tvc, treq, AFS_ASYNC | AFS_WRITEBEHIND);
+	if (code && !tvc->vc_error)
+	    tvc->vc_error = afs_CheckCode(code, treq, 105);
+	afs_DestroyReq(treq);
+    }
+    tvc->wbQueued = 0;
+    ReleaseWriteLock(&tvc->lock);
+}
+
 static void
 BInvalidateSegments(struct brequest *ab)
 {
@@ -686,6 +729,57 @@ afs_BQueue(short aopcode, struct vcache *avc,
     }
 }
 
+/**
+ * Queue a background fetch of one chunk for read-ahead.
+ *
+ * Each read-ahead chunk is fetched with its own FetchData call, so the
+ * number queued or running at once is limited both for the file and for
+ * the fileserver the file was last fetched from; afs_Conn spreads the
+ * calls to one server over the connections it keeps for each user.
+ *
+ * @param[in] avc     file to fetch from
+ * @param[in] acred   credentials to fetch with
+ * @param[in] offset  offset of the chunk to fetch
+ * @param[in] tdc     dcache entry for the chunk, put by the daemon
+ *
+ * @return the queued request
+ *   @retval NULL a limit was reached, or the request table is full
+ */
+struct brequest *
+afs_BQueueFetch(struct vcache *avc, afs_ucred_t *acred, afs_size_t offset,
+		struct dcache *tdc)
+{
+    struct brequest *tb;
+    struct server *ts;
+    afs_int32 *srvFetches = NULL;
+
+    ts = avc->callback;
+    if (ts && ts->addr)
+	srvFetches = &afs_srvFetches[SHash(ts->addr->sa_ip)];
+
+    ObtainWriteLock(&afs_xbrs, 309);
+    if (avc->raFetches >= afs_fetchPerFile
+	|| (srvFetches && *srvFetches >= afs_fetchPerServer)) {
+	ReleaseWriteLock(&afs_xbrs);
+	return NULL;
+    }
+    avc->raFetches++;
+    if (srvFetches)
+	(*srvFetches)++;
+    ReleaseWriteLock(&afs_xbrs);
+
+    tb = afs_BQueue(BOP_FETCH_AHEAD, avc, B_DONTWAIT, 0, acred, offset,
+		    (afs_size_t) 1, tdc, srvFetches, NULL);
+    if (!tb) {
+	ObtainWriteLock(&afs_xbrs, 310);
+	avc->raFetches--;
+	if (srvFetches)
+	    (*srvFetches)--;
+	ReleaseWriteLock(&afs_xbrs);
+    }
+    return tb;
+}
+
 #ifdef AFS_AIX41_ENV
 /* AIX 4.1 has a much different sleep/wakeup mechanism available for use.
  * The modifications here will work for either a UP or MP machine.
@@ -1122,7 +1216,7 @@ afs_BackgroundDaemon(void)
 	    n_processed++;
 	    afs_Trace1(afs_iclSetp, CM_TRACE_BKG1, ICL_TYPE_INT32,
 		       tb->opcode);
-	    if (tb->opcode == BOP_FETCH)
+	    if (tb->opcode == BOP_FETCH || tb->opcode == BOP_FETCH_AHEAD)
 		BPrefetch(tb);
 #if defined(AFS_CACHE_BYPASS)
 	    else if (tb->opcode == BOP_FETCH_NOCACHE)
@@ -1147,6 +1241,8 @@ afs_BackgroundDaemon(void)
 #endif
 	    else if (tb->opcode == BOP_PARTIAL_STORE)
 		BPartialStore(tb);
+	    else if (tb->opcode == BOP_STORE_BEHIND)
+		BStoreBehind(tb);
 	    else if (tb->opcode == BOP_INVALIDATE_SEGMENTS)
 		BInvalidateSegments(tb);
 	    else
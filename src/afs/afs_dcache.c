@@ -33,6 +33,10 @@ static void afs_DCAdjustSize(struct dcache *, afs_int32, afs_int32);
 static void afs_DCMoveBucket(struct dcache *, afs_int32, afs_int32);
 static void afs_DCSizeInit(void);
 static afs_int32 afs_DCWhichBucket(afs_int32, afs_int32);
+/* For afs_GetDownD victim selection */
+static void afs_DCClockReset(afs_int32);
+static int afs_DCLRUVictims(afs_uint32 *, int, afs_int32);
+static int afs_DCClockVictims(afs_uint32 *, int, afs_int32, afs_int32 *);
 
 /*
  * --------------------- Exported definitions ---------------------
@@ -66,6 +70,10 @@ struct dcache **afs_indexTable;	/*!< Pointers to dcache entries */
 afs_hyper_t *afs_indexTimes;	/*!< Dcache entry Access times */
 afs_int32 *afs_indexUnique;	/*!< dcache entry Fid.Unique */
 unsigned char *afs_indexFlags;	/*!< (only one) Is there data there? */
+static unsigned char *afs_indexClock;	/*!< CLOCK policy state, DCLOCK_* */
+static afs_int32 afs_dcClockHand;	/*!< Next index the clock hand visits */
+static afs_int32 afs_dcClockHot;	/*!< Entries with DCLOCK_HOT set */
+afs_int32 afs_dcacheReplacement = AFS_DCREPL_LRU;	/*!< GetDownD policy */
 afs_hyper_t afs_indexCounter;	/*!< Fake time for marking index
 				 * entries */
 afs_int32 afs_cacheFiles = 0;	/*!< Size of afs_indexTable */
@@ -619,6 +627,183 @@ afs_AdjustSize(struct dcache *adc, afs_int32 newSize)
 }
 
 
+#define	MAXATONCE   16		/* max we can obtain at once */
+
+/*
+ * States of a dcache entry for the CLOCK replacement policy, kept in
+ * afs_indexClock.  An entry comes in cold.  The hand moves a referenced
+ * cold entry to its test period, and one referenced again by the next time
+ * the hand comes round is hot.  Cold entries the hand finds unreferenced
+ * are victims; hot ones are only demoted to cold when there are too many
+ * of them, or when the hand has gone round once without finding enough
+ * victims.  A file read once, even a large one, only ever fills cold
+ * entries, and so does not push the working set out of the cache.
+ */
+#define DCLOCK_REF	1	/* referenced since the hand last passed */
+#define DCLOCK_TEST	2	/* cold, and referenced once */
+#define DCLOCK_HOT	4	/* in the working set */
+
+#define DCLOCK_HOTPCT	75	/* most of the cache that may be hot */
+
+/*!
+ * Forget the CLOCK state of a dcache entry that is leaving the cache.
+ *
+ * \param index Index of the entry.
+ *
+ * \note Environment: called with afs_xdcache lock write-locked.
+ */
+static void
+afs_DCClockReset(afs_int32 index)
+{
+    if (afs_indexClock[index] & DCLOCK_HOT)
+	afs_dcClockHot--;
+    afs_indexClock[index] = 0;
+}
+
+/*!
+ * Select victims for afs_GetDownD: the oldest entries by afs_indexTimes.
+ * This looks at every entry in the cache.
+ *
+ * \param victims Array of MAXATONCE indices to fill in.
+ * \param phase Reclaim phase; see afs_GetDownD.
+ * \param curbucket Split cache bucket to take victims from.
+ *
+ * \return The number of victims selected.
+ *
+ * \note Environment: called with afs_xdcache lock write-locked.
+ */
+static int
+afs_DCLRUVictims(afs_uint32 *victims, int phase, afs_int32 curbucket)
+{
+    struct dcache *tdc;
+    afs_int32 i, j;
+    afs_hyper_t vtime;
+    afs_hyper_t victimTimes[MAXATONCE];	/* youngest (largest LRU time) first */
+    afs_uint32 victimPtr;	/* next free item in victim arrays */
+    afs_hyper_t maxVictimTime;	/* youngest (largest LRU time) victim */
+    afs_uint32 maxVictimPtr;	/* where it is */
+
+    maxVictimPtr = victimPtr = 0;
+    hzero(maxVictimTime);
+    /* select victims from access time array */
+    for (i = 0; i < afs_cacheFiles; i++) {
+	if (afs_indexFlags[i] & (IFDataMod | IFFree | IFDiscarded)) {
+	    /* skip if dirty or already free */
+	    continue;
+	}
+	tdc = afs_indexTable[i];
+	if (tdc && (curbucket != tdc->bucket) && (phase < 4))
+	{
+	    /* Wrong bucket; can't use it! */
+	    continue;
+	}
+	if (tdc && (tdc->refCount != 0)) {
+	    /* Referenced; can't use it! */
+	    continue;
+	}
+	hset(vtime, afs_indexTimes[i]);
+
+	/* if we've already looked at this one, skip it */
+	if (afs_indexFlags[i] & IFFlag)
+	    continue;
+
+	if (victimPtr < MAXATONCE) {
+	    /* if there's at least one free victim slot left */
+	    victims[victimPtr] = i;
+	    hset(victimTimes[victimPtr], vtime);
+	    if (hcmp(vtime, maxVictimTime) > 0) {
+		hset(maxVictimTime, vtime);
+		maxVictimPtr = victimPtr;
+	    }
+	    victimPtr++;
+	} else if (hcmp(vtime, maxVictimTime) < 0) {
+	    /*
+	     * We're older than youngest victim, so we replace at
+	     * least one victim
+	     */
+	    /* find youngest (largest LRU) victim */
+	    j = maxVictimPtr;
+	    if (j == victimPtr)
+		osi_Panic("getdownd local");
+	    victims[j] = i;
+	    hset(victimTimes[j], vtime);
+	    /* recompute maxVictimTime */
+	    hset(maxVictimTime, vtime);
+	    for (j = 0; j < victimPtr; j++)
+		if (hcmp(maxVictimTime, victimTimes[j]) < 0) {
+		    hset(maxVictimTime, victimTimes[j]);
+		    maxVictimPtr = j;
+		}
+	}
+    }			/* big for loop */
+
+    return victimPtr;
+}
+
+/*!
+ * Select victims for afs_GetDownD by moving the clock hand; see DCLOCK_REF.
+ * The hand stops when it has found MAXATONCE victims or has used up the
+ * sweep budget, so the cost is proportional to the entries it passes.
+ *
+ * \param victims Array of MAXATONCE indices to fill in.
+ * \param phase Reclaim phase; see afs_GetDownD.
+ * \param curbucket Split cache bucket to take victims from.
+ * \param asweep Entries the hand may still visit; updated.
+ *
+ * \return The number of victims selected.
+ *
+ * \note Environment: called with afs_xdcache lock write-locked.
+ */
+static int
+afs_DCClockVictims(afs_uint32 *victims, int phase, afs_int32 curbucket,
+		   afs_int32 *asweep)
+{
+    struct dcache *tdc;
+    afs_int32 i;
+    unsigned char *state;
+    int force;
+    int victimPtr = 0;
+
+    while (victimPtr < MAXATONCE && *asweep > 0) {
+	(*asweep)--;
+	i = afs_dcClockHand;
+	if (++afs_dcClockHand >= afs_cacheFiles)
+	    afs_dcClockHand = 0;
+
+	if (afs_indexFlags[i] & (IFDataMod | IFFree | IFDiscarded))
+	    continue;		/* dirty or already free */
+	tdc = afs_indexTable[i];
+	if (tdc && (curbucket != tdc->bucket) && (phase < 4))
+	    continue;		/* wrong bucket */
+	if (tdc && (tdc->refCount != 0))
+	    continue;		/* referenced */
+
+	state = &afs_indexClock[i];
+	if ((*state & DCLOCK_HOT)) {
+	    /* once round without enough victims, demote what we must */
+	    force = (*asweep < 2 * afs_cacheFiles);
+	    if ((*state & DCLOCK_REF)) {
+		*state &= ~DCLOCK_REF;
+	    } else if (force
+		       || afs_dcClockHot > PERCENT(DCLOCK_HOTPCT,
+						   afs_cacheFiles)) {
+		*state = 0;
+		afs_dcClockHot--;
+	    }
+	} else if ((*state & DCLOCK_REF)) {
+	    if ((*state & DCLOCK_TEST)) {
+		*state = DCLOCK_HOT;
+		afs_dcClockHot++;
+	    } else {
+		*state = DCLOCK_TEST;
+	    }
+	} else {
+	    victims[victimPtr++] = i;
+	}
+    }
+    return victimPtr;
+}
+
 /*!
  * This routine is responsible for moving at least one entry (but up
  * to some number of them) from the LRU queue to the free queue.
@@ -641,7 +826,6 @@ afs_AdjustSize(struct dcache *adc, afs_int32 newSize)
  *  something. We should be able to automatically correct that problem.
  */
 
-#define	MAXATONCE   16		/* max we can obtain at once */
 static void
 afs_GetDownD(int anumber, int *aneedSpace, afs_int32 buckethint)
 {
@@ -649,15 +833,12 @@ afs_GetDownD(int anumber, int *aneedSpace, afs_int32 buckethint)
     struct dcache *tdc;
     struct VenusFid *afid;
     afs_int32 i, j;
-    afs_hyper_t vtime;
     int skip, phase;
     struct vcache *tvc;
     afs_uint32 victims[MAXATONCE];
     struct dcache *victimDCs[MAXATONCE];
-    afs_hyper_t victimTimes[MAXATONCE];	/* youngest (largest LRU time) first */
     afs_uint32 victimPtr;	/* next free item in victim arrays */
-    afs_hyper_t maxVictimTime;	/* youngest (largest LRU time) victim */
-    afs_uint32 maxVictimPtr;	/* where it is */
+    afs_int32 sweep;		/* clock hand budget for this phase */
     int discard;
     int curbucket;
 
@@ -695,66 +876,20 @@ afs_GetDownD(int anumber, int *aneedSpace, afs_int32 buckethint)
 	phase = 4;
     }
 
-    for (i = 0; i < afs_cacheFiles; i++)
-	/* turn off all flags */
-	afs_indexFlags[i] &= ~IFFlag;
+    if (afs_dcacheReplacement != AFS_DCREPL_CLOCK) {
+	for (i = 0; i < afs_cacheFiles; i++)
+	    /* turn off all flags */
+	    afs_indexFlags[i] &= ~IFFlag;
+    }
+    sweep = 3 * afs_cacheFiles;
 
     while (anumber > 0 || (aneedSpace && *aneedSpace > 0)) {
-	/* find oldest entries for reclamation */
-	maxVictimPtr = victimPtr = 0;
-	hzero(maxVictimTime);
+	/* find entries for reclamation */
 	curbucket = afs_DCWhichBucket(phase, buckethint);
-	/* select victims from access time array */
-	for (i = 0; i < afs_cacheFiles; i++) {
-	    if (afs_indexFlags[i] & (IFDataMod | IFFree | IFDiscarded)) {
-		/* skip if dirty or already free */
-		continue;
-	    }
-	    tdc = afs_indexTable[i];
-	    if (tdc && (curbucket != tdc->bucket) && (phase < 4))
-	    {
-		/* Wrong bucket; can't use it! */
-	        continue;
-	    }
-	    if (tdc && (tdc->refCount != 0)) {
-		/* Referenced; can't use it! */
-		continue;
-	    }
-	    hset(vtime, afs_indexTimes[i]);
-
-	    /* if we've already looked at this one, skip it */
-	    if (afs_indexFlags[i] & IFFlag)
-		continue;
-
-	    if (victimPtr < MAXATONCE) {
-		/* if there's at least one free victim slot left */
-		victims[victimPtr] = i;
-		hset(victimTimes[victimPtr], vtime);
-		if (hcmp(vtime, maxVictimTime) > 0) {
-		    hset(maxVictimTime, vtime);
-		    maxVictimPtr = victimPtr;
-		}
-		victimPtr++;
-	    } else if (hcmp(vtime, maxVictimTime) < 0) {
-		/*
-		 * We're older than youngest victim, so we replace at
-		 * least one victim
-		 */
-		/* find youngest (largest LRU) victim */
-		j = maxVictimPtr;
-		if (j == victimPtr)
-		    osi_Panic("getdownd local");
-		victims[j] = i;
-		hset(victimTimes[j], vtime);
-		/* recompute maxVictimTime */
-		hset(maxVictimTime, vtime);
-		for (j = 0; j < victimPtr; j++)
-		    if (hcmp(maxVictimTime, victimTimes[j]) < 0) {
-			hset(maxVictimTime, victimTimes[j]);
-			maxVictimPtr = j;
-		    }
-	    }
-	}			/* big for loop */
+	if (afs_dcacheReplacement == AFS_DCREPL_CLOCK)
+	    victimPtr = afs_DCClockVictims(victims, phase, curbucket, &sweep);
+	else
+	    victimPtr = afs_DCLRUVictims(victims, phase, curbucket);
 
 	/* now really reclaim the victims */
 	j = 0;			/* flag to track if we actually got any of the victims */
@@ -939,14 +1074,19 @@ afs_GetDownD(int anumber, int *aneedSpace, afs_int32 buckethint)
 		afs_PutDCache(tdc);
 	} 			/* end of for victims loop */
 
+	if (j)
+	    sweep = 3 * afs_cacheFiles;
 	if (phase < 5) {
 	    /* Phase is 0 and no one was found, so try phase 1 (ignore
 	     * osi_Active flag) */
 	    if (j == 0) {
 		phase++;
-		for (i = 0; i < afs_cacheFiles; i++)
-		    /* turn off all flags */
-		    afs_indexFlags[i] &= ~IFFlag;
+		sweep = 3 * afs_cacheFiles;
+		if (afs_dcacheReplacement != AFS_DCREPL_CLOCK) {
+		    for (i = 0; i < afs_cacheFiles; i++)
+			/* turn off all flags */
+			afs_indexFlags[i] &= ~IFFlag;
+		}
 	    }
 	} else {
 	    /* found no one in phases 0-5, we're hosed */
@@ -1090,6 +1230,7 @@ afs_FreeDCache(struct dcache *adc)
     afs_freeDCList = adc->index;
     afs_freeDCCount++;
     afs_indexFlags[adc->index] |= IFFree;
+    afs_DCClockReset(adc->index);
     adc->dflags |= DFEntryMod;
 
     afs_WakeCacheWaitersIfDrained();
@@ -1131,6 +1272,7 @@ afs_DiscardDCache(struct dcache *adc)
     adc->f.fid.Fid.Volume = 0;
     adc->dflags |= DFEntryMod;
     afs_indexFlags[adc->index] |= IFDiscarded;
+    afs_DCClockReset(adc->index);
 
     afs_WakeCacheWaitersIfDrained();
 }				/*afs_DiscardDCache */
@@ -1611,6 +1753,7 @@ afs_FindDCache(struct vcache *avc, afs_size_t abyte)
     if (index != NULLIDX) {
 	hset(afs_indexTimes[tdc->index], afs_indexCounter);
 	hadd32(afs_indexCounter, 1);
+	afs_indexClock[tdc->index] |= DCLOCK_REF;
 	ReleaseWriteLock(&afs_xdcache);
 	return tdc;
     }
@@ -2804,6 +2947,10 @@ afs_GetDCache(struct vcache *avc, afs_size_t abyte,
 	ObtainWriteLock(&afs_xdcache, 602);
 	hset(afs_indexTimes[tdc->index], afs_indexCounter);
 	hadd32(afs_indexCounter, 1);
+	/* Going back to the chunk this file last used, as a reader working
+	 * through a chunk does, is not another reference for CLOCK. */
+	if (!shortcut)
+	    afs_indexClock[tdc->index] |= DCLOCK_REF;
 	ReleaseWriteLock(&afs_xdcache);
 
 	/* return the data */
@@ -3605,6 +3752,10 @@ afs_dcacheInit(int afiles, int ablocks, int aDentries, int achunk, int aflags)
     afs_indexFlags = afs_osi_Alloc(afiles * sizeof(u_char));
     osi_Assert(afs_indexFlags != NULL);
     memset(afs_indexFlags, 0, afiles * sizeof(char));
+    afs_indexClock = afs_osi_Alloc(afiles * sizeof(u_char));
+    osi_Assert(afs_indexClock != NULL);
+    memset(afs_indexClock, 0, afiles * sizeof(char));
+    afs_dcClockHand = afs_dcClockHot = 0;
 
     /* Allocate and thread the struct dcache entries themselves */
     tdp = afs_Initial_freeDSList =
@@ -3615,6 +3766,7 @@ afs_dcacheInit(int afiles, int ablocks, int aDentries, int achunk, int aflags)
     pin((char *)afs_indexTable, sizeof(struct dcache *) * afiles);	/* XXX */
     pin((char *)afs_indexTimes, sizeof(afs_hyper_t) * afiles);	/* XXX */
     pin((char *)afs_indexFlags, sizeof(char) * afiles);	/* XXX */
+    pin((char *)afs_indexClock, sizeof(char) * afiles);	/* XXX */
     pin((char *)afs_indexUnique, sizeof(afs_int32) * afiles);	/* XXX */
     pin((char *)tdp, aDentries * sizeof(struct dcache));	/* XXX */
     pin((char *)afs_dvhashTbl, sizeof(afs_int32) * afs_dhashsize);	/* XXX */
@@ -3699,6 +3851,7 @@ shutdown_dcache(void)
     afs_osi_Free(afs_indexTimes, afs_cacheFiles * sizeof(afs_hyper_t));
     afs_osi_Free(afs_indexUnique, afs_cacheFiles * sizeof(afs_uint32));
     afs_osi_Free(afs_indexFlags, afs_cacheFiles * sizeof(u_char));
+    afs_osi_Free(afs_indexClock, afs_cacheFiles * sizeof(u_char));
     afs_osi_Free(afs_Initial_freeDSList,
 		 afs_dcentries * sizeof(struct dcache));
 #ifdef	KERNEL_HAVE_PIN
@@ -3708,6 +3861,7 @@ shutdown_dcache(void)
     unpin((char *)afs_indexTimes, afs_cacheFiles * sizeof(afs_hyper_t));
     unpin((char *)afs_indexUnique, afs_cacheFiles * sizeof(afs_uint32));
     unpin((u_char *) afs_indexFlags, afs_cacheFiles * sizeof(u_char));
+    unpin((u_char *) afs_indexClock, afs_cacheFiles * sizeof(u_char));
     unpin(afs_Initial_freeDSList, afs_dcentries * sizeof(struct dcache));
 #endif
 
@@ -212,6 +212,10 @@ extern afs_int32 afs_gcpags_procsize;
 extern afs_int32 afs_CheckServerDaemonStarted;
 extern afs_int32 afs_probe_interval;
 extern afs_int32 afs_preCache;
+extern afs_int32 afs_readAhead;
+extern afs_int32 afs_fetchPerFile;
+extern afs_int32 afs_fetchPerServer;
+extern afs_int32 afs_writeBehind;
 
 extern void afs_Daemon(void);
 extern struct brequest *afs_BQueue(short aopcode,
@@ -221,6 +225,10 @@ extern struct brequest *afs_BQueue(short aopcode,
 				   afs_size_t asparm0, afs_size_t asparm1,
 				   void *apparm0, void *apparm1,
 				   void *apparm2);
+extern struct brequest *afs_BQueueFetch(struct vcache *avc,
+					afs_ucred_t *acred,
+					afs_size_t offset,
+					struct dcache *tdc);
 extern void afs_CheckServerDaemon(void);
 extern int afs_CheckRootVolume(void);
 extern void afs_BRelease(struct brequest *ab);
@@ -247,6 +255,7 @@ extern int afs_WaitForCacheDrain;
 extern int cacheDiskType;
 extern afs_uint32 afs_tpct1, afs_tpct2, splitdcache;
 extern unsigned char *afs_indexFlags;
+extern afs_int32 afs_dcacheReplacement;
 extern struct afs_cacheOps *afs_cacheType;
 extern afs_dcache_id_t cacheInode;
 extern struct osi_file *afs_cacheInodep;
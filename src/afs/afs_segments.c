@@ -146,6 +146,8 @@ afs_StoreMini(struct vcache *avc, struct vrequest *areq)
  * Parameters:
  *	avc  : Pointer to vcache entry.
  *	areq : Pointer to request structure.
+ *	sync : Store synchrony flags.  With AFS_WRITEBEHIND, chunks from
+ *	       avc->wbChunk on are left dirty.
  *
  * Environment:
  *	Called with avc write-locked.
@@ -172,6 +174,8 @@ afs_StoreAllSegments(struct vcache *avc, struct vrequest *areq,
     unsigned int i, j, minj, moredata, high, off;
     afs_size_t maxStoredLength;	/* highest offset we've written to server. */
     int safety, marineronce = 0;
+    afs_int32 endChunk = MAX_AFS_INT32;	/* store chunks before this one */
+    int skipped = 0;		/* left dirty chunks at or after endChunk */
 
     AFS_STATCNT(afs_StoreAllSegments);
 
@@ -246,6 +250,9 @@ afs_StoreAllSegments(struct vcache *avc, struct vrequest *areq,
      */
     origCBs = afs_allCBs;
 
+    if ((sync & AFS_WRITEBEHIND))
+	endChunk = avc->wbChunk;
+
     maxStoredLength = 0;
     minj = 0;
 
@@ -269,7 +276,13 @@ afs_StoreAllSegments(struct vcache *avc, struct vrequest *areq,
 		    goto done;
 		}
 		ReleaseReadLock(&tdc->tlock);
-		if (!FidCmp(&tdc->f.fid, &avc->f.fid) && tdc->f.chunk >= minj) {
+		if (!FidCmp(&tdc->f.fid, &avc->f.fid)
+		    && tdc->f.chunk >= endChunk) {
+		    /* still being written; leave it for a later store */
+		    skipped = 1;
+		    afs_PutDCache(tdc);
+		} else if (!FidCmp(&tdc->f.fid, &avc->f.fid)
+			   && tdc->f.chunk >= minj) {
 		    off = tdc->f.chunk - minj;
 		    if (off < NCHUNKSATONCE) {
 			if (dcList[off])
@@ -333,8 +346,9 @@ afs_StoreAllSegments(struct vcache *avc, struct vrequest *areq,
  done:
     UpgradeSToWLock(&avc->lock, 29);
 
-    /* send a trivial truncation store if did nothing else */
-    if (code == 0) {
+    /* send a trivial truncation store if did nothing else; if chunks were
+     * left for later, the store of those takes care of it */
+    if (code == 0 && !skipped) {
 	/*
 	 * Call StoreMini if we haven't written enough data to extend the
 	 * file at the fileserver to the client's notion of the file length.
@@ -438,8 +452,12 @@ afs_StoreAllSegments(struct vcache *avc, struct vrequest *areq,
 			hset(tdc->f.versionNo, avc->f.m.DataVersion);
 			tdc->dflags |= DFEntryMod;
 			/* DWriting may not have gotten cleared above, if all
-			 * we did was a StoreMini */
-			tdc->f.states &= ~DWriting;
+			 * we did was a StoreMini.  Chunks left dirty by a
+			 * write-behind store still get the new DV, so that
+			 * the writer can keep using them, but stay DWriting
+			 * until they are stored. */
+			if (tdc->f.chunk < endChunk)
+			    tdc->f.states &= ~DWriting;
 			ConvertWToSLock(&tdc->lock);
 		    }
 		}
@@ -482,7 +500,7 @@ afs_StoreAllSegments(struct vcache *avc, struct vrequest *areq,
      * as recently as newDV.
      * Turn off CDirty bit because the stored data is now in sync with server.
      */
-    if (code == 0 && hcmp(avc->mapDV, oldDV) >= 0) {
+    if (code == 0 && !skipped && hcmp(avc->mapDV, oldDV) >= 0) {
 	if ((!(afs_dvhack || foreign) && hsame(avc->f.m.DataVersion, newDV))
 	    || ((afs_dvhack || foreign) && (origCBs == afs_allCBs))) {
 	    hset(avc->mapDV, newDV);
@@ -660,7 +660,8 @@ struct afs_MeanStats {
     AFS_CS(PFlushAllVolumeData)	/* afs_pioctl.c */ \
     AFS_CS(afs_InitVolSlot)     /* afs_volume.c */ \
     AFS_CS(afs_SetupVolSlot)    /* afs_volume.c */ \
-    AFS_CS(PGetLiteralFID)	/* afs_pioctl.c */
+    AFS_CS(PGetLiteralFID)	/* afs_pioctl.c */ \
+    AFS_CS(BStoreBehind)	/* afs_daemons.c */
 
 struct afs_CMCallStats {
 #define AFS_CS(call) afs_int32 C_ ## call;
@@ -993,6 +993,12 @@ afs_PrePopulateVCache(struct vcache *avc, struct VenusFid *afid,
     avc->Access = NULL;
     avc->callback = serverp;         /* to minimize chance that clear
 				      * request is lost */
+    avc->raChunk = -1;
+    avc->raNextChunk = 0;
+    avc->raWindow = 0;
+    avc->raFetches = 0;
+    avc->wbChunk = 0;
+    avc->wbQueued = 0;
 
 #if defined(AFS_CACHE_BYPASS)
     avc->cachingStates = 0;
@@ -68,6 +68,11 @@
   *	-rxmaxfrags Max number of UDP fragments per rx packet.
   *	-inumcalc  inode number calculation method; 0=compat, 1=MD5 digest
   *	-volume-ttl vldb cache timeout in seconds
+  *	-readahead  Max number of chunks to read ahead.
+  *	-fetch-per-file   Max read-ahead fetches at once for one file.
+  *	-fetch-per-server Max read-ahead fetches at once from one server.
+  *	-writebehind Chunks written before storing them in the background.
+  *	-dcache-policy Cache replacement policy; lru or clock.
   *---------------------------------------------------------------------------*/
 
 #include <afsconfig.h>
@@ -285,6 +290,11 @@ static int afsd_CloseSynch = 0;	/*Are closes synchronous or not? */
 static int rxmaxmtu = 0;       /* Are we forcing a limit on the mtu? */
 static int rxmaxfrags = 0;      /* Are we forcing a limit on frags? */
 static int volume_ttl = 0;      /* enable vldb cache timeout support */
+static int read_ahead = -1;     /* max chunks of read-ahead; -1 for default */
+static int fetch_per_file = AFS_DEFAULT_FETCH_PER_FILE;
+static int fetch_per_server = AFS_DEFAULT_FETCH_PER_SERVER;
+static int write_behind = 0;    /* chunks written before storing behind */
+static char *dcache_policy = NULL;	/* cache replacement policy */
 
 #ifdef AFS_SGI_ENV
 #define AFSD_INO_T ino64_t
@@ -364,6 +374,11 @@ enum optionsList {
     OPT_rxmaxfrags,
     OPT_inumcalc,
     OPT_volume_ttl,
+    OPT_readahead,
+    OPT_fetch_per_file,
+    OPT_fetch_per_server,
+    OPT_writebehind,
+    OPT_dcache_policy,
 };
 
 #ifdef MACOS_EVENT_HANDLING
@@ -2358,6 +2373,13 @@ CheckOptions(struct cmd_syndesc *as)
 	cmd_OptionAsString(as, OPT_inumcalc, &inumcalc);
     }
     cmd_OptionAsInt(as, OPT_volume_ttl, &volume_ttl);
+    cmd_OptionAsInt(as, OPT_readahead, &read_ahead);
+    cmd_OptionAsInt(as, OPT_fetch_per_file, &fetch_per_file);
+    cmd_OptionAsInt(as, OPT_fetch_per_server, &fetch_per_server);
+    cmd_OptionAsInt(as, OPT_writebehind, &write_behind);
+    if (cmd_OptionPresent(as, OPT_dcache_policy)) {
+	cmd_OptionAsString(as, OPT_dcache_policy, &dcache_policy);
+    }
 
     /* parse cacheinfo file if this is a diskcache */
     if (ParseCacheInfoFile()) {
@@ -2894,6 +2916,75 @@ afsd_run(void)
 	}
     }
 
+    if (read_ahead != -1) {
+	if (afsd_verbose)
+	    printf("%s: Calling AFSOP_SET_READAHEAD with '%d'\n", rn, read_ahead);
+	code = afsd_syscall(AFSOP_SET_READAHEAD, read_ahead);
+	if (code == EFAULT) {
+	    printf("%s: Failed to set read-ahead to %d chunks; "
+		   "value must be between 0 and %d.\n", rn, read_ahead,
+		   AFS_MAX_READAHEAD);
+	} else if (code != 0) {
+	    printf("%s: Failed to set read-ahead to %d chunks; "
+		   "code=%d.\n", rn, read_ahead, code);
+	}
+    }
+
+    if (fetch_per_file != AFS_DEFAULT_FETCH_PER_FILE
+	|| fetch_per_server != AFS_DEFAULT_FETCH_PER_SERVER) {
+	if (afsd_verbose)
+	    printf("%s: Calling AFSOP_SET_FETCHLIMITS with '%d', '%d'\n", rn,
+		   fetch_per_file, fetch_per_server);
+	code = afsd_syscall(AFSOP_SET_FETCHLIMITS, fetch_per_file,
+			    fetch_per_server);
+	if (code == EFAULT) {
+	    printf("%s: Failed to set read-ahead fetch limits to %d per file, "
+		   "%d per server; values must be between 1 and %d.\n", rn,
+		   fetch_per_file, fetch_per_server, AFS_MAX_FETCH_LIMIT);
+	} else if (code != 0) {
+	    printf("%s: Failed to set read-ahead fetch limits to %d per file, "
+		   "%d per server; code=%d.\n", rn, fetch_per_file,
+		   fetch_per_server, code);
+	}
+    }
+
+    if (write_behind != 0) {
+	if (afsd_verbose)
+	    printf("%s: Calling AFSOP_SET_WRITEBEHIND with '%d'\n", rn,
+		   write_behind);
+	code = afsd_syscall(AFSOP_SET_WRITEBEHIND, write_behind);
+	if (code == EFAULT) {
+	    printf("%s: Failed to set write-behind to %d chunks; "
+		   "value must not be negative.\n", rn, write_behind);
+	} else if (code != 0) {
+	    printf("%s: Failed to set write-behind to %d chunks; "
+		   "code=%d.\n", rn, write_behind, code);
+	}
+    }
+
+    if (dcache_policy != NULL) {
+	int policy = -1;
+
+	if (strcmp(dcache_policy, "lru") == 0)
+	    policy = AFS_DCREPL_LRU;
+	else if (strcmp(dcache_policy, "clock") == 0)
+	    policy = AFS_DCREPL_CLOCK;
+	if (policy == -1) {
+	    printf("%s: Unknown value for -dcache-policy: %s. "
+		   "Using the default cache replacement policy.\n", rn,
+		   dcache_policy);
+	} else {
+	    if (afsd_verbose)
+		printf("%s: Setting the %s cache replacement policy in "
+		       "kernel.\n", rn, dcache_policy);
+	    code = afsd_syscall(AFSOP_SET_DCACHEPOLICY, policy);
+	    if (code) {
+		printf("%s: Error setting cache replacement policy: "
+		       "code=%d.\n", rn, code);
+	    }
+	}
+    }
+
     /*
      * Pass the kernel the name of the workstation cache file holding the
      * volume information.
@@ -3096,6 +3187,24 @@ afsd_init(void)
     cmd_AddParmAtOffset(ts, OPT_volume_ttl, "-volume-ttl", CMD_SINGLE,
 			CMD_OPTIONAL,
 			"Set the vldb cache timeout value in seconds.");
+    cmd_AddParmAtOffset(ts, OPT_readahead, "-readahead", CMD_SINGLE,
+			CMD_OPTIONAL,
+			"Set the maximum number of chunks to read ahead.");
+    cmd_AddParmAtOffset(ts, OPT_fetch_per_file, "-fetch-per-file",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"Set the maximum number of read-ahead fetches at once "
+			"for one file.");
+    cmd_AddParmAtOffset(ts, OPT_fetch_per_server, "-fetch-per-server",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"Set the maximum number of read-ahead fetches at once "
+			"from one file server.");
+    cmd_AddParmAtOffset(ts, OPT_writebehind, "-writebehind", CMD_SINGLE,
+			CMD_OPTIONAL,
+			"Store written chunks in the background after this "
+			"many more have been written.");
+    cmd_AddParmAtOffset(ts, OPT_dcache_policy, "-dcache-policy", CMD_SINGLE,
+			CMD_OPTIONAL,
+			"Set the cache replacement policy (lru or clock)");
 }
 
 /**
@@ -3177,6 +3286,9 @@ afsd_syscall_populate(struct afsd_syscall_args *args, int syscall, va_list ap)
     case AFSOP_SET_RMTSYS_FLAG:
     case AFSOP_SET_INUMCALC:
     case AFSOP_SET_VOLUME_TTL:
+    case AFSOP_SET_READAHEAD:
+    case AFSOP_SET_WRITEBEHIND:
+    case AFSOP_SET_DCACHEPOLICY:
 	params[0] = CAST_SYSCALL_PARAM((va_arg(ap, int)));
 	break;
     case AFSOP_SET_THISCELL:
@@ -3211,6 +3323,10 @@ afsd_syscall_populate(struct afsd_syscall_args *args, int syscall, va_list ap)
 	params[1] = CAST_SYSCALL_PARAM((va_arg(ap, int)));
 	params[2] = CAST_SYSCALL_PARAM((va_arg(ap, int)));
 	break;
+    case AFSOP_SET_FETCHLIMITS:
+	params[0] = CAST_SYSCALL_PARAM((va_arg(ap, int)));
+	params[1] = CAST_SYSCALL_PARAM((va_arg(ap, int)));
+	break;
     case AFSOP_ADVISEADDR:
 	params[0] = CAST_SYSCALL_PARAM((va_arg(ap, int)));
 	params[1] = CAST_SYSCALL_PARAM((va_arg(ap, void *)));
@@ -169,6 +169,10 @@ afsd_init_syscall_opcodes(void)
     add_opcode(AFSOP_SET_RMTSYS_FLAG);
     add_opcode(AFSOP_SEED_ENTROPY);
     add_opcode(AFSOP_SET_INUMCALC);
+    add_opcode(AFSOP_SET_READAHEAD);
+    add_opcode(AFSOP_SET_FETCHLIMITS);
+    add_opcode(AFSOP_SET_WRITEBEHIND);
+    add_opcode(AFSOP_SET_DCACHEPOLICY);
     add_opcode(AFSOP_RXLISTENER_DAEMON);
     add_opcode(AFSOP_CACHEBASEDIR);
     add_opcode(AFSOP_CACHEDIRS);
@@ -10,6 +10,8 @@ AC_CHECK_HEADERS([ \
     errno.h \
     fcntl.h \
     grp.h \
+    linux/fs.h \
+    linux/io_uring.h \
     math.h \
     mntent.h \
     ncurses.h \
@@ -102,6 +104,12 @@ AC_CHECK_TYPES([fsblkcnt_t],,,[
 #include <sys/statvfs.h>
 #endif
 ])
+dnl IORING_OP_FADVISE is in the Linux 5.6 headers; earlier ones lack it
+AC_CHECK_DECLS([IORING_OP_FADVISE],,,[
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+])
 ])
 
 AC_DEFUN([OPENAFS_NETDB_CHECKS],[
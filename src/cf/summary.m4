@@ -94,6 +94,7 @@ libraries:
   hcrypto : ${LIB_hcrypto}
   intl    : ${LIB_libintl}
   lmdb    : ${summary_lmdb}
+  zlib    : ${LIB_z}
 ***************************************************************
 EOF
 ])
@@ -0,0 +1,8 @@
+AC_DEFUN([OPENAFS_ZLIB_CHECKS],[
+dnl Check for zlib, used to compress volume dumps
+AC_CHECK_HEADERS([zlib.h],
+  [AC_CHECK_LIB(z, deflate,
+    [LIB_z="-lz"
+     AC_DEFINE([HAVE_ZLIB], [1], [define if zlib is available])])])
+AC_SUBST(LIB_z)
+])
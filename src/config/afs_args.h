@@ -61,10 +61,14 @@
 #define AFSOP_SET_VOLUME_TTL     47     /* set the vldb cache timeout */
 
 #define AFSOP_RXLISTENER_DAEMON  48	/* starts kernel RX listener */
+#define AFSOP_SET_READAHEAD	 49	/* set max chunks of read-ahead */
 
 #define AFSOP_CACHEBASEDIR	 50	/* cache base dir */
 #define AFSOP_CACHEDIRS		 51	/* number of files per dir */
 #define AFSOP_CACHEFILES	 52	/* number of files */
+#define AFSOP_SET_FETCHLIMITS	 53	/* set read-ahead fetches per file, server */
+#define AFSOP_SET_WRITEBEHIND	 54	/* set chunks written before storing behind */
+#define AFSOP_SET_DCACHEPOLICY	 55	/* set dcache replacement policy */
 
 #define AFSOP_SETINT		 60	/* set key/value pairs for ints */
 
@@ -197,10 +201,25 @@ enum {
     AFS_INUMCALC_MD5 = 1
 };
 
+/* Supported dcache replacement policies. */
+enum {
+    AFS_DCREPL_LRU = 0,
+    AFS_DCREPL_CLOCK = 1
+};
+
 /* Supported volume ttl range. */
 #define AFS_MIN_VOLUME_TTL 600
 #define AFS_MAX_VOLUME_TTL MAX_AFS_INT32
 
+/* Supported read-ahead range, in chunks. */
+#define AFS_DEFAULT_READAHEAD 8
+#define AFS_MAX_READAHEAD 256
+
+/* Limits on read-ahead fetches in progress at once. */
+#define AFS_DEFAULT_FETCH_PER_FILE 4
+#define AFS_DEFAULT_FETCH_PER_SERVER 8
+#define AFS_MAX_FETCH_LIMIT 64
+
 /*
  * Note that the AFS_*ALLOCSIZ values should be multiples of sizeof(void*) to
  * accomodate pointer alignment.
@@ -389,6 +389,7 @@ DZap(dir_file_t dir)
 	    ReleaseWriteLock(&tb->lock);
 	}
     ReleaseReadLock(&afs_bufferLock);
+    DIndexZap(dir, 0);
 }
 
 int
@@ -411,6 +412,7 @@ DFlushVolume(afs_int32 vid)
 	    ReleaseWriteLock(&tb->lock);
 	}
     ReleaseReadLock(&afs_bufferLock);
+    DIndexFlushVolume(vid);
     return rcode;
 }
 
@@ -73,11 +73,15 @@ extern int DNew(struct dcache *adc, int page, struct DirBuffer *);
 #endif /* KERNEL */
 
 /* Local static prototypes */
-static int FindBlobs(dir_file_t, int);
+static int FindBlobs(dir_file_t, int, int);
 static int AddPage(dir_file_t, int);
 static void FreeBlobs(dir_file_t, int, int);
 static int FindItem(dir_file_t, char *, struct DirBuffer *,
 		    struct DirBuffer *);
+#ifndef KERNEL
+static int FindItemIndexed(dir_file_t, char *, int, struct DirBuffer *,
+			   struct DirBuffer *, struct DirBuffer *);
+#endif
 
 /* Find out how many entries are required to store a name. */
 int
@@ -95,7 +99,7 @@ afs_dir_Create(dir_file_t dir, char *entry, void *voidfid)
 {
     afs_int32 *vfid = (afs_int32 *) voidfid;
     int blobs, firstelt;
-    int i;
+    int i, oldhead;
     struct DirBuffer entrybuf, prevbuf, headerbuf;
     struct DirEntry *ep;
     struct DirHeader *dhp;
@@ -118,7 +122,7 @@ afs_dir_Create(dir_file_t dir, char *entry, void *voidfid)
     }
 
     blobs = afs_dir_NameBlobs(entry);	/* number of entries required */
-    firstelt = FindBlobs(dir, blobs);
+    firstelt = FindBlobs(dir, blobs, 0);
     if (firstelt < 0)
 	return EFBIG;		/* directory is full */
 
@@ -149,10 +153,16 @@ afs_dir_Create(dir_file_t dir, char *entry, void *voidfid)
     dhp = (struct DirHeader *)headerbuf.data;
 
     i = afs_dir_DirHash(entry);
+    oldhead = ntohs(dhp->hashTable[i]);
     ep->next = dhp->hashTable[i];
     dhp->hashTable[i] = htons(firstelt);
     DRelease(&headerbuf, 1);
     DRelease(&entrybuf, 1);
+#ifndef KERNEL
+    DIndexInsert(dir, entry, vfid[1], vfid[2], firstelt, oldhead);
+#else
+    (void)oldhead;
+#endif
     return 0;
 }
 
@@ -186,7 +196,7 @@ int
 afs_dir_Delete(dir_file_t dir, char *entry)
 {
 
-    int nitems, index;
+    int nitems, index, nextblob;
     struct DirBuffer entrybuf, prevbuf;
     struct DirEntry *firstitem;
     unsigned short *previtem;
@@ -202,12 +212,18 @@ afs_dir_Delete(dir_file_t dir, char *entry)
 
     *previtem = firstitem->next;
     DRelease(&prevbuf, 1);
+    nextblob = ntohs(firstitem->next);
     index = DVOffset(&entrybuf) / 32;
     nitems = afs_dir_NameBlobs(firstitem->name);
     /* Clear entire DirEntry and any DirXEntry extensions */
     memset(firstitem, 0, nitems * sizeof(*firstitem));
     DRelease(&entrybuf, 1);
     FreeBlobs(dir, index, nitems);
+#ifndef KERNEL
+    DIndexRemove(dir, entry, nextblob);
+#else
+    (void)nextblob;
+#endif
     return 0;
 }
 
@@ -216,12 +232,13 @@ afs_dir_Delete(dir_file_t dir, char *entry)
  *
  * \param dir	    pointer to the directory object
  * \param nblobs    number of contiguous entries we need
+ * \param firstpage first page to look in
  *
  * \return element number (directory entry) of the requested space
  * \retval -1		failed to find 'nblobs' contiguous entries
  */
 static int
-FindBlobs(dir_file_t dir, int nblobs)
+FindBlobs(dir_file_t dir, int nblobs, int firstpage)
 {
     int i, j, k;
     int failed = 0;
@@ -236,7 +253,7 @@ FindBlobs(dir_file_t dir, int nblobs)
 	return -1;
     dhp = (struct DirHeader *)headerbuf.data;
 
-    for (i = 0; i < BIGMAXPAGES; i++) {
+    for (i = firstpage; i < BIGMAXPAGES; i++) {
 	if (i >= MAXPAGES || dhp->alloMap[i] >= nblobs) {
 	    /* if page could contain enough entries */
 	    /* If there are EPP free entries, then the page is not even allocated. */
@@ -384,6 +401,10 @@ afs_dir_MakeDir(dir_file_t dir, afs_int32 * me, afs_int32 * parent)
     struct DirHeader *dhp;
     int code;
 
+#ifndef KERNEL
+    /* Whatever was indexed under this fid is about to be overwritten. */
+    DIndexZap(dir, 0);
+#endif
     code = DNew(dir, 0, &buffer);
     if (code)
 	return code;
@@ -629,7 +650,15 @@ afs_dir_GetVerifiedBlob(dir_file_t file, afs_int32 blobno,
 
     /* A blob is only valid if the name within it is NULL terminated before
      * the end of the blob's containing page */
+#ifdef KERNEL
     for (cp = dir->name; *cp != '\0' && cp < ((char *)dir) + maxlen; cp++);
+#else
+    /* maxlen is the offset of the page's last byte; memchr scans the name a
+     * word or vector at a time rather than byte by byte. */
+    cp = memchr(dir->name, '\0', ((char *)dir) + maxlen + 1 - dir->name);
+    if (cp == NULL)
+	cp = ((char *)dir) + maxlen;
+#endif
 
     if (*cp != '\0') {
 	DRelease(&buffer, 0);
@@ -660,6 +689,45 @@ afs_dir_DirHash(char *string)
     return tval;
 }
 
+/* Powers of the afs_dir_DirHash multiplier, for folding four characters
+ * into the hash per step. */
+#define DH_P1	173u
+#define DH_P2	(DH_P1 * DH_P1)
+#define DH_P3	(DH_P2 * DH_P1)
+#define DH_P4	(DH_P3 * DH_P1)
+
+/* Hash many names at once; hashes[i] is set to afs_dir_DirHash(names[i]).
+ * If lens is not NULL, lens[i] must be strlen(names[i]).
+ *
+ * h*173^4 + a*173^3 + b*173^2 + c*173 + d is the same, modulo 2^32, as four
+ * rounds of the byte-at-a-time loop, but the four products do not depend on
+ * each other, so long names hash several times faster than a serial chain of
+ * multiplies allows.  This is what the salvager uses to check every name in
+ * a directory. */
+void
+afs_dir_DirHashBatch(char **names, int *lens, int n, int *hashes)
+{
+    const unsigned char *cp;
+    unsigned int hval;
+    int i, j, len, tval;
+
+    for (i = 0; i < n; i++) {
+	cp = (const unsigned char *)names[i];
+	len = (lens != NULL ? lens[i] : strlen(names[i]));
+	hval = 0;
+	for (j = 0; j + 4 <= len; j += 4) {
+	    hval = hval * DH_P4 + cp[j] * DH_P3 + cp[j + 1] * DH_P2
+		+ cp[j + 2] * DH_P1 + cp[j + 3];
+	}
+	for (; j < len; j++)
+	    hval = hval * DH_P1 + cp[j];
+	tval = hval & (NHASHENT - 1);
+	if (tval != 0 && hval >= 1u<<31)
+	    tval = NHASHENT - tval;
+	hashes[i] = tval;
+    }
+}
+
 
 /* Find a directory entry, given its name.  This entry returns a pointer
  * to a locked buffer, and a pointer to a locked buffer (in previtem)
@@ -676,6 +744,9 @@ FindItem(dir_file_t dir, char *ename, struct DirBuffer *prevbuf,
     struct DirHeader *dhp;
     struct DirEntry *tp;
     int elements;
+#ifndef KERNEL
+    int indexMiss;
+#endif
 
     memset(prevbuf, 0, sizeof(struct DirBuffer));
     memset(itembuf, 0, sizeof(struct DirBuffer));
@@ -686,6 +757,15 @@ FindItem(dir_file_t dir, char *ename, struct DirBuffer *prevbuf,
     dhp = (struct DirHeader *)prev.data;
 
     i = afs_dir_DirHash(ename);
+
+#ifndef KERNEL
+    code = FindItemIndexed(dir, ename, i, &prev, prevbuf, itembuf);
+    if (code == 0)
+	return 0;
+    /* The hash chain has the last word on a name the index lacks */
+    indexMiss = (code == ENOENT);
+#endif
+
     if (dhp->hashTable[i] == 0) {
 	/* no such entry */
 	code = ENOENT;
@@ -709,6 +789,10 @@ FindItem(dir_file_t dir, char *ename, struct DirBuffer *prevbuf,
 	tp = (struct DirEntry *)curr.data;
 	if (!strcmp(ename, tp->name)) {
 	    /* Found it! */
+#ifndef KERNEL
+	    if (indexMiss)
+		DIndexZap(dir, 1);
+#endif
 	    *prevbuf = prev;
 	    *itembuf = curr;
 	    return 0;
@@ -740,6 +824,148 @@ out:
     return code;
 }
 
+#ifndef KERNEL
+/*!
+ * Build the name index for a large directory by walking every hash chain,
+ * and publish it.
+ *
+ * \param dir	    pointer to the directory object
+ * \param dhp	    the directory's header page, read-locked by the caller
+ *
+ * \retval 0	    success
+ * \retval nonzero the directory could not be read or is damaged
+ */
+static int
+BuildIndex(dir_file_t dir, struct DirHeader *dhp)
+{
+    struct DirIndex *idx;
+    struct DirBuffer entrybuf;
+    struct DirEntry *ep;
+    int i, num, prevnum, code, elements, npages;
+
+    npages = ntohs(dhp->header.pgcount);
+    if (npages == 0)
+	npages = MAXPAGES;
+    idx = DIndexAlloc(npages * EPP / 2);
+    if (idx == NULL)
+	return ENOMEM;
+
+    elements = 0;
+    for (i = 0; i < NHASHENT; i++) {
+	prevnum = 0;
+	num = ntohs(dhp->hashTable[i]);
+	while (num != 0) {
+	    if (++elements > BIGMAXPAGES * EPP) {
+		code = EIO;	/* circular hash chain */
+		goto fail;
+	    }
+	    code = afs_dir_GetVerifiedBlob(dir, num, &entrybuf);
+	    if (code)
+		goto fail;
+	    ep = (struct DirEntry *)entrybuf.data;
+	    code = DIndexAddEntry(idx, ep->name, ntohl(ep->fid.vnode),
+				  ntohl(ep->fid.vunique), num, prevnum);
+	    prevnum = num;
+	    num = ntohs(ep->next);
+	    DRelease(&entrybuf, 0);
+	    if (code)
+		goto fail;
+	}
+    }
+    DIndexInstall(dir, idx);
+    return 0;
+
+  fail:
+    DIndexFree(idx);
+    return code;
+}
+
+/*!
+ * Find a directory entry through the directory's name index, building the
+ * index first if the directory is large enough to deserve one.  A result
+ * is checked against the directory pages before it is returned.  A name
+ * the index lacks is not taken as absent: the caller walks the hash chain,
+ * so a stale index can slow a lookup down but never hide an entry.
+ *
+ * \param dir	    pointer to the directory object
+ * \param ename    name to look for
+ * \param hashslot hash chain the name belongs on
+ * \param header   buffer holding the directory header page; on success it
+ *		    is either released or returned in prevbuf
+ * \param prevbuf  buffer referencing the link to the found item
+ * \param itembuf  buffer referencing the found item
+ *
+ * \retval 0	    found
+ * \retval ENOENT  not in the index; header is still held and the caller
+ *		    must walk the hash chain itself
+ * \retval -1	    no usable index; as for ENOENT
+ */
+static int
+FindItemIndexed(dir_file_t dir, char *ename, int hashslot,
+		struct DirBuffer *header, struct DirBuffer *prevbuf,
+		struct DirBuffer *itembuf)
+{
+    struct DirHeader *dhp = (struct DirHeader *)header->data;
+    struct DirBuffer curr, prev;
+    struct DirEntry *tp, *pp;
+    int code, blob, prevblob, npages;
+
+    code = DIndexLookup(dir, ename, &blob, &prevblob);
+    if (code == -1) {
+	npages = ntohs(dhp->header.pgcount);
+	if (npages == 0)
+	    npages = MAXPAGES;
+	if (!DIndexWanted(npages) || BuildIndex(dir, dhp) != 0)
+	    return -1;
+	code = DIndexLookup(dir, ename, &blob, &prevblob);
+	if (code == -1)
+	    return -1;
+    }
+    if (code == ENOENT)
+	return ENOENT;
+
+    code = afs_dir_GetVerifiedBlob(dir, blob, &curr);
+    if (code)
+	goto stale;
+    tp = (struct DirEntry *)curr.data;
+    if (strcmp(ename, tp->name) != 0) {
+	DRelease(&curr, 0);
+	goto stale;
+    }
+
+    if (prevblob == 0) {
+	if (ntohs(dhp->hashTable[hashslot]) != blob) {
+	    DRelease(&curr, 0);
+	    goto stale;
+	}
+	prev = *header;
+	prev.data = &(dhp->hashTable[hashslot]);
+    } else {
+	code = afs_dir_GetVerifiedBlob(dir, prevblob, &prev);
+	if (code) {
+	    DRelease(&curr, 0);
+	    goto stale;
+	}
+	pp = (struct DirEntry *)prev.data;
+	if (ntohs(pp->next) != blob) {
+	    DRelease(&prev, 0);
+	    DRelease(&curr, 0);
+	    goto stale;
+	}
+	prev.data = &(pp->next);
+	DRelease(header, 0);
+    }
+
+    *prevbuf = prev;
+    *itembuf = curr;
+    return 0;
+
+  stale:
+    DIndexZap(dir, 1);
+    return -1;
+}
+#endif /* !KERNEL */
+
 static int
 FindFid (void *dir, afs_uint32 vnode, afs_uint32 unique,
 	 struct DirBuffer *itembuf)
@@ -861,9 +1087,180 @@ afs_dir_ChangeFid(dir_file_t dir, char *entry, afs_uint32 *old_fid,
 
 	firstitem->fid.vnode = htonl(fid_new->vnode);
 	firstitem->fid.vunique = htonl(fid_new->vunique);
+#ifndef KERNEL
+	DIndexChangeFid(dir, entry, fid_new->vnode, fid_new->vunique);
+#endif
     }
 
     DRelease(&entrybuf, 1);
 
     return 0;
 }
+
+#ifndef KERNEL
+/*!
+ * Measure how full a directory is.
+ *
+ * Only the first MAXPAGES pages have a free count in the header's alloMap;
+ * any pages after them are counted as full, so a very large directory can
+ * look fuller than it is, but never emptier.
+ *
+ * \param dir	    pointer to the directory object
+ * \param pages	    set to the number of pages in the directory
+ * \param freeblobs set to the number of free blobs found
+ *
+ * \retval 0	    success
+ * \retval nonzero the directory header could not be read
+ */
+int
+afs_dir_Usage(dir_file_t dir, int *pages, int *freeblobs)
+{
+    struct DirBuffer headerbuf;
+    struct DirHeader *dhp;
+    int i, code;
+
+    *pages = afs_dir_Length(dir) / AFS_PAGESIZE;
+    code = DRead(dir, 0, &headerbuf);
+    if (code)
+	return code;
+    dhp = (struct DirHeader *)headerbuf.data;
+
+    *freeblobs = 0;
+    for (i = 0; i < *pages && i < MAXPAGES; i++)
+	*freeblobs += dhp->alloMap[i];
+    DRelease(&headerbuf, 0);
+    return 0;
+}
+
+/*!
+ * Copy the entries of a directory densely into a new directory.
+ *
+ * The hash chains are copied one after another, each in its original
+ * order, and every entry goes into the first space at or after the page
+ * the previous one went into.  The result has free blobs only where an
+ * entry did not fit at the end of a page, and the entries of each chain
+ * sit together, so a lookup reads few pages.
+ *
+ * \param fromdir   pointer to the directory object to compact
+ * \param todir	    pointer to an empty directory object for the result
+ *
+ * \retval 0	    success
+ * \retval nonzero fromdir is damaged, or todir could not be written
+ */
+int
+afs_dir_Compact(dir_file_t fromdir, dir_file_t todir)
+{
+    afs_int32 me[3], parent[3];
+    unsigned short tail[NHASHENT];
+    struct DirBuffer headerbuf, newheaderbuf, entrybuf, newbuf, tailbuf;
+    struct DirHeader *dhp, *newdhp;
+    struct DirEntry *ep, *newep;
+    int i, blob, next, newblob, blobs, page, elements;
+    size_t rlen;
+    int code;
+
+    code = afs_dir_Lookup(fromdir, ".", me);
+    if (code)
+	return code;
+    code = afs_dir_Lookup(fromdir, "..", parent);
+    if (code)
+	return code;
+    code = afs_dir_MakeDir(todir, me, parent);
+    if (code)
+	return code;
+
+    /* Find the ends of the chains that MakeDir put "." and ".." on. */
+    code = DRead(todir, 0, &newheaderbuf);
+    if (code)
+	return code;
+    newdhp = (struct DirHeader *)newheaderbuf.data;
+    for (i = 0; i < NHASHENT; i++) {
+	tail[i] = 0;
+	for (blob = ntohs(newdhp->hashTable[i]); blob != 0; blob = next) {
+	    code = afs_dir_GetBlob(todir, blob, &newbuf);
+	    if (code) {
+		DRelease(&newheaderbuf, 0);
+		return code;
+	    }
+	    next = ntohs(((struct DirEntry *)newbuf.data)->next);
+	    tail[i] = blob;
+	    DRelease(&newbuf, 0);
+	}
+    }
+    DRelease(&newheaderbuf, 0);
+
+    code = DRead(fromdir, 0, &headerbuf);
+    if (code)
+	return code;
+    dhp = (struct DirHeader *)headerbuf.data;
+
+    page = 0;
+    elements = 0;
+    for (i = 0; i < NHASHENT; i++) {
+	for (blob = ntohs(dhp->hashTable[i]); blob != 0; blob = next) {
+	    /* Detect circular hash chains. */
+	    if (++elements > BIGMAXPAGES * EPP) {
+		code = EIO;
+		goto out;
+	    }
+	    code = afs_dir_GetVerifiedBlob(fromdir, blob, &entrybuf);
+	    if (code)
+		goto out;
+	    ep = (struct DirEntry *)entrybuf.data;
+	    next = ntohs(ep->next);
+	    if (strcmp(ep->name, ".") == 0 || strcmp(ep->name, "..") == 0) {
+		DRelease(&entrybuf, 0);
+		continue;
+	    }
+
+	    blobs = afs_dir_NameBlobs(ep->name);
+	    newblob = FindBlobs(todir, blobs, page);
+	    if (newblob < 0) {
+		DRelease(&entrybuf, 0);
+		code = EFBIG;
+		goto out;
+	    }
+	    page = newblob >> LEPP;
+
+	    code = afs_dir_GetBlob(todir, newblob, &newbuf);
+	    if (code) {
+		DRelease(&entrybuf, 0);
+		goto out;
+	    }
+	    newep = (struct DirEntry *)newbuf.data;
+	    newep->flag = FFIRST;
+	    newep->next = 0;
+	    newep->fid = ep->fid;
+	    /* FindBlobs has already ensured that the name can fit. */
+	    rlen = strlcpy(newep->name, ep->name, AFSNAMEMAX + 1);
+	    DRelease(&newbuf, 1);
+	    DRelease(&entrybuf, 0);
+	    if (rlen >= AFSNAMEMAX + 1) {
+		code = ENAMETOOLONG;
+		goto out;
+	    }
+
+	    /* Thread the new entry onto the end of its chain. */
+	    if (tail[i] == 0) {
+		code = DRead(todir, 0, &newheaderbuf);
+		if (code)
+		    goto out;
+		newdhp = (struct DirHeader *)newheaderbuf.data;
+		newdhp->hashTable[i] = htons(newblob);
+		DRelease(&newheaderbuf, 1);
+	    } else {
+		code = afs_dir_GetBlob(todir, tail[i], &tailbuf);
+		if (code)
+		    goto out;
+		((struct DirEntry *)tailbuf.data)->next = htons(newblob);
+		DRelease(&tailbuf, 1);
+	    }
+	    tail[i] = newblob;
+	}
+    }
+
+  out:
+    DRelease(&headerbuf, 0);
+    return code;
+}
+#endif
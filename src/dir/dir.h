@@ -109,6 +109,8 @@ extern int afs_dir_GetBlobWithErrno(dir_file_t dir, afs_int32 blobno,
 extern int afs_dir_GetVerifiedBlob(dir_file_t dir, afs_int32 blobno,
 				   struct DirBuffer *);
 extern int afs_dir_DirHash(char *string);
+extern void afs_dir_DirHashBatch(char **names, int *lens, int n,
+				 int *hashes);
 
 extern int afs_dir_InverseLookup (void *dir, afs_uint32 vnode,
 				  afs_uint32 unique, char *name,
@@ -116,6 +118,10 @@ extern int afs_dir_InverseLookup (void *dir, afs_uint32 vnode,
 
 extern int afs_dir_ChangeFid(dir_file_t dir, char *entry,
 		             afs_uint32 *old_fid, afs_uint32 *new_fid);
+#ifndef KERNEL
+extern int afs_dir_Usage(dir_file_t dir, int *pages, int *freeblobs);
+extern int afs_dir_Compact(dir_file_t fromdir, dir_file_t todir);
+#endif
 
 /* buffer operations */
 
@@ -132,10 +138,36 @@ extern int DFlushVolume(afs_int32 vid);
 extern int DFlushEntry(dir_file_t fid);
 extern int DVOffset(struct DirBuffer *);
 
+/* dirindex.c */
+
+#ifndef KERNEL
+struct DirIndex;
+
+extern void DInitIndex(int amaxentries, int aminpages);
+extern int DIndexWanted(int npages);
+extern struct DirIndex *DIndexAlloc(int aexpect);
+extern void DIndexFree(struct DirIndex *idx);
+extern int DIndexAddEntry(struct DirIndex *idx, char *name, afs_int32 vnode,
+			  afs_int32 unique, int blob, int prevblob);
+extern void DIndexInstall(dir_file_t dir, struct DirIndex *idx);
+extern int DIndexLookup(dir_file_t dir, char *name, int *blobp,
+			int *prevblobp);
+extern void DIndexInsert(dir_file_t dir, char *name, afs_int32 vnode,
+			 afs_int32 unique, int blob, int oldhead);
+extern void DIndexRemove(dir_file_t dir, char *name, int nextblob);
+extern void DIndexChangeFid(dir_file_t dir, char *name, afs_int32 vnode,
+			    afs_int32 unique);
+extern void DIndexZap(dir_file_t dir, int stale);
+extern void DIndexFlushVolume(afs_int32 vid);
+extern int DIndexStat(int *adirs, int *aentries, int *ahits, int *amisses,
+		      int *abuilds, int *aevictions, int *astale);
+#endif
+
 /* salvage.c */
 
 #ifndef KERNEL
 extern int DirOK(void *);
+extern int DirOKByBlob(void *);
 extern int DirSalvage(void *, void *, afs_int32, afs_int32,
                       afs_int32, afs_int32);
 
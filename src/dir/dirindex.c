@@ -0,0 +1,645 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * In-memory name index for large directories.
+ *
+ * The on-disk directory format only offers NHASHENT hash chains, so a
+ * directory with tens of thousands of entries has chains that are hundreds
+ * of blobs long, and every lookup walks one of them through the buffer
+ * package.  This module keeps, for a bounded number of large directories,
+ * a name -> (vnode, unique, blob) map together with the blob that precedes
+ * each entry on its hash chain.  dir.c uses it to go straight to the blob
+ * (and its predecessor) it would otherwise have found by walking the chain.
+ *
+ * The index is only ever a hint: dir.c verifies every hit against the
+ * directory pages, walks the hash chain for every miss, and zaps the index
+ * if either disagrees with it.  It is kept
+ * coherent by afs_dir_Create, afs_dir_Delete, afs_dir_ChangeFid and
+ * afs_dir_MakeDir, and dropped by DZap and DFlushVolume along with the
+ * buffers for the directory.  Indexes are keyed on the same fid the buffer
+ * package uses, so anything that invalidates cached pages for a directory
+ * (a new inode, a reattached volume) also makes its old index unreachable.
+ *
+ * The package is disabled until DInitIndex is called with a non-zero entry
+ * limit; only the fileserver does that.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+#include <afs/opr.h>
+#include <opr/queue.h>
+#include <opr/jhash.h>
+
+#include <lock.h>
+
+#include "dir.h"
+
+/* The fid is an opaque copy of the caller's DirHandle; see buffer.c. */
+#ifdef AFS_64BIT_IOPS_ENV
+#define DINDEX_FID_SIZE (9*sizeof(int) + 2*sizeof(char*))
+#else
+#define DINDEX_FID_SIZE (6*sizeof(int) + 2*sizeof(char*))
+#endif
+
+/* Number of buckets in the table of indexed directories. */
+#define DIHSIZE 64
+/* Like pHash in buffer.c, this depends on every DirHandle starting with
+ * the volume id, the device and the inode number. */
+#define diHash(fid) \
+    ((((afs_int32 *)(fid))[0] ^ ((afs_int32 *)(fid))[2]) & (DIHSIZE-1))
+
+#define DINDEX_MIN_BUCKETS 64
+
+struct DirIndexEntry {
+    struct DirIndexEntry *nameNext;	/* next entry on the name hash chain */
+    struct DirIndexEntry *blobNext;	/* next entry on the blob hash chain */
+    afs_int32 vnode;
+    afs_int32 unique;
+    unsigned short blob;		/* first blob of the entry */
+    unsigned short prevblob;		/* preceding blob on the dir's hash
+					 * chain, or 0 for the chain head */
+    char name[1];			/* actually longer */
+};
+
+struct DirIndex {
+    char fid[DINDEX_FID_SIZE];
+    struct opr_queue hashq;		/* on diTable[diHash(fid)] */
+    struct opr_queue lruq;		/* on diLRU, most recent first */
+    int installed;
+    afs_uint32 nentries;
+    afs_uint32 nbuckets;		/* power of 2 */
+    struct DirIndexEntry **nameHash;
+    struct DirIndexEntry **blobHash;
+};
+
+static struct Lock dirIndexLock;
+static struct opr_queue diTable[DIHSIZE];
+static struct opr_queue diLRU;
+
+static int diEnabled;
+static afs_uint32 diMaxEntries;	/* total entries over all indexes */
+static int diMinPages;		/* smallest directory worth indexing */
+static afs_uint32 diEntries;
+static int diCount;
+
+/* statistics */
+static afs_uint32 diHits, diMisses, diBuilds, diEvictions, diStale;
+
+/* See buffer.c */
+extern int FidEq(dir_file_t, dir_file_t);
+extern void FidZap(dir_file_t);
+extern int  FidVolEq(dir_file_t, afs_int32 vid);
+extern void FidCpy(dir_file_t, dir_file_t fromfile);
+
+static_inline dir_file_t
+indexDir(struct DirIndex *idx)
+{
+    return (dir_file_t) &idx->fid;
+}
+
+static_inline afs_uint32
+nameHashOf(struct DirIndex *idx, char *name)
+{
+    return opr_jhash_opaque(name, strlen(name), 0) & (idx->nbuckets - 1);
+}
+
+static_inline afs_uint32
+blobHashOf(struct DirIndex *idx, int blob)
+{
+    return opr_jhash_int(blob, 0) & (idx->nbuckets - 1);
+}
+
+/**
+ * initialize the directory index package.
+ *
+ * @param[in] amaxentries  maximum number of entries held across all
+ *                         indexes; 0 disables the package
+ * @param[in] aminpages    only directories of at least this many pages
+ *                         are indexed
+ */
+void
+DInitIndex(int amaxentries, int aminpages)
+{
+    int i;
+
+    Lock_Init(&dirIndexLock);
+    for (i = 0; i < DIHSIZE; i++)
+	opr_queue_Init(&diTable[i]);
+    opr_queue_Init(&diLRU);
+    diMaxEntries = amaxentries > 0 ? amaxentries : 0;
+    diMinPages = aminpages > 0 ? aminpages : 1;
+    diEnabled = (diMaxEntries != 0);
+}
+
+/**
+ * return whether a directory of the given size should be indexed.
+ *
+ * @param[in] npages  number of pages in the directory
+ */
+int
+DIndexWanted(int npages)
+{
+    return diEnabled && npages >= diMinPages;
+}
+
+/**
+ * allocate an empty, unpublished index.
+ *
+ * @param[in] aexpect  expected number of entries, used to size the tables
+ *
+ * @return the new index, or NULL if out of memory
+ */
+struct DirIndex *
+DIndexAlloc(int aexpect)
+{
+    struct DirIndex *idx;
+    afs_uint32 n = DINDEX_MIN_BUCKETS;
+
+    while (n < aexpect && n < BIGMAXPAGES * EPP)
+	n <<= 1;
+
+    idx = calloc(1, sizeof(*idx));
+    if (idx == NULL)
+	return NULL;
+    idx->nbuckets = n;
+    idx->nameHash = calloc(n, sizeof(struct DirIndexEntry *));
+    idx->blobHash = calloc(n, sizeof(struct DirIndexEntry *));
+    if (idx->nameHash == NULL || idx->blobHash == NULL) {
+	free(idx->nameHash);
+	free(idx->blobHash);
+	free(idx);
+	return NULL;
+    }
+    return idx;
+}
+
+static void
+FreeEntries(struct DirIndex *idx)
+{
+    afs_uint32 i;
+    struct DirIndexEntry *ep, *next;
+
+    for (i = 0; i < idx->nbuckets; i++) {
+	for (ep = idx->nameHash[i]; ep; ep = next) {
+	    next = ep->nameNext;
+	    free(ep);
+	}
+    }
+    free(idx->nameHash);
+    free(idx->blobHash);
+}
+
+/**
+ * free an index that was never installed, or has been removed.
+ */
+void
+DIndexFree(struct DirIndex *idx)
+{
+    if (idx == NULL)
+	return;
+    FreeEntries(idx);
+    if (idx->installed)
+	FidZap(indexDir(idx));
+    free(idx);
+}
+
+/* Double the hash tables of an index; on allocation failure the index is
+ * simply left as it is, with longer chains. */
+static void
+Grow(struct DirIndex *idx)
+{
+    struct DirIndexEntry **nameHash, **blobHash, *ep, *next;
+    afs_uint32 i, n, h;
+
+    n = idx->nbuckets << 1;
+    nameHash = calloc(n, sizeof(struct DirIndexEntry *));
+    blobHash = calloc(n, sizeof(struct DirIndexEntry *));
+    if (nameHash == NULL || blobHash == NULL) {
+	free(nameHash);
+	free(blobHash);
+	return;
+    }
+    for (i = 0; i < idx->nbuckets; i++) {
+	for (ep = idx->nameHash[i]; ep; ep = next) {
+	    next = ep->nameNext;
+	    h = opr_jhash_opaque(ep->name, strlen(ep->name), 0) & (n - 1);
+	    ep->nameNext = nameHash[h];
+	    nameHash[h] = ep;
+	    h = opr_jhash_int(ep->blob, 0) & (n - 1);
+	    ep->blobNext = blobHash[h];
+	    blobHash[h] = ep;
+	}
+    }
+    free(idx->nameHash);
+    free(idx->blobHash);
+    idx->nameHash = nameHash;
+    idx->blobHash = blobHash;
+    idx->nbuckets = n;
+}
+
+static struct DirIndexEntry *
+FindName(struct DirIndex *idx, char *name)
+{
+    struct DirIndexEntry *ep;
+
+    for (ep = idx->nameHash[nameHashOf(idx, name)]; ep; ep = ep->nameNext)
+	if (strcmp(ep->name, name) == 0)
+	    return ep;
+    return NULL;
+}
+
+static struct DirIndexEntry *
+FindBlob(struct DirIndex *idx, int blob)
+{
+    struct DirIndexEntry *ep;
+
+    for (ep = idx->blobHash[blobHashOf(idx, blob)]; ep; ep = ep->blobNext)
+	if (ep->blob == blob)
+	    return ep;
+    return NULL;
+}
+
+/**
+ * add an entry to an index.
+ *
+ * @param[in] idx       index to add to
+ * @param[in] name      entry name
+ * @param[in] vnode     vnode number of the entry
+ * @param[in] unique    uniquifier of the entry
+ * @param[in] blob      first blob of the entry
+ * @param[in] prevblob  blob preceding the entry on its hash chain, or 0
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval ENOMEM out of memory
+ */
+int
+DIndexAddEntry(struct DirIndex *idx, char *name, afs_int32 vnode,
+	       afs_int32 unique, int blob, int prevblob)
+{
+    struct DirIndexEntry *ep;
+    size_t len = strlen(name);
+    afs_uint32 h;
+
+    ep = malloc(sizeof(*ep) + len);
+    if (ep == NULL)
+	return ENOMEM;
+    ep->vnode = vnode;
+    ep->unique = unique;
+    ep->blob = blob;
+    ep->prevblob = prevblob;
+    memcpy(ep->name, name, len + 1);
+
+    if (idx->nentries >= 2 * idx->nbuckets)
+	Grow(idx);
+
+    h = nameHashOf(idx, name);
+    ep->nameNext = idx->nameHash[h];
+    idx->nameHash[h] = ep;
+    h = blobHashOf(idx, blob);
+    ep->blobNext = idx->blobHash[h];
+    idx->blobHash[h] = ep;
+    idx->nentries++;
+    if (idx->installed)
+	diEntries++;
+    return 0;
+}
+
+static void
+RemoveEntry(struct DirIndex *idx, struct DirIndexEntry *ep)
+{
+    struct DirIndexEntry **epp;
+
+    for (epp = &idx->nameHash[nameHashOf(idx, ep->name)]; *epp;
+	 epp = &(*epp)->nameNext) {
+	if (*epp == ep) {
+	    *epp = ep->nameNext;
+	    break;
+	}
+    }
+    for (epp = &idx->blobHash[blobHashOf(idx, ep->blob)]; *epp;
+	 epp = &(*epp)->blobNext) {
+	if (*epp == ep) {
+	    *epp = ep->blobNext;
+	    break;
+	}
+    }
+    idx->nentries--;
+    diEntries--;
+    free(ep);
+}
+
+/* Find the installed index for a directory.  Must be called with
+ * dirIndexLock held. */
+static struct DirIndex *
+Lookup(dir_file_t dir)
+{
+    struct opr_queue *cursor;
+    struct DirIndex *idx;
+
+    for (opr_queue_Scan(&diTable[diHash(dir)], cursor)) {
+	idx = opr_queue_Entry(cursor, struct DirIndex, hashq);
+	if (FidEq(indexDir(idx), dir))
+	    return idx;
+    }
+    return NULL;
+}
+
+/* Unlink an index from the tables.  Must be called with dirIndexLock
+ * write-locked; the caller frees the index after dropping the lock. */
+static void
+Unlink(struct DirIndex *idx)
+{
+    opr_queue_Remove(&idx->hashq);
+    opr_queue_Remove(&idx->lruq);
+    diEntries -= idx->nentries;
+    diCount--;
+}
+
+/* Evict least recently used indexes, other than keep, until need more
+ * entries fit under the limit.  Must be called with dirIndexLock
+ * write-locked; evicted indexes are queued on evicted for the caller to
+ * free once the lock is dropped. */
+static void
+Evict(afs_uint32 need, struct DirIndex *keep, struct opr_queue *evicted)
+{
+    struct DirIndex *victim;
+
+    while (diEntries + need > diMaxEntries && !opr_queue_IsEmpty(&diLRU)) {
+	victim = opr_queue_Last(&diLRU, struct DirIndex, lruq);
+	if (victim == keep)
+	    break;
+	Unlink(victim);
+	opr_queue_Append(evicted, &victim->lruq);
+	diEvictions++;
+    }
+}
+
+static void
+FreeQueue(struct opr_queue *q)
+{
+    struct DirIndex *idx;
+
+    while (!opr_queue_IsEmpty(q)) {
+	idx = opr_queue_First(q, struct DirIndex, lruq);
+	opr_queue_Remove(&idx->lruq);
+	DIndexFree(idx);
+    }
+}
+
+/**
+ * publish a fully built index for a directory.
+ *
+ * If an index for the directory was installed in the meantime, or the
+ * index would not fit in the entry limit, the new index is discarded.
+ * Least recently used indexes are evicted to make room.
+ *
+ * @param[in] dir  directory the index describes
+ * @param[in] idx  index built by DIndexAlloc/DIndexAddEntry; ownership
+ *                 passes to the package
+ */
+void
+DIndexInstall(dir_file_t dir, struct DirIndex *idx)
+{
+    struct opr_queue evicted;
+
+    opr_queue_Init(&evicted);
+
+    ObtainWriteLock(&dirIndexLock);
+    if (!diEnabled || idx->nentries > diMaxEntries || Lookup(dir) != NULL) {
+	ReleaseWriteLock(&dirIndexLock);
+	DIndexFree(idx);
+	return;
+    }
+    Evict(idx->nentries, NULL, &evicted);
+    FidCpy(indexDir(idx), dir);
+    idx->installed = 1;
+    opr_queue_Prepend(&diTable[diHash(dir)], &idx->hashq);
+    opr_queue_Prepend(&diLRU, &idx->lruq);
+    diEntries += idx->nentries;
+    diCount++;
+    diBuilds++;
+    ReleaseWriteLock(&dirIndexLock);
+
+    FreeQueue(&evicted);
+}
+
+/**
+ * look up a name in the index for a directory.
+ *
+ * @param[in]  dir        directory to search
+ * @param[in]  name       name to look for
+ * @param[out] blobp      first blob of the entry
+ * @param[out] prevblobp  blob preceding the entry on its hash chain, or 0
+ *                        if the entry is at the head of the chain
+ *
+ * @return lookup status
+ *    @retval 0 name found
+ *    @retval ENOENT the directory is indexed and the index lacks name
+ *    @retval -1 the directory is not indexed
+ */
+int
+DIndexLookup(dir_file_t dir, char *name, int *blobp, int *prevblobp)
+{
+    struct DirIndex *idx;
+    struct DirIndexEntry *ep;
+    int code;
+
+    if (!diEnabled)
+	return -1;
+
+    ObtainWriteLock(&dirIndexLock);
+    idx = Lookup(dir);
+    if (idx == NULL) {
+	code = -1;
+    } else {
+	opr_queue_Remove(&idx->lruq);
+	opr_queue_Prepend(&diLRU, &idx->lruq);
+	ep = FindName(idx, name);
+	if (ep != NULL) {
+	    *blobp = ep->blob;
+	    *prevblobp = ep->prevblob;
+	    diHits++;
+	    code = 0;
+	} else {
+	    diMisses++;
+	    code = ENOENT;
+	}
+    }
+    ReleaseWriteLock(&dirIndexLock);
+    return code;
+}
+
+/**
+ * record a new entry threaded onto the head of a hash chain.
+ *
+ * @param[in] dir      directory
+ * @param[in] name     name of the new entry
+ * @param[in] vnode    vnode number of the new entry
+ * @param[in] unique   uniquifier of the new entry
+ * @param[in] blob     first blob of the new entry
+ * @param[in] oldhead  blob that was at the head of the chain, or 0
+ */
+void
+DIndexInsert(dir_file_t dir, char *name, afs_int32 vnode, afs_int32 unique,
+	     int blob, int oldhead)
+{
+    struct DirIndex *idx;
+    struct DirIndexEntry *ep;
+    struct opr_queue evicted;
+
+    if (!diEnabled)
+	return;
+
+    opr_queue_Init(&evicted);
+    ObtainWriteLock(&dirIndexLock);
+    idx = Lookup(dir);
+    if (idx != NULL) {
+	if (oldhead != 0 && (ep = FindBlob(idx, oldhead)) != NULL)
+	    ep->prevblob = blob;
+	Evict(1, idx, &evicted);
+	if (DIndexAddEntry(idx, name, vnode, unique, blob, 0) != 0) {
+	    Unlink(idx);
+	    opr_queue_Append(&evicted, &idx->lruq);
+	}
+    }
+    ReleaseWriteLock(&dirIndexLock);
+
+    FreeQueue(&evicted);
+}
+
+/**
+ * forget an entry that has been unthreaded from its hash chain.
+ *
+ * @param[in] dir       directory
+ * @param[in] name      name of the removed entry
+ * @param[in] nextblob  blob that followed the entry on its chain, or 0
+ */
+void
+DIndexRemove(dir_file_t dir, char *name, int nextblob)
+{
+    struct DirIndex *idx;
+    struct DirIndexEntry *ep, *nep;
+
+    if (!diEnabled)
+	return;
+
+    ObtainWriteLock(&dirIndexLock);
+    idx = Lookup(dir);
+    if (idx != NULL && (ep = FindName(idx, name)) != NULL) {
+	if (nextblob != 0 && (nep = FindBlob(idx, nextblob)) != NULL)
+	    nep->prevblob = ep->prevblob;
+	RemoveEntry(idx, ep);
+    }
+    ReleaseWriteLock(&dirIndexLock);
+}
+
+/**
+ * update the fid recorded for an entry.
+ *
+ * @param[in] dir     directory
+ * @param[in] name    entry name
+ * @param[in] vnode   new vnode number
+ * @param[in] unique  new uniquifier
+ */
+void
+DIndexChangeFid(dir_file_t dir, char *name, afs_int32 vnode,
+		afs_int32 unique)
+{
+    struct DirIndex *idx;
+    struct DirIndexEntry *ep;
+
+    if (!diEnabled)
+	return;
+
+    ObtainWriteLock(&dirIndexLock);
+    idx = Lookup(dir);
+    if (idx != NULL && (ep = FindName(idx, name)) != NULL) {
+	ep->vnode = vnode;
+	ep->unique = unique;
+    }
+    ReleaseWriteLock(&dirIndexLock);
+}
+
+/**
+ * drop the index for a directory, if there is one.
+ *
+ * @param[in] dir    directory
+ * @param[in] stale  non-zero if the index was found to disagree with the
+ *                   directory pages
+ */
+void
+DIndexZap(dir_file_t dir, int stale)
+{
+    struct DirIndex *idx;
+
+    if (!diEnabled)
+	return;
+
+    ObtainWriteLock(&dirIndexLock);
+    idx = Lookup(dir);
+    if (idx != NULL) {
+	Unlink(idx);
+	if (stale)
+	    diStale++;
+    }
+    ReleaseWriteLock(&dirIndexLock);
+    DIndexFree(idx);
+}
+
+/**
+ * drop the indexes for all directories in a volume.
+ *
+ * @param[in] vid  volume id
+ */
+void
+DIndexFlushVolume(afs_int32 vid)
+{
+    struct opr_queue *cursor, *store;
+    struct opr_queue dropped;
+    struct DirIndex *idx;
+
+    if (!diEnabled)
+	return;
+
+    opr_queue_Init(&dropped);
+    ObtainWriteLock(&dirIndexLock);
+    for (opr_queue_ScanSafe(&diLRU, cursor, store)) {
+	idx = opr_queue_Entry(cursor, struct DirIndex, lruq);
+	if (FidVolEq(indexDir(idx), vid)) {
+	    Unlink(idx);
+	    opr_queue_Append(&dropped, &idx->lruq);
+	}
+    }
+    ReleaseWriteLock(&dirIndexLock);
+
+    FreeQueue(&dropped);
+}
+
+/**
+ * return directory index statistics.
+ */
+int
+DIndexStat(int *adirs, int *aentries, int *ahits, int *amisses,
+	   int *abuilds, int *aevictions, int *astale)
+{
+    ObtainReadLock(&dirIndexLock);
+    *adirs = diCount;
+    *aentries = diEntries;
+    *ahits = diHits;
+    *amisses = diMisses;
+    *abuilds = diBuilds;
+    *aevictions = diEvictions;
+    *astale = diStale;
+    ReleaseReadLock(&dirIndexLock);
+    return 0;
+}
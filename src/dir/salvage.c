@@ -56,55 +56,20 @@ ComputeUsedPages(struct DirHeader *dhp)
     return usedPages;
 }
 
-/**
- * check whether a directory object is ok.
- *
- * @param[in] file  opaque pointer to directory object fid
- *
- * @return operation status
- *    @retval 1 dir is fine, or something went wrong checking
- *    @retval 0 we *know* that the dir is bad
- */
-int
-DirOK(void *file)
+/* Number of hash chain entries gathered before their names are hashed. */
+#define DIROK_BATCH 64
+
+/* Check the first page's magic number and the alloMap in the directory
+ * header, and work out how many pages are in use.  Returns 0 if the header
+ * is bad. */
+static int
+CheckHeader(struct DirHeader *dhp, int *usedPagesp)
 {
-    struct DirHeader *dhp;
-    struct PageHeader *pp;
-    struct DirEntry *ep;
-    struct DirBuffer headerbuf, pagebuf, entrybuf;
     int i, j, k, up;
-    int havedot = 0, havedotdot = 0;
-    int usedPages, count, entry;
-    char eaMap[BIGMAXPAGES * EPP / 8];	/* Change eaSize initialization below, too. */
-    int eaSize;
-    afs_int32 entcount, maxents;
-    unsigned short ne;
-    int code;
-    int physerr;
-
-    eaSize = BIGMAXPAGES * EPP / 8;
-
-    /* Read the directory header */
-    code = DReadWithErrno(file, 0, &headerbuf, &physerr);
-    if (code) {
-	/* if physerr is 0, then we know that the read worked, but was short,
-	 * and the damage is permanent.  Otherwise, we got an I/O or programming
-	 * error.  Claim the dir is OK, but log something.
-	 */
-	if (physerr != 0) {
-	    printf("Could not read first page in directory (%d)\n", physerr);
-	    Die("dirok1");
-	    AFS_UNREACHED(return 1);
-	}
-	printf("First page in directory does not exist.\n");
-	return 0;
-    }
-    dhp = (struct DirHeader *)headerbuf.data;
 
     /* Check magic number for first page */
     if (dhp->header.tag != htons(1234)) {
 	printf("Bad first pageheader magic number.\n");
-	DRelease(&headerbuf, 0);
 	return 0;
     }
 
@@ -125,13 +90,11 @@ DirOK(void *file)
 		 * two must exist for "." and ".."
 		 */
 		printf("The dir header alloc map for page %d is bad.\n", i);
-		DRelease(&headerbuf, 0);
 		return 0;
 	    }
 	} else {
 	    if ((j < 0) || (j > EPP)) {
 		printf("The dir header alloc map for page %d is bad.\n", i);
-		DRelease(&headerbuf, 0);
 		return 0;
 	    }
 	}
@@ -142,7 +105,6 @@ DirOK(void *file)
 		printf
 		    ("A partially-full page occurs in slot %d, after the dir end.\n",
 		     i);
-		DRelease(&headerbuf, 0);
 		return 0;
 	    }
 	} else if (j == EPP) {	/* is this the last page */
@@ -156,23 +118,44 @@ DirOK(void *file)
      ** those pages, the value of 'up' must be less than pgcount. The above
      ** loop only checks the first MAXPAGES in a directory. An alloMap does
      ** not exists for pages between MAXPAGES and BIGMAXPAGES */
-    usedPages = ComputeUsedPages(dhp);
-    if (usedPages < up) {
+    *usedPagesp = ComputeUsedPages(dhp);
+    if (*usedPagesp < up) {
 	printf
 	    ("Count of used directory pages does not match count in directory header\n");
-	DRelease(&headerbuf, 0);
 	return 0;
     }
+    return 1;
+}
+
+/* Count the entries marked allocated in a page's freebitmap.  The map is
+ * EPP / 8 == 8 bytes long, so it is counted as one 64-bit word. */
+static int
+CountAllocated(char *freebitmap)
+{
+    afs_uint64 x;
+
+    memcpy(&x, freebitmap, sizeof(x));
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+/* For each directory page, check the magic number in each page header, and
+ * check that number of free entries (from freebitmap) matches the count in
+ * the alloMap from directory header.  If image is not NULL, each page is
+ * also copied into it.  Returns 0 if the directory is bad. */
+static int
+CheckPages(void *file, struct DirHeader *dhp, int usedPages, char *image)
+{
+    struct DirBuffer pagebuf;
+    struct PageHeader *pp;
+    int i, count, code, physerr;
 
-    /* For each directory page, check the magic number in each page
-     * header, and check that number of free entries (from freebitmap)
-     * matches the count in the alloMap from directory header.
-     */
     for (i = 0; i < usedPages; i++) {
 	/* Read the page header */
 	code = DReadWithErrno(file, i, &pagebuf, &physerr);
 	if (code) {
-	    DRelease(&headerbuf, 0);
 	    if (physerr != 0) {
 		/* couldn't read page, but not because it wasn't there permanently */
 		printf("Failed to read dir page %d (errno %d)\n", i, physerr);
@@ -188,34 +171,11 @@ DirOK(void *file)
 	if (pp->tag != htons(1234)) {
 	    printf("Directory page %d has a bad magic number.\n", i);
 	    DRelease(&pagebuf, 0);
-	    DRelease(&headerbuf, 0);
 	    return 0;
 	}
 
-	/* Count the number of entries allocated in this single
-	 * directory page using the freebitmap in the page header.
-	 */
-	count = 0;
-	for (j = 0; j < EPP / 8; j++) {
-	    k = pp->freebitmap[j];
-	    if (k & 0x80)
-		count++;
-	    if (k & 0x40)
-		count++;
-	    if (k & 0x20)
-		count++;
-	    if (k & 0x10)
-		count++;
-	    if (k & 0x08)
-		count++;
-	    if (k & 0x04)
-		count++;
-	    if (k & 0x02)
-		count++;
-	    if (k & 0x01)
-		count++;
-	}
-	count = EPP - count;	/* Change to count of free entries */
+	/* Change to count of free entries */
+	count = EPP - CountAllocated(pp->freebitmap);
 
 	/* Now check that the count of free entries matches the count in the alloMap */
 	if ((i < MAXPAGES) && ((count & 0xff) != (dhp->alloMap[i] & 0xff))) {
@@ -223,39 +183,121 @@ DirOK(void *file)
 		("Header alloMap count doesn't match count in freebitmap for page %d.\n",
 		 i);
 	    DRelease(&pagebuf, 0);
-	    DRelease(&headerbuf, 0);
 	    return 0;
 	}
 
+	if (image != NULL)
+	    memcpy(image + i * AFS_PAGESIZE, pagebuf.data, AFS_PAGESIZE);
 	DRelease(&pagebuf, 0);
     }
+    return 1;
+}
 
-    /* Initialize the in-memory freebit map for all pages. */
-    for (i = 0; i < eaSize; i++) {
-	eaMap[i] = 0;
-	if (i < usedPages * (EPP / 8)) {
-	    if (i == 0) {
-		eaMap[i] = 0xff;	/* A dir header uses first 13 entries */
-	    } else if (i == 1) {
-		eaMap[i] = 0x1f;	/* A dir header uses first 13 entries */
-	    } else if ((i % 8) == 0) {
-		eaMap[i] = 0x01;	/* A page header uses only first entry */
-	    }
-	}
+/* Return the length of the name in entry ep, which is blob number entry, or
+ * -1 if the name is not terminated before the end of its page. */
+static int
+NameLength(struct DirEntry *ep, int entry)
+{
+    char *end;
+    size_t room;
+
+    room = AFS_PAGESIZE - 32 * (entry & (EPP - 1)) - (ep->name - (char *)ep);
+    end = memchr(ep->name, '\0', room);
+    if (end == NULL)
+	return -1;
+    return end - ep->name;
+}
+
+/* Check an entry found on hash chain 'chain', and mark the blobs it uses in
+ * eaMap.  len is the length of the entry's name as returned by NameLength,
+ * and hash is the name's hash if len is not -1.  Returns 0 if the entry is
+ * bad. */
+static int
+CheckEntry(struct DirEntry *ep, int entry, int chain, int len, int hash,
+	   char *eaMap, int *havedot, int *havedotdot)
+{
+    int j, k;
+
+    /* A null name is no good */
+    if (ep->name[0] == '\000') {
+	printf("Dir entry %d in chain %d has bogus (null) name.\n",
+		entry, chain);
+	return 0;
     }
-    maxents = usedPages * EPP;
 
-    /* Walk down all the hash lists, ensuring that each flag field has FFIRST
-     * in it.  Mark the appropriate bits in the in-memory freebit map.
-     * Check that the name is in the right hash bucket.
-     * Also check for loops in the hash chain by counting the entries.
+    /* The entry flag better be FFIRST */
+    if (ep->flag != FFIRST) {
+	printf("Dir entry %d in chain %d has bogus flag field.\n",
+		entry, chain);
+	return 0;
+    }
+
+    /* Check the size of the name */
+    if (len < 0 || len >= MAXENAME) {	/* MAXENAME counts the null */
+	printf("Dir entry %d in chain %d has too-long name.\n", entry, chain);
+	return 0;
+    }
+
+    /* The name used up k directory entries, set the bit in our in-memory
+     * freebitmap for each entry used by the name (see afs_dir_NameBlobs).
      */
+    k = 1 + ((len + 1 + 15) >> 5);
+    for (j = 0; j < k; j++) {
+	eaMap[(entry + j) >> 3] |= (1 << ((entry + j) & 7));
+    }
+
+    /* Make sure the name is in the correct name hash */
+    if (hash != chain) {
+	printf("Dir entry %d should be in hash bucket %d but IS in %d.\n",
+	       entry, hash, chain);
+	return 0;
+    }
+
+    /* Check that if this is entry 13 (the 1st entry), then name must be "." */
+    if (entry == 13) {
+	if (strcmp(ep->name, ".") == 0) {
+	    *havedot = 1;
+	} else {
+	    printf
+		("Dir entry %d, index 13 has name '%s' should be '.'\n",
+		 entry, ep->name);
+	    return 0;
+	}
+    }
+
+    /* Check that if this is entry 14 (the 2nd entry), then name must be ".." */
+    if (entry == 14) {
+	if (strcmp(ep->name, "..") == 0) {
+	    *havedotdot = 1;
+	} else {
+	    printf
+		("Dir entry %d, index 14 has name '%s' should be '..'\n",
+		 entry, ep->name);
+	    return 0;
+	}
+    }
+
+    /* CHECK FOR DUPLICATE NAMES? */
+
+    return 1;
+}
+
+/* Walk the hash chains one blob at a time through the buffer package. */
+static int
+WalkChainsByBlob(void *file, struct DirHeader *dhp, afs_int32 maxents,
+		 char *eaMap, int *havedot, int *havedotdot)
+{
+    struct DirBuffer entrybuf;
+    struct DirEntry *ep;
+    afs_int32 entcount;
+    unsigned short ne;
+    int i, len, hash, entry, code, physerr;
+
     for (entcount = 0, i = 0; i < NHASHENT; i++) {
 	for (entry = ntohs(dhp->hashTable[i]); entry; entry = ne) {
 	    /* Verify that the entry is within range */
 	    if (entry < 0 || entry >= maxents) {
 		printf("Out-of-range hash id %d in chain %d.\n", entry, i);
-		DRelease(&headerbuf, 0);
 		return 0;
 	    }
 
@@ -268,11 +310,9 @@ DirOK(void *file)
 		     */
 		    printf("Could not get dir blob %d (errno %d)\n", entry,
 			   physerr);
-		    DRelease(&headerbuf, 0);
 		    Die("dirok3");
 		}
 		printf("Invalid hash id %d in chain %d.\n", entry, i);
-		DRelease(&headerbuf, 0);
 		return 0;
 	    }
 	    ep = (struct DirEntry *)entrybuf.data;
@@ -283,94 +323,160 @@ DirOK(void *file)
 	    if (++entcount >= maxents) {
 		printf("Directory's hash chain %d is circular.\n", i);
 		DRelease(&entrybuf, 0);
-		DRelease(&headerbuf, 0);
-		return 0;
-	    }
-
-	    /* A null name is no good */
-	    if (ep->name[0] == '\000') {
-		printf("Dir entry %p in chain %d has bogus (null) name.\n",
-			ep, i);
-		DRelease(&entrybuf, 0);
-		DRelease(&headerbuf, 0);
-		return 0;
-	    }
-
-	    /* The entry flag better be FFIRST */
-	    if (ep->flag != FFIRST) {
-		printf("Dir entry %p in chain %d has bogus flag field.\n",
-			ep, i);
-		DRelease(&entrybuf, 0);
-		DRelease(&headerbuf, 0);
 		return 0;
 	    }
 
-	    /* Check the size of the name */
-	    j = strlen(ep->name);
-	    if (j >= MAXENAME) {	/* MAXENAME counts the null */
-		printf("Dir entry %p in chain %d has too-long name.\n", ep, i);
+	    len = NameLength(ep, entry);
+	    hash = (len < 0 ? -1 : afs_dir_DirHash(ep->name));
+	    if (!CheckEntry(ep, entry, i, len, hash, eaMap, havedot,
+			    havedotdot)) {
 		DRelease(&entrybuf, 0);
-		DRelease(&headerbuf, 0);
 		return 0;
 	    }
+	    DRelease(&entrybuf, 0);
+	}
+    }
+    return 1;
+}
 
-	    /* The name used up k directory entries, set the bit in our in-memory
-	     * freebitmap for each entry used by the name.
-	     */
-	    k = afs_dir_NameBlobs(ep->name);
-	    for (j = 0; j < k; j++) {
-		eaMap[(entry + j) >> 3] |= (1 << ((entry + j) & 7));
-	    }
+/* Walk the hash chains through an in-memory copy of the directory's pages,
+ * hashing the names in batches of up to DIROK_BATCH chain entries. */
+static int
+WalkChainsInImage(char *image, afs_int32 maxents, char *eaMap,
+		  int *havedot, int *havedotdot)
+{
+    struct DirHeader *dhp = (struct DirHeader *)image;
+    struct DirEntry *ep;
+    int entries[DIROK_BATCH], lens[DIROK_BATCH], hashlens[DIROK_BATCH];
+    int hashes[DIROK_BATCH];
+    char *names[DIROK_BATCH];
+    afs_int32 entcount;
+    int i, j, n, entry;
 
-	    /* Hash the name and make sure it is in the correct name hash */
-	    if ((j = afs_dir_DirHash(ep->name)) != i) {
-		printf("Dir entry %p should be in hash bucket %d but IS in %d.\n",
-		       ep, j, i);
-		DRelease(&entrybuf, 0);
-		DRelease(&headerbuf, 0);
-		return 0;
-	    }
+    for (entcount = 0, i = 0; i < NHASHENT; i++) {
+	entry = ntohs(dhp->hashTable[i]);
+	while (entry) {
+	    for (n = 0; entry && n < DIROK_BATCH; n++) {
+		/* Verify that the entry is within range */
+		if (entry < 0 || entry >= maxents) {
+		    printf("Out-of-range hash id %d in chain %d.\n", entry, i);
+		    return 0;
+		}
+		ep = (struct DirEntry *)(image + 32 * entry);
 
-	    /* Check that if this is entry 13 (the 1st entry), then name must be "." */
-	    if (entry == 13) {
-		if (strcmp(ep->name, ".") == 0) {
-		    havedot = 1;
-		} else {
-		    printf
-			("Dir entry %p, index 13 has name '%s' should be '.'\n",
-			 ep, ep->name);
-		    DRelease(&entrybuf, 0);
-		    DRelease(&headerbuf, 0);
+		/* There can't be more than maxents entries */
+		if (++entcount >= maxents) {
+		    printf("Directory's hash chain %d is circular.\n", i);
 		    return 0;
 		}
+
+		entries[n] = entry;
+		names[n] = ep->name;
+		lens[n] = NameLength(ep, entry);
+		/* unterminated names are rejected before their hash is used */
+		hashlens[n] = (lens[n] < 0 ? 0 : lens[n]);
+		entry = ntohs(ep->next);
 	    }
 
-	    /* Check that if this is entry 14 (the 2nd entry), then name must be ".." */
-	    if (entry == 14) {
-		if (strcmp(ep->name, "..") == 0) {
-		    havedotdot = 1;
-		} else {
-		    printf
-			("Dir entry %p, index 14 has name '%s' should be '..'\n",
-			 ep, ep->name);
-		    DRelease(&entrybuf, 0);
-		    DRelease(&headerbuf, 0);
+	    afs_dir_DirHashBatch(names, hashlens, n, hashes);
+	    for (j = 0; j < n; j++) {
+		ep = (struct DirEntry *)(image + 32 * entries[j]);
+		if (!CheckEntry(ep, entries[j], i, lens[j], hashes[j], eaMap,
+				havedot, havedotdot))
 		    return 0;
-		}
 	    }
+	}
+    }
+    return 1;
+}
 
-	    /* CHECK FOR DUPLICATE NAMES? */
+/* Check a directory.  If inMemory is set, the directory is copied into
+ * memory as its pages are first read, and the rest of the checks work from
+ * the copy. */
+static int
+DirCheck(void *file, int inMemory)
+{
+    struct DirHeader *dhp;
+    struct PageHeader *pp;
+    struct DirBuffer headerbuf, pagebuf;
+    int i, j, count;
+    int havedot = 0, havedotdot = 0;
+    int usedPages;
+    char eaMap[BIGMAXPAGES * EPP / 8];	/* Change eaSize initialization below, too. */
+    char *image = NULL;
+    int eaSize;
+    afs_int32 maxents;
+    int code;
+    int physerr;
 
-	    DRelease(&entrybuf, 0);
+    eaSize = BIGMAXPAGES * EPP / 8;
+
+    /* Read the directory header */
+    code = DReadWithErrno(file, 0, &headerbuf, &physerr);
+    if (code) {
+	/* if physerr is 0, then we know that the read worked, but was short,
+	 * and the damage is permanent.  Otherwise, we got an I/O or programming
+	 * error.  Claim the dir is OK, but log something.
+	 */
+	if (physerr != 0) {
+	    printf("Could not read first page in directory (%d)\n", physerr);
+	    Die("dirok1");
+	    AFS_UNREACHED(return 1);
+	}
+	printf("First page in directory does not exist.\n");
+	return 0;
+    }
+    dhp = (struct DirHeader *)headerbuf.data;
+
+    if (!CheckHeader(dhp, &usedPages)) {
+	DRelease(&headerbuf, 0);
+	return 0;
+    }
+
+    /* If there is no memory for a copy of the directory, fall back to
+     * walking it through the buffer package. */
+    if (inMemory)
+	image = malloc(usedPages * AFS_PAGESIZE);
+
+    if (!CheckPages(file, dhp, usedPages, image)) {
+	free(image);
+	DRelease(&headerbuf, 0);
+	return 0;
+    }
+
+    /* Initialize the in-memory freebit map for all pages. */
+    for (i = 0; i < eaSize; i++) {
+	eaMap[i] = 0;
+	if (i < usedPages * (EPP / 8)) {
+	    if (i == 0) {
+		eaMap[i] = 0xff;	/* A dir header uses first 13 entries */
+	    } else if (i == 1) {
+		eaMap[i] = 0x1f;	/* A dir header uses first 13 entries */
+	    } else if ((i % 8) == 0) {
+		eaMap[i] = 0x01;	/* A page header uses only first entry */
+	    }
 	}
     }
+    maxents = usedPages * EPP;
+
+    /* Walk down all the hash lists, ensuring that each flag field has FFIRST
+     * in it.  Mark the appropriate bits in the in-memory freebit map.
+     * Check that the name is in the right hash bucket.
+     * Also check for loops in the hash chain by counting the entries.
+     */
+    if (image != NULL)
+	code = WalkChainsInImage(image, maxents, eaMap, &havedot, &havedotdot);
+    else
+	code = WalkChainsByBlob(file, dhp, maxents, eaMap, &havedot,
+				&havedotdot);
+    if (!code)
+	goto bad;
 
     /* Verify that we found '.' and '..' in the correct place */
     if (!havedot || !havedotdot) {
 	printf
 	    ("Directory entry '.' or '..' does not exist or is in the wrong index.\n");
-	DRelease(&headerbuf, 0);
-	return 0;
+	goto bad;
     }
 
     /* The in-memory freebit map has been computed.  Check that it
@@ -378,23 +484,29 @@ DirOK(void *file)
      * Note that if this matches, alloMap has already been checked against it.
      */
     for (i = 0; i < usedPages; i++) {
-	code = DReadWithErrno(file, i, &pagebuf, &physerr);
-	if (code) {
-	    printf
-		("Failed on second attempt to read dir page %d (errno %d)\n",
-		 i, physerr);
-	    DRelease(&headerbuf, 0);
-	    /* if physerr is 0, then the dir is really bad, and we return dir
-	     * *not* OK.  Otherwise, we Die instead of returning true (1),
-	     * becauase the dir isn't known to be bad (we can't tell, since
-	     * I/Os are failing).
-	     */
-	    if (physerr != 0)
-		Die("dirok4");
-	    else
-		return 0;	/* dir is really shorter */
+	if (image != NULL) {
+	    pp = (struct PageHeader *)(image + i * AFS_PAGESIZE);
+	    if (memcmp(&eaMap[i * (EPP / 8)], pp->freebitmap, EPP / 8) == 0)
+		continue;
+	} else {
+	    code = DReadWithErrno(file, i, &pagebuf, &physerr);
+	    if (code) {
+		printf
+		    ("Failed on second attempt to read dir page %d (errno %d)\n",
+		     i, physerr);
+		DRelease(&headerbuf, 0);
+		/* if physerr is 0, then the dir is really bad, and we return dir
+		 * *not* OK.  Otherwise, we Die instead of returning true (1),
+		 * becauase the dir isn't known to be bad (we can't tell, since
+		 * I/Os are failing).
+		 */
+		if (physerr != 0)
+		    Die("dirok4");
+		else
+		    return 0;	/* dir is really shorter */
+	    }
+	    pp = (struct PageHeader *)pagebuf.data;
 	}
-	pp = (struct PageHeader *)pagebuf.data;
 
 	count = i * (EPP / 8);
 	for (j = 0; j < EPP / 8; j++) {
@@ -402,18 +514,62 @@ DirOK(void *file)
 		printf
 		    ("Entry freebitmap error, page %d, map offset %d, %x should be %x.\n",
 		     i, j, pp->freebitmap[j], eaMap[count + j]);
-		DRelease(&pagebuf, 0);
-		DRelease(&headerbuf, 0);
-		return 0;
+		if (image == NULL)
+		    DRelease(&pagebuf, 0);
+		goto bad;
 	    }
 	}
 
-	DRelease(&pagebuf, 0);
+	if (image == NULL)
+	    DRelease(&pagebuf, 0);
     }
 
     /* Finally cleanup and return. */
+    free(image);
     DRelease(&headerbuf, 0);
     return 1;
+
+  bad:
+    free(image);
+    DRelease(&headerbuf, 0);
+    return 0;
+}
+
+/**
+ * check whether a directory object is ok.
+ *
+ * Each page is read once, into a private copy of the directory, and the
+ * hash chains are checked against that copy with the names hashed in
+ * batches.
+ *
+ * @param[in] file  opaque pointer to directory object fid
+ *
+ * @return operation status
+ *    @retval 1 dir is fine, or something went wrong checking
+ *    @retval 0 we *know* that the dir is bad
+ */
+int
+DirOK(void *file)
+{
+    return DirCheck(file, 1);
+}
+
+/**
+ * check whether a directory object is ok, one blob at a time.
+ *
+ * This makes the same checks as DirOK, but fetches each hash chain entry
+ * through the buffer package instead of copying the directory.
+ *
+ * @param[in] file  opaque pointer to directory object fid
+ *
+ * @return operation status
+ *    @retval 1 dir is fine, or something went wrong checking
+ *    @retval 0 we *know* that the dir is bad
+ */
+int
+DirOKByBlob(void *file)
+{
+    return DirCheck(file, 0);
 }
 
 /**
@@ -223,6 +223,18 @@ struct opr_queue rx_idleServerQueue;
 /* List of free rx_serverQueueEntry structs */
 struct opr_queue rx_freeServerQueue;
 
+#ifndef KERNEL
+/* Optional policy for choosing which queued call to run next; see
+ * rx_SetCallScheduler.  Only consulted by pthreaded servers. */
+static struct rx_callScheduler *rxi_callScheduler;
+# ifdef RX_ENABLE_LOCKS
+#  define RX_CALL_SCHEDULER
+/* Calls offered to the scheduler; protected by rx_serverPool_lock */
+#  define RX_SCHED_MAXCANDIDATES 64
+static struct rx_call *rxi_schedCandidates[RX_SCHED_MAXCANDIDATES];
+# endif
+#endif
+
 #if !defined(offsetof)
 #include <stddef.h>		/* for definition of offsetof() */
 #endif
@@ -234,6 +246,9 @@ static afs_kmutex_t freeSQEList_lock;
 
 /* Forward prototypes */
 static struct rx_call * rxi_NewCall(struct rx_connection *, int);
+#ifdef RX_CALL_SCHEDULER
+static void rxi_SchedulerEnd(struct rx_call *call, int started);
+#endif
 
 static_inline void
 putConnection (struct rx_connection *conn) {
@@ -1907,6 +1922,9 @@ rxi_ServerProc(int threadID, struct rx_call *newcall, osi_socket * socketp)
 	if (rx_tranquil && (call != NULL)) {
 	    SPLVAR;
 
+#ifdef RX_CALL_SCHEDULER
+	    rxi_SchedulerEnd(call, 0);
+#endif
 	    NETPRI;
 	    MUTEX_ENTER(&call->lock);
 
@@ -1928,6 +1946,9 @@ rxi_ServerProc(int threadID, struct rx_call *newcall, osi_socket * socketp)
 	if (tservice->afterProc)
 	    (*tservice->afterProc) (call, code);
 
+#ifdef RX_CALL_SCHEDULER
+	rxi_SchedulerEnd(call, 1);
+#endif
 	rx_EndCall(call, code);
 
 	if (tservice->postProc)
@@ -2009,6 +2030,110 @@ rx_WakeupServerProcs(void)
  * sit on the idle server queue and are assigned by "...ReceivePacket" as soon
  * as a new call arrives.
  */
+#ifndef KERNEL
+/**
+ * Install a policy for choosing which queued call a server thread runs next.
+ *
+ * Without a scheduler, idle server threads take incoming calls in arrival
+ * order (with some preference for calls whose data has already arrived).
+ * With one, calls are still handed straight to an idle thread when there is
+ * one, but only if the scheduler's admit hook agrees; otherwise they wait
+ * on the incoming call queue, and whenever a thread becomes free the
+ * scheduler's pick hook chooses among the oldest waiting call from each
+ * peer.  The end hook is called once for every call the scheduler admitted
+ * or picked, when that call is finished with.
+ *
+ * @param[in] sched  scheduler hooks, or NULL for the default policy
+ *
+ * @note must be called before rx_StartServer.  Only pthreaded servers
+ *       consult the scheduler.
+ */
+void
+rx_SetCallScheduler(struct rx_callScheduler *sched)
+{
+    rxi_callScheduler = sched;
+}
+#endif
+
+#ifdef RX_CALL_SCHEDULER
+/*
+ * Tell the call scheduler that a call it admitted or picked is finished
+ * with.  If the call ran, report how long it waited to be started.
+ */
+static void
+rxi_SchedulerEnd(struct rx_call *call, int started)
+{
+    struct clock waited;
+
+    if (rxi_callScheduler == NULL)
+	return;
+    if (started) {
+	waited = call->startTime;
+	clock_Sub(&waited, &call->queueTime);
+	if (waited.sec < 0)
+	    clock_Zero(&waited);
+    }
+    (*rxi_callScheduler->end)(rxi_callScheduler->rock, call,
+			      started ? &waited : NULL);
+}
+/*
+ * Ask the call scheduler whether an incoming call may be given to an idle
+ * server thread right away.  Called with rx_serverPool_lock held.
+ */
+static int
+rxi_SchedulerAdmit(struct rx_call *call)
+{
+    if (rxi_callScheduler == NULL)
+	return 1;
+    return (*rxi_callScheduler->admit)(rxi_callScheduler->rock, call);
+}
+
+/*
+ * Let the call scheduler choose the next queued call to run.  Called with
+ * rx_serverPool_lock held; returns the call, still on the incoming queue,
+ * with its service's quota taken, or NULL if nothing should run now.
+ */
+static struct rx_call *
+rxi_PickScheduledCall(void)
+{
+    struct rx_call *tcall;
+    struct opr_queue *cursor;
+    int i, n = 0, choice;
+
+    for (opr_queue_Scan(&rx_incomingCallQueue, cursor)) {
+	tcall = opr_queue_Entry(cursor, struct rx_call, entry);
+	if (!QuotaOK(tcall->conn->service))
+	    continue;
+	ReturnToServerPool(tcall->conn->service);
+
+	/* Offer only the oldest eligible call from each peer */
+	for (i = 0; i < n; i++) {
+	    if (rxi_schedCandidates[i]->conn->peer == tcall->conn->peer)
+		break;
+	}
+	if (i < n)
+	    continue;
+	rxi_schedCandidates[n++] = tcall;
+	if (n == RX_SCHED_MAXCANDIDATES)
+	    break;
+    }
+    if (n == 0)
+	return NULL;
+
+    choice = (*rxi_callScheduler->pick)(rxi_callScheduler->rock,
+					rxi_schedCandidates, n);
+    if (choice < 0 || choice >= n)
+	return NULL;
+    tcall = rxi_schedCandidates[choice];
+    if (!QuotaOK(tcall->conn->service)) {
+	rxi_SchedulerEnd(tcall, 0);
+	return NULL;
+    }
+    return tcall;
+}
+
+#endif /* RX_CALL_SCHEDULER */
+
 /* Sleep until a call arrives.  Returns a pointer to the call, ready
  * for an rx_Read. */
 #ifdef RX_ENABLE_LOCKS
@@ -2038,6 +2163,15 @@ rx_GetCall(int tno, struct rx_service *cur_service, osi_socket * socketp)
 	ReturnToServerPool(cur_service);
     }
     while (1) {
+#ifdef RX_CALL_SCHEDULER
+	if (rxi_callScheduler != NULL) {
+	    if (!opr_queue_IsEmpty(&rx_incomingCallQueue)) {
+		call = rxi_PickScheduledCall();
+		if (call != NULL)
+		    service = call->conn->service;
+	    }
+	} else
+#endif
 	if (!opr_queue_IsEmpty(&rx_incomingCallQueue)) {
 	    struct rx_call *tcall, *choice2 = NULL;
 	    struct opr_queue *cursor;
@@ -2106,6 +2240,9 @@ rx_GetCall(int tno, struct rx_service *cur_service, osi_socket * socketp)
 
 	    if (call->state != RX_STATE_PRECALL || call->error) {
 		MUTEX_EXIT(&call->lock);
+#ifdef RX_CALL_SCHEDULER
+		rxi_SchedulerEnd(call, 0);
+#endif
 		MUTEX_ENTER(&rx_serverPool_lock);
 		ReturnToServerPool(service);
 		call = NULL;
@@ -5003,7 +5140,11 @@ rxi_AttachServerProc(struct rx_call *call,
     MUTEX_ENTER(&rx_serverPool_lock);
 
     haveQuota = QuotaOK(service);
-    if ((!haveQuota) || opr_queue_IsEmpty(&rx_idleServerQueue)) {
+    if ((!haveQuota) || opr_queue_IsEmpty(&rx_idleServerQueue)
+#ifdef RX_CALL_SCHEDULER
+	|| !rxi_SchedulerAdmit(call)
+#endif
+	) {
 	/* If there are no processes available to service this call,
 	 * put the call on the incoming call queue (unless it's
 	 * already on the queue).
@@ -334,6 +334,22 @@ struct rx_service {
 
 };
 
+/* Hooks for a server call scheduler; see rx_SetCallScheduler.  The hooks
+ * other than end are called with rx's server pool lock held, so they must
+ * not block or call back into rx other than to look at the call. */
+struct rx_callScheduler {
+    /* May this call be given to an idle thread now? Nonzero means yes, and
+     * that the call is now counted as running */
+    int (*admit) (void *rock, struct rx_call * acall);
+    /* Index of the waiting call to run next, or -1 to leave them all
+     * waiting; the chosen call is now counted as running */
+    int (*pick) (void *rock, struct rx_call ** acalls, int ncalls);
+    /* An admitted or picked call is done; waited is how long it was queued,
+     * or NULL if it never ran */
+    void (*end) (void *rock, struct rx_call * acall, struct clock * waited);
+    void *rock;
+};
+
 /* Flag bits for connection structure */
 #define RX_CONN_MAKECALL_WAITING    1	/* rx_NewCall is waiting for a channel */
 #define RX_CONN_DESTROY_ME	    2	/* Destroy *client* connection after last call */
@@ -182,7 +182,10 @@ extern afs_int32 implicitAdminRights;
 extern afs_int32 readonlyServer;
 extern afs_int32 adminwriteServer;
 extern int CopyOnWrite_calls, CopyOnWrite_off0, CopyOnWrite_size0;
+extern int dirCompactMinPages;
 extern afs_fsize_t CopyOnWrite_maxsize;
+extern int norightscache;
+extern afs_uint64 RightsCacheHits, RightsCacheMisses;
 
 /*
  * Externals used by the xstat code.
@@ -266,6 +269,24 @@ SetVolumeSync(struct AFSVolSync *async, Volume * avol)
     FS_UNLOCK;
 }				/*SetVolumeSync */
 
+/*
+ * Start the vnode index reads for the remaining fids of a bulk status call
+ * that live in the same volume as afid, so that the serial GetVolumePackage
+ * calls which follow do not each wait on their own disk read.
+ */
+static void
+PrefetchBulkVnodes(Volume * avol, struct AFSFid *afid, int nfids)
+{
+    VnodeId vnodes[AFSCBMAX];
+    int i, n;
+
+    for (i = 1, n = 0; i < nfids && n < AFSCBMAX; i++) {
+	if (afid[i].Volume == afid->Volume)
+	    vnodes[n++] = afid[i].Vnode;
+    }
+    VPrefetchVnodes(avol, vnodes, n);
+}
+
 /**
  * Verify that the on-disk size for a vnode matches the length in the vnode
  * index.
@@ -745,17 +766,121 @@ client_HasAsMember(struct client *client, afs_int32 id)
     return code;
 }
 
+/*
+ * Bumped by StoreACL under FS_LOCK.  ACLs are changed rarely enough that one generation
+ * for the whole server is enough to keep the clients' cached rights honest.
+ */
+static afs_uint32 aclGeneration;
+
+/*
+ * Build the key under which the rights to aclvnode's ACL are cached.
+ *
+ * The generations are read without locks.  Each is bumped when the ACL or
+ * CPS it covers changes, and the key is built before the rights are
+ * computed, so rights computed while one of them changes are cached under
+ * the old generation and never used.  The client's own CPS is the
+ * exception: h_ClearRights empties the slots before the new CPS is in
+ * place, so PutCachedRights checks cpsGen again rather than relying on a
+ * miss.
+ */
+static void
+RightsKey(struct client *client, Volume *volptr, Vnode *aclvnode,
+	  struct clientRights *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->volume = V_id(volptr);
+    key->vnode = Vn_id(aclvnode);
+    key->unique = aclvnode->disk.uniquifier;
+    key->dataVersion = aclvnode->disk.dataVersion;
+    key->cacheCheck = volptr->cacheCheck;
+    key->aclGen = aclGeneration;
+    key->hcpsGen = client->z.host->z.hcpsGen;
+    key->cpsGen = client->z.cpsGen;
+}
+
+static_inline struct clientRights *
+RightsSlot(struct client *client, struct clientRights *key)
+{
+    /* directory vnode numbers are odd */
+    return &client->z.rights[((key->vnode >> 1) ^ key->volume)
+			     & (CLIENT_RIGHTS_SLOTS - 1)];
+}
+
+/*
+ * Look up rights cached in the client.  Returns 1 and fills in rights and
+ * anyrights on a hit, 0 on a miss.
+ */
+static int
+GetCachedRights(struct client *client, struct clientRights *key,
+		afs_int32 *rights, afs_int32 *anyrights)
+{
+    struct clientRights *slot;
+    int hit = 0;
+
+    ObtainReadLock(&client->lock);
+    slot = RightsSlot(client, key);
+    if (client->z.CPS.prlist_len > 0 && !client->z.deleted
+	&& !(client->z.host->z.hostFlags & HOSTDELETED)
+	&& slot->volume == key->volume && slot->vnode == key->vnode
+	&& slot->unique == key->unique
+	&& slot->dataVersion == key->dataVersion
+	&& slot->cacheCheck == key->cacheCheck
+	&& slot->aclGen == key->aclGen && slot->hcpsGen == key->hcpsGen
+	&& slot->cpsGen == key->cpsGen) {
+	*rights = slot->rights;
+	*anyrights = slot->anyrights;
+	hit = 1;
+    }
+    ReleaseReadLock(&client->lock);
+
+    FS_LOCK;
+    if (hit)
+	RightsCacheHits++;
+    else
+	RightsCacheMisses++;
+    FS_UNLOCK;
+    return hit;
+}
+
+static void
+PutCachedRights(struct client *client, struct clientRights *key,
+		afs_int32 rights, afs_int32 anyrights)
+{
+    struct clientRights *slot;
+
+    ObtainWriteLock(&client->lock);
+    /* drop rights computed from a CPS that has since been flushed */
+    if (client->z.CPS.prlist_len > 0 && !client->z.deleted
+	&& key->cpsGen == client->z.cpsGen) {
+	slot = RightsSlot(client, key);
+	*slot = *key;
+	slot->rights = rights;
+	slot->anyrights = anyrights;
+    }
+    ReleaseWriteLock(&client->lock);
+}
+
 /*
  * Compare the directory's ACL with the user's access rights in the client
  * connection and return the user's and everybody else's access permissions
- * in rights and anyrights, respectively
+ * in rights and anyrights, respectively.  aclvnode is the directory the ACL
+ * belongs to; the result is cached in the client unless -norightscache was
+ * given.
  */
 static afs_int32
-GetRights(struct client *client, struct acl_accessList *ACL,
-	  afs_int32 * rights, afs_int32 * anyrights)
+GetRights(struct client *client, Volume *volptr, Vnode *aclvnode,
+	  struct acl_accessList *ACL, afs_int32 * rights,
+	  afs_int32 * anyrights)
 {
     extern prlist SystemAnyUserCPS;
     afs_int32 hrights = 0;
+    struct clientRights key;
+
+    if (!norightscache) {
+	RightsKey(client, volptr, aclvnode, &key);
+	if (GetCachedRights(client, &key, rights, anyrights))
+	    return 0;
+    }
 
     if (acl_CheckRights(ACL, &SystemAnyUserCPS, anyrights) != 0) {
 	ViceLog(0, ("CheckRights failed\n"));
@@ -789,6 +914,9 @@ GetRights(struct client *client, struct acl_accessList *ACL,
     *rights |= hrights;
     *anyrights |= hrights;
 
+    if (!norightscache)
+	PutCachedRights(client, &key, *rights, *anyrights);
+
     return (0);
 
 }				/*GetRights */
@@ -887,7 +1015,8 @@ GetVolumePackageWithCall(struct rx_call *acall, struct VCallByVol *cbv,
 		goto gvpdone;
 	    }
 	}
-	GetRights(*client, aCL, rights, anyrights);
+	GetRights(*client, *volptr, (*parent ? *parent : *targetptr), aCL,
+		  rights, anyrights);
 	/* ok, if this is not a dir, set the PRSFS_ADMINISTER bit iff we're the owner */
 	if ((*targetptr)->disk.type != vDirectory) {
 	    /* anyuser can't be owner, so only have to worry about rights, not anyrights */
@@ -1376,7 +1505,11 @@ CopyOnWrite(Vnode * targetptr, Volume * volptr, afs_foff_t off, afs_fsize_t len)
 	return VSALVAGE;
     }
 
-    done = off;
+    /* Have the kernel clone or copy what it can; the loop below copies the
+     * rest, and deals with any error the kernel ran into */
+    done = FDH_COPYRANGE(targFdP, newFdP, off, size);
+    size -= done;
+    done += off;
     while (size > 0) {
 	if (size > COPYBUFFSIZE) {	/* more than a buffer */
 	    length = COPYBUFFSIZE;
@@ -1462,6 +1595,104 @@ CopyOnWrite(Vnode * targetptr, Volume * volptr, afs_foff_t off, afs_fsize_t len)
 }				/*CopyOnWrite */
 
 
+/*
+ * Once removes have left a directory of at least dirCompactMinPages pages
+ * with half of its blobs free, rewrite it densely into a new inode (see
+ * afs_dir_Compact).  The caller holds the directory's vnode write lock and
+ * has flushed its changes; on success 'dir' refers to the new inode.  The
+ * data version is bumped an extra time so that clients refetch the
+ * directory instead of applying the caller's change to a cached copy laid
+ * out differently.  Any failure leaves the directory as it was.
+ *
+ * The vnode is written out pointing at the new inode before the old one
+ * is released, since the old inode's last link is its only copy.  If that
+ * write fails, the old inode is left for the salvager to reclaim.
+ */
+static void
+CompactDir(Vnode * parentptr, Volume * volptr, DirHandle * dir)
+{
+    DirHandle newdir;
+    IHandle_t *newH, *oldH;
+    Inode ino, oldino;
+    Error error;
+    int pages, newpages = 0, freeblobs, code;
+
+    if (parentptr->disk.cloned)
+	return;
+    if (afs_dir_Usage(dir, &pages, &freeblobs) != 0
+	|| pages < dirCompactMinPages
+	|| freeblobs < (pages < MAXPAGES ? pages : MAXPAGES) * EPP / 2)
+	return;
+
+    ino =
+	IH_CREATE(V_linkHandle(volptr), V_device(volptr),
+		  VPartitionPath(V_partition(volptr)), VN_GET_INO(parentptr),
+		  V_id(volptr), parentptr->vnodeNumber,
+		  parentptr->disk.uniquifier,
+		  (int)parentptr->disk.dataVersion);
+    if (!VALID_INO(ino)) {
+	ViceLog(0,
+		("CompactDir: could not create inode for directory %u in volume %" AFS_VOLID_FMT " (errno %d)\n",
+		 parentptr->vnodeNumber,
+		 afs_printable_VolumeId_lu(V_id(volptr)), errno));
+	return;
+    }
+    IH_INIT(newH, V_device(volptr), V_id(volptr), ino);
+
+    memset(&newdir, 0, sizeof(newdir));
+    newdir.dirh_vid = newH->ih_vid;
+    newdir.dirh_dev = newH->ih_dev;
+    newdir.dirh_ino = newH->ih_ino;
+    newdir.dirh_vnode = parentptr->vnodeNumber;
+    newdir.dirh_cacheCheck = volptr->cacheCheck;
+    newdir.dirh_unique = parentptr->disk.uniquifier;
+    IH_COPY(newdir.dirh_handle, newH);
+
+    code = afs_dir_Compact(dir, &newdir);
+    if (!code)
+	code = DFlush();
+    if (!code)
+	newpages = afs_dir_Length(&newdir) / AFS_PAGESIZE;
+    DZap(&newdir);
+    FidZap(&newdir);
+    if (code) {
+	ViceLog(0,
+		("CompactDir: compacting directory %u in volume %" AFS_VOLID_FMT " failed (%d)\n",
+		 parentptr->vnodeNumber,
+		 afs_printable_VolumeId_lu(V_id(volptr)), code));
+	IH_RELEASE(newH);
+	IH_DEC(V_linkHandle(volptr), ino, V_parentId(volptr));
+	return;
+    }
+
+    ViceLog(1,
+	    ("CompactDir: compacted directory %u in volume %" AFS_VOLID_FMT " from %d pages to %d\n",
+	     parentptr->vnodeNumber, afs_printable_VolumeId_lu(V_id(volptr)),
+	     pages, newpages));
+
+    DZap(dir);
+    FidZap(dir);
+    oldH = parentptr->handle;
+    oldino = VN_GET_INO(parentptr);
+    parentptr->handle = newH;
+    VN_SET_INO(parentptr, ino);
+    parentptr->disk.dataVersion++;
+    SetDirHandle(dir, parentptr);
+
+    VSyncVnode(&error, parentptr);
+    IH_REALLYCLOSE(oldH);
+    if (error) {
+	ViceLog(0,
+		("CompactDir: could not write vnode %u in volume %" AFS_VOLID_FMT " (%d); leaving its old directory inode to the salvager\n",
+		 parentptr->vnodeNumber,
+		 afs_printable_VolumeId_lu(V_id(volptr)), error));
+    } else {
+	code = IH_DEC(V_linkHandle(volptr), oldino, V_parentId(volptr));
+	opr_Assert(!code);
+    }
+    IH_RELEASE(oldH);
+}
+
 /* _ri: For Reverse Index
  * WRAPPERS FOR afs_dir_Create and afs_dir_Delete with reverse index code
  */
@@ -1659,6 +1890,8 @@ DeleteTarget(Vnode * parentptr, Volume * volptr, Vnode ** targetptr,
     }
 
     DFlush();
+    if (!errorCode && dirCompactMinPages > 0)
+	CompactDir(parentptr, volptr, dir);
     return (errorCode);
 
 }				/*DeleteTarget */
@@ -2717,6 +2950,7 @@ SRXAFS_BulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
     struct rx_connection *tcon = rx_ConnectionOf(acall);
     struct host *thost;
     struct client *t_client = NULL;     /* tmp pointer to the client data */
+    afs_uint32 prefetchVolume = 0;	/* volume whose vnodes were prefetched */
     struct fsstats fsstats;
 
     fsstats_StartOp(&fsstats, FS_STATS_RPCIDX_BULKSTATUS);
@@ -2759,6 +2993,11 @@ SRXAFS_BulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 			      &rights, &anyrights)))
 	    goto Bad_BulkStatus;
 
+	if (tfid->Volume != prefetchVolume) {
+	    PrefetchBulkVnodes(volptr, tfid, nfiles - i);
+	    prefetchVolume = tfid->Volume;
+	}
+
 	/* set volume synchronization information, but only once per call */
 	if (i == 0)
 	    SetVolumeSync(Sync, volptr);
@@ -2838,6 +3077,7 @@ SRXAFS_InlineBulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
     struct client *t_client = NULL;	/* tmp ptr to client data */
     AFSFetchStatus *tstatus;
     int VolSync_set = 0;
+    afs_uint32 prefetchVolume = 0;	/* volume whose vnodes were prefetched */
     struct fsstats fsstats;
 
     fsstats_StartOp(&fsstats, FS_STATS_RPCIDX_BULKSTATUS);
@@ -2900,6 +3140,11 @@ SRXAFS_InlineBulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 	    continue;
 	}
 
+	if (tfid->Volume != prefetchVolume) {
+	    PrefetchBulkVnodes(volptr, tfid, nfiles - i);
+	    prefetchVolume = tfid->Volume;
+	}
+
 	/* set volume synchronization information, but only once per call */
 	if (!VolSync_set) {
 	    SetVolumeSync(Sync, volptr);
@@ -3258,6 +3503,9 @@ common_StoreACL(afs_uint64 opcode,
     }
 
     targetptr->changed_newTime = 1;	/* status change of directory */
+    FS_LOCK;
+    aclGeneration++;		/* forget rights cached from the old ACL */
+    FS_UNLOCK;
 
     /* convert the write lock to a read lock before breaking callbacks */
     VVnodeWriteToRead(&errorCode, targetptr);
@@ -5431,12 +5679,12 @@ FillPerfValues(struct afs_PerfStats *a_perfP)
      */
     a_perfP->vcache_L_Entries = VnodeClassInfo[vLarge].cacheSize;
     a_perfP->vcache_L_Allocs = VnodeClassInfo[vLarge].allocs;
-    a_perfP->vcache_L_Gets = VnodeClassInfo[vLarge].gets;
+    a_perfP->vcache_L_Gets = VCountVnodeGets(vLarge);
     a_perfP->vcache_L_Reads = VnodeClassInfo[vLarge].reads;
     a_perfP->vcache_L_Writes = VnodeClassInfo[vLarge].writes;
     a_perfP->vcache_S_Entries = VnodeClassInfo[vSmall].cacheSize;
     a_perfP->vcache_S_Allocs = VnodeClassInfo[vSmall].allocs;
-    a_perfP->vcache_S_Gets = VnodeClassInfo[vSmall].gets;
+    a_perfP->vcache_S_Gets = VCountVnodeGets(vSmall);
     a_perfP->vcache_S_Reads = VnodeClassInfo[vSmall].reads;
     a_perfP->vcache_S_Writes = VnodeClassInfo[vSmall].writes;
     a_perfP->vcache_H_Entries = VStats.hdr_cache_size;
@@ -5819,6 +6067,7 @@ FlushClientCPS(struct client *client, void *arock)
     ObtainWriteLock(&client->lock);
 
     client->z.prfail = 2;	/* Means re-eval client's cps */
+    h_ClearRights(client);
 
     if ((client->z.ViceId != ANONYMOUSID) && client->z.CPS.prlist_val) {
 	free(client->z.CPS.prlist_val);
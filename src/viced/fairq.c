@@ -0,0 +1,258 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Per-host fair queuing of fileserver calls.
+ *
+ * Installed as the rx call scheduler, this decides which waiting call a
+ * free server thread runs next.  Hosts are served by deficit round robin
+ * with a cost of one per call: in each round a host may start as many
+ * calls as its weight (1 unless configured otherwise), and a new round
+ * begins once no host with a waiting call has any of its share left.
+ * A host may also be limited in how many calls it has running at once, so
+ * that a single busy client cannot occupy every thread.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#include <opr/lock.h>
+#include <opr/queue.h>
+#include <opr/jhash.h>
+#include <rx/rx.h>
+#include <afs/afsint.h>
+#include <afs/afsutil.h>
+
+#include "viced_prototypes.h"
+
+#define FQ_HASH_BITS	8
+#define FQ_HASH_SIZE	opr_jhash_size(FQ_HASH_BITS)
+#define FQ_HASH_MASK	opr_jhash_mask(FQ_HASH_BITS)
+
+/* Hosts beyond this many share one entry, to bound memory use */
+#define FQ_MAXHOSTS	16384
+
+struct fqHost {
+    struct opr_queue hashq;	/* hash chain */
+    afs_uint32 addr;		/* host address, network order */
+    int weight;			/* calls per round */
+    int deficit;		/* calls left this round */
+    int running;		/* calls admitted or picked and not ended */
+    afs_uint64 calls;		/* calls run */
+    afs_uint64 waited;		/* calls which had to queue */
+    afs_uint64 waitSum;		/* total queue wait, usec */
+    afs_uint64 waitMax;		/* longest queue wait, usec */
+};
+
+static opr_mutex_t fqLock;
+static struct opr_queue fqHash[FQ_HASH_SIZE];
+static int fqHashInit;
+static int fqNHosts;
+static int fqMaxRunning;	/* 0 means no per-host limit */
+static struct fqHost fqOverflow = { .weight = 1 };
+
+static int fq_Admit(void *rock, struct rx_call *call);
+static int fq_Pick(void *rock, struct rx_call **calls, int ncalls);
+static void fq_End(void *rock, struct rx_call *call, struct clock *waited);
+
+static struct rx_callScheduler fqScheduler = {
+    fq_Admit,
+    fq_Pick,
+    fq_End,
+    NULL
+};
+
+static_inline afs_uint32
+CallHost(struct rx_call *call)
+{
+    return rx_HostOf(rx_PeerOf(rx_ConnectionOf(call)));
+}
+
+/*
+ * Find the entry for a host, creating it if need be.  Called with fqLock
+ * held, or before the scheduler is installed.
+ */
+static struct fqHost *
+GetHost(afs_uint32 addr)
+{
+    struct fqHost *h;
+    struct opr_queue *cursor;
+    int bucket;
+
+    if (!fqHashInit) {
+	for (bucket = 0; bucket < FQ_HASH_SIZE; bucket++)
+	    opr_queue_Init(&fqHash[bucket]);
+	fqHashInit = 1;
+    }
+
+    bucket = opr_jhash_int(addr, 0) & FQ_HASH_MASK;
+    for (opr_queue_Scan(&fqHash[bucket], cursor)) {
+	h = opr_queue_Entry(cursor, struct fqHost, hashq);
+	if (h->addr == addr)
+	    return h;
+    }
+
+    if (fqNHosts >= FQ_MAXHOSTS || (h = calloc(1, sizeof(*h))) == NULL)
+	return &fqOverflow;
+    h->addr = addr;
+    h->weight = 1;
+    opr_queue_Prepend(&fqHash[bucket], &h->hashq);
+    fqNHosts++;
+    return h;
+}
+
+static_inline int
+AtLimit(struct fqHost *h)
+{
+    return fqMaxRunning > 0 && h->running >= fqMaxRunning;
+}
+
+static int
+fq_Admit(void *rock, struct rx_call *call)
+{
+    struct fqHost *h;
+
+    opr_mutex_enter(&fqLock);
+    h = GetHost(CallHost(call));
+    if (AtLimit(h)) {
+	opr_mutex_exit(&fqLock);
+	return 0;
+    }
+    if (h->deficit > 0)
+	h->deficit--;
+    h->running++;
+    opr_mutex_exit(&fqLock);
+    return 1;
+}
+
+static int
+fq_Pick(void *rock, struct rx_call **calls, int ncalls)
+{
+    struct fqHost *h;
+    int i, round;
+
+    opr_mutex_enter(&fqLock);
+    for (round = 0; round < 2; round++) {
+	for (i = 0; i < ncalls; i++) {
+	    h = GetHost(CallHost(calls[i]));
+	    if (!AtLimit(h) && h->deficit > 0) {
+		h->deficit--;
+		h->running++;
+		opr_mutex_exit(&fqLock);
+		return i;
+	    }
+	}
+
+	/* Every host that could run has used its share; start a new round */
+	for (i = 0; i < ncalls; i++) {
+	    h = GetHost(CallHost(calls[i]));
+	    if (!AtLimit(h))
+		h->deficit = h->weight;
+	}
+    }
+    opr_mutex_exit(&fqLock);
+    return -1;
+}
+
+static void
+fq_End(void *rock, struct rx_call *call, struct clock *waited)
+{
+    struct fqHost *h;
+    afs_uint64 usec;
+
+    opr_mutex_enter(&fqLock);
+    h = GetHost(CallHost(call));
+    if (h->running > 0)
+	h->running--;
+    if (waited != NULL) {
+	h->calls++;
+	usec = (afs_uint64)waited->sec * 1000000 + waited->usec;
+	if (usec > 0) {
+	    h->waited++;
+	    h->waitSum += usec;
+	    if (usec > h->waitMax)
+		h->waitMax = usec;
+	}
+    }
+    opr_mutex_exit(&fqLock);
+}
+
+/**
+ * Set the share of server threads given to a host.
+ *
+ * @param[in] addr    host address, network byte order
+ * @param[in] weight  calls the host may start per round
+ *
+ * @return 0 on success, -1 if weight is out of range
+ *
+ * @pre called before fq_Init
+ */
+int
+fq_SetWeight(afs_uint32 addr, int weight)
+{
+    if (weight < 1 || weight > 1000)
+	return -1;
+    GetHost(addr)->weight = weight;
+    return 0;
+}
+
+/**
+ * Start scheduling calls fairly between hosts.
+ *
+ * @param[in] maxRunning  most calls one host may have running at once, or 0
+ *                        for no limit
+ *
+ * @pre called before rx_StartServer
+ */
+void
+fq_Init(int maxRunning)
+{
+    opr_mutex_init(&fqLock);
+    fqMaxRunning = maxRunning;
+    rx_SetCallScheduler(&fqScheduler);
+}
+
+/**
+ * Log queue wait statistics for each host that has had to wait.
+ */
+void
+fq_PrintStats(void)
+{
+    struct fqHost *h;
+    struct opr_queue *cursor;
+    char hoststr[16];
+    int bucket;
+
+    opr_mutex_enter(&fqLock);
+    ViceLog(0, ("Fair queuing: %d hosts, limit %d running calls per host\n",
+		fqNHosts, fqMaxRunning));
+    for (bucket = 0; fqHashInit && bucket < FQ_HASH_SIZE; bucket++) {
+	for (opr_queue_Scan(&fqHash[bucket], cursor)) {
+	    h = opr_queue_Entry(cursor, struct fqHost, hashq);
+	    if (h->waited == 0)
+		continue;
+	    ViceLog(0, ("  host %s weight %d: %d running, %llu calls, "
+			"%llu waited, avg wait %llu ms, max wait %llu ms\n",
+			afs_inet_ntoa_r(h->addr, hoststr), h->weight,
+			h->running, h->calls, h->waited,
+			h->waitSum / h->waited / 1000, h->waitMax / 1000));
+	}
+    }
+    if (fqOverflow.waited > 0) {
+	ViceLog(0, ("  other hosts: %d running, %llu calls, %llu waited, "
+		    "avg wait %llu ms, max wait %llu ms\n",
+		    fqOverflow.running, fqOverflow.calls, fqOverflow.waited,
+		    fqOverflow.waitSum / fqOverflow.waited / 1000,
+		    fqOverflow.waitMax / 1000));
+    }
+    opr_mutex_exit(&fqLock);
+}
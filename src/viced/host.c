@@ -580,6 +580,7 @@ h_gethostcps_r(struct host *host, afs_int32 now)
 	free(host->z.hcps.prlist_val);	/* this is for hostaclRefresh */
     host->z.hcps.prlist_val = NULL;
     host->z.hcps.prlist_len = 0;
+    host->z.hcpsGen++;
     host->z.cpsCall = slept ? time(NULL) : (now);
 
     H_UNLOCK;
@@ -623,6 +624,7 @@ h_gethostcps_r(struct host *host, afs_int32 now)
     } else
 	host->z.hcpsfailed = 0;
 
+    host->z.hcpsGen++;
     host->z.hostFlags &= ~HCPS_INPROGRESS;
     /* signal all who are waiting */
     if (host->z.hostFlags & HCPS_WAITING) {	/* somebody is waiting */
@@ -2714,6 +2716,7 @@ h_FindClient_r(struct rx_connection *tcon, afs_int32 *a_viceid)
     client->z.prfail = fail;
 
     if (!(client->z.CPS.prlist_val) || (viceid != client->z.ViceId)) {
+	h_ClearRights(client);
 	client->z.CPS.prlist_len = 0;
 	if (client->z.CPS.prlist_val && (client->z.ViceId != ANONYMOUSID))
 	    free(client->z.CPS.prlist_val);
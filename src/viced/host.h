@@ -66,6 +66,7 @@ struct host_to_zero {
 				 * the File Server's? */
     char hcpsfailed;	 	/* Retry the cps call next time */
     prlist hcps;		/* cps for hostip acls */
+    afs_uint32 hcpsGen;		/* bumped whenever hcps changes */
     afs_uint32 LastCall;	/* time of last call from host */
     afs_uint32 ActiveCall;	/* time of any call but gettime,
 				 * getstats and getcaps */
@@ -104,6 +105,29 @@ struct h_UuidHashChain {
     struct h_UuidHashChain *next;
 };
 
+/*
+ * Rights computed for a directory ACL, cached in the client.  An entry is
+ * good for as long as the directory's data version, the volume's attach
+ * (cacheCheck), the ACL generation and the host's hcps are unchanged.  The
+ * whole cache is cleared whenever the client's CPS changes, and the
+ * client's cpsGen is bumped, so that rights computed from the old CPS
+ * cannot be stored afterwards.
+ */
+#define CLIENT_RIGHTS_SLOTS 8
+
+struct clientRights {
+    afs_uint32 volume;		/* 0 if the entry is unused */
+    afs_uint32 vnode;
+    afs_uint32 unique;
+    afs_uint32 dataVersion;
+    afs_uint32 cacheCheck;	/* volume cacheCheck */
+    afs_uint32 aclGen;		/* ACL generation; see GetRights */
+    afs_uint32 hcpsGen;		/* host->z.hcpsGen */
+    afs_uint32 cpsGen;		/* client->z.cpsGen */
+    afs_int32 rights;
+    afs_int32 anyrights;
+};
+
 struct client_to_zero {
     struct client *next;	/* next client entry for host */
     struct host *host;		/* ptr to parent host entry */
@@ -124,6 +148,8 @@ struct client_to_zero {
     char prfail;		/* True if prserver couldn't be contacted */
     char InSameNetwork;		/* Is client's IP address in the same
 				 * network as ours? */
+    struct clientRights rights[CLIENT_RIGHTS_SLOTS];	/* protected by lock */
+    afs_uint32 cpsGen;		/* bumped when rights are cleared */
 };
 
 struct client {
@@ -133,6 +159,13 @@ struct client {
 };
 
 
+/* Forget the client's cached rights; client must be write locked */
+#define h_ClearRights(client) \
+    do { \
+	memset((client)->z.rights, 0, sizeof((client)->z.rights)); \
+	(client)->z.cpsGen++; \
+    } while (0)
+
 /*
  * key for the client structure stored in connection specific data
  */
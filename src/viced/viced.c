@@ -157,7 +157,14 @@ int volcache = 400;		/* 400 */
 int numberofcbs = 60000;	/* 60000 */
 int lwps = 9;			/* 6 */
 int buffs = 90;			/* 70 */
+int dirIndexMax = 0;		/* entries in directory name indexes */
+int dirIndexMinPages = 16;	/* smallest directory to index */
+int dirCompactMinPages = 0;	/* smallest directory to compact; 0 = never */
+static int fairQueuing = 0;	/* schedule calls fairly between hosts */
+static int fairQueueMaxRunning = 0;	/* running calls per host; 0 = any */
 int novbc = 0;			/* Enable Volume Break calls */
+int norightscache = 0;		/* don't cache computed access rights */
+afs_uint64 RightsCacheHits = 0, RightsCacheMisses = 0;	/* under FS_LOCK */
 int busy_threshold = 600;
 int abort_threshold = 10;
 int udpBufSize = 0;		/* UDP buffer size for receive */
@@ -422,6 +429,10 @@ FiveMinuteCheckLWP(void *unused)
 	    ViceLog(5, ("Timed out callbacks deleted\n"));
 	ViceLog(2, ("Set disk usage statistics\n"));
 	VSetDiskUsage();
+#ifdef AFS_DEMAND_ATTACH_FS
+	ViceLog(2, ("Saving volume access ranking\n"));
+	VLRU_SaveState();
+#endif
 	if (FS_registered == 1)
 	    Do_VLRegisterRPC();
 	/* Force wakeup in case we missed something; pthreads does timedwait */
@@ -631,6 +642,7 @@ static void
 PrintCounters(void)
 {
     int dirbuff, dircall, dirio;
+    int idxdirs, idxentries, idxhits, idxmisses, idxbuilds, idxevicts, idxstale;
     struct timeval tpl;
     int workstations, activeworkstations, delworkstations;
     int processSize = 0;
@@ -656,10 +668,27 @@ PrintCounters(void)
 #endif
     VPrintCacheStats();
     VPrintDiskStats();
+    ih_PrintStats();
     DStat(&dirbuff, &dircall, &dirio);
     ViceLog(0,
 	    ("With %d directory buffers; %d reads resulted in %d read I/Os\n",
 	     dirbuff, dircall, dirio));
+    if (dirIndexMax > 0) {
+	DIndexStat(&idxdirs, &idxentries, &idxhits, &idxmisses, &idxbuilds,
+		   &idxevicts, &idxstale);
+	ViceLog(0,
+		("Directory index: %d dirs, %d entries; %d hits, %d misses, "
+		 "%d builds, %d evictions, %d stale\n", idxdirs, idxentries,
+		 idxhits, idxmisses, idxbuilds, idxevicts, idxstale));
+    }
+    if (!norightscache) {
+	FS_LOCK;
+	ViceLog(0, ("Access rights cache: %llu hits, %llu misses\n",
+		    RightsCacheHits, RightsCacheMisses));
+	FS_UNLOCK;
+    }
+    if (fairQueuing)
+	fq_PrintStats();
     rx_PrintStats(stderr);
     audit_PrintStats(stderr);
     h_PrintStats();
@@ -906,10 +935,14 @@ enum optionsList {
     OPT_spare,
     OPT_pctspare,
     OPT_hostcpsrefresh,
+    OPT_norightscache,
     OPT_vattachthreads,
     OPT_abortthreshold,
     OPT_busyat,
     OPT_nobusy,
+    OPT_fairq,
+    OPT_fairq_maxrunning,
+    OPT_fairq_weight,
     OPT_offline_timeout,
     OPT_offline_shutdown_timeout,
     OPT_vhandle_setaside,
@@ -919,10 +952,14 @@ enum optionsList {
     OPT_fs_state_dont_restore,
     OPT_fs_state_verify,
     OPT_vhashsize,
+    OPT_dirindex_max,
+    OPT_dirindex_minpages,
+    OPT_dircompact_minpages,
     OPT_vlrudisable,
     OPT_vlruthresh,
     OPT_vlruinterval,
     OPT_vlrumax,
+    OPT_vhotattach,
     OPT_unsafe_nosalvage,
     OPT_cbwait,
     OPT_novbc,
@@ -949,6 +986,7 @@ enum optionsList {
     OPT_dotted,
     OPT_realm,
     OPT_sync,
+    OPT_io_uring,
     OPT_transarc_logs
 };
 
@@ -1023,6 +1061,8 @@ ParseArgs(int argc, char *argv[])
     cmd_AddParmAtOffset(opts, OPT_hostcpsrefresh, "-hr", CMD_SINGLE,
 			CMD_OPTIONAL, "hours between host CPS refreshes");
 
+    cmd_AddParmAtOffset(opts, OPT_norightscache, "-norightscache", CMD_FLAG,
+			CMD_OPTIONAL, "don't cache computed access rights");
     cmd_AddParmAtOffset(opts, OPT_vattachthreads, "-vattachpar", CMD_SINGLE,
 			CMD_OPTIONAL, "# of volume attachment threads");
 
@@ -1033,6 +1073,13 @@ ParseArgs(int argc, char *argv[])
 			"# of queued entries after which server is busy");
     cmd_AddParmAtOffset(opts, OPT_nobusy, "-nobusy", CMD_FLAG, CMD_OPTIONAL,
 			"send VRESTARTING while restarting the server");
+    cmd_AddParmAtOffset(opts, OPT_fairq, "-fairq", CMD_FLAG, CMD_OPTIONAL,
+			"share threads fairly between client hosts");
+    cmd_AddParmAtOffset(opts, OPT_fairq_maxrunning, "-fairq-maxrunning",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"max running calls per client host");
+    cmd_AddParmAtOffset(opts, OPT_fairq_weight, "-fairq-weight", CMD_LIST,
+			CMD_OPTIONAL, "host:weight");
 
     cmd_AddParmAtOffset(opts, OPT_offline_timeout, "-offline-timeout",
 			CMD_SINGLE, CMD_OPTIONAL,
@@ -1053,6 +1100,15 @@ ParseArgs(int argc, char *argv[])
     cmd_AddParmAtOffset(opts, OPT_vhashsize, "-vhashsize",
 			CMD_SINGLE, CMD_OPTIONAL,
 			"log(2) of # of volume hash buckets");
+    cmd_AddParmAtOffset(opts, OPT_dirindex_max, "-dirindex-max",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"max entries held in directory name indexes");
+    cmd_AddParmAtOffset(opts, OPT_dirindex_minpages, "-dirindex-minpages",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"min pages for a directory to be indexed");
+    cmd_AddParmAtOffset(opts, OPT_dircompact_minpages,
+			"-dircompact-minpages", CMD_SINGLE, CMD_OPTIONAL,
+			"min pages for a sparse directory to be compacted");
 
 #ifdef AFS_DEMAND_ATTACH_FS
     /* dafs options */
@@ -1073,6 +1129,9 @@ ParseArgs(int argc, char *argv[])
 			CMD_SINGLE, CMD_OPTIONAL, "secs between VLRU scans");
     cmd_AddParmAtOffset(opts, OPT_vlrumax, "-vlrumax", CMD_SINGLE, CMD_OPTIONAL,
 		        "max volumes to detach in one scan");
+    cmd_AddParmAtOffset(opts, OPT_vhotattach, "-vhotattach", CMD_SINGLE,
+			CMD_OPTIONAL,
+			"max most active volumes to attach at startup");
     cmd_AddParmAtOffset(opts, OPT_unsafe_nosalvage, "-unsafe-nosalvage",
 			CMD_FLAG, CMD_OPTIONAL,
 			"bypass safety checks on volume attach");
@@ -1132,6 +1191,8 @@ ParseArgs(int argc, char *argv[])
 			CMD_LIST, CMD_OPTIONAL, "local realm");
     cmd_AddParmAtOffset(opts, OPT_sync, "-sync",
 			CMD_SINGLE, CMD_OPTIONAL, "always | onclose | never");
+    cmd_AddParmAtOffset(opts, OPT_io_uring, "-io-uring",
+			CMD_FLAG, CMD_OPTIONAL, "use io_uring for file I/O");
 
     /* testing options */
     cmd_AddParmAtOffset(opts, OPT_logfile, "-logfile", CMD_SINGLE,
@@ -1202,6 +1263,27 @@ ParseArgs(int argc, char *argv[])
     if (optval != 0)
 	enable_old_store_acl = 0;
     cmd_OptionAsInt(opts, OPT_buffers, &buffs);
+    if (cmd_OptionAsInt(opts, OPT_dirindex_max, &dirIndexMax) == 0) {
+	if (dirIndexMax < 0) {
+	    printf("Invalid -dirindex-max value %d\n", dirIndexMax);
+	    return -1;
+	}
+    }
+    if (cmd_OptionAsInt(opts, OPT_dirindex_minpages, &dirIndexMinPages) == 0) {
+	if (dirIndexMinPages < 1 || dirIndexMinPages > BIGMAXPAGES) {
+	    printf("Invalid -dirindex-minpages value %d; must be between "
+		   "1 and %d\n", dirIndexMinPages, BIGMAXPAGES);
+	    return -1;
+	}
+    }
+    if (cmd_OptionAsInt(opts, OPT_dircompact_minpages,
+			&dirCompactMinPages) == 0) {
+	if (dirCompactMinPages < 0 || dirCompactMinPages > BIGMAXPAGES) {
+	    printf("Invalid -dircompact-minpages value %d; must be between "
+		   "0 and %d\n", dirCompactMinPages, BIGMAXPAGES);
+	    return -1;
+	}
+    }
 
     if (cmd_OptionAsInt(opts, OPT_callbacks, &numberofcbs) == 0) {
 	if ((numberofcbs < 10000) || (numberofcbs > 2147483647)) {
@@ -1248,6 +1330,7 @@ ParseArgs(int argc, char *argv[])
 
     cmd_OptionAsInt(opts, OPT_vattachthreads, &vol_attach_threads);
 
+    cmd_OptionAsFlag(opts, OPT_norightscache, &norightscache);
     cmd_OptionAsInt(opts, OPT_abortthreshold, &abort_threshold);
 
     /* busyat is at the end, as rxpackets has to be set before we can use it */
@@ -1283,6 +1366,10 @@ ParseArgs(int argc, char *argv[])
 	    return -1;
 	}
     }
+    if (cmd_OptionPresent(opts, OPT_io_uring) && ih_UseIOUring()) {
+	printf("-io-uring is not supported on this platform\n");
+	return -1;
+    }
     if (cmd_OptionAsInt(opts, OPT_vhashsize, &optval) == 0) {
 	if (VSetVolHashSize(optval)) {
 	    fprintf(stderr, "specified -vhashsize (%d) is invalid or out "
@@ -1319,6 +1406,8 @@ ParseArgs(int argc, char *argv[])
 	VLRU_SetOptions(VLRU_SET_INTERVAL, optval);
     if (cmd_OptionAsInt(opts, OPT_vlrumax, &optval) == 0)
 	VLRU_SetOptions(VLRU_SET_MAX, optval);
+    if (cmd_OptionAsInt(opts, OPT_vhotattach, &optval) == 0)
+	VLRU_SetOptions(VLRU_SET_HOT_ATTACH, optval);
     cmd_OptionAsFlag(opts, OPT_unsafe_nosalvage, &unsafe_attach);
 #endif /* AFS_DEMAND_ATTACH_FS */
 
@@ -1434,6 +1523,37 @@ ParseArgs(int argc, char *argv[])
 	busy_threshold = 3 * rxpackets / 2;
     }
 
+    cmd_OptionAsFlag(opts, OPT_fairq, &fairQueuing);
+    if (cmd_OptionAsInt(opts, OPT_fairq_maxrunning,
+			&fairQueueMaxRunning) == 0) {
+	if (fairQueueMaxRunning < 0) {
+	    printf("Invalid -fairq-maxrunning value %d\n",
+		   fairQueueMaxRunning);
+	    return -1;
+	}
+	fairQueuing = 1;
+    }
+    if (cmd_OptionAsList(opts, OPT_fairq_weight, &optlist) == 0) {
+	for (; optlist != NULL; optlist = optlist->next) {
+	    char *colon = strrchr(optlist->data, ':');
+	    afs_uint32 addr;
+
+	    if (colon != NULL)
+		*colon = '\0';
+	    addr = inet_addr(optlist->data);
+	    if (colon == NULL || addr == INADDR_NONE
+		|| fq_SetWeight(addr, atoi(colon + 1)) != 0) {
+		if (colon != NULL)
+		    *colon = ':';
+		printf("Invalid -fairq-weight value %s; must be "
+		       "host:weight with weight between 1 and 1000\n",
+		       optlist->data);
+		return -1;
+	    }
+	}
+	fairQueuing = 1;
+    }
+
     if (cmd_OptionAsString(opts, OPT_config, &FS_configPath) == 0) {
 	configDirExplicit = FS_configPath;
     }
@@ -1920,6 +2040,7 @@ main(int argc, char *argv[])
     }
 #endif
     DInit(buffs);
+    DInitIndex(dirIndexMax, dirIndexMinPages);
 #ifdef AFS_DEMAND_ATTACH_FS
     FS_STATE_INIT;
 #endif
@@ -1989,6 +2110,8 @@ main(int argc, char *argv[])
     rx_extraPackets = rxpackets;
     rx_extraQuota = 4;		/* for outgoing prserver calls from R threads */
     rx_SetBusyThreshold(busy_threshold, VBUSY);
+    if (fairQueuing)
+	fq_Init(fairQueueMaxRunning);
     rx_SetCallAbortThreshold(abort_threshold);
     rx_SetConnAbortThreshold(abort_threshold);
 #ifdef AFS_XBSD_ENV
@@ -18,6 +18,11 @@ void init_sys_error_to_et(void);
 extern afs_int32 BlocksSpare;
 extern afs_int32 PctSpare;
 
+/* fairq.c */
+extern int fq_SetWeight(afs_uint32 addr, int weight);
+extern void fq_Init(int maxRunning);
+extern void fq_PrintStats(void);
+
 /* callback.c */
 extern int InitCallBack(int);
 extern int BreakLaterCallBacks(void);
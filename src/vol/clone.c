@@ -20,6 +20,11 @@
 
 #include <roken.h>
 
+#include <afs/opr.h>
+#ifdef AFS_PTHREAD_ENV
+# include <opr/lock.h>
+#endif
+
 #ifdef AFS_NT40_ENV
 #include <windows.h>
 #include <winbase.h>
@@ -36,6 +41,7 @@
 #include "ihandle.h"
 #include "vnode.h"
 #include "volume.h"
+#include "vnmap.h"
 #include "partition.h"
 #include "viceinode.h"
 #include "vol_prototypes.h"
@@ -109,17 +115,15 @@ ci_InitHead(struct clone_head *ah)
     return 0;
 }
 
-/* apply a function to all dudes in the set */
+/* apply a function to all dudes in the set, a block at a time */
 int
-ci_Apply(struct clone_head *ah, int (*aproc) (Inode,  void *), void *arock)
+ci_Apply(struct clone_head *ah, int (*aproc) (Inode *, int, void *),
+	 void *arock)
 {
     struct clone_items *ti;
-    int i;
 
     for (ti = ah->first; ti; ti = ti->next) {
-	for (i = 0; i < ti->nitems; i++) {
-	    (*aproc) (ti->data[i], arock);
-	}
+	(*aproc) (ti->data, ti->nitems, arock);
     }
     return 0;
 }
@@ -138,103 +142,127 @@ ci_Destroy(struct clone_head *ah)
 }
 
 static int
-IDecProc(Inode adata, void *arock)
+IDecProc(Inode * adata, int ndata, void *arock)
 {
     struct clone_rock *aparm = (struct clone_rock *)arock;
-    IH_DEC(aparm->h, adata, aparm->vol);
+    IH_DECMULTI(aparm->h, adata, ndata, aparm->vol);
     DOPOLL;
     return 0;
 }
 
-afs_int32
-DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
-{
-    afs_int32 code, error = 0;
-    FdHandle_t *rwFd = 0, *clFdIn = 0, *clFdOut = 0;
-    StreamHandle_t *rwfile = 0, *clfilein = 0, *clfileout = 0;
-    IHandle_t *rwH = 0, *clHin = 0, *clHout = 0;
-    char buf[SIZEOF_LARGEDISKVNODE], dbuf[SIZEOF_LARGEDISKVNODE];
-    struct VnodeDiskObject *rwvnode = (struct VnodeDiskObject *)buf;
-    struct VnodeDiskObject *clvnode = (struct VnodeDiskObject *)dbuf;
-    Inode rwinode = 0;
-    Inode clinode;
-    struct clone_head decHead;
-    struct clone_rock decRock;
-    afs_foff_t offset = 0;
-    afs_int32 dircloned, inodeinced;
-    afs_int32 filecount = 0, diskused = 0;
-    afs_ino_str_t stmp;
-
-    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
-    /*
-     * The fileserver's -readonly switch should make this false, but we
-     * have no useful way to know in the volserver.
-     * This doesn't make client data mutable.
-     */
-    int ReadWriteOriginal = 1;
+/*
+ * Cloning an index.
+ *
+ * The index is cloned in batches of CLONE_BATCH vnodes.  For each batch
+ * the RW vnodes (and, when recloning, the old clone's vnodes) are read in
+ * one go, the link counts of all the inodes the new clone shares are
+ * incremented together, and the batch is written to the clone's index.
+ * A batch of one class covers 2 * CLONE_BATCH vnode numbers, so its link
+ * count updates touch a single page of the link table.
+ *
+ * Batches are handed out in order to vol_CloneThreads worker threads, so
+ * that a large index is read, written and link counted in several places
+ * at once.  Inodes the new clone no longer uses are only decremented once
+ * every batch has been written and synced, as before.
+ */
+#define CLONE_BATCH	1024
+
+/* Worker threads used to clone one index; 1 clones on the calling thread */
+int vol_CloneThreads = CLONE_DEFAULT_THREADS;
+
+struct clone_job {
+    Volume *rwvp;
+    Volume *clvp;
+    VnodeClass class;
+    int reclone;
+    int threaded;		/* batches run on worker threads */
+    afs_int32 nvnodes;		/* vnodes in the RW index */
+    afs_int32 nbatches;
+    struct VnMapBuilder *mapBuilder;
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_t lock;		/* protects everything below */
+#endif
+    afs_int32 nextBatch;
+    afs_int32 error;		/* first error seen; stops all workers */
+    afs_int32 filecount;
+    afs_int32 diskused;
+    struct clone_head decHead;	/* inodes to decrement at the end */
+};
 
-    /* Correct number of files in volume: this assumes indexes are always
-       cloned starting with vLarge */
-    if (ReadWriteOriginal && class != vLarge) {
-	filecount = V_filecount(rwvp);
-	diskused = V_diskused(rwvp);
-    }
+#ifdef AFS_PTHREAD_ENV
+# define CLONE_LOCK(job)	opr_mutex_enter(&(job)->lock)
+# define CLONE_UNLOCK(job)	opr_mutex_exit(&(job)->lock)
+#else
+# define CLONE_LOCK(job)
+# define CLONE_UNLOCK(job)
+#endif
 
-    /* Initialize list of inodes to nuke - must do this before any calls
-     * to ERROR_EXIT, as the error handler requires an initialised list
-     */
-    ci_InitHead(&decHead);
-    decRock.h = V_linkHandle(rwvp);
-    decRock.vol = V_parentId(rwvp);
+/* What one worker needs to clone a batch */
+struct clone_worker {
+    struct clone_job *job;
+    FdHandle_t *rwFd;
+    FdHandle_t *clFd;
+    char *rwbuf;		/* RW vnodes of the batch */
+    char *clbuf;		/* old clone vnodes, if recloning */
+    char cloned[CLONE_BATCH];	/* RW vnodes' cloned bits as read */
+    Inode incs[CLONE_BATCH];
+    Inode decs[CLONE_BATCH];
+};
 
-    /* Open the RW volume's index file and seek to beginning */
-    IH_COPY(rwH, rwvp->vnodeIndex[class].handle);
-    rwFd = IH_OPEN(rwH);
-    if (!rwFd)
-	ERROR_EXIT(EIO);
-    rwfile = FDH_FDOPEN(rwFd, ReadWriteOriginal ? "r+" : "r");
-    if (!rwfile)
-	ERROR_EXIT(EIO);
-    STREAM_ASEEK(rwfile, vcp->diskSize);	/* Will fail if no vnodes */
+/* Give back the link counts taken for a batch that could not be written */
+static void
+UndoIncs(Volume * rwvp, Inode * incs, int nincs)
+{
+    afs_ino_str_t stmp;
+    int done;
+
+    done = IH_DECMULTI(V_linkHandle(rwvp), incs, nincs, V_parentId(rwvp));
+    if (done < nincs) {
+	Log("IH_DEC failed: %p, %s, %" AFS_VOLID_FMT " errno %d\n",
+	    V_linkHandle(rwvp), PrintInode(stmp, incs[done]),
+	    afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
+	VForceOffline(rwvp);
+    }
+}
 
-    /* Open the clone volume's index file and seek to beginning */
-    IH_COPY(clHout, clvp->vnodeIndex[class].handle);
-    clFdOut = IH_OPEN(clHout);
-    if (!clFdOut)
-	ERROR_EXIT(EIO);
-    clfileout = FDH_FDOPEN(clFdOut, "a");
-    if (!clfileout)
-	ERROR_EXIT(EIO);
-    code = STREAM_ASEEK(clfileout, vcp->diskSize);
-    if (code)
-	ERROR_EXIT(EIO);
+static afs_int32
+CloneBatch(struct clone_worker *w, afs_int32 batch)
+{
+    struct clone_job *job = w->job;
+    Volume *rwvp = job->rwvp;
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[job->class];
+    struct VnodeDiskObject *rwvnode, *clvnode;
+    afs_int32 first = batch * CLONE_BATCH;
+    afs_int32 count = job->nvnodes - first;
+    afs_foff_t offset;
+    ssize_t len, cllen = 0;
+    Inode rwinode, clinode;
+    int i, nincs = 0, ndecs = 0, done, dirs = 0;
+    afs_int32 filecount = 0, diskused = 0;
+    afs_ino_str_t stmp;
 
-    /* If recloning, open the new volume's index; this time for
-     * reading. We never read anything that we're simultaneously
-     * writing, so this all works.
-     */
-    if (reclone) {
-	IH_COPY(clHin, clvp->vnodeIndex[class].handle);
-	clFdIn = IH_OPEN(clHin);
-	if (!clFdIn)
-	    ERROR_EXIT(EIO);
-	clfilein = FDH_FDOPEN(clFdIn, "r");
-	if (!clfilein)
-	    ERROR_EXIT(EIO);
-	STREAM_ASEEK(clfilein, vcp->diskSize);	/* Will fail if no vnodes */
+    if (count > CLONE_BATCH)
+	count = CLONE_BATCH;
+    offset = (afs_foff_t)(first + 1) * vcp->diskSize;
+    len = (ssize_t)count * vcp->diskSize;
+
+    if (FDH_PREAD(w->rwFd, w->rwbuf, len, offset) != len)
+	return EIO;
+    /* The old clone may have fewer vnodes than the RW */
+    if (job->reclone) {
+	cllen = FDH_PREAD(w->clFd, w->clbuf, len, offset);
+	if (cllen < 0)
+	    return EIO;
     }
 
-    /* Read each vnode in the old volume's index file */
-    for (offset = vcp->diskSize;
-	 STREAM_READ(rwvnode, vcp->diskSize, 1, rwfile) == 1;
-	 offset += vcp->diskSize) {
-	dircloned = inodeinced = 0;
-
-	/* If we are recloning the volume, read the corresponding vnode
-	 * from the clone and determine its inode number.
-	 */
-	if (reclone && !STREAM_EOF(clfilein)
-	    && (STREAM_READ(clvnode, vcp->diskSize, 1, clfilein) == 1)) {
+    for (i = 0; i < count; i++) {
+	rwvnode = (struct VnodeDiskObject *)(w->rwbuf + i * vcp->diskSize);
+	w->cloned[i] = rwvnode->cloned;
+
+	/* If we are recloning the volume, find the inode of the
+	 * corresponding vnode in the clone. */
+	if ((i + 1) * vcp->diskSize <= cllen) {
+	    clvnode = (struct VnodeDiskObject *)(w->clbuf + i * vcp->diskSize);
 	    clinode = VNDISK_GET_INO(clvnode);
 	} else {
 	    clinode = 0;
@@ -244,7 +272,7 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 	    afs_fsize_t ll;
 
 	    if (rwvnode->vnodeMagic != vcp->magic)
-		ERROR_EXIT(-1);
+		return -1;
 	    rwinode = VNDISK_GET_INO(rwvnode);
 	    filecount++;
 	    VNDISK_GET_LEN(ll, rwvnode);
@@ -254,19 +282,11 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 	    if (clinode && (clinode == rwinode)) {
 		clinode = 0;	/* already cloned - don't delete later */
 	    } else if (rwinode) {
-		if (IH_INC(V_linkHandle(rwvp), rwinode, V_parentId(rwvp)) ==
-		    -1) {
-		    Log("IH_INC failed: %p, %s, %" AFS_VOLID_FMT " errno %d\n",
-			V_linkHandle(rwvp), PrintInode(stmp, rwinode),
-			afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
-		    VForceOffline(rwvp);
-		    ERROR_EXIT(EIO);
-		}
-		inodeinced = 1;
+		w->incs[nincs++] = rwinode;
 	    }
 
 	    /* If a directory, mark vnode in old volume as cloned */
-	    if ((rwvnode->type == vDirectory) && ReadWriteOriginal) {
+	    if (rwvnode->type == vDirectory) {
 #ifdef DVINC
 		/*
 		 * It is my firmly held belief that immediately after
@@ -283,146 +303,301 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 		rwvnode->dataVersion++;
 #endif /* DVINC */
 		rwvnode->cloned = 1;
-		code = STREAM_ASEEK(rwfile, offset);
-		if (code == -1)
-		    goto clonefailed;
-		code = STREAM_WRITE(rwvnode, vcp->diskSize, 1, rwfile);
-		if (code != 1)
-		    goto clonefailed;
-		dircloned = 1;
-		code = STREAM_ASEEK(rwfile, offset + vcp->diskSize);
-		if (code == -1)
-		    goto clonefailed;
+		dirs = 1;
+	    }
+	}
+
+	/* Removal of the old cloned inode, once the batch is written */
+	if (clinode)
+	    w->decs[ndecs++] = clinode;
+    }
+
+    /* Take the new clone's references before anything points at them */
+    done = IH_INCMULTI(V_linkHandle(rwvp), w->incs, nincs, V_parentId(rwvp));
+    if (done < nincs) {
+	Log("IH_INC failed: %p, %s, %" AFS_VOLID_FMT " errno %d\n",
+	    V_linkHandle(rwvp), PrintInode(stmp, w->incs[done]),
+	    afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
+	UndoIncs(rwvp, w->incs, done);
+	VForceOffline(rwvp);
+	return EIO;
+    }
+
+    /* Write back the directories marked as cloned */
+    if (dirs && FDH_PWRITE(w->rwFd, w->rwbuf, len, offset) != len)
+	goto clonefailed;
+
+    /* Write the batch to the clone's index */
+    for (i = 0; i < count; i++) {
+	rwvnode = (struct VnodeDiskObject *)(w->rwbuf + i * vcp->diskSize);
 #ifdef DVINC
-		rwvnode->dataVersion--;	/* Really needs to be set to the value in the inode,
+	if (rwvnode->type == vDirectory)
+	    rwvnode->dataVersion--;	/* Really needs to be set to the value in the inode,
 					 * for the read-only volume */
 #endif /* DVINC */
-	    }
+	rwvnode->cloned = 0;
+    }
+    if (FDH_PWRITE(w->clFd, w->rwbuf, len, offset) != len)
+	goto clonefailed;
+
+    CLONE_LOCK(job);
+    for (i = 0; i < count; i++) {
+	rwvnode = (struct VnodeDiskObject *)(w->rwbuf + i * vcp->diskSize);
+	VnMapBuildAdd(job->mapBuilder,
+		      bitNumberToVnodeNumber(first + i, job->class), rwvnode);
+    }
+    for (i = 0; i < ndecs; i++)
+	ci_AddItem(&job->decHead, w->decs[i]);
+    job->filecount += filecount;
+    job->diskused += diskused;
+    CLONE_UNLOCK(job);
+    return 0;
+
+  clonefailed:
+    /* Couldn't clone, go back and decrement the inodes' link counts */
+    UndoIncs(rwvp, w->incs, nincs);
+    /* And if directories were marked cloned, unmark them */
+    if (dirs) {
+	for (i = 0; i < count; i++) {
+	    rwvnode = (struct VnodeDiskObject *)(w->rwbuf + i * vcp->diskSize);
+	    rwvnode->cloned = w->cloned[i];
 	}
+	(void)FDH_PWRITE(w->rwFd, w->rwbuf, len, offset);
+    }
+    return EIO;
+}
 
-	/* Overwrite the vnode entry in the clone volume */
-	rwvnode->cloned = 0;
-	code = STREAM_WRITE(rwvnode, vcp->diskSize, 1, clfileout);
-	if (code != 1) {
-	  clonefailed:
-	    /* Couldn't clone, go back and decrement the inode's link count */
-	    if (inodeinced) {
-		if (IH_DEC(V_linkHandle(rwvp), rwinode, V_parentId(rwvp)) ==
-		    -1) {
-		    Log("IH_DEC failed: %p, %s, %" AFS_VOLID_FMT " errno %d\n",
-			V_linkHandle(rwvp), PrintInode(stmp, rwinode),
-			afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
-		    VForceOffline(rwvp);
-		    ERROR_EXIT(EIO);
-		}
-	    }
-	    /* And if the directory was marked clone, unmark it */
-	    if (dircloned) {
-		rwvnode->cloned = 0;
-		if (STREAM_ASEEK(rwfile, offset) != -1)
-		    (void)STREAM_WRITE(rwvnode, vcp->diskSize, 1, rwfile);
-	    }
-	    ERROR_EXIT(EIO);
+static void *
+CloneWorker(void *rock)
+{
+    struct clone_worker w;
+    struct clone_job *job = rock;
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[job->class];
+    afs_int32 batch, code = 0;
+
+    memset(&w, 0, sizeof(w));
+    w.job = job;
+    w.rwFd = IH_OPEN(job->rwvp->vnodeIndex[job->class].handle);
+    w.clFd = IH_OPEN(job->clvp->vnodeIndex[job->class].handle);
+    w.rwbuf = malloc(CLONE_BATCH * vcp->diskSize);
+    if (job->reclone)
+	w.clbuf = malloc(CLONE_BATCH * vcp->diskSize);
+    if (!w.rwFd || !w.clFd || !w.rwbuf || (job->reclone && !w.clbuf))
+	code = EIO;
+
+    while (!code) {
+	CLONE_LOCK(job);
+	if (job->error || job->nextBatch >= job->nbatches) {
+	    CLONE_UNLOCK(job);
+	    break;
 	}
+	batch = job->nextBatch++;
+	CLONE_UNLOCK(job);
+
+	code = CloneBatch(&w, batch);
+	if (!job->threaded)
+	    DOPOLL;
+    }
+
+    if (code) {
+	CLONE_LOCK(job);
+	if (!job->error)
+	    job->error = code;
+	CLONE_UNLOCK(job);
+    }
 
-	/* Removal of the old cloned inode */
-	if (clinode) {
-	    ci_AddItem(&decHead, clinode);	/* just queue it */
+    if (w.rwFd)
+	FDH_CLOSE(w.rwFd);
+    if (w.clFd)
+	FDH_CLOSE(w.clFd);
+    free(w.rwbuf);
+    free(w.clbuf);
+    return NULL;
+}
+
+/* Run the batches of a job on worker threads, or here if there are few */
+static void
+CloneRun(struct clone_job *job)
+{
+#ifdef AFS_PTHREAD_ENV
+    pthread_t tids[CLONE_MAX_THREADS];
+    pthread_attr_t attr;
+    int i, nthreads;
+
+    nthreads = vol_CloneThreads;
+    if (nthreads > CLONE_MAX_THREADS)
+	nthreads = CLONE_MAX_THREADS;
+    if (nthreads > job->nbatches)
+	nthreads = job->nbatches;
+    if (nthreads > 1) {
+	job->threaded = 1;
+	opr_Verify(pthread_attr_init(&attr) == 0);
+	opr_Verify(pthread_attr_setdetachstate(&attr,
+					       PTHREAD_CREATE_JOINABLE) == 0);
+	for (i = 0; i < nthreads; i++) {
+	    if (pthread_create(&tids[i], &attr, CloneWorker, job) != 0)
+		break;
 	}
+	nthreads = i;
+	for (i = 0; i < nthreads; i++)
+	    opr_Verify(pthread_join(tids[i], NULL) == 0);
+	opr_Verify(pthread_attr_destroy(&attr) == 0);
+	job->threaded = 0;
+    }
+#endif
+    /* Anything the threads did not get to (or all of it, if there were
+     * no threads) is done here */
+    CloneWorker(job);
+}
 
-	DOPOLL;
+afs_int32
+DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone,
+	     struct VnMapBuilder *mapBuilder)
+{
+    afs_int32 code, error = 0;
+    FdHandle_t *fdP;
+    char dbuf[SIZEOF_LARGEDISKVNODE];
+    struct VnodeDiskObject *clvnode = (struct VnodeDiskObject *)dbuf;
+    struct clone_job job;
+    struct clone_rock decRock;
+    afs_foff_t offset, size;
+    afs_sfsize_t rwsize;
+
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    /*
+     * The fileserver's -readonly switch should make this false, but we
+     * have no useful way to know in the volserver.
+     * This doesn't make client data mutable.
+     */
+    int ReadWriteOriginal = 1;
+
+    /* Initialize list of inodes to nuke - must do this before any calls
+     * to ERROR_EXIT, as the error handler requires an initialised list
+     */
+    memset(&job, 0, sizeof(job));
+    ci_InitHead(&job.decHead);
+    decRock.h = V_linkHandle(rwvp);
+    decRock.vol = V_parentId(rwvp);
+    job.rwvp = rwvp;
+    job.clvp = clvp;
+    job.class = class;
+    job.reclone = reclone;
+    job.mapBuilder = mapBuilder;
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_init(&job.lock);
+#endif
+
+    /* Correct number of files in volume: this assumes indexes are always
+       cloned starting with vLarge */
+    if (ReadWriteOriginal && class != vLarge) {
+	job.filecount = V_filecount(rwvp);
+	job.diskused = V_diskused(rwvp);
     }
-    if (STREAM_ERROR(clfileout))
+
+    /* Count the vnodes in the RW volume's index */
+    fdP = IH_OPEN(rwvp->vnodeIndex[class].handle);
+    if (!fdP)
+	ERROR_EXIT(EIO);
+    rwsize = FDH_SIZE(fdP);
+    FDH_CLOSE(fdP);
+    if (rwsize < 0)
 	ERROR_EXIT(EIO);
+    job.nvnodes = rwsize / vcp->diskSize;
+    job.nvnodes = (job.nvnodes > 0) ? job.nvnodes - 1 : 0;
+    job.nbatches = (job.nvnodes + CLONE_BATCH - 1) / CLONE_BATCH;
+    offset = (afs_foff_t)(job.nvnodes + 1) * vcp->diskSize;
+
+    CloneRun(&job);
+    if (job.error)
+	ERROR_EXIT(job.error);
 
     /* Clean out any junk at end of clone file */
     if (reclone) {
-	STREAM_ASEEK(clfilein, offset);
-	while (STREAM_READ(clvnode, vcp->diskSize, 1, clfilein) == 1) {
+	fdP = IH_OPEN(clvp->vnodeIndex[class].handle);
+	if (!fdP)
+	    ERROR_EXIT(EIO);
+	for (size = offset;
+	     FDH_PREAD(fdP, clvnode, vcp->diskSize, size) == vcp->diskSize;
+	     size += vcp->diskSize) {
 	    if (clvnode->type != vNull && VNDISK_GET_INO(clvnode) != 0) {
-		ci_AddItem(&decHead, VNDISK_GET_INO(clvnode));
+		ci_AddItem(&job.decHead, VNDISK_GET_INO(clvnode));
 	    }
 	    DOPOLL;
 	}
+	FDH_CLOSE(fdP);
     }
 
     /* come here to finish up.  If code is non-zero, we've already run into problems,
      * and shouldn't do the idecs.
      */
   error_exit:
-    if (rwfile)
-	STREAM_CLOSE(rwfile);
-    if (clfilein)
-	STREAM_CLOSE(clfilein);
-    if (clfileout)
-	STREAM_CLOSE(clfileout);
-
-    if (rwFd)
-	FDH_CLOSE(rwFd);
-    if (clFdIn)
-	FDH_CLOSE(clFdIn);
-    if (clFdOut)
-	FDH_CLOSE(clFdOut);
-
-    if (rwH)
-	IH_RELEASE(rwH);
-    if (clHout)
-	IH_RELEASE(clHout);
-    if (clHin)
-	IH_RELEASE(clHin);
-
-    /* Next, we sync the disk. We have to reopen in case we're truncating,
-     * since we were using stdio above, and don't know when the buffers
-     * would otherwise be flushed.  There's no stdio fftruncate call.
+    /* Next, we sync the disk.  If recloning, the clone's index also has
+     * to be cut back to the size of the RW's.
      */
-    rwFd = IH_OPEN(clvp->vnodeIndex[class].handle);
-    if (rwFd == NULL) {
+    fdP = IH_OPEN(clvp->vnodeIndex[class].handle);
+    if (fdP == NULL) {
 	if (!error)
 	    error = EIO;
     } else {
-	if (reclone) {
+	if (reclone && !error) {
 	    /* If doing a reclone, we're keeping the clone. We need to
 	     * truncate the file to offset bytes.
 	     */
-	    if (reclone && !error) {
-		error = FDH_TRUNC(rwFd, offset);
-	    }
+	    error = FDH_TRUNC(fdP, offset);
+	}
+	(void)FDH_SYNC(fdP);
+	FDH_CLOSE(fdP);
+    }
+    if (ReadWriteOriginal) {
+	/* Make the cloned marks on the RW's directories stable too */
+	fdP = IH_OPEN(rwvp->vnodeIndex[class].handle);
+	if (fdP) {
+	    (void)FDH_SYNC(fdP);
+	    FDH_CLOSE(fdP);
 	}
-	(void)FDH_SYNC(rwFd);
-	FDH_CLOSE(rwFd);
     }
 
     /* Now finally do the idec's.  At this point, all potential
      * references have been cleaned up and sent to the disk
-     * (see above fclose and fsync). No matter what happens, we
+     * (see above fsync). No matter what happens, we
      * no longer need to keep these references around.
      */
-    code = ci_Apply(&decHead, IDecProc, (char *)&decRock);
+    code = ci_Apply(&job.decHead, IDecProc, (char *)&decRock);
     if (!error)
 	error = code;
-    ci_Destroy(&decHead);
+    ci_Destroy(&job.decHead);
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_destroy(&job.lock);
+#endif
 
-    if (ReadWriteOriginal && filecount > 0)
-	V_filecount(rwvp) = filecount;
-    if (ReadWriteOriginal && diskused > 0)
-	V_diskused(rwvp) = diskused;
+    if (ReadWriteOriginal && job.filecount > 0)
+	V_filecount(rwvp) = job.filecount;
+    if (ReadWriteOriginal && job.diskused > 0)
+	V_diskused(rwvp) = job.diskused;
     return error;
 }
 
+
 void
 CloneVolume(Error * rerror, Volume * original, Volume * new, Volume * old)
 {
     afs_int32 code, error = 0;
     afs_int32 reclone;
     afs_int32 filecount = V_filecount(original), diskused = V_diskused(original);
+    struct VnMapBuilder *mapBuilder;
 
     *rerror = 0;
     reclone = ((new == old) ? 1 : 0);
 
-    code = DoCloneIndex(original, new, vLarge, reclone);
+    /* The clone's indexes are rewritten in full, so rebuild its vnode map
+     * as we go.  The original only has its cloned bits changed, which the
+     * map does not record. */
+    mapBuilder = VnMapBuildBegin(VGetVnMap(new));
+
+    code = DoCloneIndex(original, new, vLarge, reclone, mapBuilder);
     if (code)
 	ERROR_EXIT(code);
-    code = DoCloneIndex(original, new, vSmall, reclone);
+    code = DoCloneIndex(original, new, vSmall, reclone, mapBuilder);
     if (code)
 	ERROR_EXIT(code);
     if (filecount != V_filecount(original) || diskused != V_diskused(original))
@@ -435,5 +610,7 @@ CloneVolume(Error * rerror, Volume * original, Volume * new, Volume * old)
 	ERROR_EXIT(code);
 
   error_exit:
+    VnMapBuildEnd(mapBuilder, new->vnodeIndex[vLarge].handle,
+		  new->vnodeIndex[vSmall].handle, !error);
     *rerror = error;
 }
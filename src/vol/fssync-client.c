@@ -189,6 +189,86 @@ FSYNC_VolOp(VolumeId volume, char * partition,
     return FSYNC_GenericOp(&vcom, sizeof(vcom), command, reason, res);
 }
 
+/**
+ * apply a volume operation to a list of volumes.
+ *
+ * The volumes are sent to the fileserver FSYNC_BATCH_MAX_VOLUMES at a time,
+ * so that a long list costs a few round trips rather than one per volume.
+ * The fileserver may run the operations of one request concurrently.
+ *
+ * @param[in]  volumes   volume ids
+ * @param[in]  nvolumes  number of volume ids
+ * @param[in]  partName  partition name string
+ * @param[in]  command   FSSYNC command code; one of FSYNC_VOL_ON,
+ *                       FSYNC_VOL_OFF, FSYNC_VOL_NEEDVOLUME,
+ *                       FSYNC_VOL_LEAVE_OFF, FSYNC_VOL_DONE or
+ *                       FSYNC_VOL_BREAKCBKS
+ * @param[in]  reason    FSSYNC reason sub-code
+ * @param[out] results   outcome for each volume, or NULL
+ *
+ * @return operation status
+ *    @retval SYNC_OK  the operation succeeded for every volume
+ *    @retval other    the first failure; see results for which volumes
+ *                     failed.  SYNC_BAD_COMMAND means the fileserver does not
+ *                     support batches, and the volumes should be sent one at
+ *                     a time with FSYNC_VolOp.
+ */
+afs_int32
+FSYNC_VolOpBatch(VolumeId *volumes, int nvolumes, char *partName,
+		 int command, int reason, FSSYNC_VolBatch_result *results)
+{
+    FSSYNC_VolBatch_hdr bcom;
+    FSSYNC_VolBatch_response_t bres;
+    SYNC_response res;
+    afs_int32 code, ret = SYNC_OK;
+    int i, n, done;
+
+    for (done = 0; done < nvolumes; done += n) {
+	n = nvolumes - done;
+	if (n > FSYNC_BATCH_MAX_VOLUMES)
+	    n = FSYNC_BATCH_MAX_VOLUMES;
+
+	memset(&bcom, 0, sizeof(bcom));
+	bcom.command = command;
+	bcom.nvolumes = n;
+	if (partName)
+	    strlcpy(bcom.partName, partName, sizeof(bcom.partName));
+	memcpy(bcom.volumes, &volumes[done], n * sizeof(VolumeId));
+
+	memset(&bres, 0, sizeof(bres));
+	memset(&res, 0, sizeof(res));
+	res.hdr.response_len = sizeof(res.hdr);
+	res.payload.buf = &bres;
+	res.payload.len = sizeof(bres);
+
+	code = FSYNC_GenericOp(&bcom, sizeof(bcom), FSYNC_VOL_BATCH,
+			       reason, &res);
+	if (res.recv_len < sizeof(res.hdr) + sizeof(bres) || bres.nvolumes != n) {
+	    /* the batch was not run; report the same failure for each volume */
+	    if (code == SYNC_OK)
+		code = SYNC_COM_ERROR;
+	    for (i = 0; i < n; i++) {
+		bres.results[i].response = code;
+		bres.results[i].reason = res.hdr.reason;
+	    }
+	}
+	if (results)
+	    memcpy(&results[done], bres.results, n * sizeof(*results));
+	if (code != SYNC_OK && ret == SYNC_OK)
+	    ret = code;
+	if (code == SYNC_BAD_COMMAND || code == SYNC_COM_ERROR) {
+	    done += n;
+	    break;
+	}
+    }
+    for (; done < nvolumes && results; done++) {
+	results[done].response = ret;
+	results[done].reason = SYNC_REASON_NONE;
+    }
+
+    return ret;
+}
+
 /**
  * verify that the fileserver still thinks we have a volume checked out.
  *
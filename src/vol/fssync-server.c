@@ -121,10 +121,74 @@ static void * FSYNC_salvageThread(void *);
 static void FSYNC_backgroundSalvage(Volume *vp);
 #endif /* AFS_DEMAND_ATTACH_FS */
 
+#if defined(HAVE_POLL) && defined(AFS_PTHREAD_ENV)
+/*
+ * Commands are read by FSYNC_sync and run by a pool of worker threads, so
+ * that a command waiting on a volume state transition does not hold up
+ * commands for other volumes.  Commands for the same volume still run one
+ * at a time, in the order they were read.
+ */
+#define FSYNC_WORKER_POOL
+#define FSYNC_NWORKERS	8
+#define FSYNC_ORDER_HASH_SIZE 64	/* must be a power of 2 */
+#endif
+
+/**
+ * an fssync command, from the time it is read until it has been answered.
+ */
+struct fsync_job {
+    struct rx_queue q;
+    osi_socket fd;                  /**< connection the command arrived on */
+    SYNC_command com;
+    SYNC_response res;
+    afs_int64 com_buf[SYNC_PROTO_MAX_LEN / sizeof(afs_int64)];
+    afs_int64 res_buf[SYNC_PROTO_MAX_LEN / sizeof(afs_int64)];
+#ifdef FSYNC_WORKER_POOL
+    struct fsync_order *order;      /**< ordering of commands for our volume,
+				     *   or NULL if the command has no volume */
+    afs_uint32 ticket;              /**< our turn in order */
+    struct fsync_job *batch;        /**< batch this is one volume of, or NULL */
+    int item;                       /**< index of our volume in batch */
+    int pending;                    /**< volumes of this batch not yet done */
+#endif
+};
+
+#ifdef FSYNC_WORKER_POOL
+/**
+ * the commands for one volume which have been read and not yet run.
+ */
+struct fsync_order {
+    struct rx_queue q;              /**< hash chain */
+    VolumeId volume;
+    afs_uint32 next;                /**< next ticket to hand out */
+    afs_uint32 serving;             /**< ticket of the command allowed to run */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cv;              /**< a job may have become runnable */
+    struct rx_queue jobs;           /**< jobs waiting to run, in arrival order */
+    struct rx_queue done;           /**< answered jobs, for FSYNC_sync to reap */
+    struct rx_queue order[FSYNC_ORDER_HASH_SIZE];
+    int wakeup[2];                  /**< pipe on which workers wake FSYNC_sync */
+} fsync_pool;
+
+static void FSYNC_startWorkers(void);
+static void * FSYNC_worker(void *);
+static void FSYNC_queueJob(struct fsync_job *job);
+static void FSYNC_reapJobs(void);
+static VolumeId FSYNC_comVolume(SYNC_command * com);
+static void SetHandlerBusy(osi_socket afd, int busy);
+#endif /* FSYNC_WORKER_POOL */
+
 /* Forward declarations */
 static void * FSYNC_sync(void *);
+static int FSYNC_threadInit(char *name);
 static void FSYNC_newconnection(osi_socket afd);
 static void FSYNC_com(osi_socket fd);
+static struct fsync_job *FSYNC_newJob(osi_socket fd);
+static void FSYNC_runJob(struct fsync_job *job);
+static void FSYNC_endJob(struct fsync_job *job);
 static void FSYNC_Drop(osi_socket fd);
 static void AcceptOn(void);
 static void AcceptOff(void);
@@ -153,6 +217,11 @@ static afs_int32 FSYNC_com_VolBreakCBKs(FSSYNC_VolOp_command * com, SYNC_respons
 static afs_int32 FSYNC_com_VolDone(FSSYNC_VolOp_command * com, SYNC_response * res);
 static afs_int32 FSYNC_com_VolQuery(FSSYNC_VolOp_command * com, SYNC_response * res);
 static afs_int32 FSYNC_com_VolHdrQuery(FSSYNC_VolOp_command * com, SYNC_response * res);
+static afs_int32 FSYNC_com_VolBatch(osi_socket fd, SYNC_command * com, SYNC_response * res);
+static afs_int32 FSYNC_batchCheck(SYNC_command * com, SYNC_response * res, int *nvolumes);
+static void FSYNC_batchItem(SYNC_command * com, int i, SYNC_command * icom);
+static void FSYNC_batchResult(SYNC_response * res, int i, SYNC_response * ires);
+static afs_int32 FSYNC_batchEnd(SYNC_response * res);
 #ifdef AFS_DEMAND_ATTACH_FS
 static afs_int32 FSYNC_com_VGUpdate(osi_socket fd, SYNC_command * com, SYNC_response * res);
 static afs_int32 FSYNC_com_VolOpQuery(FSSYNC_VolOp_command * com, SYNC_response * res);
@@ -178,6 +247,8 @@ static void FSYNC_com_to_info(FSSYNC_VolOp_command * vcom, FSSYNC_VolOp_info * i
 
 static int FSYNC_partMatch(FSSYNC_VolOp_command * vcom, Volume * vp, int match_anon);
 
+static struct offlineInfo * FSYNC_freeSlot(struct offlineInfo * volumes);
+
 
 /*
  * This lock controls access to the handler array. The overhead
@@ -216,7 +287,7 @@ FSYNC_fsInit(void)
 }
 
 #if defined(HAVE_POLL) && defined(AFS_PTHREAD_ENV)
-static struct pollfd FSYNC_readfds[MAXHANDLERS];
+static struct pollfd FSYNC_readfds[MAXHANDLERS + 1];	/* + the wakeup pipe */
 #else
 static fd_set FSYNC_readfds;
 #endif
@@ -227,12 +298,8 @@ FSYNC_sync(void * args)
 {
     extern int VInit;
     int code;
-#ifdef AFS_PTHREAD_ENV
-    int tid;
-#endif
     SYNC_server_state_t * state = &fssync_server_state;
 #ifdef AFS_DEMAND_ATTACH_FS
-    VThreadOptions_t * thread_opts;
     int min_vinit = 2;
 #else
     /*
@@ -254,12 +321,8 @@ FSYNC_sync(void * args)
     (void)signal(SIGPIPE, SIG_IGN);
 #endif
 
-#ifdef AFS_PTHREAD_ENV
-    /* set our 'thread-id' so that the host hold table works */
-    tid = rx_SetThreadNum();
-    Log("Set thread id %d for FSYNC_sync\n", tid);
-    opr_threadname_set("FSYNC_sync");
-#endif /* AFS_PTHREAD_ENV */
+    if (FSYNC_threadInit("FSYNC_sync"))
+	return NULL;
 
     VOL_LOCK;
 
@@ -282,33 +345,33 @@ FSYNC_sync(void * args)
     opr_Assert(!code);
 
 #ifdef AFS_DEMAND_ATTACH_FS
-    /*
-     * make sure the volume package is incapable of recursively executing
-     * salvsync calls on this thread, since there is a possibility of
-     * deadlock.
-     */
-    thread_opts = malloc(sizeof(VThreadOptions_t));
-    if (thread_opts == NULL) {
-	Log("failed to allocate memory for thread-specific volume package options structure\n");
-	return NULL;
-    }
-    memcpy(thread_opts, &VThread_defaults, sizeof(VThread_defaults));
-    thread_opts->disallow_salvsync = 1;
-    opr_Verify(pthread_setspecific(VThread_key, thread_opts) == 0);
-
     code = VVGCache_PkgInit();
     opr_Assert(code == 0);
 #endif
 
     InitHandler();
+#ifdef FSYNC_WORKER_POOL
+    FSYNC_startWorkers();
+#endif
     AcceptOn();
 
     for (;;) {
 #if defined(HAVE_POLL) && defined(AFS_PTHREAD_ENV)
         int nfds;
         GetHandler(FSYNC_readfds, MAXHANDLERS, POLLIN|POLLPRI, &nfds);
+#ifdef FSYNC_WORKER_POOL
+	FSYNC_readfds[nfds].fd = fsync_pool.wakeup[0];
+	FSYNC_readfds[nfds].events = POLLIN;
+	FSYNC_readfds[nfds].revents = 0;
+	if (poll(FSYNC_readfds, nfds + 1, -1) >= 1) {
+	    if (FSYNC_readfds[nfds].revents & POLLIN)
+		FSYNC_reapJobs();
+	    CallHandler(FSYNC_readfds, nfds, POLLIN|POLLPRI);
+	}
+#else
         if (poll(FSYNC_readfds, nfds, -1) >=1)
 	    CallHandler(FSYNC_readfds, nfds, POLLIN|POLLPRI);
+#endif
 #else
 	int maxfd;
 #ifdef AFS_PTHREAD_ENV
@@ -331,6 +394,51 @@ FSYNC_sync(void * args)
     AFS_UNREACHED(return(NULL)); /* hush now, little gcc */
 }
 
+/**
+ * prepare the calling thread to run fssync commands.
+ *
+ * @param[in] name  thread name
+ *
+ * @return operation status
+ *   @retval 0 success
+ *   @retval -1 out of memory
+ */
+static int
+FSYNC_threadInit(char *name)
+{
+#ifdef AFS_PTHREAD_ENV
+    int tid;
+#endif
+#ifdef AFS_DEMAND_ATTACH_FS
+    VThreadOptions_t * thread_opts;
+#endif
+
+#ifdef AFS_PTHREAD_ENV
+    /* set our 'thread-id' so that the host hold table works */
+    tid = rx_SetThreadNum();
+    Log("Set thread id %d for %s\n", tid, name);
+    opr_threadname_set(name);
+#endif /* AFS_PTHREAD_ENV */
+
+#ifdef AFS_DEMAND_ATTACH_FS
+    /*
+     * make sure the volume package is incapable of recursively executing
+     * salvsync calls on this thread, since there is a possibility of
+     * deadlock.
+     */
+    thread_opts = malloc(sizeof(VThreadOptions_t));
+    if (thread_opts == NULL) {
+	Log("failed to allocate memory for thread-specific volume package options structure\n");
+	return -1;
+    }
+    memcpy(thread_opts, &VThread_defaults, sizeof(VThread_defaults));
+    thread_opts->disallow_salvsync = 1;
+    opr_Verify(pthread_setspecific(VThread_key, thread_opts) == 0);
+#endif
+
+    return 0;
+}
+
 #ifdef AFS_DEMAND_ATTACH_FS
 /**
  * thread for salvaging volumes in the background.
@@ -441,44 +549,40 @@ afs_int32 FS_cnt = 0;
 static void
 FSYNC_com(osi_socket fd)
 {
-    SYNC_command com;
-    SYNC_response res;
-    SYNC_PROTO_BUF_DECL(com_buf);
-    SYNC_PROTO_BUF_DECL(res_buf);
-
-    memset(&res.hdr, 0, sizeof(res.hdr));
+    struct fsync_job *job;
+    SYNC_command *com;
+    SYNC_response *res;
 
-    com.payload.buf = (void *)com_buf;
-    com.payload.len = SYNC_PROTO_MAX_LEN;
-    res.hdr.response_len = sizeof(res.hdr);
-    res.payload.len = SYNC_PROTO_MAX_LEN;
-    res.payload.buf = (void *)res_buf;
+    job = FSYNC_newJob(fd);
+    com = &job->com;
+    res = &job->res;
 
     FS_cnt++;
-    if (SYNC_getCom(&fssync_server_state, fd, &com)) {
+    if (SYNC_getCom(&fssync_server_state, fd, com)) {
 	Log("FSYNC_com:  read failed; dropping connection (cnt=%d)\n", FS_cnt);
+	free(job);
 	FSYNC_Drop(fd);
 	return;
     }
 
-    if (com.recv_len < sizeof(com.hdr)) {
-	Log("FSSYNC_com:  invalid protocol message length (%u)\n", com.recv_len);
-	res.hdr.response = SYNC_COM_ERROR;
-	res.hdr.reason = SYNC_REASON_MALFORMED_PACKET;
-	res.hdr.flags |= SYNC_FLAG_CHANNEL_SHUTDOWN;
+    if (com->recv_len < sizeof(com->hdr)) {
+	Log("FSSYNC_com:  invalid protocol message length (%u)\n", com->recv_len);
+	res->hdr.response = SYNC_COM_ERROR;
+	res->hdr.reason = SYNC_REASON_MALFORMED_PACKET;
+	res->hdr.flags |= SYNC_FLAG_CHANNEL_SHUTDOWN;
 	goto respond;
     }
 
-    if (com.hdr.proto_version != FSYNC_PROTO_VERSION) {
-	Log("FSYNC_com:  invalid protocol version (%u)\n", com.hdr.proto_version);
-	res.hdr.response = SYNC_COM_ERROR;
-	res.hdr.flags |= SYNC_FLAG_CHANNEL_SHUTDOWN;
+    if (com->hdr.proto_version != FSYNC_PROTO_VERSION) {
+	Log("FSYNC_com:  invalid protocol version (%u)\n", com->hdr.proto_version);
+	res->hdr.response = SYNC_COM_ERROR;
+	res->hdr.flags |= SYNC_FLAG_CHANNEL_SHUTDOWN;
 	goto respond;
     }
 
-    if (com.hdr.command == SYNC_COM_CHANNEL_CLOSE) {
-	res.hdr.response = SYNC_OK;
-	res.hdr.flags |= SYNC_FLAG_CHANNEL_SHUTDOWN;
+    if (com->hdr.command == SYNC_COM_CHANNEL_CLOSE) {
+	res->hdr.response = SYNC_OK;
+	res->hdr.flags |= SYNC_FLAG_CHANNEL_SHUTDOWN;
 
 	/* don't respond, just drop; senders of SYNC_COM_CHANNEL_CLOSE
 	 * never wait for a response. */
@@ -487,18 +591,64 @@ FSYNC_com(osi_socket fd)
 
     ViceLog(125, ("FSYNC_com: from fd %d got command %ld (%s) reason %ld (%s) "
                   "pt %ld (%s) pid %ld\n", (int)fd,
-                  afs_printable_int32_ld(com.hdr.command),
-                  FSYNC_com2string(com.hdr.command),
-                  afs_printable_int32_ld(com.hdr.reason),
-                  FSYNC_reason2string(com.hdr.reason),
-                  afs_printable_int32_ld(com.hdr.programType),
-                  VPTypeToString(com.hdr.programType),
-                  afs_printable_int32_ld(com.hdr.pid)));
+                  afs_printable_int32_ld(com->hdr.command),
+                  FSYNC_com2string(com->hdr.command),
+                  afs_printable_int32_ld(com->hdr.reason),
+                  FSYNC_reason2string(com->hdr.reason),
+                  afs_printable_int32_ld(com->hdr.programType),
+                  VPTypeToString(com->hdr.programType),
+                  afs_printable_int32_ld(com->hdr.pid)));
+
+    res->hdr.com_seq = com->hdr.com_seq;
+
+#ifdef FSYNC_WORKER_POOL
+    /* a worker thread answers the command, and hands the job back to us to
+     * finish in FSYNC_reapJobs */
+    FSYNC_queueJob(job);
+    return;
+#else
+    FSYNC_runJob(job);
+#endif
+
+ respond:
+    SYNC_putRes(&fssync_server_state, fd, res);
+
+ done:
+    FSYNC_endJob(job);
+}
+
+static struct fsync_job *
+FSYNC_newJob(osi_socket fd)
+{
+    struct fsync_job *job;
 
-    res.hdr.com_seq = com.hdr.com_seq;
+    job = calloc(1, sizeof(*job));
+    opr_Assert(job != NULL);
+
+    job->fd = fd;
+    job->com.payload.buf = (void *)job->com_buf;
+    job->com.payload.len = SYNC_PROTO_MAX_LEN;
+    job->res.hdr.response_len = sizeof(job->res.hdr);
+    job->res.payload.len = SYNC_PROTO_MAX_LEN;
+    job->res.payload.buf = (void *)job->res_buf;
+
+    return job;
+}
+
+/**
+ * run an fssync command.
+ *
+ * @param[in] job  command to run; the outcome is left in job->res
+ */
+static void
+FSYNC_runJob(struct fsync_job *job)
+{
+    osi_socket fd = job->fd;
+    SYNC_command *com = &job->com;
+    SYNC_response *res = &job->res;
 
     VOL_LOCK;
-    switch (com.hdr.command) {
+    switch (com->hdr.command) {
     case FSYNC_VOL_ON:
     case FSYNC_VOL_ATTACH:
     case FSYNC_VOL_LEAVE_OFF:
@@ -517,46 +667,326 @@ FSYNC_com(osi_socket fd)
     case FSYNC_VG_SCAN:
     case FSYNC_VG_SCAN_ALL:
 #endif
-	res.hdr.response = FSYNC_com_VolOp(fd, &com, &res);
+	res->hdr.response = FSYNC_com_VolOp(fd, com, res);
+	break;
+    case FSYNC_VOL_BATCH:
+	res->hdr.response = FSYNC_com_VolBatch(fd, com, res);
 	break;
     case FSYNC_VOL_STATS_GENERAL:
     case FSYNC_VOL_STATS_VICEP:
     case FSYNC_VOL_STATS_HASH:
     case FSYNC_VOL_STATS_HDR:
     case FSYNC_VOL_STATS_VLRU:
-	res.hdr.response = FSYNC_com_StatsOp(fd, &com, &res);
+	res->hdr.response = FSYNC_com_StatsOp(fd, com, res);
 	break;
     case FSYNC_VOL_QUERY_VNODE:
-	res.hdr.response = FSYNC_com_VnQry(fd, &com, &res);
+	res->hdr.response = FSYNC_com_VnQry(fd, com, res);
 	break;
 #ifdef AFS_DEMAND_ATTACH_FS
     case FSYNC_VG_ADD:
     case FSYNC_VG_DEL:
-	res.hdr.response = FSYNC_com_VGUpdate(fd, &com, &res);
+	res->hdr.response = FSYNC_com_VGUpdate(fd, com, res);
 	break;
 #endif
     default:
-	res.hdr.response = SYNC_BAD_COMMAND;
+	res->hdr.response = SYNC_BAD_COMMAND;
 	break;
     }
     VOL_UNLOCK;
 
     ViceLog(125, ("FSYNC_com: fd %d responding with code %ld (%s) reason %ld "
                   "(%s)\n", (int)fd,
-                  afs_printable_int32_ld(res.hdr.response),
-                  SYNC_res2string(res.hdr.response),
-                  afs_printable_int32_ld(res.hdr.reason),
-                  FSYNC_reason2string(res.hdr.reason)));
+                  afs_printable_int32_ld(res->hdr.response),
+                  SYNC_res2string(res->hdr.response),
+                  afs_printable_int32_ld(res->hdr.reason),
+                  FSYNC_reason2string(res->hdr.reason)));
+}
 
- respond:
-    SYNC_putRes(&fssync_server_state, fd, &res);
+/**
+ * finish with an answered command.
+ *
+ * @param[in] job  command to finish; freed
+ */
+static void
+FSYNC_endJob(struct fsync_job *job)
+{
+    if (job->res.hdr.flags & SYNC_FLAG_CHANNEL_SHUTDOWN) {
+	FSYNC_Drop(job->fd);
+    }
+    free(job);
+}
 
- done:
-    if (res.hdr.flags & SYNC_FLAG_CHANNEL_SHUTDOWN) {
-	FSYNC_Drop(fd);
+#ifdef FSYNC_WORKER_POOL
+static void
+FSYNC_startWorkers(void)
+{
+    pthread_t tid;
+    pthread_attr_t tattr;
+    int i;
+
+    opr_mutex_init(&fsync_pool.lock);
+    opr_cv_init(&fsync_pool.cv);
+    queue_Init(&fsync_pool.jobs);
+    queue_Init(&fsync_pool.done);
+    for (i = 0; i < FSYNC_ORDER_HASH_SIZE; i++)
+	queue_Init(&fsync_pool.order[i]);
+
+    opr_Verify(pipe(fsync_pool.wakeup) == 0);
+    opr_Verify(fcntl(fsync_pool.wakeup[0], F_SETFL, O_NONBLOCK) == 0);
+    opr_Verify(fcntl(fsync_pool.wakeup[1], F_SETFL, O_NONBLOCK) == 0);
+
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    for (i = 0; i < FSYNC_NWORKERS; i++)
+	opr_Verify(pthread_create(&tid, &tattr, FSYNC_worker, NULL) == 0);
+}
+
+/**
+ * find the volume a command is for, so that commands for one volume can be
+ * run in order.
+ *
+ * @param[in] com  command
+ *
+ * @return volume id, or 0 if the command is not for a particular volume
+ */
+static VolumeId
+FSYNC_comVolume(SYNC_command * com)
+{
+    switch (com->hdr.command) {
+    case FSYNC_VOL_ON:
+    case FSYNC_VOL_ATTACH:
+    case FSYNC_VOL_LEAVE_OFF:
+    case FSYNC_VOL_OFF:
+    case FSYNC_VOL_FORCE_ERROR:
+    case FSYNC_VOL_NEEDVOLUME:
+    case FSYNC_VOL_MOVE:
+    case FSYNC_VOL_BREAKCBKS:
+    case FSYNC_VOL_DONE:
+    case FSYNC_VOL_QUERY:
+    case FSYNC_VOL_QUERY_HDR:
+    case FSYNC_VOL_QUERY_VOP:
+	if (com->recv_len == sizeof(com->hdr) + sizeof(FSSYNC_VolOp_hdr))
+	    return ((FSSYNC_VolOp_hdr *)com->payload.buf)->volume;
+	break;
+    case FSYNC_VOL_QUERY_VNODE:
+	if (com->recv_len == sizeof(com->hdr) + sizeof(FSSYNC_VnQry_hdr))
+	    return ((FSSYNC_VnQry_hdr *)com->payload.buf)->volume;
+	break;
+    case FSYNC_VG_ADD:
+    case FSYNC_VG_DEL:
+	if (com->recv_len == sizeof(com->hdr) + sizeof(FSSYNC_VGUpdate_command_t))
+	    return ((FSSYNC_VGUpdate_command_t *)com->payload.buf)->parent;
+	break;
+    }
+    return 0;
+}
+
+/**
+ * give a job its turn among the commands for its volume.
+ *
+ * @param[in] job     job
+ * @param[in] volume  volume id, or 0 to run the job in any order
+ *
+ * @pre fsync_pool.lock held
+ */
+static void
+FSYNC_orderJob(struct fsync_job *job, VolumeId volume)
+{
+    struct fsync_order *o, *no;
+    struct rx_queue *chain;
+
+    if (volume == 0)
+	return;
+
+    chain = &fsync_pool.order[volume & (FSYNC_ORDER_HASH_SIZE - 1)];
+    for (queue_Scan(chain, o, no, fsync_order)) {
+	if (o->volume == volume)
+	    break;
     }
+    if (queue_IsEnd(chain, o)) {
+	o = calloc(1, sizeof(*o));
+	opr_Assert(o != NULL);
+	o->volume = volume;
+	queue_Append(chain, o);
+    }
+    job->order = o;
+    job->ticket = o->next++;
 }
 
+/**
+ * pass the turn for a job's volume to the next command for it.
+ *
+ * @pre fsync_pool.lock held
+ */
+static void
+FSYNC_orderDone(struct fsync_job *job)
+{
+    struct fsync_order *o = job->order;
+
+    if (o == NULL)
+	return;
+    o->serving++;
+    if (o->serving == o->next) {
+	queue_Remove(o);
+	free(o);
+    }
+    job->order = NULL;
+}
+
+/**
+ * answer a command, and hand its job back to FSYNC_sync.
+ *
+ * The response is written without fsync_pool.lock, so that a client which
+ * is slow to read it holds up only the thread answering it.
+ *
+ * @pre fsync_pool.lock not held
+ */
+static void
+FSYNC_answerJob(struct fsync_job *job)
+{
+    SYNC_putRes(&fssync_server_state, job->fd, &job->res);
+    opr_mutex_enter(&fsync_pool.lock);
+    queue_Append(&fsync_pool.done, job);
+    opr_mutex_exit(&fsync_pool.lock);
+    if (write(fsync_pool.wakeup[1], "", 1) < 0) {
+	/* the pipe is full, so FSYNC_sync is waking up anyway */
+    }
+}
+
+/**
+ * hand a command read by FSYNC_sync to the worker threads.
+ *
+ * A batch is split into one job per volume, so that each volume takes its
+ * turn with the other commands for it, and the volumes of the batch can run
+ * at the same time.
+ *
+ * @param[in] job  command
+ */
+static void
+FSYNC_queueJob(struct fsync_job *job)
+{
+    struct fsync_job *item;
+    struct fsync_job *answer = NULL;
+    afs_int32 code;
+    int i, n;
+
+    /* stop listening on the connection until the command is answered */
+    SetHandlerBusy(job->fd, 1);
+
+    opr_mutex_enter(&fsync_pool.lock);
+    if (job->com.hdr.command == FSYNC_VOL_BATCH) {
+	code = FSYNC_batchCheck(&job->com, &job->res, &n);
+	if (code != SYNC_OK || n == 0) {
+	    job->res.hdr.response = code;
+	    answer = job;
+	} else {
+	    job->pending = n;
+	    for (i = 0; i < n; i++) {
+		item = FSYNC_newJob(job->fd);
+		FSYNC_batchItem(&job->com, i, &item->com);
+		item->batch = job;
+		item->item = i;
+		FSYNC_orderJob(item, FSYNC_comVolume(&item->com));
+		queue_Append(&fsync_pool.jobs, item);
+	    }
+	}
+    } else {
+	FSYNC_orderJob(job, FSYNC_comVolume(&job->com));
+	queue_Append(&fsync_pool.jobs, job);
+    }
+    opr_cv_broadcast(&fsync_pool.cv);
+    opr_mutex_exit(&fsync_pool.lock);
+
+    if (answer != NULL)
+	FSYNC_answerJob(answer);
+}
+
+/**
+ * worker thread which runs fssync commands.
+ *
+ * A worker takes the oldest job whose volume has no earlier command still
+ * waiting or running, runs it, and answers it.  Answered jobs are handed
+ * back to FSYNC_sync, which owns the connections.
+ *
+ * @param[in] args  unused
+ */
+static void *
+FSYNC_worker(void * args)
+{
+    struct fsync_job *job, *njob, *batch;
+
+    if (FSYNC_threadInit("FSYNC_worker"))
+	return NULL;
+
+    opr_mutex_enter(&fsync_pool.lock);
+    for (;;) {
+	for (queue_Scan(&fsync_pool.jobs, job, njob, fsync_job)) {
+	    if (job->order == NULL || job->order->serving == job->ticket)
+		break;
+	}
+	if (queue_IsEnd(&fsync_pool.jobs, job)) {
+	    opr_cv_wait(&fsync_pool.cv, &fsync_pool.lock);
+	    continue;
+	}
+	queue_Remove(job);
+	opr_mutex_exit(&fsync_pool.lock);
+
+	FSYNC_runJob(job);
+
+	opr_mutex_enter(&fsync_pool.lock);
+	FSYNC_orderDone(job);
+	batch = job->batch;
+	if (batch != NULL) {
+	    FSYNC_batchResult(&batch->res, job->item, &job->res);
+	    free(job);
+	    job = NULL;
+	    if (--batch->pending == 0) {
+		batch->res.hdr.response = FSYNC_batchEnd(&batch->res);
+		job = batch;
+	    }
+	}
+	opr_cv_broadcast(&fsync_pool.cv);
+	if (job != NULL) {
+	    opr_mutex_exit(&fsync_pool.lock);
+	    FSYNC_answerJob(job);
+	    opr_mutex_enter(&fsync_pool.lock);
+	}
+    }
+
+    AFS_UNREACHED(opr_mutex_exit(&fsync_pool.lock));
+    AFS_UNREACHED(return(NULL));
+}
+
+/**
+ * finish the jobs the workers have answered, and listen for the next
+ * command on their connections.
+ *
+ * @note called by FSYNC_sync when woken by a worker
+ */
+static void
+FSYNC_reapJobs(void)
+{
+    struct rx_queue done;
+    struct fsync_job *job, *njob;
+    char buf[64];
+
+    while (read(fsync_pool.wakeup[0], buf, sizeof(buf)) > 0)
+	;
+
+    queue_Init(&done);
+    opr_mutex_enter(&fsync_pool.lock);
+    queue_SpliceAppend(&done, &fsync_pool.done);
+    opr_mutex_exit(&fsync_pool.lock);
+
+    for (queue_Scan(&done, job, njob, fsync_job)) {
+	queue_Remove(job);
+	SetHandlerBusy(job->fd, 0);
+	FSYNC_endJob(job);
+    }
+}
+#endif /* FSYNC_WORKER_POOL */
+
 static afs_int32
 FSYNC_com_VolOp(osi_socket fd, SYNC_command * com, SYNC_response * res)
 {
@@ -640,6 +1070,173 @@ FSYNC_com_VolOp(osi_socket fd, SYNC_command * com, SYNC_response * res)
     return code;
 }
 
+/**
+ * service an FSYNC request to apply a volume operation to a list of volumes.
+ *
+ * @param[in]   fd    client socket
+ * @param[in]   com   command packet
+ * @param[out]  res   object in which to store response packet
+ *
+ * @return operation status
+ *   @retval SYNC_OK the operation succeeded for every volume
+ *   @retval other the first failure; the response payload holds the
+ *                 outcome for each volume
+ *
+ * @note this is an FSYNC RPC server stub
+ *
+ * @note this procedure handles the FSYNC_VOL_BATCH command code when the
+ *       fileserver runs commands in a single thread; otherwise
+ *       FSYNC_queueJob splits the batch, and the volumes are run as separate
+ *       commands.
+ *
+ * @internal
+ */
+static afs_int32
+FSYNC_com_VolBatch(osi_socket fd, SYNC_command * com, SYNC_response * res)
+{
+    SYNC_command icom;
+    SYNC_response ires;
+    FSSYNC_VolOp_hdr vop;
+    afs_int32 code;
+    int i, n;
+
+    code = FSYNC_batchCheck(com, res, &n);
+    if (code != SYNC_OK)
+	return code;
+
+    for (i = 0; i < n; i++) {
+	icom.payload.buf = &vop;
+	icom.payload.len = sizeof(vop);
+	FSYNC_batchItem(com, i, &icom);
+
+	memset(&ires.hdr, 0, sizeof(ires.hdr));
+	ires.hdr.response_len = sizeof(ires.hdr);
+	ires.payload.buf = NULL;
+	ires.payload.len = 0;
+	ires.hdr.response = FSYNC_com_VolOp(fd, &icom, &ires);
+
+	FSYNC_batchResult(res, i, &ires);
+    }
+
+    return FSYNC_batchEnd(res);
+}
+
+/**
+ * check a batch command, and make room in the response for its results.
+ *
+ * @param[in]   com       command packet
+ * @param[out]  res       response packet
+ * @param[out]  nvolumes  number of volumes in the batch
+ *
+ * @return operation status
+ *   @retval SYNC_OK the batch may be run
+ *
+ * @internal
+ */
+static afs_int32
+FSYNC_batchCheck(SYNC_command * com, SYNC_response * res, int *nvolumes)
+{
+    FSSYNC_VolBatch_hdr *bcom = com->payload.buf;
+    FSSYNC_VolBatch_response_t *bres = res->payload.buf;
+
+    if (com->recv_len != (sizeof(com->hdr) + sizeof(*bcom)) ||
+	bcom->nvolumes > FSYNC_BATCH_MAX_VOLUMES ||
+	res->payload.len < sizeof(*bres)) {
+	res->hdr.reason = SYNC_REASON_MALFORMED_PACKET;
+	res->hdr.flags |= SYNC_FLAG_CHANNEL_SHUTDOWN;
+	return SYNC_COM_ERROR;
+    }
+
+    /* only operations which change volume state may be batched; the
+     * response has no room for anything else */
+    switch (bcom->command) {
+    case FSYNC_VOL_ON:
+    case FSYNC_VOL_OFF:
+    case FSYNC_VOL_NEEDVOLUME:
+    case FSYNC_VOL_LEAVE_OFF:
+    case FSYNC_VOL_DONE:
+    case FSYNC_VOL_BREAKCBKS:
+	break;
+    default:
+	return SYNC_BAD_COMMAND;
+    }
+
+    if (SYNC_verifyProtocolString(bcom->partName, sizeof(bcom->partName))) {
+	res->hdr.reason = SYNC_REASON_MALFORMED_PACKET;
+	return SYNC_FAILED;
+    }
+
+    memset(bres, 0, sizeof(*bres));
+    bres->nvolumes = bcom->nvolumes;
+    res->hdr.response_len += sizeof(*bres);
+    *nvolumes = bcom->nvolumes;
+
+    return SYNC_OK;
+}
+
+/**
+ * make the vol op command for one volume of a batch.
+ *
+ * @param[in]   com   batch command packet
+ * @param[in]   i     index of the volume in the batch
+ * @param[out]  icom  vol op command packet; its payload buffer must hold an
+ *                    FSSYNC_VolOp_hdr
+ *
+ * @internal
+ */
+static void
+FSYNC_batchItem(SYNC_command * com, int i, SYNC_command * icom)
+{
+    FSSYNC_VolBatch_hdr *bcom = com->payload.buf;
+    FSSYNC_VolOp_hdr *vop = icom->payload.buf;
+
+    icom->hdr = com->hdr;
+    icom->hdr.command = bcom->command;
+    icom->hdr.command_len = sizeof(icom->hdr) + sizeof(*vop);
+    icom->recv_len = sizeof(icom->hdr) + sizeof(*vop);
+
+    memset(vop, 0, sizeof(*vop));
+    vop->volume = bcom->volumes[i];
+    memcpy(vop->partName, bcom->partName, sizeof(vop->partName));
+}
+
+/**
+ * record the outcome for one volume of a batch.
+ *
+ * @internal
+ */
+static void
+FSYNC_batchResult(SYNC_response * res, int i, SYNC_response * ires)
+{
+    FSSYNC_VolBatch_response_t *bres = res->payload.buf;
+
+    bres->results[i].response = ires->hdr.response;
+    bres->results[i].reason = ires->hdr.reason;
+}
+
+/**
+ * get the response code for a batch whose volumes have all been run.
+ *
+ * @return SYNC_OK if every volume succeeded, or else the response code of
+ *         the first that did not, whose reason is copied to the response
+ *
+ * @internal
+ */
+static afs_int32
+FSYNC_batchEnd(SYNC_response * res)
+{
+    FSSYNC_VolBatch_response_t *bres = res->payload.buf;
+    afs_uint32 i;
+
+    for (i = 0; i < bres->nvolumes; i++) {
+	if (bres->results[i].response != SYNC_OK) {
+	    res->hdr.reason = bres->results[i].reason;
+	    return bres->results[i].response;
+	}
+    }
+    return SYNC_OK;
+}
+
 /**
  * service an FSYNC request to bring a volume online.
  *
@@ -824,7 +1421,6 @@ FSYNC_com_VolOff(FSSYNC_VolOp_command * vcom, SYNC_response * res)
 {
     FSSYNC_VolOp_info info;
     afs_int32 code = SYNC_OK;
-    int i;
     Volume * vp;
     Error error;
 #ifdef AFS_DEMAND_ATTACH_FS
@@ -843,12 +1439,7 @@ FSYNC_com_VolOff(FSSYNC_VolOp_command * vcom, SYNC_response * res)
 	vcom->v = NULL;
     } else {
 	if (!vcom->v) {
-	    for (i = 0; i < MAXOFFLINEVOLUMES; i++) {
-		if (vcom->volumes[i].volumeID == 0) {
-		    vcom->v = &vcom->volumes[i];
-		    break;
-		}
-	    }
+	    vcom->v = FSYNC_freeSlot(vcom->volumes);
 	}
 	if (!vcom->v) {
 	    goto deny;
@@ -1081,6 +1672,16 @@ FSYNC_com_VolOff(FSSYNC_VolOp_command * vcom, SYNC_response * res)
 	     * many volumes the volserver or whatever is using.  Note that
 	     * vp is valid since leaveonline is only set when vp is valid.
 	     */
+	    if (vcom->v && vcom->v->volumeID != 0 &&
+		vcom->v->volumeID != vcom->vop->volume) {
+		/* another command on this connection took the slot while we
+		 * waited for the volume */
+		vcom->v = FSYNC_freeSlot(vcom->volumes);
+		if (!vcom->v) {
+		    Log("FSYNC_com_VolOff: no slot left to track volume %" AFS_VOLID_FMT "\n",
+			afs_printable_VolumeId_lu(vcom->vop->volume));
+		}
+	    }
 	    if (vcom->v) {
 		vcom->v->volumeID = vcom->vop->volume;
 		strlcpy(vcom->v->partName, vp->partition->name, sizeof(vcom->v->partName));
@@ -1983,6 +2584,29 @@ FSYNC_partMatch(FSSYNC_VolOp_command * vcom, Volume * vp, int match_anon)
 }
 
 
+/**
+ * find an unused entry in a connection's list of offline volumes.
+ *
+ * @param[in] volumes  the connection's offline volumes
+ *
+ * @return unused entry, or NULL if there is none
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal
+ */
+static struct offlineInfo *
+FSYNC_freeSlot(struct offlineInfo * volumes)
+{
+    int i;
+
+    for (i = 0; i < MAXOFFLINEVOLUMES; i++) {
+	if (volumes[i].volumeID == 0)
+	    return &volumes[i];
+    }
+    return NULL;
+}
+
 static void
 FSYNC_Drop(osi_socket fd)
 {
@@ -2048,6 +2672,7 @@ AcceptOff(void)
 
 static osi_socket HandlerFD[MAXHANDLERS];
 static void (*HandlerProc[MAXHANDLERS]) (osi_socket);
+static int HandlerBusy[MAXHANDLERS];	/* a command is being run; don't poll */
 
 static void
 InitHandler(void)
@@ -2057,6 +2682,7 @@ InitHandler(void)
     for (i = 0; i < MAXHANDLERS; i++) {
 	HandlerFD[i] = OSI_NULLSOCKET;
 	HandlerProc[i] = 0;
+	HandlerBusy[i] = 0;
     }
     ReleaseWriteLock(&FSYNC_handler_lock);
 }
@@ -2109,6 +2735,7 @@ AddHandler(osi_socket afd, void (*aproc) (osi_socket))
     }
     HandlerFD[i] = afd;
     HandlerProc[i] = aproc;
+    HandlerBusy[i] = 0;
     ReleaseWriteLock(&FSYNC_handler_lock);
     return 1;
 }
@@ -2149,6 +2776,16 @@ RemoveHandler(osi_socket afd)
     return 1;
 }
 
+#ifdef FSYNC_WORKER_POOL
+static void
+SetHandlerBusy(osi_socket afd, int busy)
+{
+    ObtainWriteLock(&FSYNC_handler_lock);
+    HandlerBusy[FindHandler_r(afd)] = busy;
+    ReleaseWriteLock(&FSYNC_handler_lock);
+}
+#endif
+
 #if defined(HAVE_POLL) && defined(AFS_PTHREAD_ENV)
 static void
 GetHandler(struct pollfd *fds, int maxfds, int events, int *nfds)
@@ -2157,7 +2794,7 @@ GetHandler(struct pollfd *fds, int maxfds, int events, int *nfds)
     int fdi = 0;
     ObtainReadLock(&FSYNC_handler_lock);
     for (i = 0; i < MAXHANDLERS; i++)
-	if (HandlerFD[i] != OSI_NULLSOCKET) {
+	if (HandlerFD[i] != OSI_NULLSOCKET && !HandlerBusy[i]) {
 	    opr_Assert(fdi<maxfds);
 	    fds[fdi].fd = HandlerFD[i];
 	    fds[fdi].events = events;
@@ -58,6 +58,7 @@ enum FSYNCOpCode {
     FSYNC_VG_DEL              = SYNC_COM_CODE_DECL(21), /**< delete a volume id from a vg */
     FSYNC_VG_SCAN             = SYNC_COM_CODE_DECL(22), /**< force a re-scan of a given partition */
     FSYNC_VG_SCAN_ALL         = SYNC_COM_CODE_DECL(23), /**< force a re-scan of all vice partitions */
+    FSYNC_VOL_BATCH           = SYNC_COM_CODE_DECL(24), /**< apply a vol op to a list of volumes */
     FSYNC_OP_CODE_END
 };
 
@@ -108,6 +109,38 @@ typedef struct FSSYNC_VolOp_command {
 } FSSYNC_VolOp_command;
 
 
+/**
+ * most volumes in one FSYNC_VOL_BATCH request.
+ */
+#define FSYNC_BATCH_MAX_VOLUMES 64
+
+/**
+ * fssync protocol batched volume operation request message.
+ */
+typedef struct FSSYNC_VolBatch_hdr {
+    afs_int32 command;          /**< vol op command to apply to each volume */
+    afs_uint32 nvolumes;        /**< number of volume ids in volumes */
+    char partName[16];          /**< partition name, e.g. /vicepa */
+    VolumeId volumes[FSYNC_BATCH_MAX_VOLUMES]; /**< volume ids */
+} FSSYNC_VolBatch_hdr;
+
+/**
+ * outcome of a vol op for one volume of a batch.
+ */
+typedef struct FSSYNC_VolBatch_result {
+    afs_int32 response;         /**< response code */
+    afs_int32 reason;           /**< reason for response */
+} FSSYNC_VolBatch_result;
+
+/**
+ * fssync protocol batched volume operation response message.
+ */
+typedef struct FSSYNC_VolBatch_response {
+    afs_uint32 nvolumes;        /**< number of entries in results */
+    FSSYNC_VolBatch_result results[FSYNC_BATCH_MAX_VOLUMES]; /**< per-volume outcome,
+							       *   in request order */
+} FSSYNC_VolBatch_response_t;
+
 /**
  * volume operation processing state.
  */
@@ -214,6 +247,9 @@ extern afs_int32 FSYNC_GenericOp(void * ext_hdr, size_t ext_len,
  */
 extern afs_int32 FSYNC_VolOp(VolumeId volume, char *partName, int com, int reason,
 			     SYNC_response * res);
+extern afs_int32 FSYNC_VolOpBatch(VolumeId *volumes, int nvolumes,
+				  char *partName, int com, int reason,
+				  FSSYNC_VolBatch_result *results);
 
 /* statistics query interface */
 extern afs_int32 FSYNC_StatsOp(FSSYNC_StatsOp_hdr * scom, int command, int reason,
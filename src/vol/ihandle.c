@@ -26,6 +26,11 @@
 # include <sys/statfs.h>
 #endif
 
+#ifdef HAVE_LINUX_FS_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+
 #include <afs/opr.h>
 #ifdef AFS_PTHREAD_ENV
 # include <opr/lock.h>
@@ -38,27 +43,80 @@
 #include "ihandle.h"
 #include "viceinode.h"
 
+#ifdef AFS_IH_URING_ENV
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif
+
 #ifdef AFS_PTHREAD_ENV
 pthread_once_t ih_glock_once = PTHREAD_ONCE_INIT;
 pthread_mutex_t ih_glock_mutex;
 #endif /* AFS_PTHREAD_ENV */
 
-/* Linked list of available inode handles */
-IHandle_t *ihAvailHead;
-IHandle_t *ihAvailTail;
+/*
+ * The inode handle cache is split into shards, so that threads opening and
+ * closing unrelated files do not all wait for one lock.  An inode handle
+ * belongs to the shard picked by its hash bucket, and so do its file
+ * descriptor handles.  The shard's lock protects all of them, along with
+ * the shard's LRU of cached descriptors and its free lists.  Each shard
+ * gets an equal share of the descriptor cache.
+ *
+ * The global IH_LOCK only protects package initialization and the
+ * stream handle free list.
+ */
+#ifdef AFS_PTHREAD_ENV
+# define IH_NSHARDS	16	/* power of 2, no more than I_HANDLE_HASH_SIZE */
+#else
+# define IH_NSHARDS	1
+#endif
+
+struct ih_shard {
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_t lock;
+#endif
+    /* Linked list of available inode handles */
+    IHandle_t *ihAvailHead;
+    IHandle_t *ihAvailTail;
+
+    /* Linked list of available file descriptor handles */
+    FdHandle_t *fdAvailHead;
+    FdHandle_t *fdAvailTail;
+
+    /* LRU list for file descriptor handles */
+    FdHandle_t *fdLruHead;
+    FdHandle_t *fdLruTail;
 
-/* Linked list of available file descriptor handles */
-FdHandle_t *fdAvailHead;
-FdHandle_t *fdAvailTail;
+    int fdInUseCount;		/* open descriptors, in use or cached */
+    int fdCacheSize;		/* this shard's share of fdCacheSize */
+    int fdCacheShrunk;		/* taken off fdCacheSize after EMFILE */
+
+    afs_uint64 opens;		/* ih_open calls */
+    afs_uint64 hits;		/* opens which found a descriptor */
+    afs_uint64 evictions;	/* cached descriptors closed to make room */
+};
+
+static struct ih_shard ih_shards[IH_NSHARDS];
+
+#define IH_SHARD(ihP) \
+    (&ih_shards[IH_HASH((ihP)->ih_dev, (ihP)->ih_vid, (ihP)->ih_ino) \
+		& (IH_NSHARDS - 1)])
+
+#ifdef AFS_PTHREAD_ENV
+# define SHARD_LOCK(s) \
+    do { opr_Verify(pthread_once(&ih_glock_once, ih_glock_init) == 0);	\
+	opr_mutex_enter(&(s)->lock); \
+    } while (0)
+# define SHARD_UNLOCK(s) opr_mutex_exit(&(s)->lock)
+#else
+# define SHARD_LOCK(s) ((void)(s))
+# define SHARD_UNLOCK(s) ((void)(s))
+#endif
 
 /* Linked list of available stream descriptor handles */
 StreamHandle_t *streamAvailHead;
 StreamHandle_t *streamAvailTail;
 
-/* LRU list for file descriptor handles */
-FdHandle_t *fdLruHead;
-FdHandle_t *fdLruTail;
-
 int ih_Inited = 0;
 
 /* Most of the servers use fopen/fdopen. Since the FILE structure
@@ -72,13 +130,10 @@ int ih_Inited = 0;
 int fdMaxCacheSize = 0;
 int fdCacheSize = 0;
 
-/* Number of in use file descriptors */
-int fdInUseCount = 0;
-
 /* Hash table for inode handles */
 IHashBucket_t ihashTable[I_HANDLE_HASH_SIZE];
 
-static int _ih_release_r(IHandle_t * ihP);
+static int _ih_release_r(struct ih_shard *shard, IHandle_t * ihP);
 
 /* start-time configurable I/O limits */
 ih_init_params vol_io_params;
@@ -136,25 +191,65 @@ ih_SetSyncBehavior(const char *behavior)
     return 0;
 }
 
+/**
+ * Do file data I/O through io_uring rather than one system call at a time.
+ *
+ * @return 0 on success, -1 if this build has no io_uring support
+ */
+int
+ih_UseIOUring(void)
+{
+#ifdef AFS_IH_URING_ENV
+    ih_uring = 1;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 #ifdef AFS_PTHREAD_ENV
-/* Initialize the global ihandle mutex */
+/* Initialize the global ihandle mutex and the shard mutexes */
 void
 ih_glock_init(void)
 {
+    int i;
+
     opr_mutex_init(&ih_glock_mutex);
+    for (i = 0; i < IH_NSHARDS; i++)
+	opr_mutex_init(&ih_shards[i].lock);
 }
 #endif /* AFS_PTHREAD_ENV */
 
+/* Divide fdCacheSize between the shards */
+static void
+ih_SetShardCacheSize(void)
+{
+    int i, share;
+
+    share = fdCacheSize / IH_NSHARDS;
+    if (share == 0 && fdCacheSize > 0)
+	share = 1;
+    for (i = 0; i < IH_NSHARDS; i++) {
+	SHARD_LOCK(&ih_shards[i]);
+	ih_shards[i].fdCacheSize = share;
+	ih_shards[i].fdCacheShrunk = 0;
+	SHARD_UNLOCK(&ih_shards[i]);
+    }
+}
+
 /* Initialize the file descriptor cache */
 void
 ih_Initialize(void)
 {
+    struct ih_shard *shard;
     int i;
     opr_Assert(!ih_Inited);
-    ih_Inited = 1;
-    DLL_INIT_LIST(ihAvailHead, ihAvailTail);
-    DLL_INIT_LIST(fdAvailHead, fdAvailTail);
-    DLL_INIT_LIST(fdLruHead, fdLruTail);
+    for (i = 0; i < IH_NSHARDS; i++) {
+	shard = &ih_shards[i];
+	DLL_INIT_LIST(shard->ihAvailHead, shard->ihAvailTail);
+	DLL_INIT_LIST(shard->fdAvailHead, shard->fdAvailTail);
+	DLL_INIT_LIST(shard->fdLruHead, shard->fdLruTail);
+    }
     for (i = 0; i < I_HANDLE_HASH_SIZE; i++) {
 	DLL_INIT_LIST(ihashTable[i].ihash_head, ihashTable[i].ihash_tail);
     }
@@ -192,6 +287,10 @@ ih_Initialize(void)
     }
 #endif
     fdCacheSize = min(fdMaxCacheSize, vol_io_params.fd_initial_cachesize);
+    ih_SetShardCacheSize();
+
+    /* Last, as ih_init only takes IH_LOCK while this is unset */
+    ih_Inited = 1;
 }
 
 /* Make the file descriptor cache as big as possible. Don't this call
@@ -211,23 +310,25 @@ ih_UseLargeCache(void)
     }
 
     fdCacheSize = fdMaxCacheSize;
+    ih_SetShardCacheSize();
 
     IH_UNLOCK;
 }
 
 /* Allocate a chunk of inode handles */
-void
-iHandleAllocateChunk(void)
+static void
+iHandleAllocateChunk(struct ih_shard *shard)
 {
     int i;
     IHandle_t *ihP;
 
-    opr_Assert(ihAvailHead == NULL);
+    opr_Assert(shard->ihAvailHead == NULL);
     ihP = malloc(I_HANDLE_MALLOCSIZE * sizeof(IHandle_t));
     opr_Assert(ihP != NULL);
     for (i = 0; i < I_HANDLE_MALLOCSIZE; i++) {
 	ihP[i].ih_refcnt = 0;
-	DLL_INSERT_TAIL(&ihP[i], ihAvailHead, ihAvailTail, ih_next, ih_prev);
+	DLL_INSERT_TAIL(&ihP[i], shard->ihAvailHead, shard->ihAvailTail,
+			ih_next, ih_prev);
     }
 }
 
@@ -236,31 +337,37 @@ IHandle_t *
 ih_init(int dev, int vid, Inode ino)
 {
     int ihash = IH_HASH(dev, vid, ino);
+    struct ih_shard *shard = &ih_shards[ihash & (IH_NSHARDS - 1)];
     IHandle_t *ihP;
 
-    ih_PkgDefaults();
-
-    IH_LOCK;
     if (!ih_Inited) {
-        ih_Initialize();
+	ih_PkgDefaults();
+
+	IH_LOCK;
+	if (!ih_Inited) {
+	    ih_Initialize();
+	}
+	IH_UNLOCK;
     }
 
+    SHARD_LOCK(shard);
+
     /* Do we already have a handle for this Inode? */
     for (ihP = ihashTable[ihash].ihash_head; ihP; ihP = ihP->ih_next) {
 	if (ihP->ih_ino == ino && ihP->ih_vid == vid && ihP->ih_dev == dev) {
 	    ihP->ih_refcnt++;
-	    IH_UNLOCK;
+	    SHARD_UNLOCK(shard);
 	    return ihP;
 	}
     }
 
     /* Allocate and initialize a new Inode handle */
-    if (ihAvailHead == NULL) {
-	iHandleAllocateChunk();
+    if (shard->ihAvailHead == NULL) {
+	iHandleAllocateChunk(shard);
     }
-    ihP = ihAvailHead;
+    ihP = shard->ihAvailHead;
     opr_Assert(ihP->ih_refcnt == 0);
-    DLL_DELETE(ihP, ihAvailHead, ihAvailTail, ih_next, ih_prev);
+    DLL_DELETE(ihP, shard->ihAvailHead, shard->ihAvailTail, ih_next, ih_prev);
     ihP->ih_dev = dev;
     ihP->ih_vid = vid;
     ihP->ih_ino = ino;
@@ -270,7 +377,7 @@ ih_init(int dev, int vid, Inode ino)
     DLL_INIT_LIST(ihP->ih_fdhead, ihP->ih_fdtail);
     DLL_INSERT_TAIL(ihP, ihashTable[ihash].ihash_head,
 		    ihashTable[ihash].ihash_tail, ih_next, ih_prev);
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
     return ihP;
 }
 
@@ -278,22 +385,24 @@ ih_init(int dev, int vid, Inode ino)
 IHandle_t *
 ih_copy(IHandle_t * ihP)
 {
-    IH_LOCK;
+    struct ih_shard *shard = IH_SHARD(ihP);
+
+    SHARD_LOCK(shard);
     opr_Assert(ih_Inited);
     opr_Assert(ihP->ih_refcnt > 0);
     ihP->ih_refcnt++;
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
     return ihP;
 }
 
 /* Allocate a chunk of file descriptor handles */
-void
-fdHandleAllocateChunk(void)
+static void
+fdHandleAllocateChunk(struct ih_shard *shard)
 {
     int i;
     FdHandle_t *fdP;
 
-    opr_Assert(fdAvailHead == NULL);
+    opr_Assert(shard->fdAvailHead == NULL);
     fdP = malloc(FD_HANDLE_MALLOCSIZE * sizeof(FdHandle_t));
     opr_Assert(fdP != NULL);
     for (i = 0; i < FD_HANDLE_MALLOCSIZE; i++) {
@@ -303,7 +412,8 @@ fdHandleAllocateChunk(void)
 	fdP[i].fd_fd = INVALID_FD;
         fdP[i].fd_ihnext = NULL;
         fdP[i].fd_ihprev = NULL;
-	DLL_INSERT_TAIL(&fdP[i], fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(&fdP[i], shard->fdAvailHead, shard->fdAvailTail,
+			fd_next, fd_prev);
     }
 }
 
@@ -325,17 +435,33 @@ streamHandleAllocateChunk(void)
     }
 }
 
+/*
+ * Account for descriptors closed by their users, rather than evicted from
+ * the cache.  Each gives back a descriptor the shard's cache gave up when
+ * the process ran out of them.  Called with the shard lock held.
+ */
+static void
+ih_fdreleased_r(struct ih_shard *shard, int n)
+{
+    shard->fdInUseCount -= n;
+    for (; n > 0 && shard->fdCacheShrunk > 0; n--) {
+	shard->fdCacheShrunk--;
+	shard->fdCacheSize++;
+    }
+}
+
 /*
  * Get a file descriptor handle given an Inode handle
  * Takes the given file descriptor, and creates a new FdHandle_t for it,
- * attached to the given IHandle_t. If fdLruHead is not NULL, fd can be
- * INVALID_FD, indicating that the caller failed to open the relevant file
- * because we had too many FDs open; ih_attachfd_r will then just evict/close
- * an existing fd in the cache, and return NULL. You must not call this
- * function with an invalid fd while fdLruHead is NULL; instead, error out.
+ * attached to the given IHandle_t. If the shard's fdLruHead is not NULL, fd
+ * can be INVALID_FD, indicating that the caller failed to open the relevant
+ * file because we had too many FDs open; ih_attachfd_r will then just
+ * evict/close an existing fd in the cache, and return NULL. You must not
+ * call this function with an invalid fd while fdLruHead is NULL; instead,
+ * error out.  Called with the shard lock held; may drop and reacquire it.
  */
 static FdHandle_t *
-ih_attachfd_r(IHandle_t *ihP, FD_t fd)
+ih_attachfd_r(struct ih_shard *shard, IHandle_t *ihP, FD_t fd)
 {
     FD_t closeFd;
     FdHandle_t *fdP;
@@ -343,38 +469,45 @@ ih_attachfd_r(IHandle_t *ihP, FD_t fd)
     /* If the given fd is invalid, we must have an available fd to close.
      * Otherwise, the caller must have realized this before calling
      * ih_attachfd_r and yielded an error before getting here. */
-    opr_Assert(fd != INVALID_FD || fdLruHead != NULL);
+    opr_Assert(fd != INVALID_FD || shard->fdLruHead != NULL);
 
     /* fdCacheSize limits the size of the descriptor cache, but
      * we permit the number of open files to exceed fdCacheSize.
      * We only recycle open file descriptors when the number
      * of open files reaches the size of the cache */
-    if ((fdInUseCount > fdCacheSize || fd == INVALID_FD)  && fdLruHead != NULL) {
-	fdP = fdLruHead;
+    if ((shard->fdInUseCount > shard->fdCacheSize || fd == INVALID_FD)
+	&& shard->fdLruHead != NULL) {
+	fdP = shard->fdLruHead;
 	opr_Assert(fdP->fd_status == FD_HANDLE_OPEN);
-	DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	DLL_DELETE(fdP, shard->fdLruHead, shard->fdLruTail, fd_next, fd_prev);
 	DLL_DELETE(fdP, fdP->fd_ih->ih_fdhead, fdP->fd_ih->ih_fdtail,
 		   fd_ihnext, fd_ihprev);
 	closeFd = fdP->fd_fd;
+	shard->evictions++;
 	if (fd == INVALID_FD) {
-	    fdCacheSize--;          /* reduce in order to not run into here too often */
-	    DLL_INSERT_TAIL(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	    /* reduce in order to not run into here too often; see
+	     * ih_fdreleased_r */
+	    shard->fdCacheSize--;
+	    shard->fdCacheShrunk++;
+	    DLL_INSERT_TAIL(fdP, shard->fdAvailHead, shard->fdAvailTail,
+			    fd_next, fd_prev);
 	    fdP->fd_status = FD_HANDLE_AVAIL;
 	    fdP->fd_ih = NULL;
 	    fdP->fd_fd = INVALID_FD;
-	    IH_UNLOCK;
+	    SHARD_UNLOCK(shard);
 	    OS_CLOSE(closeFd);
-	    IH_LOCK;
-	    fdInUseCount -= 1;
+	    SHARD_LOCK(shard);
+	    shard->fdInUseCount -= 1;
 	    return NULL;
 	}
     } else {
-	if (fdAvailHead == NULL) {
-	    fdHandleAllocateChunk();
+	if (shard->fdAvailHead == NULL) {
+	    fdHandleAllocateChunk(shard);
 	}
-	fdP = fdAvailHead;
+	fdP = shard->fdAvailHead;
 	opr_Assert(fdP->fd_status == FD_HANDLE_AVAIL);
-	DLL_DELETE(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_DELETE(fdP, shard->fdAvailHead, shard->fdAvailTail, fd_next,
+		   fd_prev);
 	closeFd = INVALID_FD;
     }
 
@@ -390,10 +523,10 @@ ih_attachfd_r(IHandle_t *ihP, FD_t fd)
 		    fd_ihprev);
 
     if (closeFd != INVALID_FD) {
-	IH_UNLOCK;
+	SHARD_UNLOCK(shard);
 	OS_CLOSE(closeFd);
-	IH_LOCK;
-	fdInUseCount -= 1;
+	SHARD_LOCK(shard);
+	shard->fdInUseCount -= 1;
     }
 
     return fdP;
@@ -402,37 +535,69 @@ ih_attachfd_r(IHandle_t *ihP, FD_t fd)
 FdHandle_t *
 ih_attachfd(IHandle_t *ihP, FD_t fd)
 {
+    struct ih_shard *shard;
     FdHandle_t *fdP;
 
     if (fd == INVALID_FD) {
 	return NULL;
     }
 
-    IH_LOCK;
+    shard = IH_SHARD(ihP);
+    SHARD_LOCK(shard);
 
-    fdInUseCount += 1;
+    shard->fdInUseCount += 1;
 
-    fdP = ih_attachfd_r(ihP, fd);
+    fdP = ih_attachfd_r(shard, ihP, fd);
     opr_Assert(fdP);
 
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
 
     return fdP;
 }
 
+/*
+ * Close the least recently used cached descriptor of some shard other than
+ * the given one, to free a descriptor for it.  Called without any shard
+ * lock held.  Returns 1 if a descriptor was closed, 0 if no other shard had
+ * one cached.
+ */
+static int
+ih_evict_other(struct ih_shard *shard)
+{
+    struct ih_shard *other;
+    FdHandle_t *fdP;
+    int i;
+
+    for (i = 1; i < IH_NSHARDS; i++) {
+	other = &ih_shards[((shard - ih_shards) + i) & (IH_NSHARDS - 1)];
+	SHARD_LOCK(other);
+	if (other->fdLruHead != NULL) {
+	    fdP = ih_attachfd_r(other, NULL, INVALID_FD);
+	    opr_Assert(fdP == NULL);
+	    SHARD_UNLOCK(other);
+	    return 1;
+	}
+	SHARD_UNLOCK(other);
+    }
+    return 0;
+}
+
 /*
  * Get a file descriptor handle given an Inode handle
  */
 FdHandle_t *
 ih_open(IHandle_t * ihP)
 {
+    struct ih_shard *shard;
     FdHandle_t *fdP;
     FD_t fd;
 
     if (!ihP)			/* XXX should log here in the fileserver */
 	return NULL;
 
-    IH_LOCK;
+    shard = IH_SHARD(ihP);
+    SHARD_LOCK(shard);
+    shard->opens++;
 
     /* Do we already have an open file handle for this Inode? */
     for (fdP = ihP->ih_fdtail; fdP != NULL; fdP = fdP->fd_ihprev) {
@@ -457,35 +622,45 @@ ih_open(IHandle_t * ihP)
 	fdP->fd_refcnt++;
 	if (fdP->fd_status == FD_HANDLE_OPEN) {
 	    fdP->fd_status = FD_HANDLE_INUSE;
-	    DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	    DLL_DELETE(fdP, shard->fdLruHead, shard->fdLruTail, fd_next,
+		       fd_prev);
 	}
 	ihP->ih_refcnt++;
-	IH_UNLOCK;
+	shard->hits++;
+	SHARD_UNLOCK(shard);
 	return fdP;
     }
 
     /*
      * Try to open the Inode, return NULL on error.
      */
-    fdInUseCount += 1;
-    IH_UNLOCK;
+    shard->fdInUseCount += 1;
+    SHARD_UNLOCK(shard);
 ih_open_retry:
     fd = OS_IOPEN(ihP);
-    IH_LOCK;
-    if (fd == INVALID_FD && (errno != EMFILE || fdLruHead == NULL) ) {
-	fdInUseCount -= 1;
-	IH_UNLOCK;
+    SHARD_LOCK(shard);
+    if (fd == INVALID_FD && errno == EMFILE && shard->fdLruHead == NULL) {
+	/* Nothing of our own to close; take a descriptor from another shard */
+	SHARD_UNLOCK(shard);
+	if (ih_evict_other(shard))
+	    goto ih_open_retry;
+	SHARD_LOCK(shard);
+	errno = EMFILE;
+    }
+    if (fd == INVALID_FD && (errno != EMFILE || shard->fdLruHead == NULL) ) {
+	shard->fdInUseCount -= 1;
+	SHARD_UNLOCK(shard);
 	return NULL;
     }
 
-    fdP = ih_attachfd_r(ihP, fd);
+    fdP = ih_attachfd_r(shard, ihP, fd);
     if (!fdP) {
 	opr_Assert(fd == INVALID_FD);
-	IH_UNLOCK;
+	SHARD_UNLOCK(shard);
 	goto ih_open_retry;
     }
 
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
 
     return fdP;
 }
@@ -496,27 +671,30 @@ ih_open_retry:
 int
 fd_close(FdHandle_t * fdP)
 {
+    struct ih_shard *shard;
     IHandle_t *ihP;
 
     if (!fdP)
 	return 0;
 
-    IH_LOCK;
+    ihP = fdP->fd_ih;
+    shard = IH_SHARD(ihP);
+
+    SHARD_LOCK(shard);
     opr_Assert(ih_Inited);
-    opr_Assert(fdInUseCount > 0);
+    opr_Assert(shard->fdInUseCount > 0);
     opr_Assert(fdP->fd_status == FD_HANDLE_INUSE ||
                fdP->fd_status == FD_HANDLE_CLOSING);
 
-    ihP = fdP->fd_ih;
-
     /* Call fd_reallyclose to really close the unused file handles if
      * the previous attempt to close (ih_reallyclose()) all file handles
      * failed (this is determined by checking the ihandle for the flag
      * IH_REALLY_CLOSED) or we have too many open files.
      */
     if (fdP->fd_status == FD_HANDLE_CLOSING ||
-        ihP->ih_flags & IH_REALLY_CLOSED || fdInUseCount > fdCacheSize) {
-	IH_UNLOCK;
+        ihP->ih_flags & IH_REALLY_CLOSED
+	|| shard->fdInUseCount > shard->fdCacheSize) {
+	SHARD_UNLOCK(shard);
 	return fd_reallyclose(fdP);
     }
 
@@ -524,7 +702,8 @@ fd_close(FdHandle_t * fdP)
     if (fdP->fd_refcnt == 0) {
 	/* Put this descriptor back into the cache */
 	fdP->fd_status = FD_HANDLE_OPEN;
-	DLL_INSERT_TAIL(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(fdP, shard->fdLruHead, shard->fdLruTail, fd_next,
+			fd_prev);
     }
 
     /* If this is not the only reference to the Inode then we can decrement
@@ -533,9 +712,9 @@ fd_close(FdHandle_t * fdP)
     if (ihP->ih_refcnt > 1)
 	ihP->ih_refcnt--;
     else
-	_ih_release_r(ihP);
+	_ih_release_r(shard, ihP);
 
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
 
     return 0;
 }
@@ -547,25 +726,29 @@ fd_close(FdHandle_t * fdP)
 int
 fd_reallyclose(FdHandle_t * fdP)
 {
+    struct ih_shard *shard;
     FD_t closeFd;
     IHandle_t *ihP;
 
     if (!fdP)
 	return 0;
 
-    IH_LOCK;
+    ihP = fdP->fd_ih;
+    shard = IH_SHARD(ihP);
+
+    SHARD_LOCK(shard);
     opr_Assert(ih_Inited);
-    opr_Assert(fdInUseCount > 0);
+    opr_Assert(shard->fdInUseCount > 0);
     opr_Assert(fdP->fd_status == FD_HANDLE_INUSE ||
                fdP->fd_status == FD_HANDLE_CLOSING);
 
-    ihP = fdP->fd_ih;
     closeFd = fdP->fd_fd;
     fdP->fd_refcnt--;
 
     if (fdP->fd_refcnt == 0) {
 	DLL_DELETE(fdP, ihP->ih_fdhead, ihP->ih_fdtail, fd_ihnext, fd_ihprev);
-	DLL_INSERT_TAIL(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(fdP, shard->fdAvailHead, shard->fdAvailTail, fd_next,
+			fd_prev);
 
 	fdP->fd_status = FD_HANDLE_AVAIL;
 	fdP->fd_refcnt = 0;
@@ -596,10 +779,10 @@ fd_reallyclose(FdHandle_t * fdP)
     }
 
     if (fdP->fd_refcnt == 0) {
-	IH_UNLOCK;
+	SHARD_UNLOCK(shard);
 	OS_CLOSE(closeFd);
-	IH_LOCK;
-	fdInUseCount -= 1;
+	SHARD_LOCK(shard);
+	ih_fdreleased_r(shard, 1);
     }
 
     /* If this is not the only reference to the Inode then we can decrement
@@ -607,9 +790,9 @@ fd_reallyclose(FdHandle_t * fdP)
     if (ihP->ih_refcnt > 1)
 	ihP->ih_refcnt--;
     else
-	_ih_release_r(ihP);
+	_ih_release_r(shard, ihP);
 
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
 
     return 0;
 }
@@ -689,7 +872,7 @@ stream_read(void *ptr, afs_fsize_t size, afs_fsize_t nitems,
 	if (streamP->str_buflen == 0) {
 	    streamP->str_bufoff = 0;
 	    streamP->str_buflen =
-		OS_PREAD(streamP->str_fd, streamP->str_buffer,
+		IH_IO_PREAD(streamP->str_fd, streamP->str_buffer,
 			STREAM_HANDLE_BUFSIZE, streamP->str_fdoff);
 	    if (streamP->str_buflen < 0) {
 		streamP->str_error = errno;
@@ -741,7 +924,7 @@ stream_write(void *ptr, afs_fsize_t size, afs_fsize_t nitems,
     p = (char *)ptr;
     while (nbytes > 0) {
 	if (streamP->str_buflen == 0) {
-	    rc = OS_PWRITE(streamP->str_fd, streamP->str_buffer,
+	    rc = IH_IO_PWRITE(streamP->str_fd, streamP->str_buffer,
 			  STREAM_HANDLE_BUFSIZE, streamP->str_fdoff);
 	    if (rc < 0) {
 		streamP->str_error = errno;
@@ -777,7 +960,7 @@ stream_aseek(StreamHandle_t * streamP, afs_foff_t offset)
 
     if (streamP->str_direction == STREAM_DIRECTION_WRITE
 	&& streamP->str_bufoff > 0) {
-	rc = OS_PWRITE(streamP->str_fd, streamP->str_buffer,
+	rc = IH_IO_PWRITE(streamP->str_fd, streamP->str_buffer,
 		      streamP->str_bufoff, streamP->str_fdoff);
 	if (rc < 0) {
 	    streamP->str_error = errno;
@@ -801,7 +984,7 @@ stream_flush(StreamHandle_t * streamP)
 
     if (streamP->str_direction == STREAM_DIRECTION_WRITE
 	&& streamP->str_bufoff > 0) {
-	rc = OS_PWRITE(streamP->str_fd, streamP->str_buffer,
+	rc = IH_IO_PWRITE(streamP->str_fd, streamP->str_buffer,
 		      streamP->str_bufoff, streamP->str_fdoff);
 	if (rc < 0) {
 	    streamP->str_error = errno;
@@ -826,7 +1009,7 @@ stream_close(StreamHandle_t * streamP, int reallyClose)
     opr_Assert(streamP != NULL);
     if (streamP->str_direction == STREAM_DIRECTION_WRITE
 	&& streamP->str_bufoff > 0) {
-	rc = OS_PWRITE(streamP->str_fd, streamP->str_buffer,
+	rc = IH_IO_PWRITE(streamP->str_fd, streamP->str_buffer,
 		      streamP->str_bufoff, streamP->str_fdoff);
 	if (rc < 0) {
 	    retval = -1;
@@ -850,12 +1033,12 @@ stream_close(StreamHandle_t * streamP, int reallyClose)
 }
 
 /* Close all unused file descriptors associated with the inode
- * handle. Called with IH_LOCK held. May drop and reacquire
- * IH_LOCK. Sets the IH_REALLY_CLOSED flag in the inode handle
+ * handle. Called with the shard lock held. May drop and reacquire
+ * it. Sets the IH_REALLY_CLOSED flag in the inode handle
  * if it fails to close all file handles.
  */
 static int
-ih_fdclose(IHandle_t * ihP)
+ih_fdclose(struct ih_shard *shard, IHandle_t * ihP)
 {
     int closeCount, closedAll;
     FdHandle_t *fdP, *head, *tail, *next;
@@ -884,7 +1067,8 @@ ih_fdclose(IHandle_t * ihP)
 	     * off here. */
 	    DLL_DELETE(fdP, ihP->ih_fdhead, ihP->ih_fdtail, fd_ihnext,
 		       fd_ihprev);
-	    DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	    DLL_DELETE(fdP, shard->fdLruHead, shard->fdLruTail, fd_next,
+		       fd_prev);
 	    DLL_INSERT_TAIL(fdP, head, tail, fd_next, fd_prev);
 	} else {
 	    closedAll = 0;
@@ -906,7 +1090,7 @@ ih_fdclose(IHandle_t * ihP)
 	return 0;		/* No file descriptors closed */
     }
 
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
     /*
      * Close the file descriptors
      */
@@ -920,20 +1104,20 @@ ih_fdclose(IHandle_t * ihP)
 	closeCount++;
     }
 
-    IH_LOCK;
-    opr_Assert(fdInUseCount >= closeCount);
-    fdInUseCount -= closeCount;
+    SHARD_LOCK(shard);
+    opr_Assert(shard->fdInUseCount >= closeCount);
+    ih_fdreleased_r(shard, closeCount);
 
     /*
      * Append the temporary queue to the list of available descriptors
      */
-    if (fdAvailHead == NULL) {
-	fdAvailHead = head;
-	fdAvailTail = tail;
+    if (shard->fdAvailHead == NULL) {
+	shard->fdAvailHead = head;
+	shard->fdAvailTail = tail;
     } else {
-	fdAvailTail->fd_next = head;
-	head->fd_prev = fdAvailTail;
-	fdAvailTail = tail;
+	shard->fdAvailTail->fd_next = head;
+	head->fd_prev = shard->fdAvailTail;
+	shard->fdAvailTail = tail;
     }
 
     return 0;
@@ -943,37 +1127,40 @@ ih_fdclose(IHandle_t * ihP)
 int
 ih_reallyclose(IHandle_t * ihP)
 {
+    struct ih_shard *shard;
+
     if (!ihP)
 	return 0;
 
-    IH_LOCK;
+    shard = IH_SHARD(ihP);
+    SHARD_LOCK(shard);
     ihP->ih_refcnt++;   /* must not disappear over unlock */
     if (ihP->ih_synced) {
 	FdHandle_t *fdP;
 	opr_Assert(vol_io_params.sync_behavior != IH_SYNC_ALWAYS);
 	opr_Assert(vol_io_params.sync_behavior != IH_SYNC_NEVER);
         ihP->ih_synced = 0;
-	IH_UNLOCK;
+	SHARD_UNLOCK(shard);
 
 	fdP = IH_OPEN(ihP);
 	if (fdP) {
-	    OS_SYNC(fdP->fd_fd);
+	    IH_IO_SYNC(fdP->fd_fd);
 	    FDH_CLOSE(fdP);
 	}
 
-	IH_LOCK;
+	SHARD_LOCK(shard);
     }
 
     opr_Assert(ihP->ih_refcnt > 0);
 
-    ih_fdclose(ihP);
+    ih_fdclose(shard, ihP);
 
     if (ihP->ih_refcnt > 1)
 	ihP->ih_refcnt--;
     else
-	_ih_release_r(ihP);
+	_ih_release_r(shard, ihP);
 
-    IH_UNLOCK;
+    SHARD_UNLOCK(shard);
     return 0;
 }
 
@@ -981,7 +1168,7 @@ ih_reallyclose(IHandle_t * ihP)
  * inode are closed when the last reference to this handle is released
  */
 static int
-_ih_release_r(IHandle_t * ihP)
+_ih_release_r(struct ih_shard *shard, IHandle_t * ihP)
 {
     int ihash;
 
@@ -999,11 +1186,12 @@ _ih_release_r(IHandle_t * ihP)
     DLL_DELETE(ihP, ihashTable[ihash].ihash_head,
 	       ihashTable[ihash].ihash_tail, ih_next, ih_prev);
 
-    ih_fdclose(ihP);
+    ih_fdclose(shard, ihP);
 
     ihP->ih_refcnt--;
 
-    DLL_INSERT_TAIL(ihP, ihAvailHead, ihAvailTail, ih_next, ih_prev);
+    DLL_INSERT_TAIL(ihP, shard->ihAvailHead, shard->ihAvailTail, ih_next,
+		    ih_prev);
 
     return 0;
 }
@@ -1014,17 +1202,45 @@ _ih_release_r(IHandle_t * ihP)
 int
 ih_release(IHandle_t * ihP)
 {
+    struct ih_shard *shard;
     int ret;
 
     if (!ihP)
 	return 0;
 
-    IH_LOCK;
-    ret = _ih_release_r(ihP);
-    IH_UNLOCK;
+    shard = IH_SHARD(ihP);
+    SHARD_LOCK(shard);
+    ret = _ih_release_r(shard, ihP);
+    SHARD_UNLOCK(shard);
     return ret;
 }
 
+/**
+ * Log the state of each file descriptor cache shard.
+ */
+void
+ih_PrintStats(void)
+{
+    struct ih_shard *shard;
+    afs_uint64 opens, hits, evictions;
+    int i, inUse, cacheSize;
+
+    for (i = 0; i < IH_NSHARDS; i++) {
+	shard = &ih_shards[i];
+	SHARD_LOCK(shard);
+	opens = shard->opens;
+	hits = shard->hits;
+	evictions = shard->evictions;
+	inUse = shard->fdInUseCount;
+	cacheSize = shard->fdCacheSize;
+	SHARD_UNLOCK(shard);
+	ViceLog(0, ("File descriptor cache shard %d: %d open of %d; "
+		    "%llu opens, %llu hits (%d%%), %llu evictions\n", i,
+		    inUse, cacheSize, opens, hits,
+		    opens ? (int)(hits * 100 / opens) : 0, evictions));
+    }
+}
+
 /* Sync an inode to disk if its handle isn't NULL */
 int
 ih_condsync(IHandle_t * ihP)
@@ -1068,6 +1284,31 @@ ih_icreate(IHandle_t * ih, int dev, char *part, Inode nI, int p1, int p2,
     ino = ICREATE(dev, part, nI, p1, p2, p3, p4);
     return ino;
 }
+
+/* Inode link counts live in the filesystem, so there is nothing to batch */
+int
+ih_incMulti(IHandle_t * ih, Inode * inos, int ninos, int p1)
+{
+    int i;
+
+    for (i = 0; i < ninos; i++) {
+	if (IH_INC(ih, inos[i], p1) == -1)
+	    break;
+    }
+    return i;
+}
+
+int
+ih_decMulti(IHandle_t * ih, Inode * inos, int ninos, int p1)
+{
+    int i;
+
+    for (i = 0; i < ninos; i++) {
+	if (IH_DEC(ih, inos[i], p1) == -1)
+	    break;
+    }
+    return i;
+}
 #endif /* AFS_NAMEI_ENV */
 
 #if defined(AFS_NT40_ENV) || !defined(AFS_NAMEI_ENV)
@@ -1145,7 +1386,7 @@ ih_fdsync(FdHandle_t *fdP)
 {
     switch (vol_io_params.sync_behavior) {
     case IH_SYNC_ALWAYS:
-	return OS_SYNC(fdP->fd_fd);
+	return IH_IO_SYNC(fdP->fd_fd);
     case IH_SYNC_ONCLOSE:
 	if (fdP->fd_ih) {
 	    fdP->fd_ih->ih_synced = 1;
@@ -1159,6 +1400,652 @@ ih_fdsync(FdHandle_t *fdP)
     }
 }
 
+/**
+ * Copy part of one file to the same place in another without passing the
+ * data through user space.
+ *
+ * Where the filesystem can share blocks between files, as XFS and btrfs
+ * can, a whole file copied into an empty one is cloned in constant time.
+ * Otherwise the kernel copies what it can with copy_file_range.  Whatever
+ * is not copied here, the caller copies itself.
+ *
+ * @param[in] from    file to copy from
+ * @param[in] to      file to copy to
+ * @param[in] offset  where the range starts in both files
+ * @param[in] length  bytes to copy, no more than from holds past offset
+ *
+ * @return how many bytes from the start of the range were copied; errors
+ *         are left for the caller's own copy to find
+ */
+afs_sfsize_t
+ih_copyrange(FD_t from, FD_t to, afs_foff_t offset, afs_fsize_t length)
+{
+    afs_sfsize_t done = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+    loff_t inoff, outoff;
+    ssize_t n;
+#endif
+
+#ifdef FICLONE
+    if (offset == 0 && length > 0 && ih_size(to) == 0
+	&& ih_size(from) == length && ioctl(to, FICLONE, from) == 0)
+	return length;
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+    while (done < length) {
+	inoff = outoff = offset + done;
+	n = copy_file_range(from, &inoff, to, &outoff, length - done, 0);
+	if (n <= 0)
+	    break;
+	done += n;
+    }
+#endif
+    return done;
+}
+
+#ifdef AFS_IH_URING_ENV
+/*
+ * io_uring backend.
+ *
+ * Each thread that does file I/O gets a small ring of its own the first
+ * time it needs one, so submitting needs no locking.  Reads, writes and
+ * syncs are submitted and then waited for, so callers see exactly what the
+ * system calls would have returned.  A batch of reads (see FDH_PREADM) is
+ * submitted all at once and then waited for, so the device has all of it
+ * to work on together.  Read-ahead hints for a file are submitted together
+ * and nobody waits for them, so a batch of hints, a batch of reads, or a
+ * vectored request, costs one system call.  No request is left queued once
+ * the call that made it returns: a queued request names only a raw
+ * descriptor, which the descriptor cache may close and reuse as soon as the
+ * caller lets go of its FdHandle.
+ *
+ * A ring's descriptor is charged to one of the descriptor cache's shards,
+ * as if it were a cached file, so that the rings and the cache together
+ * stay within fdMaxCacheSize.
+ *
+ * A thread that cannot set up a ring, for instance because the kernel has
+ * io_uring disabled, uses the system calls instead.
+ */
+#define IH_URING_ENTRIES	64
+#define IH_URING_HINT	0	/* user_data of requests nobody waits for */
+#define IH_URING_RETRIES	100	/* io_uring_enter calls while busy */
+
+struct ih_uring_ring {
+    int fd;
+    struct ih_shard *shard;	/* charged with fd */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_entries;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+    unsigned queued;		/* requests not yet handed to the kernel */
+    int done;			/* waited-for requests that have completed */
+};
+
+/* A request somebody waits for; its address is the user_data */
+struct ih_uring_req {
+    unsigned pos;		/* its place in the submission queue */
+    int res;
+};
+
+int ih_uring = 0;		/* set by ih_UseIOUring */
+static pthread_once_t ih_uring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ih_uring_key;
+static struct ih_uring_ring ih_uring_none;	/* thread has no ring */
+static int ih_uring_warned;
+
+static int
+ih_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+#ifdef __NR_io_uring_setup
+    return syscall(__NR_io_uring_setup, entries, p);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int
+ih_uring_syscall(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+#ifdef __NR_io_uring_enter
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void
+ih_uring_free(void *rock)
+{
+    struct ih_uring_ring *r = rock;
+
+    if (r == NULL || r == &ih_uring_none)
+	return;
+    if (r->sqes != NULL)
+	munmap(r->sqes, r->sqes_len);
+    if (r->cq_map != NULL && r->cq_map != r->sq_map)
+	munmap(r->cq_map, r->cq_len);
+    if (r->sq_map != NULL)
+	munmap(r->sq_map, r->sq_len);
+    if (r->fd >= 0) {
+	close(r->fd);
+	SHARD_LOCK(r->shard);
+	ih_fdreleased_r(r->shard, 1);
+	SHARD_UNLOCK(r->shard);
+    }
+    free(r);
+}
+
+static void
+ih_uring_keyinit(void)
+{
+    opr_Verify(pthread_key_create(&ih_uring_key, ih_uring_free) == 0);
+}
+
+static void *
+ih_uring_map(struct ih_uring_ring *r, size_t len, off_t what)
+{
+    void *p;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	     r->fd, what);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* Get this thread's ring, setting it up if need be */
+static struct ih_uring_ring *
+ih_uring_get(void)
+{
+    struct io_uring_params p;
+    struct ih_uring_ring *r;
+    char *sq, *cq;
+    static unsigned int nrings;
+
+    opr_Verify(pthread_once(&ih_uring_once, ih_uring_keyinit) == 0);
+    r = pthread_getspecific(ih_uring_key);
+    if (r != NULL)
+	return (r == &ih_uring_none) ? NULL : r;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+	goto fail;
+    memset(&p, 0, sizeof(p));
+    r->fd = ih_uring_setup(IH_URING_ENTRIES, &p);
+    if (r->fd < 0)
+	goto fail;
+    r->shard = &ih_shards[__atomic_fetch_add(&nrings, 1, __ATOMIC_RELAXED)
+			  & (IH_NSHARDS - 1)];
+    SHARD_LOCK(r->shard);
+    r->shard->fdInUseCount++;
+    SHARD_UNLOCK(r->shard);
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (r->cq_len > r->sq_len)
+	    r->sq_len = r->cq_len;
+	r->cq_len = r->sq_len;
+    }
+#endif
+    r->sq_map = ih_uring_map(r, r->sq_len, IORING_OFF_SQ_RING);
+    if (r->sq_map == NULL)
+	goto fail;
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	r->cq_map = r->sq_map;
+    else
+#endif
+    if ((r->cq_map = ih_uring_map(r, r->cq_len, IORING_OFF_CQ_RING)) == NULL)
+	goto fail;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = ih_uring_map(r, r->sqes_len, IORING_OFF_SQES);
+    if (r->sqes == NULL)
+	goto fail;
+
+    sq = r->sq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq = r->cq_map;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    opr_Verify(pthread_setspecific(ih_uring_key, r) == 0);
+    return r;
+
+  fail:
+    if (!ih_uring_warned) {
+	ih_uring_warned = 1;
+	ViceLog(0, ("io_uring is not available (errno %d); using system "
+		    "calls for file I/O\n", errno));
+    }
+    if (r != NULL)
+	ih_uring_free(r);
+    opr_Verify(pthread_setspecific(ih_uring_key, &ih_uring_none) == 0);
+    return NULL;
+}
+
+/* Consume completions, noting the results of waited-for requests */
+static void
+ih_uring_reap(struct ih_uring_ring *r)
+{
+    struct io_uring_cqe *cqe;
+    struct ih_uring_req *req;
+    unsigned head, tail;
+
+    head = *r->cq_head;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+	cqe = &r->cqes[head & *r->cq_mask];
+	if (cqe->user_data != IH_URING_HINT) {
+	    req = (struct ih_uring_req *)(uintptr_t)cqe->user_data;
+	    req->res = cqe->res;
+	    r->done++;
+	}
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Hand queued requests to the kernel, and wait for up to wait completions */
+static int
+ih_uring_enter(struct ih_uring_ring *r, unsigned wait)
+{
+    int n;
+    int busy = 0;
+
+    for (;;) {
+	n = ih_uring_syscall(r->fd, r->queued, wait,
+			     wait ? IORING_ENTER_GETEVENTS : 0);
+	if (n >= 0) {
+	    r->queued -= (n < r->queued) ? n : r->queued;
+	    return 0;
+	}
+	if (errno == EINTR)
+	    continue;
+	if ((errno == EAGAIN || errno == EBUSY) && busy++ < IH_URING_RETRIES) {
+	    /* completion queue full; empty it and try again */
+	    ih_uring_reap(r);
+	    if (wait && r->done)
+		return 0;
+	    continue;
+	}
+	return -1;
+    }
+}
+
+/* Drop requests the kernel has not been given; only ever hints or the
+ * requests about to fall back to system calls */
+static void
+ih_uring_drop(struct ih_uring_ring *r)
+{
+    __atomic_store_n(r->sq_tail, __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE),
+		     __ATOMIC_RELEASE);
+    r->queued = 0;
+}
+
+static struct io_uring_sqe *
+ih_uring_sqe(struct ih_uring_ring *r)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *r->sq_tail;
+
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= *r->sq_entries) {
+	/* full of hints; start them to make room */
+	if (ih_uring_enter(r, 0) < 0)
+	    ih_uring_drop(r);
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= *r->sq_entries)
+	    return NULL;
+    }
+    sqe = &r->sqes[tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* How many more requests can be queued without starting any */
+static unsigned
+ih_uring_space(struct ih_uring_ring *r)
+{
+    return *r->sq_entries
+	- (*r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/* Queue the request filled in on the sqe ih_uring_sqe returned; req is
+ * NULL for a hint */
+static void
+ih_uring_queue(struct ih_uring_ring *r, struct io_uring_sqe *sqe,
+	       struct ih_uring_req *req)
+{
+    unsigned tail = *r->sq_tail;
+
+    if (req != NULL) {
+	req->pos = tail;
+	sqe->user_data = (uintptr_t)req;
+    } else {
+	sqe->user_data = IH_URING_HINT;
+    }
+    r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+}
+
+/* Stop using this thread's ring; its I/O goes to the system calls */
+static void
+ih_uring_retire(struct ih_uring_ring *r)
+{
+    ih_uring_free(r);
+    opr_Verify(pthread_setspecific(ih_uring_key, &ih_uring_none) == 0);
+}
+
+/*
+ * Submit the nreqs requests just queued, along with any queued hints, and
+ * wait for them.  Returns how many of them completed, with their results;
+ * the kernel never saw the rest, which the caller should make with system
+ * calls itself.
+ *
+ * If io_uring_enter fails once the kernel has a request, the request
+ * cannot be made again with a system call.  Its completion is polled for,
+ * and the thread then stops using its ring.
+ */
+static int
+ih_uring_wait(struct ih_uring_ring *r, struct ih_uring_req *reqs, int nreqs)
+{
+    unsigned head;
+    int failed = 0;
+
+    r->done = 0;
+    for (;;) {
+	ih_uring_reap(r);
+	if (r->done >= nreqs)
+	    break;
+	if (failed) {
+	    usleep(1000);
+	    continue;
+	}
+	if (ih_uring_enter(r, nreqs - r->done) == 0)
+	    continue;
+	if (r->queued > 0) {
+	    /* the kernel never saw the last of them */
+	    head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	    while (nreqs > 0 && (int)(reqs[nreqs - 1].pos - head) >= 0)
+		nreqs--;
+	    ih_uring_drop(r);
+	    if (nreqs == 0)
+		return 0;
+	    continue;
+	}
+	ViceLog(0, ("io_uring_enter failed (errno %d); using system calls "
+		    "for file I/O in this thread\n", errno));
+	failed = 1;
+    }
+    if (failed)
+	ih_uring_retire(r);
+    return nreqs;
+}
+
+/* The result of a completed request, as the system call would return it */
+static ssize_t
+ih_uring_result(struct ih_uring_req *req)
+{
+    if (req->res < 0) {
+	errno = -req->res;
+	return -1;
+    }
+    return req->res;
+}
+
+/*
+ * Submit one request, along with any queued hints, and wait for it.
+ * Returns 0 with the request's result in *res, or -1 if the ring could not
+ * take it and the caller should make the system call itself.
+ */
+static int
+ih_uring_do(int opcode, FD_t fd, const void *addr, unsigned len,
+	    afs_foff_t offset, ssize_t *res)
+{
+    struct ih_uring_ring *r;
+    struct io_uring_sqe *sqe;
+    struct ih_uring_req req;
+
+    r = ih_uring_get();
+    if (r == NULL || (sqe = ih_uring_sqe(r)) == NULL)
+	return -1;
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)addr;
+    sqe->len = len;
+    sqe->off = offset;
+    ih_uring_queue(r, sqe, &req);
+    if (ih_uring_wait(r, &req, 1) == 0)
+	return -1;
+    *res = ih_uring_result(&req);
+    return 0;
+}
+
+/* Larger requests go to the system calls, as a completion only has room
+ * for an int result */
+#define IH_URING_MAXIO	(1 << 30)
+
+#ifdef HAVE_PIOV
+static size_t
+ih_uring_iovlen(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+	len += iov[i].iov_len;
+    return len;
+}
+
+ssize_t
+ih_uring_preadv(FD_t fd, const struct iovec *iov, int iovcnt,
+		afs_foff_t offset)
+{
+    ssize_t res;
+
+    if (ih_uring_iovlen(iov, iovcnt) > IH_URING_MAXIO
+	|| ih_uring_do(IORING_OP_READV, fd, iov, iovcnt, offset, &res) < 0)
+	return OS_PREADV(fd, iov, iovcnt, offset);
+    return res;
+}
+
+ssize_t
+ih_uring_pwritev(FD_t fd, const struct iovec *iov, int iovcnt,
+		 afs_foff_t offset)
+{
+    ssize_t res;
+
+    if (ih_uring_iovlen(iov, iovcnt) > IH_URING_MAXIO
+	|| ih_uring_do(IORING_OP_WRITEV, fd, iov, iovcnt, offset, &res) < 0)
+	return OS_PWRITEV(fd, iov, iovcnt, offset);
+    return res;
+}
+#endif /* HAVE_PIOV */
+
+ssize_t
+ih_uring_pread(FD_t fd, void *buf, size_t count, afs_foff_t offset)
+{
+    struct iovec iov;
+    ssize_t res;
+
+    iov.iov_base = buf;
+    iov.iov_len = count;
+    if (count > IH_URING_MAXIO
+	|| ih_uring_do(IORING_OP_READV, fd, &iov, 1, offset, &res) < 0)
+	return OS_PREAD(fd, buf, count, offset);
+    return res;
+}
+
+ssize_t
+ih_uring_pwrite(FD_t fd, const void *buf, size_t count, afs_foff_t offset)
+{
+    struct iovec iov;
+    ssize_t res;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = count;
+    if (count > IH_URING_MAXIO
+	|| ih_uring_do(IORING_OP_WRITEV, fd, &iov, 1, offset, &res) < 0)
+	return OS_PWRITE(fd, buf, count, offset);
+    return res;
+}
+
+int
+ih_uring_fsync(FD_t fd)
+{
+    ssize_t res;
+
+    if (ih_uring_do(IORING_OP_FSYNC, fd, NULL, 0, 0, &res) < 0)
+	return OS_SYNC(fd);
+    return (int)res;
+}
+
+/*
+ * Submit a batch of reads from one file and wait for them all.  Returns how
+ * many of them were made; the caller reads the rest with system calls.
+ */
+static int
+ih_uring_preadm(FD_t fd, struct ih_io *ios, int nios)
+{
+    struct ih_uring_ring *r;
+    struct io_uring_sqe *sqe;
+    struct ih_uring_req reqs[IH_URING_ENTRIES];
+    struct iovec iov[IH_URING_ENTRIES];
+    int i = 0, j, n, done;
+
+    while (i < nios) {
+	r = ih_uring_get();
+	if (r == NULL || (sqe = ih_uring_sqe(r)) == NULL)
+	    break;
+	/* as many as fit without starting any */
+	n = nios - i;
+	if (n > ih_uring_space(r))
+	    n = ih_uring_space(r);
+	if (n > IH_URING_ENTRIES)
+	    n = IH_URING_ENTRIES;
+	for (j = 0; j < n; j++) {
+	    if (j > 0)
+		sqe = ih_uring_sqe(r);
+	    if (ios[i + j].length > IH_URING_MAXIO)
+		break;
+	    iov[j].iov_base = ios[i + j].buf;
+	    iov[j].iov_len = ios[i + j].length;
+	    sqe->opcode = IORING_OP_READV;
+	    sqe->fd = fd;
+	    sqe->addr = (unsigned long)&iov[j];
+	    sqe->len = 1;
+	    sqe->off = ios[i + j].offset;
+	    ih_uring_queue(r, sqe, &reqs[j]);
+	}
+	if (j == 0)
+	    break;
+	done = ih_uring_wait(r, reqs, j);
+	for (n = 0; n < done; n++, i++) {
+	    ios[i].result = ih_uring_result(&reqs[n]);
+	    ios[i].error = (ios[i].result < 0) ? errno : 0;
+	}
+	if (done < j)
+	    break;
+    }
+    return i;
+}
+
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+/*
+ * Submit read-ahead hints for ranges of a file, without waiting for them.
+ * Returns how many ranges were dealt with; the caller gives the kernel the
+ * rest with posix_fadvise.  A hint the kernel refuses is simply lost.
+ */
+static int
+ih_uring_willneed(FD_t fd, struct ih_range *ranges, int nranges)
+{
+    int i = 0;
+#if HAVE_DECL_IORING_OP_FADVISE
+    struct ih_uring_ring *r;
+    struct io_uring_sqe *sqe;
+
+    r = ih_uring_get();
+    if (r == NULL)
+	return 0;
+    for (; i < nranges; i++) {
+	if ((sqe = ih_uring_sqe(r)) == NULL)
+	    break;
+	sqe->opcode = IORING_OP_FADVISE;
+	sqe->fd = fd;
+	sqe->off = ranges[i].offset;
+	/* 0 is to the end */
+	sqe->len = (ranges[i].length > UINT_MAX) ? 0 : ranges[i].length;
+	sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+	ih_uring_queue(r, sqe, NULL);
+    }
+    if (r->queued > 0) {
+	(void)ih_uring_enter(r, 0);
+	if (r->queued > 0)
+	    ih_uring_drop(r);
+    }
+    ih_uring_reap(r);
+#else
+    /* headers older than Linux 5.6 have no IORING_OP_FADVISE */
+#endif
+    return i;
+}
+#endif
+#endif /* AFS_IH_URING_ENV */
+
+/* Read a batch of ranges of an open file; see FDH_PREADM */
+void
+ih_preadm(FdHandle_t *fdP, struct ih_io *ios, int nios)
+{
+    int i = 0;
+
+#ifdef AFS_IH_URING_ENV
+    if (ih_uring)
+	i = ih_uring_preadm(fdP->fd_fd, ios, nios);
+#endif
+    for (; i < nios; i++) {
+	ios[i].result = OS_PREAD(fdP->fd_fd, ios[i].buf, ios[i].length,
+				 ios[i].offset);
+	ios[i].error = (ios[i].result < 0) ? errno : 0;
+    }
+}
+
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+/* Hint that ranges of an open file will be read soon; see FDH_WILLNEED */
+int
+ih_willneed(FdHandle_t *fdP, struct ih_range *ranges, int nranges)
+{
+    int i = 0, code = 0;
+
+#ifdef AFS_IH_URING_ENV
+    if (ih_uring)
+	i = ih_uring_willneed(fdP->fd_fd, ranges, nranges);
+#endif
+    for (; i < nranges; i++) {
+	if (posix_fadvise(fdP->fd_fd, ranges[i].offset, ranges[i].length,
+			  POSIX_FADV_WILLNEED) != 0)
+	    code = -1;
+    }
+    return code;
+}
+#endif
+
 #ifdef AFS_NT40_ENV
 
 static int
@@ -56,12 +56,15 @@
  *	file descriptor.
  * IH_IREAD/IH_IWRITE - read/write an Inode.
  * IH_INC/IH_DEC - increment/decrement the link count.
+ * IH_INCMULTI/IH_DECMULTI - increment/decrement the link counts of many
+ *	inodes at once.
  *
  * Replacements for C runtime file operations
  * FDH_CLOSE - return a file descriptor to the cache
  * FDH_REALLYCLOSE - Close a file descriptor, do not return to the cache
  * FDH_SYNC - Unconditionally sync an open file.
  * FDH_TRUNC - Truncate a file
+ * FDH_COPYRANGE - copy part of a file to another inside the kernel
  * FDH_LOCKFILE - Lock a whole file
  * FDH_UNLOCKFILE - Unlock a whole file
  *
@@ -325,7 +328,9 @@ extern FD_t *ih_fdopen(FdHandle_t * h, char *fdperms);
 extern void ih_PkgDefaults(void);
 extern void ih_Initialize(void);
 extern void ih_UseLargeCache(void);
+extern void ih_PrintStats(void);
 extern int ih_SetSyncBehavior(const char *behavior);
+extern int ih_UseIOUring(void);
 extern IHandle_t *ih_init(int /*@alt Device@ */ dev, int /*@alt VolId@ */ vid,
 			  Inode ino);
 extern IHandle_t *ih_copy(IHandle_t * ihP);
@@ -407,6 +412,32 @@ extern ssize_t ih_pwrite(FD_t fd, const void * buf, size_t count, afs_foff_t off
 # define OS_PWRITE(FD, B, S, O) ih_pwrite(FD, B, S, O)
 #endif
 
+/* File data I/O goes through io_uring instead of the system calls above
+ * when ih_UseIOUring has been called; see ihandle.c. */
+#if defined(AFS_LINUX_ENV) && defined(AFS_PTHREAD_ENV) \
+    && defined(HAVE_LINUX_IO_URING_H)
+# define AFS_IH_URING_ENV 1
+extern int ih_uring;
+extern ssize_t ih_uring_pread(FD_t fd, void *buf, size_t count,
+			      afs_foff_t offset);
+extern ssize_t ih_uring_pwrite(FD_t fd, const void *buf, size_t count,
+			       afs_foff_t offset);
+extern ssize_t ih_uring_preadv(FD_t fd, const struct iovec *iov, int iovcnt,
+			       afs_foff_t offset);
+extern ssize_t ih_uring_pwritev(FD_t fd, const struct iovec *iov, int iovcnt,
+				afs_foff_t offset);
+extern int ih_uring_fsync(FD_t fd);
+# define IH_IO_PREAD(FD, B, S, O) \
+    (ih_uring ? ih_uring_pread(FD, B, S, O) : OS_PREAD(FD, B, S, O))
+# define IH_IO_PWRITE(FD, B, S, O) \
+    (ih_uring ? ih_uring_pwrite(FD, B, S, O) : OS_PWRITE(FD, B, S, O))
+# define IH_IO_SYNC(FD) (ih_uring ? ih_uring_fsync(FD) : OS_SYNC(FD))
+#else
+# define IH_IO_PREAD(FD, B, S, O) OS_PREAD(FD, B, S, O)
+# define IH_IO_PWRITE(FD, B, S, O) OS_PWRITE(FD, B, S, O)
+# define IH_IO_SYNC(FD) OS_SYNC(FD)
+#endif
+
 #ifdef AFS_NT40_ENV
 # define OS_LOCKFILE(FD, O) (!LockFile(FD, (DWORD)((O) & 0xFFFFFFFF), (DWORD)((O) >> 32), 2, 0))
 # define OS_UNLOCKFILE(FD, O) (!UnlockFile(FD, (DWORD)((O) & 0xFFFFFFFF), (DWORD)((O) >> 32), 2, 0))
@@ -504,6 +535,8 @@ extern int OS_TRUNC(FD_t FD, OFFT L);
 # endif /* AFS_NT40_ENV */
 # define IH_INC(H, I, P) namei_inc(H, I, P)
 # define IH_DEC(H, I, P) namei_dec(H, I, P)
+# define IH_INCMULTI(H, I, N, P) namei_incMulti(H, I, N, P)
+# define IH_DECMULTI(H, I, N, P) namei_decMulti(H, I, N, P)
 # define IH_IREAD(H, O, B, S) namei_iread(H, O, B, S)
 # define IH_IWRITE(H, O, B, S) namei_iwrite(H, O, B, S)
 # define IH_CREATE(H, D, P, N, P1, P2, P3, P4) \
@@ -518,6 +551,11 @@ extern Inode ih_icreate(IHandle_t * ih, int dev, char *part, Inode nI, int p1,
 # define IH_CREATE(H, D, P, N, P1, P2, P3, P4) \
         ih_icreate(H, D, P, N, P1, P2, P3, P4)
 
+extern int ih_incMulti(IHandle_t * ih, Inode * inos, int ninos, int p1);
+# define IH_INCMULTI(H, I, N, P) ih_incMulti(H, I, N, P)
+extern int ih_decMulti(IHandle_t * ih, Inode * inos, int ninos, int p1);
+# define IH_DECMULTI(H, I, N, P) ih_decMulti(H, I, N, P)
+
 # ifdef AFS_LINUX_ENV
 #  define OS_IOPEN(H) -1
 # else
@@ -561,18 +599,31 @@ extern Inode ih_icreate(IHandle_t * ih, int dev, char *part, Inode nI, int p1,
 #define OS_SIZE(FD) ih_size(FD)
 extern afs_sfsize_t ih_size(FD_t);
 
+#define OS_COPYRANGE(F, T, O, L) ih_copyrange(F, T, O, L)
+extern afs_sfsize_t ih_copyrange(FD_t from, FD_t to, afs_foff_t offset,
+				 afs_fsize_t length);
+
 #ifdef HAVE_PIOV
 # ifdef O_LARGEFILE
-#  define FDH_PREADV(H, I, N, O) preadv64((H)->fd_fd, I, N, O)
-#  define FDH_PWRITEV(H, I, N, O) pwritev64((H)->fd_fd, I, N, O)
+#  define OS_PREADV(FD, I, N, O) preadv64(FD, I, N, O)
+#  define OS_PWRITEV(FD, I, N, O) pwritev64(FD, I, N, O)
 # else /* !O_LARGEFILE */
-#  define FDH_PREADV(H, I, N, O) preadv((H)->fd_fd, I, N, O)
-#  define FDH_PWRITEV(H, I, N, O) pwritev((H)->fd_fd, I, N, O)
+#  define OS_PREADV(FD, I, N, O) preadv(FD, I, N, O)
+#  define OS_PWRITEV(FD, I, N, O) pwritev(FD, I, N, O)
 # endif /* !O_LARGEFILE */
+# ifdef AFS_IH_URING_ENV
+#  define FDH_PREADV(H, I, N, O) (ih_uring ? \
+    ih_uring_preadv((H)->fd_fd, I, N, O) : OS_PREADV((H)->fd_fd, I, N, O))
+#  define FDH_PWRITEV(H, I, N, O) (ih_uring ? \
+    ih_uring_pwritev((H)->fd_fd, I, N, O) : OS_PWRITEV((H)->fd_fd, I, N, O))
+# else
+#  define FDH_PREADV(H, I, N, O) OS_PREADV((H)->fd_fd, I, N, O)
+#  define FDH_PWRITEV(H, I, N, O) OS_PWRITEV((H)->fd_fd, I, N, O)
+# endif
 #endif
 
-#define FDH_PREAD(H, B, S, O) OS_PREAD((H)->fd_fd, B, S, O)
-#define FDH_PWRITE(H, B, S, O) OS_PWRITE((H)->fd_fd, B, S, O)
+#define FDH_PREAD(H, B, S, O) IH_IO_PREAD((H)->fd_fd, B, S, O)
+#define FDH_PWRITE(H, B, S, O) IH_IO_PWRITE((H)->fd_fd, B, S, O)
 
 #define FDH_SYNC(H) ih_fdsync(H)
 #define FDH_TRUNC(H, L) OS_TRUNC((H)->fd_fd, L)
@@ -581,6 +632,32 @@ extern afs_sfsize_t ih_size(FD_t);
 #define FDH_LOCKFILE(H, O) OS_LOCKFILE((H)->fd_fd, O)
 #define FDH_UNLOCKFILE(H, O) OS_UNLOCKFILE((H)->fd_fd, O)
 #define FDH_ISUNLINKED(H) OS_ISUNLINKED((H)->fd_fd)
+#define FDH_COPYRANGE(F, T, O, L) OS_COPYRANGE((F)->fd_fd, (T)->fd_fd, O, L)
+
+/* Read several ranges of an open file, as if with FDH_PREAD on each.  With
+ * io_uring the reads are all handed to the kernel in one call, and then
+ * waited for together. */
+struct ih_io {
+    void *buf;
+    size_t length;
+    afs_foff_t offset;
+    ssize_t result;		/* what FDH_PREAD would have returned */
+    int error;			/* and errno, if that was -1 */
+};
+extern void ih_preadm(FdHandle_t *fdP, struct ih_io *ios, int nios);
+#define FDH_PREADM(H, I, N) ih_preadm(H, I, N)
+
+/* Hint that ranges of an open file will be read soon.  Only defined where
+ * the platform can start the reads without waiting for them.  With io_uring
+ * the hints for all the ranges are handed to the kernel in one call. */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+struct ih_range {
+    afs_foff_t offset;
+    afs_fsize_t length;
+};
+extern int ih_willneed(FdHandle_t *fdP, struct ih_range *ranges, int nranges);
+# define FDH_WILLNEED(H, R, N) ih_willneed(H, R, N)
+#endif
 
 extern int ih_fdsync(FdHandle_t *fdP);
 
@@ -30,6 +30,7 @@
 #endif
 
 #include <afs/opr.h>
+#include <opr/queue.h>
 #include <rx/rx_queue.h>
 #ifdef AFS_PTHREAD_ENV
 # include <opr/lock.h>
@@ -1341,13 +1342,14 @@ namei_copy_on_write(IHandle_t *h)
 	    FDH_CLOSE(fdP);
 	    return ENOMEM;
 	}
-	size = tstat.st_size;
-	offset = 0;
+	/* Let the kernel clone or copy what it can; copy the rest here */
+	offset = OS_COPYRANGE(fdP->fd_fd, fd, 0, tstat.st_size);
+	size = tstat.st_size - offset;
 	while (size) {
 	    tlen = size > 8192 ? 8192 : size;
 	    if (FDH_PREAD(fdP, buf, tlen, offset) != tlen)
 		break;
-	    if (OS_WRITE(fd, buf, tlen) != tlen)
+	    if (OS_PWRITE(fd, buf, tlen, offset) != tlen)
 		break;
 	    size -= tlen;
 	    offset += tlen;
@@ -1736,6 +1738,430 @@ namei_UnlockLinkCount(FdHandle_t * fdP, Inode ino)
     FDH_UNLOCKFILE(fdP, offset);
 }
 
+/* A lock, two reads, a write, a sync and an unlock, as in namei_inc */
+#define LINK_CALLS_PER_UPDATE	6
+
+#ifndef AFS_NT40_ENV
+/*
+ * Link table batches.
+ *
+ * namei_incMulti and namei_decMulti change many link counts in one volume
+ * group under a single hold of the link table lock.  Each page of the table
+ * they touch is read once and changed in memory; when the batch ends, only
+ * the dirty pages are written back, the table is synced once, and the lock
+ * is dropped.  No page outlives the batch, so the fileserver, volserver and
+ * salvager, which all take the same lock, see the table just as if the
+ * counts had been changed one at a time.
+ *
+ * A batch holds at most LINKPAGE_MAX pages; when it needs another, it is
+ * ended and a new one begun.  Each batch is written all or nothing: if a
+ * page cannot be written, the pages already written are put back as they
+ * were read, so a caller told that an inode's count was not changed can
+ * safely try it again.  Should putting them back fail as well, that is
+ * logged, and the volume needs salvaging.
+ *
+ * On NT the link table is locked a row at a time, so the batches there
+ * fall back to namei_inc and namei_dec.
+ */
+#define LINKPAGE_SIZE	4096
+#define LINKPAGE_MAX	64	/* pages a batch keeps in memory */
+
+struct LinkPage {
+    struct opr_queue q;		/* on the batch's list, most recent first */
+    afs_foff_t offset;		/* of the page in the link table */
+    ssize_t len;		/* bytes of the table read into the page */
+    int dirty;
+    int written;		/* rows have been written to the table */
+    unsigned short rows[LINKPAGE_SIZE / sizeof(unsigned short)];
+    unsigned short orig[LINKPAGE_SIZE / sizeof(unsigned short)];
+};
+
+struct LinkBatch {
+    FdHandle_t *fdP;
+    struct opr_queue pages;
+    int npages;
+    afs_uint64 updates;		/* link counts changed */
+    afs_uint64 calls;		/* link table syscalls made */
+};
+
+/* Totals for all batches, under NAMEI_GLC_LOCK */
+static afs_uint64 linkBatchUpdates;
+static afs_uint64 linkBatchCalls;
+
+static int
+CompareLinkRow(const void *a, const void *b)
+{
+    Inode ia = *(const Inode *)a & NAMEI_VNODEMASK;
+    Inode ib = *(const Inode *)b & NAMEI_VNODEMASK;
+
+    return (ia < ib) ? -1 : (ia > ib);
+}
+
+/*
+ * Move the special inodes to the front of inos, since namei_inc and
+ * namei_dec count those in their own ways.  Returns how many there are.
+ */
+static int
+SpecialsFirst(Inode * inos, int ninos)
+{
+    Inode tmp;
+    int i, nspecial = 0;
+
+    for (i = 0; i < ninos; i++) {
+	if ((inos[i] & NAMEI_INODESPECIAL) == NAMEI_INODESPECIAL) {
+	    tmp = inos[nspecial];
+	    inos[nspecial++] = inos[i];
+	    inos[i] = tmp;
+	}
+    }
+    return nspecial;
+}
+
+static int
+LinkBatchBegin(struct LinkBatch *lb, IHandle_t * h)
+{
+    memset(lb, 0, sizeof(*lb));
+    opr_queue_Init(&lb->pages);
+
+    lb->fdP = IH_OPEN(h);
+    if (lb->fdP == NULL)
+	return -1;
+    lb->calls++;
+    if (FDH_LOCKFILE(lb->fdP, 0) != 0) {
+	FDH_REALLYCLOSE(lb->fdP);
+	return -1;
+    }
+    return 0;
+}
+
+static int
+LinkPageFlush(struct LinkBatch *lb, struct LinkPage *pg)
+{
+    if (!pg->dirty)
+	return 0;
+    lb->calls++;
+    if (FDH_PWRITE(lb->fdP, (char *)pg->rows, pg->len, pg->offset) != pg->len) {
+	errno = OS_ERROR(EBADF);
+	return -1;
+    }
+    pg->dirty = 0;
+    pg->written = 1;
+    return 0;
+}
+
+/*
+ * Find the link table row for an inode, reading its page if need be.
+ * Sets *full instead if the batch has no room for the page.
+ */
+static unsigned short *
+LinkBatchRow(struct LinkBatch *lb, Inode ino, int *index,
+	     struct LinkPage **pgp, int *full)
+{
+    struct LinkPage *pg = NULL;
+    struct opr_queue *cursor;
+    afs_foff_t offset, base;
+
+    namei_GetLCOffsetAndIndexFromIno(ino, &offset, index);
+    base = offset - (offset % LINKPAGE_SIZE);
+
+    for (opr_queue_Scan(&lb->pages, cursor)) {
+	pg = opr_queue_Entry(cursor, struct LinkPage, q);
+	if (pg->offset == base)
+	    break;
+	pg = NULL;
+    }
+
+    if (pg == NULL) {
+	if (lb->npages >= LINKPAGE_MAX) {
+	    *full = 1;
+	    return NULL;
+	}
+	pg = malloc(sizeof(*pg));
+	if (pg == NULL)
+	    return NULL;
+	opr_queue_Prepend(&lb->pages, &pg->q);
+	lb->npages++;
+	pg->offset = base;
+	pg->dirty = 0;
+	pg->written = 0;
+	lb->calls++;
+	pg->len = FDH_PREAD(lb->fdP, (char *)pg->rows, LINKPAGE_SIZE, base);
+	if (pg->len < 0)
+	    pg->len = 0;
+	memcpy(pg->orig, pg->rows, pg->len);
+    }
+    opr_queue_Remove(&pg->q);
+    opr_queue_Prepend(&lb->pages, &pg->q);
+
+    /* as in namei_GetLinkCount, a row past the end of the table is an error */
+    if (offset + sizeof(unsigned short) > base + pg->len) {
+	errno = OS_ERROR(EBADF);
+	return NULL;
+    }
+    *pgp = pg;
+    return &pg->rows[(offset - base) / sizeof(unsigned short)];
+}
+
+/*
+ * Change the link count of an inode by delta.  A count that would go
+ * below zero is left at zero, but *count is still set to the result.
+ * Returns 1, changing nothing, if the batch must be ended first.
+ */
+static int
+LinkBatchAdjust(struct LinkBatch *lb, Inode ino, int delta, int *count)
+{
+    struct LinkPage *pg;
+    unsigned short *row;
+    int index, full = 0;
+
+    row = LinkBatchRow(lb, ino, &index, &pg, &full);
+    if (full)
+	return 1;
+    if (row == NULL)
+	return -1;
+
+    *count = ((*row >> index) & NAMEI_TAGMASK) + delta;
+    if (*count > 7) {
+	errno = OS_ERROR(EINVAL);
+	return -1;
+    }
+    *row &= (unsigned short)~(NAMEI_TAGMASK << index);
+    if (*count > 0)
+	*row |= (unsigned short)(*count << index);
+    pg->dirty = 1;
+    lb->updates++;
+    return 0;
+}
+
+/*
+ * Write back the dirty pages, sync and unlock; errno is kept on success.
+ * On failure none of the batch's changes are left in the table, unless
+ * they could not be taken back either.
+ */
+static int
+LinkBatchEnd(struct LinkBatch *lb)
+{
+    struct LinkPage *pg;
+    struct opr_queue *cursor;
+    int code = 0, saved_errno = errno;
+
+    for (opr_queue_Scan(&lb->pages, cursor)) {
+	pg = opr_queue_Entry(cursor, struct LinkPage, q);
+	if (LinkPageFlush(lb, pg) < 0) {
+	    code = -1;
+	    break;
+	}
+    }
+    if (code) {
+	saved_errno = errno;
+	for (opr_queue_Scan(&lb->pages, cursor)) {
+	    pg = opr_queue_Entry(cursor, struct LinkPage, q);
+	    if (!pg->written)
+		continue;
+	    memcpy(pg->rows, pg->orig, pg->len);
+	    pg->dirty = 1;
+	    if (LinkPageFlush(lb, pg) < 0) {
+		Log("Link table of volume %" AFS_VOLID_FMT " is partly "
+		    "updated and could not be restored (errno %d); "
+		    "salvage the volume\n",
+		    afs_printable_VolumeId_lu(lb->fdP->fd_ih->ih_vid), errno);
+		break;
+	    }
+	}
+	errno = saved_errno;
+    }
+    while (!opr_queue_IsEmpty(&lb->pages)) {
+	pg = opr_queue_First(&lb->pages, struct LinkPage, q);
+	opr_queue_Remove(&pg->q);
+	free(pg);
+    }
+    if (lb->updates > 0) {
+	lb->calls++;
+	(void)FDH_SYNC(lb->fdP);
+    }
+    lb->calls++;
+    FDH_UNLOCKFILE(lb->fdP, 0);
+    if (code) {
+	FDH_REALLYCLOSE(lb->fdP);
+    } else {
+	FDH_CLOSE(lb->fdP);
+    }
+    errno = saved_errno;
+
+    NAMEI_GLC_LOCK;
+    linkBatchUpdates += lb->updates;
+    linkBatchCalls += lb->calls;
+    NAMEI_GLC_UNLOCK;
+    return code;
+}
+#endif /* !AFS_NT40_ENV */
+
+/**
+ * increment the link counts of many inodes in one volume group.
+ *
+ * Where namei_inc locks the link table, reads and writes one row, and
+ * syncs for every inode, this does so once for all of them, as described
+ * under link table batches above.
+ *
+ * @param[in]    h      link table handle
+ * @param[inout] inos   inodes to increment; reordered on return
+ * @param[in]    ninos  number of inodes
+ * @param[in]    p1     volume group id, as for namei_inc
+ *
+ * @return number of inodes incremented, which are the first ones in inos;
+ *         if fewer than ninos, errno says why, and the others' counts are
+ *         as they were
+ */
+int
+namei_incMulti(IHandle_t * h, Inode * inos, int ninos, int p1)
+{
+    int i;
+#ifndef AFS_NT40_ENV
+    struct LinkBatch lb;
+    int code, count, nspecial, start;
+
+    nspecial = SpecialsFirst(inos, ninos);
+    for (i = 0; i < nspecial; i++) {
+	if (namei_inc(h, inos[i], p1) < 0)
+	    return i;
+    }
+    if (nspecial == ninos)
+	return ninos;
+
+    qsort(inos + nspecial, ninos - nspecial, sizeof(Inode), CompareLinkRow);
+    for (start = i; start < ninos; start = i) {
+	if (LinkBatchBegin(&lb, h) < 0)
+	    return start;
+	code = 0;
+	for (; i < ninos; i++) {
+	    code = LinkBatchAdjust(&lb, inos[i], 1, &count);
+	    if (code)
+		break;
+	}
+	if (LinkBatchEnd(&lb) < 0)
+	    return start;
+	if (code < 0)
+	    break;
+    }
+#else
+    for (i = 0; i < ninos; i++) {
+	if (namei_inc(h, inos[i], p1) < 0)
+	    break;
+    }
+#endif
+    return i;
+}
+
+/**
+ * decrement the link counts of many inodes in one volume group.
+ *
+ * Like namei_dec for each inode, removing those whose count drops to zero,
+ * but with the link table locked, written and synced only once.  The files
+ * are removed after the link table is synced; any that cannot be are left
+ * with a zero link count for the salvager.
+ *
+ * @param[in]    h      link table handle
+ * @param[inout] inos   inodes to decrement; reordered on return
+ * @param[in]    ninos  number of inodes
+ * @param[in]    p1     volume group id, as for namei_dec
+ *
+ * @return number of inodes decremented, which are the first ones in inos;
+ *         if fewer than ninos, errno says why, and the others' counts are
+ *         as they were
+ */
+int
+namei_decMulti(IHandle_t * h, Inode * inos, int ninos, int p1)
+{
+    int i;
+#ifndef AFS_NT40_ENV
+    struct LinkBatch lb;
+    IHandle_t *th;
+    namei_t name;
+    char *gone;
+    int j, code, count, nspecial, start, saved_errno;
+
+    nspecial = SpecialsFirst(inos, ninos);
+    for (i = 0; i < nspecial; i++) {
+	if (namei_dec(h, inos[i], p1) < 0)
+	    return i;
+    }
+    if (nspecial == ninos)
+	return ninos;
+
+    gone = calloc(ninos, 1);
+    if (gone == NULL)
+	return nspecial;
+    qsort(inos + nspecial, ninos - nspecial, sizeof(Inode), CompareLinkRow);
+    for (start = i; start < ninos; start = i) {
+	if (LinkBatchBegin(&lb, h) < 0) {
+	    i = start;
+	    break;
+	}
+	code = 0;
+	for (; i < ninos; i++) {
+	    code = LinkBatchAdjust(&lb, inos[i], -1, &count);
+	    if (code)
+		break;
+	    if (count < 0) {
+		IH_INIT(th, h->ih_dev, h->ih_vid, inos[i]);
+		Log("Warning: Lost ref on ihandle dev %d vid %" AFS_VOLID_FMT " ino %lld\n",
+		    th->ih_dev, afs_printable_VolumeId_lu(th->ih_vid), (afs_int64)th->ih_ino);
+		IH_RELEASE(th);
+	    }
+	    gone[i] = (count == 0);
+	}
+	if (LinkBatchEnd(&lb) < 0) {
+	    i = start;
+	    break;
+	}
+
+	/* Only now that the zero counts are on disk can the files go */
+	saved_errno = errno;
+	for (j = start; j < i; j++) {
+	    if (!gone[j])
+		continue;
+	    IH_INIT(th, h->ih_dev, h->ih_vid, inos[j]);
+	    namei_HandleToName(&name, th);
+	    IH_RELEASE(th);
+	    (void)OS_UNLINK(name.n_path);
+	}
+	errno = saved_errno;
+	if (code < 0)
+	    break;
+    }
+    free(gone);
+#else
+    for (i = 0; i < ninos; i++) {
+	if (namei_dec(h, inos[i], p1) < 0)
+	    break;
+    }
+#endif
+    return i;
+}
+
+/**
+ * get statistics on link counts changed in batches.
+ *
+ * @param[out] updates  link counts changed by namei_incMulti and
+ *                      namei_decMulti
+ * @param[out] calls    link table system calls made to change them
+ * @param[out] avoided  system calls saved over changing them one at a time
+ */
+void
+namei_GetLinkBatchStats(afs_uint64 * updates, afs_uint64 * calls,
+			afs_uint64 * avoided)
+{
+#ifndef AFS_NT40_ENV
+    NAMEI_GLC_LOCK;
+    *updates = linkBatchUpdates;
+    *calls = linkBatchCalls;
+    NAMEI_GLC_UNLOCK;
+#else
+    *updates = *calls = 0;
+#endif
+    *avoided = *updates * LINK_CALLS_PER_UPDATE;
+    *avoided = (*avoided > *calls) ? *avoided - *calls : 0;
+}
 
 /* ListViceInodes - write inode data to a results file. */
 static int DecodeInode(char *dpath, char *name, struct ViceInodeInfo *info,
@@ -33,6 +33,10 @@ afs_sfsize_t namei_iwrite(IHandle_t * h, afs_foff_t offset, char *buf,
 			  afs_fsize_t size);
 extern int namei_dec(IHandle_t * h, Inode ino, int p1);
 extern int namei_inc(IHandle_t * h, Inode ino, int p1);
+extern int namei_incMulti(IHandle_t * h, Inode * inos, int ninos, int p1);
+extern int namei_decMulti(IHandle_t * h, Inode * inos, int ninos, int p1);
+extern void namei_GetLinkBatchStats(afs_uint64 * updates, afs_uint64 * calls,
+				   afs_uint64 * avoided);
 extern int namei_GetLinkCount(FdHandle_t * h, Inode ino, int lockit, int fixup, int nowrite);
 extern int namei_SetLinkCount(FdHandle_t * h, Inode ino, int count, int locked);
 extern int namei_ViceREADME(char *partition);
@@ -12,7 +12,14 @@
 
 #include <roken.h>
 
+#ifdef HAVE_SYS_FILE_H
+#include <sys/file.h>
+#endif
+
 #include <afs/opr.h>
+#ifdef AFS_PTHREAD_ENV
+# include <opr/lock.h>
+#endif
 #include <afs/afsint.h>
 #include <rx/rx_queue.h>
 
@@ -34,6 +41,10 @@
 
 struct Lock localLock;
 
+/* Inodes per second the background reaper may release; 0 means volumes are
+ * deleted synchronously.  See VPurgeVolume. */
+int vol_ReapRate = 0;
+
 #define MAXATONCE	100
 /* structure containing neatly packed set of inodes and the # of times we'll have
  * to idec them in order to reclaim their storage.  NukeProc, called by ListViceInodes,
@@ -231,3 +242,570 @@ nuke(char *aname, VolumeId avolid)
     ReleaseWriteLock(&localLock);
     return code;
 }
+
+/*
+ * Background inode reclamation.
+ *
+ * Deleting a large volume means releasing a reference on every file in it,
+ * which can take a long time.  When vol_ReapRate is set, VPurgeVolume
+ * instead writes the volume's data inode numbers to a reap record in the
+ * partition directory, removes the volume header, and leaves the record to
+ * the reaper thread, which releases the inodes at no more than vol_ReapRate
+ * a second.
+ *
+ * A record is written and synced in full before the volume header is
+ * removed, and only marked committed afterwards; an uncommitted record is
+ * thrown away if the volume header still exists.  The reaper syncs its
+ * progress to the record before releasing each batch of inodes, so after a
+ * crash it resumes where it left off.  A crash can therefore leak some
+ * references, which the salvager recovers, but never drops one twice.
+ *
+ * The salvager finishes all the records on a partition before counting its
+ * inodes, and, since namei inode numbers are reused by a new volume with the
+ * same vnodes, VCreateVolume finishes those for the volume group first.
+ *
+ * So that VCreateVolume need not read the partition directory when there is
+ * nothing to reap, each partition counts the records this process (only
+ * the volserver makes them) creates on it in reapGen, and notes in reapCleanGen the count at the start of the last scan
+ * that found no records at all.  Records may be present whenever the two
+ * differ, which they do until the first scan after the partition is
+ * attached.  A record is counted only once its file exists, so a scan that
+ * missed it started after it was counted.
+ */
+
+#define VREAPFORMAT	"V%010" AFS_VOLID_FMT ".%010" AFS_VOLID_FMT ".reap"
+#define VREAPMAGIC	0x52454150	/* "REAP" */
+#define VREAPVERSION	1
+#define VREAP_BATCH	100
+#define VREAP_LOGINTERVAL 100000	/* inodes between progress messages */
+
+enum VReapState {
+    VREAP_NEW = 0,		/* volume header may still exist */
+    VREAP_COMMITTED = 1,	/* volume header is gone */
+    VREAP_LINKDONE = 2		/* link table reference released too */
+};
+
+/* In local byte order; followed by nInodes inode numbers */
+struct VReapHeader {
+    afs_uint32 magic;
+    afs_uint32 version;
+    afs_uint32 volumeId;
+    afs_uint32 parentId;
+    afs_uint32 state;		/* enum VReapState */
+    afs_uint32 spare;
+    afs_uint64 linkTable;	/* link table inode to release last; namei only */
+    afs_uint64 nInodes;
+    afs_uint64 nDone;		/* inodes released so far */
+};
+
+struct VReapRecord {
+    FD_t fd;
+    struct VReapHeader hdr;
+    char path[MAXPATHLEN];
+};
+
+#ifdef AFS_PTHREAD_ENV
+static opr_mutex_t reap_lock;
+static opr_cv_t reap_cv;
+static int reap_kicked;
+static int reap_started;
+#endif
+
+/*
+ * Append the data inodes of one vnode index to the list.  Returns 0 on
+ * success, or an error if the index could not be read.
+ */
+static int
+ReapListIndex(Volume *vp, VnodeClass class, afs_uint64 **a_inodes,
+	      afs_uint64 *a_n, afs_uint64 *a_alloc)
+{
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    char buf[SIZEOF_LARGEDISKVNODE];
+    struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)buf;
+    StreamHandle_t *ifile;
+    FdHandle_t *fdP;
+    afs_uint64 *tinodes;
+    int code = 0;
+
+    fdP = IH_OPEN(vp->vnodeIndex[class].handle);
+    if (fdP == NULL)
+	return EIO;
+    ifile = FDH_FDOPEN(fdP, "r");
+    if (ifile == NULL) {
+	FDH_REALLYCLOSE(fdP);
+	return EIO;
+    }
+
+    STREAM_ASEEK(ifile, vcp->diskSize);
+    while (STREAM_READ(vnode, vcp->diskSize, 1, ifile) == 1) {
+	if (vnode->type == vNull)
+	    continue;
+	if (vnode->vnodeMagic != vcp->magic) {
+	    code = EIO;
+	    break;
+	}
+	if (!VNDISK_GET_INO(vnode))
+	    continue;
+	if (*a_n == *a_alloc) {
+	    *a_alloc = *a_alloc ? *a_alloc * 2 : 1024;
+	    tinodes = realloc(*a_inodes, *a_alloc * sizeof(**a_inodes));
+	    if (tinodes == NULL) {
+		code = ENOMEM;
+		break;
+	    }
+	    *a_inodes = tinodes;
+	}
+	(*a_inodes)[(*a_n)++] = VNDISK_GET_INO(vnode);
+    }
+    if (code == 0 && STREAM_ERROR(ifile))
+	code = EIO;
+
+    STREAM_CLOSE(ifile);
+    FDH_CLOSE(fdP);
+    return code;
+}
+
+/**
+ * Start deleting a volume in the background.
+ *
+ * Writes and syncs a reap record listing the volume's data inodes.  The
+ * caller must then remove the volume header, release the volume's other
+ * inodes except the link table, and call VReapCommit; or call VReapAbort
+ * and delete the volume synchronously.
+ *
+ * @param[in]  vp     volume being deleted
+ * @param[out] a_rec  the new reap record
+ *
+ * @return operation status
+ *   @retval 0 success
+ *   @retval EEXIST the volume is already being reaped
+ *
+ * @note the vnode indexes must not change until the record is committed
+ */
+int
+VReapCreate(Volume *vp, struct VReapRecord **a_rec)
+{
+    struct VReapRecord *rec;
+    afs_uint64 *inodes = NULL;
+    afs_uint64 n = 0, nalloc = 0;
+    size_t len;
+    int code;
+
+    rec = calloc(1, sizeof(*rec));
+    if (rec == NULL)
+	return ENOMEM;
+    snprintf(rec->path, sizeof(rec->path), "%s" OS_DIRSEP VREAPFORMAT,
+	     VPartitionPath(vp->partition),
+	     afs_printable_VolumeId_lu(V_parentId(vp)),
+	     afs_printable_VolumeId_lu(V_id(vp)));
+
+    rec->fd = OS_OPEN(rec->path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (rec->fd == INVALID_FD) {
+	code = errno;
+	free(rec);
+	return code;
+    }
+    VOL_LOCK;
+    vp->partition->reapGen++;
+    VOL_UNLOCK;
+    /* The reaper throws away an empty record if it gets the lock first */
+    if (OS_LOCKFILE(rec->fd, 0) != 0 || OS_ISUNLINKED(rec->fd)) {
+	code = EIO;
+	goto fail;
+    }
+
+    code = ReapListIndex(vp, vLarge, &inodes, &n, &nalloc);
+    if (code == 0)
+	code = ReapListIndex(vp, vSmall, &inodes, &n, &nalloc);
+    if (code)
+	goto fail;
+
+    rec->hdr.magic = VREAPMAGIC;
+    rec->hdr.version = VREAPVERSION;
+    rec->hdr.volumeId = V_id(vp);
+    rec->hdr.parentId = V_parentId(vp);
+    rec->hdr.state = VREAP_NEW;
+#ifdef AFS_NAMEI_ENV
+    rec->hdr.linkTable = V_linkHandle(vp)->ih_ino;
+#endif
+    rec->hdr.nInodes = n;
+    rec->hdr.nDone = 0;
+
+    len = n * sizeof(*inodes);
+    if ((len > 0 && OS_PWRITE(rec->fd, inodes, len, sizeof(rec->hdr)) != len)
+	|| OS_PWRITE(rec->fd, &rec->hdr, sizeof(rec->hdr), 0) != sizeof(rec->hdr)
+	|| OS_SYNC(rec->fd) != 0) {
+	code = EIO;
+	goto fail;
+    }
+    free(inodes);
+    *a_rec = rec;
+    return 0;
+
+  fail:
+    free(inodes);
+    VReapAbort(rec);
+    return code;
+}
+
+static void
+ReapKick(void)
+{
+#ifdef AFS_PTHREAD_ENV
+    if (!reap_started)
+	return;
+    opr_mutex_enter(&reap_lock);
+    reap_kicked = 1;
+    opr_cv_signal(&reap_cv);
+    opr_mutex_exit(&reap_lock);
+#endif
+}
+
+/**
+ * Hand a reap record to the reaper, once the volume header is gone.
+ *
+ * @param[in] rec  record from VReapCreate; freed
+ */
+void
+VReapCommit(struct VReapRecord *rec)
+{
+    rec->hdr.state = VREAP_COMMITTED;
+    if (OS_PWRITE(rec->fd, &rec->hdr, sizeof(rec->hdr), 0) != sizeof(rec->hdr)
+	|| OS_SYNC(rec->fd) != 0) {
+	/* The reaper commits the record itself when it sees the header gone */
+	Log("VReapCommit: failed to update %s (errno %d)\n", rec->path, errno);
+    }
+    OS_UNLOCKFILE(rec->fd, 0);
+    OS_CLOSE(rec->fd);
+    free(rec);
+    ReapKick();
+}
+
+/**
+ * Throw away a reap record whose volume is to be deleted synchronously.
+ *
+ * @param[in] rec  record from VReapCreate; freed
+ */
+void
+VReapAbort(struct VReapRecord *rec)
+{
+    OS_UNLINK(rec->path);
+    OS_UNLOCKFILE(rec->fd, 0);
+    OS_CLOSE(rec->fd);
+    free(rec);
+}
+
+/* Parse a reap record's file name; returns 0 if it is one */
+static int
+ReapParseName(const char *name, VolumeId *a_parent, VolumeId *a_volid)
+{
+    char tname[VMAXPATHLEN];
+    unsigned long parent, volid;
+
+    if (sscanf(name, "V%10lu.%10lu.reap", &parent, &volid) != 2)
+	return -1;
+    snprintf(tname, sizeof(tname), VREAPFORMAT,
+	     afs_printable_VolumeId_lu(parent),
+	     afs_printable_VolumeId_lu(volid));
+    if (strcmp(name, tname) != 0)
+	return -1;
+    *a_parent = parent;
+    *a_volid = volid;
+    return 0;
+}
+
+static int
+ReapHeaderExists(struct DiskPartition64 *dp, VolumeId volid)
+{
+    struct afs_stat_st st;
+    char path[MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s" OS_DIRSEP VFORMAT,
+	     VPartitionPath(dp), afs_printable_VolumeId_lu(volid));
+    return afs_stat(path, &st) == 0;
+}
+
+static int
+ReapWriteHeader(FD_t fd, struct VReapHeader *hdr)
+{
+    if (OS_PWRITE(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)
+	|| OS_SYNC(fd) != 0)
+	return -1;
+    return 0;
+}
+
+/*
+ * Lock a reap record and check it is still there and worth reaping.
+ * Returns 0 with the header read if so, or -1 if the caller should stop.
+ */
+static int
+ReapLock(struct DiskPartition64 *dp, const char *path, FD_t fd,
+	 VolumeId parent, VolumeId volid, struct VReapHeader *hdr)
+{
+    if (OS_LOCKFILE(fd, 0) != 0)
+	return -1;
+    if (OS_ISUNLINKED(fd))
+	goto stop;
+
+    if (OS_PREAD(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)
+	|| hdr->magic != VREAPMAGIC || hdr->version != VREAPVERSION
+	|| hdr->volumeId != volid || hdr->parentId != parent
+	|| hdr->nDone > hdr->nInodes) {
+	/* Either never written, because the volume was not deleted, or
+	 * damaged; the salvager recovers any inodes it would have named */
+	if (!ReapHeaderExists(dp, volid))
+	    Log("VReap: discarding damaged reap record %s\n", path);
+	OS_UNLINK(path);
+	goto stop;
+    }
+
+    if (hdr->state == VREAP_NEW) {
+	/* Whoever wrote it crashed before committing it */
+	if (ReapHeaderExists(dp, volid)) {
+	    OS_UNLINK(path);
+	    goto stop;
+	}
+	hdr->state = VREAP_COMMITTED;
+	if (ReapWriteHeader(fd, hdr) != 0)
+	    goto stop;
+    }
+    return 0;
+
+  stop:
+    OS_UNLOCKFILE(fd, 0);
+    return -1;
+}
+
+/*
+ * Release the inodes named by one reap record, no more than rate a second
+ * if rate is not 0.  Returns whether the record is still there.
+ */
+static int
+ReapRecord(struct DiskPartition64 *dp, const char *name, VolumeId parent,
+	   VolumeId volid, int rate)
+{
+    struct VReapHeader hdr;
+    afs_uint64 tinodes[VREAP_BATCH];
+    Inode inodes[VREAP_BATCH];
+    char path[MAXPATHLEN];
+    struct afs_stat_st st;
+    IHandle_t *lh = NULL;
+    afs_uint64 lastLog;
+    time_t window;
+    int n, i, done, windowDone;
+    FD_t fd;
+
+    snprintf(path, sizeof(path), "%s" OS_DIRSEP "%s", VPartitionPath(dp),
+	     name);
+    fd = OS_OPEN(path, O_RDWR, 0644);
+    if (fd == INVALID_FD)
+	return (errno != ENOENT);
+    if (ReapLock(dp, path, fd, parent, volid, &hdr) != 0)
+	goto done;
+
+    Log("VReap: releasing %llu inodes of deleted volume %" AFS_VOLID_FMT
+	" on %s (%llu released earlier)\n", hdr.nInodes - hdr.nDone,
+	afs_printable_VolumeId_lu(volid), VPartitionPath(dp), hdr.nDone);
+    IH_INIT(lh, dp->device, parent, (Inode)hdr.linkTable);
+    lastLog = hdr.nDone;
+    window = time(NULL);
+    windowDone = 0;
+
+    while (hdr.nDone < hdr.nInodes) {
+	n = VREAP_BATCH;
+	if (hdr.nInodes - hdr.nDone < n)
+	    n = hdr.nInodes - hdr.nDone;
+
+	if (rate > 0) {
+	    if (time(NULL) != window) {
+		window = time(NULL);
+		windowDone = 0;
+	    }
+	    if (windowDone >= rate) {
+		/* Let a salvager or VCreateVolume take over while we wait */
+		OS_UNLOCKFILE(fd, 0);
+		sleep(1);
+		if (ReapLock(dp, path, fd, parent, volid, &hdr) != 0)
+		    goto done;
+		continue;
+	    }
+	    if (rate - windowDone < n)
+		n = rate - windowDone;
+	}
+
+	if (OS_PREAD(fd, tinodes, n * sizeof(tinodes[0]),
+		     sizeof(hdr) + hdr.nDone * sizeof(tinodes[0]))
+	    != n * sizeof(tinodes[0])) {
+	    Log("VReap: failed to read %s (errno %d); giving up for now\n",
+		path, errno);
+	    goto unlock;
+	}
+	for (i = 0; i < n; i++)
+	    inodes[i] = (Inode)tinodes[i];
+
+	/* Record the progress first, so a crash can only leak references */
+	hdr.nDone += n;
+	if (ReapWriteHeader(fd, &hdr) != 0) {
+	    Log("VReap: failed to update %s (errno %d); giving up for now\n",
+		path, errno);
+	    goto unlock;
+	}
+	done = IH_DECMULTI(lh, inodes, n, parent);
+	if (done < n) {
+	    Log("VReap: failed to release %d inodes of volume %"
+		AFS_VOLID_FMT " (errno %d)\n", n - done,
+		afs_printable_VolumeId_lu(volid), errno);
+	}
+	windowDone += n;
+	DOPOLL;
+
+	if (hdr.nDone - lastLog >= VREAP_LOGINTERVAL) {
+	    Log("VReap: released %llu of %llu inodes of volume %"
+		AFS_VOLID_FMT "\n", hdr.nDone, hdr.nInodes,
+		afs_printable_VolumeId_lu(volid));
+	    lastLog = hdr.nDone;
+	}
+    }
+
+    if (hdr.state != VREAP_LINKDONE) {
+	hdr.state = VREAP_LINKDONE;
+	if (ReapWriteHeader(fd, &hdr) != 0)
+	    goto unlock;
+#ifdef AFS_NAMEI_ENV
+	if (hdr.linkTable != 0
+	    && IH_DEC(lh, (Inode)hdr.linkTable, parent) != 0) {
+	    Log("VReap: failed to release the link table of volume %"
+		AFS_VOLID_FMT " (errno %d)\n",
+		afs_printable_VolumeId_lu(volid), errno);
+	}
+#endif
+    }
+    OS_UNLINK(path);
+    Log("VReap: finished releasing the inodes of deleted volume %"
+	AFS_VOLID_FMT "\n", afs_printable_VolumeId_lu(volid));
+
+  unlock:
+    OS_UNLOCKFILE(fd, 0);
+  done:
+    if (lh)
+	IH_RELEASE(lh);
+    OS_CLOSE(fd);
+    return (afs_stat(path, &st) == 0);
+}
+
+static void
+ReapScan(struct DiskPartition64 *dp, VolumeId group, int rate)
+{
+    DIR *dirp;
+    struct dirent *dentry;
+    VolumeId parent, volid;
+    afs_uint32 gen;
+    int left = 0;
+
+    VOL_LOCK;
+    gen = dp->reapGen;
+    VOL_UNLOCK;
+
+    dirp = opendir(VPartitionPath(dp));
+    if (dirp == NULL)
+	return;
+    while ((dentry = readdir(dirp)) != NULL) {
+	if (ReapParseName(dentry->d_name, &parent, &volid) != 0)
+	    continue;
+	if (group != 0 && parent != group)
+	    left++;
+	else
+	    left += ReapRecord(dp, dentry->d_name, parent, volid, rate);
+    }
+    closedir(dirp);
+
+    if (left == 0) {
+	VOL_LOCK;
+	dp->reapCleanGen = gen;
+	VOL_UNLOCK;
+    }
+}
+
+/**
+ * Say whether a partition may have reap records on it.
+ *
+ * @param[in] dp  disk partition
+ *
+ * @pre VOL_LOCK held
+ */
+int
+VReapPending_r(struct DiskPartition64 *dp)
+{
+    return dp->reapGen != dp->reapCleanGen;
+}
+
+/**
+ * Release the inodes of every deleted volume still waiting on a partition.
+ *
+ * @param[in] dp    disk partition
+ * @param[in] rate  most inodes to release a second, or 0 for no limit
+ */
+void
+VReapPartition(struct DiskPartition64 *dp, int rate)
+{
+    ReapScan(dp, 0, rate);
+}
+
+/**
+ * Release the inodes of the deleted volumes of one volume group.
+ *
+ * @param[in] dp      disk partition
+ * @param[in] parent  volume group id
+ */
+void
+VReapVolumeGroup(struct DiskPartition64 *dp, VolumeId parent)
+{
+    ReapScan(dp, parent, 0);
+}
+
+#ifdef AFS_PTHREAD_ENV
+static void *
+ReapThread(void *rock)
+{
+    struct DiskPartition64 *dp;
+    struct timespec abstime;
+
+    opr_threadname_set("reaper");
+    for (;;) {
+	for (dp = DiskPartitionList; dp; dp = dp->next)
+	    VReapPartition(dp, vol_ReapRate);
+
+	opr_mutex_enter(&reap_lock);
+	if (!reap_kicked) {
+	    abstime.tv_sec = time(NULL) + 60;
+	    abstime.tv_nsec = 0;
+	    opr_cv_timedwait(&reap_cv, &reap_lock, &abstime);
+	}
+	reap_kicked = 0;
+	opr_mutex_exit(&reap_lock);
+    }
+    AFS_UNREACHED(return(NULL));
+}
+
+/**
+ * Start the thread which releases the inodes of deleted volumes.
+ *
+ * @pre the partitions have been attached
+ */
+void
+VReapStart(void)
+{
+    pthread_t tid;
+    pthread_attr_t tattr;
+
+    opr_mutex_init(&reap_lock);
+    opr_cv_init(&reap_cv);
+    reap_started = 1;
+
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    opr_Verify(pthread_create(&tid, &tattr, ReapThread, NULL) == 0);
+    opr_Verify(pthread_attr_destroy(&tattr) == 0);
+}
+#endif /* AFS_PTHREAD_ENV */
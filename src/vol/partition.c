@@ -223,6 +223,8 @@ VInitPartition_r(char *path, char *devname, Device dev)
     dp->lock_fd = INVALID_FD;
     dp->flags = 0;
     dp->f_files = 1;		/* just a default value */
+    dp->reapGen = 1;		/* records may be left from before */
+    dp->reapCleanGen = 0;
 #if defined(AFS_NAMEI_ENV) && !defined(AFS_NT40_ENV)
     if (programType == fileServer)
 	(void)namei_ViceREADME(VPartitionPath(dp));
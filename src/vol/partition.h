@@ -131,6 +131,8 @@ struct DiskPartition64 {
 				 * from the superblock */
     int flags;
     afs_int64 f_files;		/* total number of files in this partition */
+    afs_uint32 reapGen;		/* reap records created; see nuke.c */
+    afs_uint32 reapCleanGen;	/* reapGen when last found to have none */
 #ifdef AFS_DEMAND_ATTACH_FS
     struct {
 	struct rx_queue head;   /* list of volumes on this partition (VByPList) */
@@ -48,7 +48,7 @@ static int ObliterateRegion(Volume * avp, VnodeClass aclass, StreamHandle_t * af
 			    afs_foff_t * aoffset);
 
 static void PurgeIndex_r(Volume * vp, VnodeClass class);
-static void PurgeHeader_r(Volume * vp);
+static void PurgeHeader_r(Volume * vp, int keepLinkTable);
 
 /* No lock needed. Only the volserver will call this, and only one transaction
  * can have a given volume (volid/partition pair) in use at a time
@@ -58,6 +58,7 @@ VPurgeVolume(Error * ec, Volume * vp)
 {
     struct DiskPartition64 *tpartp = vp->partition;
     VolumeId volid, parent;
+    struct VReapRecord *rec = NULL;
     afs_int32 code;
 
     volid = V_id(vp);
@@ -71,15 +72,44 @@ VPurgeVolume(Error * ec, Volume * vp)
      * volume header. This routine can, under some circumstances, be called
      * when two volumes with the same id exist on different partitions.
      */
-    PurgeIndex_r(vp, vLarge);
-    PurgeIndex_r(vp, vSmall);
-    PurgeHeader_r(vp);
-
-    code = VDestroyVolumeDiskHeader(tpartp, volid, parent);
-    if (code) {
-	Log("VPurgeVolume: Error %ld when destroying volume %lu header\n",
-	    afs_printable_int32_ld(code),
-	    afs_printable_uint32_lu(volid));
+    if (vol_ReapRate > 0) {
+	code = VReapCreate(vp, &rec);
+	if (code) {
+	    Log("VPurgeVolume: Error %ld when creating reap record for "
+		"volume %lu; deleting it now\n", afs_printable_int32_ld(code),
+		afs_printable_uint32_lu(volid));
+	    rec = NULL;
+	}
+    }
+
+    if (rec) {
+	/* The reaper releases the data inodes, and then the link table, once
+	 * the header is gone; see nuke.c */
+	code = VDestroyVolumeDiskHeader(tpartp, volid, parent);
+	if (code) {
+	    Log("VPurgeVolume: Error %ld when destroying volume %lu header\n",
+		afs_printable_int32_ld(code),
+		afs_printable_uint32_lu(volid));
+	    VReapAbort(rec);
+	    rec = NULL;
+	    PurgeIndex_r(vp, vLarge);
+	    PurgeIndex_r(vp, vSmall);
+	    PurgeHeader_r(vp, 0);
+	} else {
+	    PurgeHeader_r(vp, 1);
+	    VReapCommit(rec);
+	}
+    } else {
+	PurgeIndex_r(vp, vLarge);
+	PurgeIndex_r(vp, vSmall);
+	PurgeHeader_r(vp, 0);
+
+	code = VDestroyVolumeDiskHeader(tpartp, volid, parent);
+	if (code) {
+	    Log("VPurgeVolume: Error %ld when destroying volume %lu header\n",
+		afs_printable_int32_ld(code),
+		afs_printable_uint32_lu(volid));
+	}
     }
 
     /*
@@ -147,10 +177,8 @@ ObliterateRegion(Volume * avp, VnodeClass aclass, StreamHandle_t * afile,
     OS_SYNC(afile->str_fd);
 
     /* finally, do the idec's */
-    for (i = 0; i < iindex; i++) {
-	IH_DEC(V_linkHandle(avp), inodes[i], V_parentId(avp));
-	DOPOLL;
-    }
+    IH_DECMULTI(V_linkHandle(avp), inodes, iindex, V_parentId(avp));
+    DOPOLL;
 
     /* return the new offset */
     *aoffset = offset;
@@ -190,8 +218,9 @@ PurgeIndex_r(Volume * vp, VnodeClass class)
     FDH_CLOSE(fdP);
 }
 
+/* If keepLinkTable is set, the link table reference is left for the reaper */
 static void
-PurgeHeader_r(Volume * vp)
+PurgeHeader_r(Volume * vp, int keepLinkTable)
 {
 #ifndef AFS_NAMEI_ENV
     /* namei opens and closes the given ihandle during IH_DEC, so don't try to
@@ -203,6 +232,7 @@ PurgeHeader_r(Volume * vp)
     IH_DEC(V_linkHandle(vp), vp->diskDataHandle->ih_ino, V_id(vp));
 #ifdef AFS_NAMEI_ENV
     /* And last, but not least, the link count table itself. */
-    IH_DEC(V_linkHandle(vp), vp->linkHandle->ih_ino, V_parentId(vp));
+    if (!keepLinkTable)
+	IH_DEC(V_linkHandle(vp), vp->linkHandle->ih_ino, V_parentId(vp));
 #endif
 }
@@ -234,6 +234,24 @@ handleit(struct cmd_syndesc *as, void *arock)
 	    }
 	}
     }
+    if ((ti = as->parms[22].items)) {	/* -vgparallel # */
+	VGParallel = atoi(ti->data);
+	if (VGParallel < 1)
+	    VGParallel = 1;
+	if (VGParallel > MAXPARALLEL) {
+	    printf("Setting parallel volume group salvages to maximum of %d \n",
+		   MAXPARALLEL);
+	    VGParallel = MAXPARALLEL;
+	}
+    }
+    if ((ti = as->parms[23].items)) {	/* -sortmem # */
+	SortMemory = atoi(ti->data);
+	if (SortMemory < SORTMEM_MIN) {
+	    printf("Setting inode sort memory to minimum of %d MB \n",
+		   SORTMEM_MIN);
+	    SortMemory = SORTMEM_MIN;
+	}
+    }
     if ((ti = as->parms[11].items)) {	/* -tmpdir */
 	DIR *dirp;
 
@@ -542,6 +560,10 @@ main(int argc, char **argv)
 #endif /* FAST_RESTART */
     cmd_Seek(ts, 21); /* skip DontSalvage and forceDAFS if needed */
     cmd_AddParm(ts, "-f", CMD_FLAG, CMD_OPTIONAL, "Alias for -force");
+    cmd_AddParm(ts, "-vgparallel", CMD_SINGLE, CMD_OPTIONAL,
+		"# of volume groups to salvage in parallel on each partition");
+    cmd_AddParm(ts, "-sortmem", CMD_SINGLE, CMD_OPTIONAL,
+		"MB of memory to use for sorting inodes");
     err = cmd_Dispatch(argc, argv);
     Exit(err);
     AFS_UNREACHED(return 0);
@@ -37,6 +37,7 @@
 #include "voldefs.h"
 #include "partition.h"
 #include <afs/errors.h>
+#include <afs/okv.h>
 
 #define __VOL_VG_CACHE_IMPL 1
 
@@ -68,6 +69,8 @@ static int _VVGC_hash_entry_add(struct DiskPartition64 *,
 				VVGCache_hash_entry_t **);
 static int _VVGC_hash_entry_del(VVGCache_hash_entry_t * entry);
 static int _VVGC_hash_entry_unlink(VVGCache_hash_entry_t * entry);
+static void _VVGC_db_update_r(struct DiskPartition64 *, VolumeId parent,
+			      VolumeId child);
 
 VVGCache_hash_table_t VVGCache_hash_table;
 VVGCache_t VVGCache;
@@ -101,6 +104,8 @@ VVGCache_PkgInit(void)
     for (i = 0; i <= VOLMAXPARTS; i++) {
 	VVGCache.part[i].state = VVGC_PART_STATE_INVALID;
 	VVGCache.part[i].dlist_hash_buckets = NULL;
+	VVGCache.part[i].dbh = NULL;
+	VVGCache.part[i].changes = 0;
 	CV_INIT(&VVGCache.part[i].cv, "cache part", CV_DEFAULT, 0);
 	if (code) {
 	    goto error;
@@ -669,7 +674,7 @@ _VVGC_lookup(struct DiskPartition64 * dp,
 }
 
 /**
- * add an entry to the volume group cache.
+ * add an entry to the in-memory volume group cache.
  *
  * @param[in] dp       disk partition object
  * @param[in] parent   parent volume id
@@ -683,12 +688,14 @@ _VVGC_lookup(struct DiskPartition64 * dp,
  *    @retval 0 success
  *    @retval -1 parent and child are already registered in
  *               different VGs
+ *
+ * @internal
  */
 int
-VVGCache_entry_add_r(struct DiskPartition64 * dp,
-		     VolumeId parent,
-		     VolumeId child,
-		     afs_int32 *newvg)
+_VVGC_entry_add_r(struct DiskPartition64 * dp,
+		  VolumeId parent,
+		  VolumeId child,
+		  afs_int32 *newvg)
 {
     int code = 0, res;
     VVGCache_entry_t * child_ent, * parent_ent;
@@ -794,6 +801,38 @@ VVGCache_entry_add_r(struct DiskPartition64 * dp,
     return code;
 }
 
+/**
+ * add an entry to the volume group cache.
+ *
+ * @param[in] dp       disk partition object
+ * @param[in] parent   parent volume id
+ * @param[in] child    child volume id
+ * @param[out] newvg   if non-NULL, *newvg is 1 if adding this added a
+ *                     new VG, 0 if we added to an existing VG
+ *
+ * @pre VOL_LOCK held
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval -1 parent and child are already registered in
+ *               different VGs
+ */
+int
+VVGCache_entry_add_r(struct DiskPartition64 * dp,
+		     VolumeId parent,
+		     VolumeId child,
+		     afs_int32 *newvg)
+{
+    int code;
+
+    code = _VVGC_entry_add_r(dp, parent, child, newvg);
+    if (code == 0) {
+	_VVGC_db_update_r(dp, parent, child);
+    }
+
+    return code;
+}
+
 /**
  * add an entry to the volume group cache.
  *
@@ -840,14 +879,20 @@ int
 VVGCache_entry_del_r(struct DiskPartition64 * dp,
 		     VolumeId parent, VolumeId child)
 {
+    int code;
+
     if (VVGCache.part[dp->index].state == VVGC_PART_STATE_UPDATING) {
-	int code;
 	code = _VVGC_dlist_add_r(dp, parent, child);
 	if (code) {
 	    return code;
 	}
     }
-    return _VVGC_entry_purge_r(dp, parent, child);
+    code = _VVGC_entry_purge_r(dp, parent, child);
+    if (code == 0
+	|| VVGCache.part[dp->index].state == VVGC_PART_STATE_UPDATING) {
+	_VVGC_db_update_r(dp, 0, child);
+    }
+    return code;
 }
 
 /**
@@ -1180,4 +1225,468 @@ _VVGC_state_change(struct DiskPartition64 * part,
     return old_state;
 }
 
+/*
+ * saved volume group cache
+ *
+ * Each partition's database maps the id of every volume on the partition to
+ * the id of its volume group, both as 4-byte integers in network byte
+ * order.  VVGC_DB_STAMP is the only other key; it is rewritten to force a
+ * synchronous commit when the database is marked clean.
+ */
+
+#define VVGC_DB_ENGINE	"lmdb"
+#define VVGC_DB_STAMP	"vgc.saved"
+#define VVGC_DB_TRIES	3	/* attempts to save while volumes change */
+
+static void
+_VVGC_db_path(struct DiskPartition64 *dp, char *name, char *path, size_t len)
+{
+    snprintf(path, len, "%s" OS_DIRSEP "%s", VPartitionPath(dp), name);
+}
+
+static int
+_VVGC_db_compare(const void *a, const void *b)
+{
+    const VVGCache_scan_entry_t *ea = a, *eb = b;
+
+    if (ea->volid < eb->volid)
+	return -1;
+    return ea->volid > eb->volid;
+}
+
+/**
+ * open a partition's saved volume group cache and read its entries.
+ *
+ * The saved cache is only used if it was marked clean when the fileserver
+ * last shut down.  The mark is removed before anything else is done, so if
+ * we crash from here on the next start will scan the partition instead.
+ *
+ * @param[in]  dp       disk partition object
+ * @param[out] a_dbh    the open database
+ * @param[out] a_ents   entries read from the database, sorted by volume id;
+ *                      the caller must free them
+ * @param[out] a_nents  number of entries read
+ *
+ * @pre VOL_LOCK is NOT held
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval ENOENT the partition has no clean saved cache
+ *
+ * @internal
+ */
+int
+_VVGC_db_load(struct DiskPartition64 *dp, struct okv_dbhandle **a_dbh,
+	      VVGCache_scan_entry_t **a_ents, int *a_nents)
+{
+    char path[MAXPATHLEN];
+    struct okv_dbhandle *dbh = NULL;
+    struct okv_trans *tx = NULL;
+    struct rx_opaque key, val;
+    VVGCache_scan_entry_t *ents = NULL, *nents;
+    int n = 0, nalloc = 0;
+    afs_uint32 volid, parent;
+    int code, eof = 0;
+
+    _VVGC_db_path(dp, VVGC_CLEAN_NAME, path, sizeof(path));
+    if (unlink(path) != 0) {
+	return ENOENT;
+    }
+
+    _VVGC_db_path(dp, VVGC_DB_NAME, path, sizeof(path));
+    code = okv_open(path, &dbh);
+    if (code) {
+	goto done;
+    }
+    code = okv_begin(dbh, OKV_BEGIN_RO, &tx);
+    if (code) {
+	goto done;
+    }
+
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    for (;;) {
+	code = okv_next(tx, &key, &val, &eof);
+	if (code || eof) {
+	    break;
+	}
+	if (key.len != sizeof(volid) || val.len != sizeof(parent)) {
+	    continue;
+	}
+	if (n == nalloc) {
+	    nalloc = nalloc ? 2 * nalloc : VVGC_SCAN_TBL_LEN;
+	    nents = realloc(ents, nalloc * sizeof(*ents));
+	    if (nents == NULL) {
+		code = ENOMEM;
+		break;
+	    }
+	    ents = nents;
+	}
+	memcpy(&volid, key.val, sizeof(volid));
+	memcpy(&parent, val.val, sizeof(parent));
+	ents[n].volid = ntohl(volid);
+	ents[n].parent = ntohl(parent);
+	n++;
+    }
+
+ done:
+    okv_abort(&tx);
+    if (code) {
+	ViceLog(0, ("VVGC_db_load: cannot read saved volume group cache %s; "
+		    "error %d\n", path, code));
+	okv_close(&dbh);
+	free(ents);
+	return code;
+    }
+
+    *a_dbh = dbh;
+    *a_ents = ents;
+    *a_nents = n;
+    return 0;
+}
+
+/**
+ * collect the in-memory cache entries for a partition.
+ *
+ * @param[in]  dp       disk partition object
+ * @param[out] a_ents   one entry for each volume on the partition, sorted
+ *                      by volume id; the caller must free them
+ * @param[out] a_nents  number of entries
+ *
+ * @pre VOL_LOCK held
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval ENOMEM out of memory
+ *
+ * @internal
+ */
+static int
+_VVGC_db_collect_r(struct DiskPartition64 *dp,
+		   VVGCache_scan_entry_t **a_ents, int *a_nents)
+{
+    VVGCache_hash_entry_t *ent, *nent;
+    VVGCache_scan_entry_t *ents;
+    int pass, i, j, n = 0;
+
+    /* count the volumes first, then fill them in */
+    ents = NULL;
+    for (pass = 0; pass < 2; pass++) {
+	if (pass == 1) {
+	    ents = malloc((n ? n : 1) * sizeof(*ents));
+	    if (ents == NULL) {
+		return ENOMEM;
+	    }
+	    n = 0;
+	}
+	for (i = 0; i < VolumeHashTable.Size; i++) {
+	    for (queue_Scan(&VVGCache_hash_table.hash_buckets[i],
+			    ent, nent, VVGCache_hash_entry)) {
+		if (ent->dp != dp) {
+		    continue;
+		}
+		/* the RW id of a group has an entry even if the RW volume
+		 * itself is not on the partition; only save real volumes */
+		for (j = 0; j < VOL_VG_MAX_VOLS; j++) {
+		    if (ent->entry->children[j] == ent->volid) {
+			break;
+		    }
+		}
+		if (j == VOL_VG_MAX_VOLS) {
+		    continue;
+		}
+		if (ents) {
+		    ents[n].volid = ent->volid;
+		    ents[n].parent = ent->entry->rw;
+		}
+		n++;
+	    }
+	}
+    }
+
+    qsort(ents, n, sizeof(*ents), _VVGC_db_compare);
+    *a_ents = ents;
+    *a_nents = n;
+    return 0;
+}
+
+/**
+ * replace a partition's saved volume group cache.
+ *
+ * @param[in]  dp      disk partition object
+ * @param[in]  ents    entries to save, sorted by volume id
+ * @param[in]  nents   number of entries
+ * @param[out] a_dbh   the new database
+ *
+ * @pre VOL_LOCK is NOT held
+ *
+ * @return operation status
+ *    @retval 0 success
+ *
+ * @internal
+ */
+static int
+_VVGC_db_write(struct DiskPartition64 *dp, VVGCache_scan_entry_t *ents,
+	       int nents, struct okv_dbhandle **a_dbh)
+{
+    char path[MAXPATHLEN];
+    struct okv_create_opts c_opts;
+    struct okv_dbhandle *dbh = NULL;
+    struct okv_trans *tx = NULL;
+    struct rx_opaque key, val;
+    afs_uint32 volid, parent;
+    int code, i;
+
+    _VVGC_db_path(dp, VVGC_DB_NAME, path, sizeof(path));
+    code = okv_unlink(path);
+    if (code) {
+	goto done;
+    }
+
+    memset(&c_opts, 0, sizeof(c_opts));
+    c_opts.engine = VVGC_DB_ENGINE;
+    code = okv_create(path, &c_opts, &dbh);
+    if (code) {
+	goto done;
+    }
+
+    /* the database is only trusted after VVGCache_checkpoint_r syncs it */
+    code = okv_dbhandle_setflags(dbh, OKV_DBH_NOSYNC, 1);
+    if (code) {
+	goto done;
+    }
+
+    code = okv_begin(dbh, OKV_BEGIN_RW, &tx);
+    if (code) {
+	goto done;
+    }
+    key.len = sizeof(volid);
+    key.val = &volid;
+    val.len = sizeof(parent);
+    val.val = &parent;
+    for (i = 0; i < nents; i++) {
+	volid = htonl(ents[i].volid);
+	parent = htonl(ents[i].parent);
+	code = okv_put(tx, &key, &val, OKV_PUT_BULKSORT);
+	if (code) {
+	    goto done;
+	}
+    }
+    code = okv_commit(&tx);
+
+ done:
+    okv_abort(&tx);
+    if (code) {
+	ViceLog(0, ("VVGC_db_write: cannot save volume group cache %s; "
+		    "error %d\n", path, code));
+	okv_close(&dbh);
+	return code;
+    }
+
+    *a_dbh = dbh;
+    return 0;
+}
+
+/**
+ * bring a partition's saved volume group cache up to date after a scan.
+ *
+ * If the cache was loaded from the saved copy and nothing has changed
+ * since, the saved copy is kept.  Otherwise it is rewritten from the
+ * in-memory cache, retrying if volumes change while we are writing it.
+ *
+ * @param[in] dp    disk partition object
+ * @param[in] dbh   saved copy the cache was loaded from, or NULL
+ *
+ * @pre VOL_LOCK held; partition is in VVGC_PART_STATE_UPDATING
+ *
+ * @warning this routine may drop VOL_LOCK internally
+ *
+ * @return the saved copy to keep up to date, or NULL if there is none
+ *
+ * @internal
+ */
+struct okv_dbhandle *
+_VVGC_db_save_r(struct DiskPartition64 *dp, struct okv_dbhandle *dbh)
+{
+    VVGCache_part_t *part = &VVGCache.part[dp->index];
+    VVGCache_scan_entry_t *ents;
+    int nents, tries, code;
+
+    if (dbh != NULL) {
+	if (part->changes == 0) {
+	    return dbh;
+	}
+	okv_close(&dbh);
+    }
+
+    for (tries = 0; tries < VVGC_DB_TRIES; tries++) {
+	code = _VVGC_db_collect_r(dp, &ents, &nents);
+	if (code) {
+	    return NULL;
+	}
+	part->changes = 0;
+
+	VOL_UNLOCK;
+	code = _VVGC_db_write(dp, ents, nents, &dbh);
+	free(ents);
+	VOL_LOCK;
+
+	if (code) {
+	    return NULL;
+	}
+	if (part->changes == 0) {
+	    return dbh;
+	}
+	okv_close(&dbh);
+    }
+
+    ViceLog(0, ("VVGC_db_save: volumes on %s kept changing; not saving the "
+		"volume group cache\n", VPartitionPath(dp)));
+    return NULL;
+}
+
+/**
+ * record a cache update in a partition's saved volume group cache.
+ *
+ * While the partition is being scanned, just count the update, so the
+ * scanner knows the saved copy needs rewriting.
+ *
+ * @param[in] dp      disk partition object
+ * @param[in] parent  volume group id, or 0 to delete the volume
+ * @param[in] child   volume id
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal
+ */
+static void
+_VVGC_db_update_r(struct DiskPartition64 *dp, VolumeId parent,
+		  VolumeId child)
+{
+    VVGCache_part_t *part = &VVGCache.part[dp->index];
+    struct okv_trans *tx = NULL;
+    struct rx_opaque key, val;
+    afs_uint32 volid, rw;
+    int code;
+
+    if (part->state == VVGC_PART_STATE_UPDATING) {
+	part->changes++;
+	return;
+    }
+    if (part->dbh == NULL) {
+	return;
+    }
+
+    volid = htonl(child);
+    key.len = sizeof(volid);
+    key.val = &volid;
+
+    code = okv_begin(part->dbh, OKV_BEGIN_RW, &tx);
+    if (code) {
+	goto done;
+    }
+    if (parent == 0) {
+	code = okv_del(tx, &key, NULL);
+	if (code == ENOENT) {
+	    code = 0;
+	}
+    } else {
+	rw = htonl(parent);
+	val.len = sizeof(rw);
+	val.val = &rw;
+	code = okv_put(tx, &key, &val, OKV_PUT_REPLACE);
+    }
+    if (code) {
+	goto done;
+    }
+    code = okv_commit(&tx);
+
+ done:
+    okv_abort(&tx);
+    if (code) {
+	ViceLog(0, ("VVGC_db_update: error %d updating the saved volume group "
+		    "cache for %s; it will be rebuilt at the next start\n",
+		    code, VPartitionPath(dp)));
+	okv_close(&part->dbh);
+    }
+}
+
+/**
+ * stop keeping a partition's saved volume group cache up to date.
+ *
+ * @param[in] dp  disk partition object
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal
+ */
+void
+_VVGC_db_close_r(struct DiskPartition64 *dp)
+{
+    okv_close(&VVGCache.part[dp->index].dbh);
+}
+
+/**
+ * save the volume group cache for the next fileserver start.
+ *
+ * Syncs each partition's saved cache to disk and marks it clean, so that
+ * the next start can load it instead of scanning the partition.  The saved
+ * caches are closed, and are not updated again by this process.
+ *
+ * @pre VOL_LOCK held
+ *
+ * @note called at shutdown, once all volumes have been taken offline
+ */
+void
+VVGCache_checkpoint_r(void)
+{
+    struct DiskPartition64 *dp;
+    VVGCache_part_t *part;
+    struct okv_trans *tx = NULL;
+    struct rx_opaque key, val;
+    char path[MAXPATHLEN];
+    afs_uint32 now;
+    int code, fd;
+
+    for (dp = DiskPartitionList; dp; dp = dp->next) {
+	part = &VVGCache.part[dp->index];
+	if (part->dbh == NULL || part->state != VVGC_PART_STATE_VALID) {
+	    continue;
+	}
+
+	/* a synchronous commit also flushes the earlier unsynced ones */
+	code = okv_dbhandle_setflags(part->dbh, OKV_DBH_NOSYNC, 0);
+	if (code == 0) {
+	    code = okv_begin(part->dbh, OKV_BEGIN_RW, &tx);
+	}
+	if (code == 0) {
+	    now = htonl(time(NULL));
+	    key.len = strlen(VVGC_DB_STAMP);
+	    key.val = VVGC_DB_STAMP;
+	    val.len = sizeof(now);
+	    val.val = &now;
+	    code = okv_put(tx, &key, &val, OKV_PUT_REPLACE);
+	}
+	if (code == 0) {
+	    code = okv_commit(&tx);
+	}
+	okv_abort(&tx);
+	okv_close(&part->dbh);
+
+	if (code == 0) {
+	    _VVGC_db_path(dp, VVGC_CLEAN_NAME, path, sizeof(path));
+	    fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	    if (fd < 0) {
+		code = errno;
+	    } else {
+		close(fd);
+	    }
+	}
+	if (code) {
+	    ViceLog(0, ("VVGCache_checkpoint: error %d saving the volume group "
+			"cache for %s\n", code, VPartitionPath(dp)));
+	}
+    }
+}
+
 #endif /* AFS_DEMAND_ATTACH_FS */
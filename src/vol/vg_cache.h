@@ -18,6 +18,16 @@
 #include "vg_cache_types.h"
 #include "partition.h"
 
+/*
+ * Each partition keeps a copy of its volume group cache in VVGC_DB_NAME,
+ * which the fileserver can load at startup instead of reading every volume
+ * header.  VVGC_CLEAN_NAME exists only while the copy is known to match the
+ * volume headers on the partition; anything that changes a volume header
+ * without telling the fileserver must remove it.
+ */
+#define VVGC_DB_NAME	"vgcache.db"
+#define VVGC_CLEAN_NAME	"vgcache.clean"
+
 extern int VVGCache_entry_add(struct DiskPartition64 *, VolumeId parent,
 			      VolumeId child, afs_int32 *newvg);
 extern int VVGCache_entry_add_r(struct DiskPartition64 *, VolumeId parent,
@@ -35,6 +45,7 @@ extern int VVGCache_checkPartition_r(struct DiskPartition64 *);
 
 extern int VVGCache_PkgInit(void);
 extern int VVGCache_PkgShutdown(void);
+extern void VVGCache_checkpoint_r(void);
 
 
 #endif /* _AFS_VOL_VG_CACHE_H */
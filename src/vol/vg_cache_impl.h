@@ -27,12 +27,21 @@ extern int _VVGC_flush_part_r(struct DiskPartition64 * part);
 extern int _VVGC_scan_start(struct DiskPartition64 * dp);
 extern int _VVGC_state_change(struct DiskPartition64 * part,
 			      VVGCache_part_state_t state);
+extern int _VVGC_entry_add_r(struct DiskPartition64 * dp,
+                             VolumeId parent, VolumeId child,
+                             afs_int32 *newvg);
 extern int _VVGC_entry_purge_r(struct DiskPartition64 * dp,
                                VolumeId parent, VolumeId child);
 extern int _VVGC_dlist_add_r(struct DiskPartition64 *dp,
                              VolumeId parent, VolumeId child);
 extern int _VVGC_dlist_del_r(struct DiskPartition64 *dp,
                              VolumeId parent, VolumeId child);
+extern int _VVGC_db_load(struct DiskPartition64 * dp,
+                         struct okv_dbhandle **a_dbh,
+                         VVGCache_scan_entry_t **a_ents, int *a_nents);
+extern struct okv_dbhandle *_VVGC_db_save_r(struct DiskPartition64 * dp,
+                                            struct okv_dbhandle *dbh);
+extern void _VVGC_db_close_r(struct DiskPartition64 * dp);
 
 #define VVGC_HASH(volumeId) (volumeId&(VolumeHashTable.Mask))
 
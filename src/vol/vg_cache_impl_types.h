@@ -23,6 +23,7 @@
 #include <rx/rx_queue.h>
 #include <signal.h>
 
+struct okv_dbhandle;
 
 /**
  * volume group cache node.
@@ -107,6 +108,10 @@ typedef struct VVGCache_part {
 					  *   VVGCache_dlist_entry_t's.
 					  *   This is NULL when we are not
 					  *   scanning. */
+    struct okv_dbhandle *dbh;     /**< saved copy of the cache for this
+                                   *   partition, or NULL if it is not
+                                   *   being kept up to date */
+    afs_uint32 changes;           /**< updates made while scanning */
 } VVGCache_part_t;
 
 /**
@@ -38,6 +38,7 @@
 #include "voldefs.h"
 #include "partition.h"
 #include <afs/errors.h>
+#include <afs/okv.h>
 
 #define __VOL_VG_CACHE_IMPL 1
 
@@ -53,6 +54,9 @@ static int _VVGC_scan_table_flush(VVGCache_scan_table_t * tbl,
 				  struct DiskPartition64 * dp);
 static void * _VVGC_scanner_thread(void *);
 static int _VVGC_scan_partition(struct DiskPartition64 * part);
+static int _VVGC_scan_saved(struct DiskPartition64 * part,
+			    VVGCache_scan_table_t * tbl,
+			    struct okv_dbhandle ** a_dbh);
 static VVGCache_dlist_entry_t * _VVGC_dlist_lookup_r(struct DiskPartition64 *dp,
                                                      VolumeId parent,
                                                      VolumeId child);
@@ -159,10 +163,10 @@ _VVGC_scan_table_flush(VVGCache_scan_table_t * tbl,
 			         tbl->entries[i].volid)) {
 	    continue;
 	}
-	res = VVGCache_entry_add_r(dp,
-				   tbl->entries[i].parent,
-				   tbl->entries[i].volid,
-				   &newvg);
+	res = _VVGC_entry_add_r(dp,
+				tbl->entries[i].parent,
+				tbl->entries[i].volid,
+				&newvg);
 	if (res) {
 	    code = res;
 	} else {
@@ -243,6 +247,156 @@ _VVGC_UnlinkHeader(struct DiskPartition64 *dp, const char *name,
     }
 }
 
+static int
+_VVGC_compare_volid(const void *a, const void *b)
+{
+    VolumeId va = *(const VolumeId *)a, vb = *(const VolumeId *)b;
+
+    if (va < vb)
+	return -1;
+    return va > vb;
+}
+
+/**
+ * list the volume headers on a partition.
+ *
+ * Only the partition directory is read; the headers are not opened.
+ *
+ * @param[in]  part_path  partition path
+ * @param[out] a_ids      volume ids of the headers found, sorted; the
+ *                        caller must free them
+ * @param[out] a_nids     number of headers found
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval EINVAL a header file does not have the usual name, so only
+ *                   reading it would tell which volume it is
+ *
+ * @internal
+ */
+static int
+_VVGC_list_headers(char *part_path, VolumeId **a_ids, int *a_nids)
+{
+    DIR *dirp;
+    struct dirent *dentry;
+    VolumeId *ids = NULL, *nids;
+    int n = 0, nalloc = 0, code = 0;
+    char *p, *end;
+    unsigned long volid;
+
+    dirp = opendir(part_path);
+    if (dirp == NULL) {
+	return errno;
+    }
+    while ((dentry = readdir(dirp)) != NULL) {
+	p = strrchr(dentry->d_name, '.');
+	if (p == NULL || strcmp(p, VHDREXT) != 0) {
+	    continue;
+	}
+	if (dentry->d_name[0] != 'V' || strlen(dentry->d_name) != VHDRNAMELEN) {
+	    code = EINVAL;
+	    break;
+	}
+	volid = strtoul(dentry->d_name + 1, &end, 10);
+	if (end != p) {
+	    code = EINVAL;
+	    break;
+	}
+	if (n == nalloc) {
+	    nalloc = nalloc ? 2 * nalloc : VVGC_SCAN_TBL_LEN;
+	    nids = realloc(ids, nalloc * sizeof(*ids));
+	    if (nids == NULL) {
+		code = ENOMEM;
+		break;
+	    }
+	    ids = nids;
+	}
+	ids[n++] = volid;
+    }
+    closedir(dirp);
+
+    if (code) {
+	free(ids);
+	return code;
+    }
+    qsort(ids, n, sizeof(*ids), _VVGC_compare_volid);
+    *a_ids = ids;
+    *a_nids = n;
+    return 0;
+}
+
+/**
+ * fill a scan table from a partition's saved volume group cache.
+ *
+ * The saved cache is used only if it is clean and lists exactly the volume
+ * headers that are on the partition now.  Anything that changes a header
+ * in place removes the clean mark (see VVGC_CLEAN_NAME), so comparing the
+ * volume ids is enough to catch the changes that do not.
+ *
+ * @param[in]  part   disk partition object
+ * @param[in]  tbl    scan table
+ * @param[out] a_dbh  the saved cache, to keep up to date
+ *
+ * @pre VOL_LOCK is NOT held
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval nonzero no usable saved cache; the partition must be scanned
+ *
+ * @internal
+ */
+static int
+_VVGC_scan_saved(struct DiskPartition64 * part, VVGCache_scan_table_t * tbl,
+		 struct okv_dbhandle ** a_dbh)
+{
+    struct okv_dbhandle *dbh = NULL;
+    VVGCache_scan_entry_t *ents = NULL;
+    VolumeId *ids = NULL;
+    int nents = 0, nids = 0, code, i;
+
+    code = _VVGC_db_load(part, &dbh, &ents, &nents);
+    if (code) {
+	goto done;
+    }
+
+    code = _VVGC_list_headers(VPartitionPath(part), &ids, &nids);
+    if (code) {
+	goto done;
+    }
+    if (nids != nents) {
+	code = -1;
+    }
+    for (i = 0; code == 0 && i < nids; i++) {
+	if (ids[i] != ents[i].volid) {
+	    code = -1;
+	}
+    }
+    if (code) {
+	ViceLog(0, ("VVGC_scan_partition: saved volume group cache for %s "
+		    "does not match its volume headers; scanning them\n",
+		    VPartitionPath(part)));
+	goto done;
+    }
+
+    for (i = 0; i < nents; i++) {
+	code = _VVGC_scan_table_add(tbl, part, ents[i].volid,
+				    ents[i].parent);
+	if (code) {
+	    goto done;
+	}
+    }
+
+ done:
+    free(ents);
+    free(ids);
+    if (code) {
+	okv_close(&dbh);
+    } else {
+	*a_dbh = dbh;
+    }
+    return code;
+}
+
 /**
  * scan a disk partition for .vol files
  *
@@ -264,6 +418,8 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
     DIR *dirp = NULL;
     VVGCache_scan_table_t tbl;
     char *part_path = NULL;
+    struct okv_dbhandle *dbh = NULL;
+    int saved = 0;
 
     code = _VVGC_scan_table_init(&tbl);
     if (code) {
@@ -285,6 +441,8 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
 	    VPartitionPath(part), res));
 	code = -2;
     }
+    _VVGC_db_close_r(part);
+    VVGCache.part[part->index].changes = 0;
     VOL_UNLOCK;
     if (code) {
 	goto done;
@@ -298,13 +456,21 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
 	goto done;
     }
 
-    ViceLog(5, ("VVGC_scan_partition: scanning partition %s for VG cache\n",
-                 part_path));
+    if (_VVGC_scan_saved(part, &tbl, &dbh) == 0) {
+	saved = 1;
+    } else {
+	ViceLog(5, ("VVGC_scan_partition: scanning partition %s for VG cache\n",
+		     part_path));
 
-    code = VWalkVolumeHeaders(part, part_path, _VVGC_RecordHeader,
-                              _VVGC_UnlinkHeader, &tbl);
-    if (code < 0) {
-	goto done;
+	code = _VVGC_scan_table_init(&tbl);
+	if (code) {
+	    goto done;
+	}
+	code = VWalkVolumeHeaders(part, part_path, _VVGC_RecordHeader,
+				  _VVGC_UnlinkHeader, &tbl);
+	if (code < 0) {
+	    goto done;
+	}
     }
 
     _VVGC_scan_table_flush(&tbl, part);
@@ -318,12 +484,21 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
 	ViceLog(0, ("VVGC_scan_partition: error %d while scanning %s\n",
 	            code, part_path));
     } else {
-	ViceLog(0, ("VVGC_scan_partition: finished scanning %s: %lu volumes in %lu groups\n",
-	             part_path, tbl.newvols, tbl.newvgs));
+	ViceLog(0, ("VVGC_scan_partition: finished %s %s: %lu volumes in %lu groups\n",
+		     saved ? "loading saved cache for" : "scanning",
+		     part_path, tbl.newvols, tbl.newvgs));
     }
 
     VOL_LOCK;
 
+    /* do this while the to-delete list still exists, since it may drop
+     * VOL_LOCK */
+    if (code == 0) {
+	dbh = _VVGC_db_save_r(part, dbh);
+    } else {
+	okv_close(&dbh);
+    }
+
     _VVGC_flush_dlist(part);
     free(VVGCache.part[part->index].dlist_hash_buckets);
     VVGCache.part[part->index].dlist_hash_buckets = NULL;
@@ -331,6 +506,7 @@ _VVGC_scan_partition(struct DiskPartition64 * part)
     if (code) {
 	_VVGC_state_change(part, VVGC_PART_STATE_INVALID);
     } else {
+	VVGCache.part[part->index].dbh = dbh;
 	_VVGC_state_change(part, VVGC_PART_STATE_VALID);
     }
 
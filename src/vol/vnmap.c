@@ -0,0 +1,735 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Vnode maps; see vnmap.h.
+ *
+ * The map file is a header followed by one VnMapEntry per vnode number,
+ * large and small vnodes interleaved as their numbers are.  Entries past
+ * the end of the file are unused vnodes: the only index writes that are
+ * not made through VnStore are the zeroes VAllocVnode uses to grow an
+ * index.
+ *
+ * The header carries a clean flag.  A process that is about to change the
+ * map clears the flag and syncs it before the first vnode index write, and
+ * sets it again when the volume's handles are closed, after syncing both
+ * indexes and the map.  A map found without the flag set is removed, since
+ * changes may have been lost from it in a crash.
+ *
+ * While the map is dirty its file is held open, so that recording a vnode
+ * costs one pwrite.  The descriptor is closed when the map is marked clean
+ * or dropped, which happens at the latest when the volume's handles are
+ * closed.  Entries are written outside the map lock; the descriptor is
+ * only closed once no write is using it.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#ifdef AFS_PTHREAD_ENV
+#include <opr/lock.h>
+#endif
+#include "rx/rx_queue.h"
+#include <afs/afsint.h>
+#include "nfs.h"
+#include "lock.h"
+#include "ihandle.h"
+#include "vnode.h"
+#include "volume.h"
+#include "vnmap.h"
+#include "common.h"
+
+#define VNMAP_MAGIC	0x766e6d70
+#define VNMAP_VERSION	1
+
+#define VNMAP_CLEAN	0x1		/* header flag: map is complete */
+
+struct VnMapHeader {
+    afs_uint32 magic;
+    afs_uint32 version;
+    afs_uint32 volumeId;
+    afs_uint32 flags;
+};
+
+/* Entries read or built at a time */
+#define VNMAP_CHUNK	4096
+
+#define VnMapOffset(vn) \
+    ((afs_foff_t)sizeof(struct VnMapHeader) \
+     + (afs_foff_t)(vn) * sizeof(struct VnMapEntry))
+
+enum VnMapState {
+    VNMAP_UNKNOWN,		/* not looked at since the volume was opened */
+    VNMAP_DIRTY,		/* unclean, and being kept up to date by us */
+    VNMAP_NONE,			/* no usable map; changes are not tracked */
+    VNMAP_BUILDING		/* being rebuilt by a VnMapBuilder */
+};
+
+struct VnMap {
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_t lock;
+    opr_cv_t cv;		/* signalled when writers drops to 0 */
+#endif
+    char *partName;
+    VolumeId volumeId;
+    enum VnMapState state;
+    FD_t fd;			/* open while the map is dirty */
+    int writers;		/* VnMapStore calls writing through fd */
+};
+
+struct VnMapReader {
+    FD_t fd;
+    int loaded;			/* buf holds a chunk */
+    VnodeId first;		/* first vnode number in buf */
+    afs_uint32 count;		/* entries in buf */
+    struct VnMapEntry buf[VNMAP_CHUNK];
+};
+
+struct VnMapBuilder {
+    struct VnMap *map;
+    FD_t fd;
+    VnodeId first;		/* first vnode number in buf */
+    int loaded;			/* buf holds a chunk */
+    int error;
+    struct VnMapEntry buf[VNMAP_CHUNK];
+};
+
+#ifdef AFS_PTHREAD_ENV
+#define VNMAP_LOCK(map)		opr_mutex_enter(&(map)->lock)
+#define VNMAP_UNLOCK(map)	opr_mutex_exit(&(map)->lock)
+#else
+#define VNMAP_LOCK(map)
+#define VNMAP_UNLOCK(map)
+#endif
+
+/* Returns 0, or ENAMETOOLONG if the path does not fit */
+static int
+MapPath(char *partName, VolumeId volumeId, char *path, size_t len)
+{
+    int n;
+
+    n = snprintf(path, len, "%s" OS_DIRSEP VNMAPFORMAT, partName,
+		 afs_printable_VolumeId_lu(volumeId));
+    if (n < 0 || (size_t)n >= len)
+	return ENAMETOOLONG;
+    return 0;
+}
+
+static int
+WriteHeader(FD_t fd, VolumeId volumeId, afs_uint32 flags)
+{
+    struct VnMapHeader hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = VNMAP_MAGIC;
+    hdr.version = VNMAP_VERSION;
+    hdr.volumeId = volumeId;
+    hdr.flags = flags;
+    if (OS_PWRITE(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+	return -1;
+    return OS_SYNC(fd);
+}
+
+/* Open a map file if it is complete; returns INVALID_FD if not */
+static FD_t
+OpenClean(struct VnMap *map, int flags)
+{
+    char path[VMAXPATHLEN];
+    struct VnMapHeader hdr;
+    FD_t fd;
+
+    if (MapPath(map->partName, map->volumeId, path, sizeof(path)) != 0)
+	return INVALID_FD;
+    fd = OS_OPEN(path, flags, 0);
+    if (fd == INVALID_FD)
+	return INVALID_FD;
+    if (OS_PREAD(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+	|| hdr.magic != VNMAP_MAGIC || hdr.version != VNMAP_VERSION
+	|| hdr.volumeId != map->volumeId || !(hdr.flags & VNMAP_CLEAN)) {
+	OS_CLOSE(fd);
+	return INVALID_FD;
+    }
+    return fd;
+}
+
+/* Wait for writes through the dirty map's fd to finish; map locked */
+static void
+WaitWriters_r(struct VnMap *map)
+{
+#ifdef AFS_PTHREAD_ENV
+    while (map->writers > 0)
+	opr_cv_wait(&map->cv, &map->lock);
+#endif
+}
+
+/* Close the dirty map's fd, if it is open; map locked */
+static void
+CloseDirty_r(struct VnMap *map)
+{
+    WaitWriters_r(map);
+    if (map->fd != INVALID_FD) {
+	OS_CLOSE(map->fd);
+	map->fd = INVALID_FD;
+    }
+}
+
+/* Called with the map locked */
+static void
+Invalidate_r(struct VnMap *map, enum VnMapState state)
+{
+    CloseDirty_r(map);
+    VnMapDestroy(map->partName, map->volumeId);
+    map->state = state;
+}
+
+/* Fsync an index, whatever the -sync setting; returns 0 on success */
+static int
+SyncIndex(IHandle_t *ih)
+{
+    FdHandle_t *fdP;
+    int code;
+
+    if (ih == NULL)
+	return 0;
+    fdP = IH_OPEN(ih);
+    if (fdP == NULL)
+	return -1;
+    code = OS_SYNC(fdP->fd_fd);
+    FDH_CLOSE(fdP);
+    return code;
+}
+
+/**
+ * Set up the map state for a volume.  No I/O is done until the map is
+ * first used.
+ *
+ * @param[in] partName  path of the volume's partition
+ * @param[in] volumeId  volume id
+ *
+ * @return map state, or NULL if out of memory
+ */
+struct VnMap *
+VnMapCreate(char *partName, VolumeId volumeId)
+{
+    struct VnMap *map;
+
+    map = calloc(1, sizeof(*map));
+    if (map == NULL)
+	return NULL;
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_init(&map->lock);
+    opr_cv_init(&map->cv);
+#endif
+    map->partName = partName;
+    map->volumeId = volumeId;
+    map->state = VNMAP_UNKNOWN;
+    map->fd = INVALID_FD;
+    return map;
+}
+
+/**
+ * Free the map state.  A map still being updated is left without its
+ * clean flag, and so will not be used again.
+ *
+ * @param[in] map  map state, or NULL
+ */
+void
+VnMapFree(struct VnMap *map)
+{
+    if (map == NULL)
+	return;
+    if (map->fd != INVALID_FD)
+	OS_CLOSE(map->fd);
+#ifdef AFS_PTHREAD_ENV
+    opr_cv_destroy(&map->cv);
+    opr_mutex_destroy(&map->lock);
+#endif
+    free(map);
+}
+
+/**
+ * Record a vnode that is about to be written to the vnode index.
+ *
+ * The first call after the volume is opened marks the map as being
+ * changed.  If the volume has no usable map, nothing is done.
+ *
+ * @param[in] map          map state, or NULL
+ * @param[in] vnodeNumber  vnode number
+ * @param[in] vnode        the vnode as it will be written
+ */
+void
+VnMapStore(struct VnMap *map, VnodeId vnodeNumber, VnodeDiskObject *vnode)
+{
+    struct VnMapEntry entry;
+    FD_t fd;
+    int code;
+
+    if (map == NULL)
+	return;
+
+    VNMAP_LOCK(map);
+    if (map->state == VNMAP_UNKNOWN) {
+	fd = OpenClean(map, O_RDWR);
+	if (fd != INVALID_FD && WriteHeader(fd, map->volumeId, 0) == 0) {
+	    map->fd = fd;
+	    map->state = VNMAP_DIRTY;
+	} else {
+	    /* Missing, unclean or unwritable; make sure it stays unused */
+	    if (fd != INVALID_FD)
+		OS_CLOSE(fd);
+	    VnMapDestroy(map->partName, map->volumeId);
+	    map->state = VNMAP_NONE;
+	}
+    }
+    if (map->state != VNMAP_DIRTY) {
+	VNMAP_UNLOCK(map);
+	return;
+    }
+    fd = map->fd;
+    map->writers++;
+    VNMAP_UNLOCK(map);
+
+    memset(&entry, 0, sizeof(entry));
+    entry.uniquifier = vnode->uniquifier;
+    entry.serverModifyTime = vnode->serverModifyTime;
+    entry.type = vnode->type;
+    code = 0;
+    if (OS_PWRITE(fd, &entry, sizeof(entry), VnMapOffset(vnodeNumber))
+	!= sizeof(entry))
+	code = -1;
+
+    VNMAP_LOCK(map);
+#ifdef AFS_PTHREAD_ENV
+    if (--map->writers == 0)
+	opr_cv_broadcast(&map->cv);
+#else
+    map->writers--;
+#endif
+    if (code != 0 && map->state == VNMAP_DIRTY) {
+	Log("VnMapStore: write failed for volume %" AFS_VOLID_FMT
+	    "; dropping its vnode map\n",
+	    afs_printable_VolumeId_lu(map->volumeId));
+	Invalidate_r(map, VNMAP_NONE);
+    }
+    VNMAP_UNLOCK(map);
+}
+
+/**
+ * Finish with the map when the volume's handles are closed.  If we have
+ * changed it, sync the vnode indexes and the map and mark it clean.
+ *
+ * @param[in] map         map state, or NULL
+ * @param[in] largeIndex  large vnode index
+ * @param[in] smallIndex  small vnode index
+ */
+void
+VnMapClose(struct VnMap *map, IHandle_t *largeIndex, IHandle_t *smallIndex)
+{
+    int code;
+
+    if (map == NULL)
+	return;
+
+    VNMAP_LOCK(map);
+    if (map->state == VNMAP_DIRTY) {
+	WaitWriters_r(map);
+	code = -1;
+	if (SyncIndex(largeIndex) == 0 && SyncIndex(smallIndex) == 0
+	    && OS_SYNC(map->fd) == 0
+	    && WriteHeader(map->fd, map->volumeId, VNMAP_CLEAN) == 0)
+	    code = 0;
+	CloseDirty_r(map);
+	if (code != 0) {
+	    Log("VnMapClose: sync failed for volume %" AFS_VOLID_FMT
+		"; dropping its vnode map\n",
+		afs_printable_VolumeId_lu(map->volumeId));
+	    Invalidate_r(map, VNMAP_UNKNOWN);
+	}
+    }
+    if (map->state != VNMAP_BUILDING)
+	map->state = VNMAP_UNKNOWN;
+    VNMAP_UNLOCK(map);
+}
+
+/**
+ * Throw away a volume's map, because its vnode index is about to be
+ * changed behind VnStore's back.  Changes are not tracked again until the
+ * volume is reopened.
+ *
+ * @param[in] map  map state, or NULL
+ */
+void
+VnMapInvalidate(struct VnMap *map)
+{
+    if (map == NULL)
+	return;
+    VNMAP_LOCK(map);
+    Invalidate_r(map, VNMAP_NONE);
+    VNMAP_UNLOCK(map);
+}
+
+/**
+ * Check whether a volume has a complete map.
+ *
+ * @param[in] map  map state, or NULL
+ *
+ * @return 1 if the map may be used, 0 if not
+ */
+int
+VnMapIsValid(struct VnMap *map)
+{
+    FD_t fd;
+    int valid = 0;
+
+    if (map == NULL)
+	return 0;
+    VNMAP_LOCK(map);
+    if (map->state == VNMAP_DIRTY) {
+	valid = 1;
+    } else if (map->state == VNMAP_UNKNOWN) {
+	fd = OpenClean(map, O_RDONLY);
+	if (fd != INVALID_FD) {
+	    OS_CLOSE(fd);
+	    valid = 1;
+	}
+    }
+    VNMAP_UNLOCK(map);
+    return valid;
+}
+
+/**
+ * Remove the map file for a volume, if there is one.
+ *
+ * @param[in] partName  path of the volume's partition
+ * @param[in] volumeId  volume id
+ */
+void
+VnMapDestroy(char *partName, VolumeId volumeId)
+{
+    char path[VMAXPATHLEN];
+
+    /* a map that cannot be named cannot have been made */
+    if (MapPath(partName, volumeId, path, sizeof(path)) != 0)
+	return;
+    if (OS_UNLINK(path) != 0 && errno != ENOENT)
+	Log("VnMapDestroy: unable to remove %s, errno %d\n", path, errno);
+}
+
+/**
+ * Open a volume's map for reading.
+ *
+ * @param[in] map  map state, or NULL
+ *
+ * @return reader, or NULL if the volume has no usable map
+ */
+struct VnMapReader *
+VnMapOpenRead(struct VnMap *map)
+{
+    struct VnMapReader *reader;
+    char path[VMAXPATHLEN];
+    FD_t fd = INVALID_FD;
+
+    if (map == NULL)
+	return NULL;
+    VNMAP_LOCK(map);
+    if (map->state == VNMAP_DIRTY) {
+	if (MapPath(map->partName, map->volumeId, path, sizeof(path)) == 0)
+	    fd = OS_OPEN(path, O_RDONLY, 0);
+    } else if (map->state == VNMAP_UNKNOWN) {
+	fd = OpenClean(map, O_RDONLY);
+    }
+    VNMAP_UNLOCK(map);
+    if (fd == INVALID_FD)
+	return NULL;
+
+    reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+	OS_CLOSE(fd);
+	return NULL;
+    }
+    reader->fd = fd;
+    return reader;
+}
+
+/**
+ * Read the map entry for a vnode.
+ *
+ * @param[in]  reader       map reader
+ * @param[in]  vnodeNumber  vnode number
+ * @param[out] entry        the vnode's entry
+ *
+ * @return 0 on success, EIO on a read error
+ */
+int
+VnMapRead(struct VnMapReader *reader, VnodeId vnodeNumber,
+	  struct VnMapEntry *entry)
+{
+    ssize_t nBytes;
+
+    if (!reader->loaded || vnodeNumber < reader->first
+	|| vnodeNumber >= reader->first + VNMAP_CHUNK) {
+	reader->first = vnodeNumber;
+	nBytes = OS_PREAD(reader->fd, reader->buf, sizeof(reader->buf),
+			  VnMapOffset(vnodeNumber));
+	if (nBytes < 0) {
+	    reader->loaded = 0;
+	    return EIO;
+	}
+	reader->count = nBytes / sizeof(struct VnMapEntry);
+	reader->loaded = 1;
+    }
+    if (vnodeNumber - reader->first < reader->count)
+	*entry = reader->buf[vnodeNumber - reader->first];
+    else
+	memset(entry, 0, sizeof(*entry));	/* past the end: unused */
+    return 0;
+}
+
+/**
+ * Close a map reader.
+ *
+ * @param[in] reader  map reader, or NULL
+ */
+void
+VnMapCloseRead(struct VnMapReader *reader)
+{
+    if (reader == NULL)
+	return;
+    OS_CLOSE(reader->fd);
+    free(reader);
+}
+
+/**
+ * Check a map entry against the vnode as read from the vnode index.
+ *
+ * @param[in] entry  map entry
+ * @param[in] vnode  the vnode from the index
+ *
+ * @return 1 if they agree, 0 if the map is stale
+ */
+int
+VnMapEntryMatches(struct VnMapEntry *entry, VnodeDiskObject *vnode)
+{
+    if (entry->type != vnode->type)
+	return 0;
+    if (entry->type == vNull)
+	return 1;
+    return entry->uniquifier == vnode->uniquifier
+	&& entry->serverModifyTime == vnode->serverModifyTime;
+}
+
+static void
+BuildFlush(struct VnMapBuilder *builder)
+{
+    if (builder->loaded && !builder->error
+	&& OS_PWRITE(builder->fd, builder->buf, sizeof(builder->buf),
+		     VnMapOffset(builder->first)) != sizeof(builder->buf))
+	builder->error = 1;
+    builder->loaded = 0;
+}
+
+/**
+ * Start rebuilding a volume's map from a complete pass over its vnode
+ * indexes, as made when cloning.  Any existing map is removed first.
+ *
+ * @param[in] map  map state
+ *
+ * @return builder, or NULL if the map cannot be built
+ */
+struct VnMapBuilder *
+VnMapBuildBegin(struct VnMap *map)
+{
+    struct VnMapBuilder *builder;
+    char path[VMAXPATHLEN];
+
+    if (map == NULL)
+	return NULL;
+
+    VNMAP_LOCK(map);
+    if (map->state == VNMAP_BUILDING) {
+	VNMAP_UNLOCK(map);
+	return NULL;
+    }
+    Invalidate_r(map, VNMAP_BUILDING);
+    VNMAP_UNLOCK(map);
+
+    builder = calloc(1, sizeof(*builder));
+    if (builder == NULL)
+	goto fail;
+    builder->map = map;
+    if (MapPath(map->partName, map->volumeId, path, sizeof(path)) != 0) {
+	Log("VnMapBuildBegin: path too long for the vnode map of volume %"
+	    AFS_VOLID_FMT "\n", afs_printable_VolumeId_lu(map->volumeId));
+	free(builder);
+	goto fail;
+    }
+    builder->fd = OS_OPEN(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (builder->fd == INVALID_FD
+	|| WriteHeader(builder->fd, map->volumeId, 0) != 0) {
+	Log("VnMapBuildBegin: unable to create %s, errno %d\n", path, errno);
+	if (builder->fd != INVALID_FD)
+	    OS_CLOSE(builder->fd);
+	free(builder);
+	goto fail;
+    }
+    return builder;
+
+  fail:
+    VNMAP_LOCK(map);
+    VnMapDestroy(map->partName, map->volumeId);
+    map->state = VNMAP_NONE;
+    VNMAP_UNLOCK(map);
+    return NULL;
+}
+
+/**
+ * Add a vnode to a map being built.  Each vnode is expected once, in
+ * ascending order within its class; the classes may be added one after
+ * the other.
+ *
+ * @param[in] builder      map builder, or NULL
+ * @param[in] vnodeNumber  vnode number
+ * @param[in] vnode        the vnode
+ */
+void
+VnMapBuildAdd(struct VnMapBuilder *builder, VnodeId vnodeNumber,
+	      VnodeDiskObject *vnode)
+{
+    struct VnMapEntry *entry;
+    ssize_t nBytes;
+
+    if (builder == NULL || builder->error)
+	return;
+
+    if (!builder->loaded || vnodeNumber < builder->first
+	|| vnodeNumber >= builder->first + VNMAP_CHUNK) {
+	BuildFlush(builder);
+	/* The other class's vnodes in this chunk may already be there */
+	builder->first = vnodeNumber - vnodeNumber % VNMAP_CHUNK;
+	memset(builder->buf, 0, sizeof(builder->buf));
+	nBytes = OS_PREAD(builder->fd, builder->buf, sizeof(builder->buf),
+			  VnMapOffset(builder->first));
+	if (nBytes < 0) {
+	    builder->error = 1;
+	    return;
+	}
+	builder->loaded = 1;
+    }
+    entry = &builder->buf[vnodeNumber - builder->first];
+    entry->uniquifier = vnode->uniquifier;
+    entry->serverModifyTime = vnode->serverModifyTime;
+    entry->type = vnode->type;
+}
+
+/**
+ * Finish building a map.  When committing, the vnode indexes are synced
+ * before the map is marked clean.
+ *
+ * @param[in] builder     map builder, or NULL
+ * @param[in] largeIndex  large vnode index
+ * @param[in] smallIndex  small vnode index
+ * @param[in] commit      0 to throw the map away, e.g. if the indexes
+ *                        could not be written
+ *
+ * @return 0 if the map was committed
+ */
+int
+VnMapBuildEnd(struct VnMapBuilder *builder, IHandle_t *largeIndex,
+	      IHandle_t *smallIndex, int commit)
+{
+    struct VnMap *map;
+    int code = -1;
+
+    if (builder == NULL)
+	return -1;
+    map = builder->map;
+
+    BuildFlush(builder);
+    if (commit && !builder->error && SyncIndex(largeIndex) == 0
+	&& SyncIndex(smallIndex) == 0 && OS_SYNC(builder->fd) == 0
+	&& WriteHeader(builder->fd, map->volumeId, VNMAP_CLEAN) == 0)
+	code = 0;
+    OS_CLOSE(builder->fd);
+    free(builder);
+
+    VNMAP_LOCK(map);
+    if (code != 0) {
+	if (commit)
+	    Log("VnMapBuildEnd: unable to build the vnode map for volume %"
+		AFS_VOLID_FMT "\n", afs_printable_VolumeId_lu(map->volumeId));
+	VnMapDestroy(map->partName, map->volumeId);
+    }
+    map->state = VNMAP_UNKNOWN;
+    VNMAP_UNLOCK(map);
+    return code;
+}
+
+/**
+ * Rebuild a volume's map by reading its vnode indexes, for use after the
+ * indexes have been written other than through VnStore, as by a restore.
+ *
+ * @param[in] map         map state
+ * @param[in] largeIndex  large vnode index
+ * @param[in] smallIndex  small vnode index
+ *
+ * @return 0 if the map was rebuilt
+ */
+int
+VnMapRebuild(struct VnMap *map, IHandle_t *largeIndex, IHandle_t *smallIndex)
+{
+    struct VnMapBuilder *builder;
+    char buf[SIZEOF_LARGEDISKVNODE];
+    struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)buf;
+    struct VnodeClassInfo *vcp;
+    IHandle_t *ih[nVNODECLASSES];
+    FdHandle_t *fdP;
+    StreamHandle_t *file;
+    VnodeClass class;
+    int vnodeIndex;
+    int error = 0;
+
+    builder = VnMapBuildBegin(map);
+    if (builder == NULL)
+	return -1;
+
+    ih[vLarge] = largeIndex;
+    ih[vSmall] = smallIndex;
+    for (class = 0; class < nVNODECLASSES && !error; class++) {
+	vcp = &VnodeClassInfo[class];
+	fdP = IH_OPEN(ih[class]);
+	if (fdP == NULL) {
+	    error = 1;
+	    break;
+	}
+	file = FDH_FDOPEN(fdP, "r");
+	if (file == NULL) {
+	    FDH_CLOSE(fdP);
+	    error = 1;
+	    break;
+	}
+	if (FDH_SIZE(fdP) > vcp->diskSize
+	    && STREAM_ASEEK(file, vcp->diskSize) == 0) {
+	    for (vnodeIndex = 0;
+		 STREAM_READ(vnode, vcp->diskSize, 1, file) == 1;
+		 vnodeIndex++) {
+		VnMapBuildAdd(builder, bitNumberToVnodeNumber(vnodeIndex, class),
+			      vnode);
+	    }
+	    if (STREAM_ERROR(file))
+		error = 1;
+	}
+	STREAM_CLOSE(file);
+	FDH_CLOSE(fdP);
+    }
+
+    return VnMapBuildEnd(builder, largeIndex, smallIndex, !error);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Vnode maps.
+ *
+ * A vnode map is a file kept beside a volume's header file which records,
+ * for every vnode in the volume, just the fields an incremental dump needs
+ * in order to decide whether the vnode has changed: its type, uniquifier
+ * and server modify time.  Incremental dumps find the changed vnodes from
+ * the map, so that they can be read ahead.  The indexes are still read
+ * through, to check each entry before it is relied on.
+ *
+ * VnStore keeps the map up to date.  Anything else that writes a vnode
+ * index must either rebuild the map (see VnMapBuildBegin and VnMapRebuild)
+ * or throw it away (see VnMapInvalidate and VnMapDestroy).  A map that is
+ * missing or was not closed cleanly is not used.
+ */
+
+#ifndef AFS_VOL_VNMAP_H
+#define AFS_VOL_VNMAP_H
+
+#define VNMAPFORMAT "V%010" AFS_VOLID_FMT ".vnmap"
+
+/* One per vnode number, in local byte order, like the vnode index */
+struct VnMapEntry {
+    afs_uint32 uniquifier;
+    afs_uint32 serverModifyTime;
+    afs_uint32 type;		/* VnodeType; vNull if the vnode is unused */
+};
+
+struct VnMap;
+struct VnMapReader;
+struct VnMapBuilder;
+
+extern struct VnMap *VnMapCreate(char *partName, VolumeId volumeId);
+extern void VnMapFree(struct VnMap *map);
+extern void VnMapStore(struct VnMap *map, VnodeId vnodeNumber,
+		       VnodeDiskObject *vnode);
+extern void VnMapClose(struct VnMap *map, IHandle_t *largeIndex,
+		       IHandle_t *smallIndex);
+extern void VnMapInvalidate(struct VnMap *map);
+extern int VnMapIsValid(struct VnMap *map);
+extern void VnMapDestroy(char *partName, VolumeId volumeId);
+
+extern struct VnMapReader *VnMapOpenRead(struct VnMap *map);
+extern int VnMapRead(struct VnMapReader *reader, VnodeId vnodeNumber,
+		     struct VnMapEntry *entry);
+extern void VnMapCloseRead(struct VnMapReader *reader);
+extern int VnMapEntryMatches(struct VnMapEntry *entry,
+			     VnodeDiskObject *vnode);
+
+extern struct VnMapBuilder *VnMapBuildBegin(struct VnMap *map);
+extern void VnMapBuildAdd(struct VnMapBuilder *builder, VnodeId vnodeNumber,
+			  VnodeDiskObject *vnode);
+extern int VnMapBuildEnd(struct VnMapBuilder *builder, IHandle_t *largeIndex,
+			 IHandle_t *smallIndex, int commit);
+extern int VnMapRebuild(struct VnMap *map, IHandle_t *largeIndex,
+			IHandle_t *smallIndex);
+
+#endif /* AFS_VOL_VNMAP_H */
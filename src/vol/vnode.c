@@ -41,6 +41,7 @@
 #include "ihandle.h"
 #include "vnode.h"
 #include "volume.h"
+#include "vnmap.h"
 #include "volume_inline.h"
 #include "vnode_inline.h"
 #include "partition.h"
@@ -95,6 +96,33 @@ private Vnode *VnodeHashTable[VNODE_HASH_TABLE_SIZE];
 #define VNODE_HASH(volumeptr,vnodenumber)\
     (opr_jhash_int((vnodenumber), V_id((volumeptr))) & VNODE_HASH_TABLE_MASK)
 
+/*
+ * Vnode cache locking.
+ *
+ * VOL_LOCK still covers the cache as a whole: a vnode's identity (volume,
+ * vnode number, cache check), the hash chains' links, and the volumes' vnode
+ * lists only change with it held.
+ *
+ * Each hash chain also has a lock, VN_LOCK(vnp) for the chain a vnode is on.
+ * It must be held, in addition to VOL_LOCK where that is required, to change
+ * a vnode's reference count, state flags, LRU membership, hash chain links
+ * and, for DAFS, its state and reader count; DAFS state waits sleep on it.
+ * The LRU links of each class are covered by the class's lruLock.  The lock
+ * order is VOL_LOCK, then a chain lock, then an LRU lock.
+ *
+ * With that, a cached vnode can be found, read locked and released with only
+ * its chain lock; see VGetVnodeFast and VPutVnodeFast.  A vnode only moves to
+ * another chain while nothing references it and it is not hashed, in
+ * VGetFreeVnode_r.
+ */
+#ifdef AFS_PTHREAD_ENV
+opr_mutex_t VnodeChainLocks[VNODE_HASH_TABLE_SIZE];
+#endif
+#ifdef AFS_DEMAND_ATTACH_FS
+/* gets counted by VGetVnodeFast, under the chain locks */
+private int VnodeChainGets[VNODE_HASH_TABLE_SIZE][nVNODECLASSES];
+#endif
+
 
 
 #define BAD_IGET	-1000
@@ -120,7 +148,7 @@ private Vnode *VnodeHashTable[VNODE_HASH_TABLE_SIZE];
  *       because we destroy all vnode cache contents during during volume
  *       detach.
  *
- * @pre VOL_LOCK held
+ * @pre VOL_LOCK and the vnode's chain lock held
  *
  * @internal volume package internal use only
  */
@@ -139,7 +167,7 @@ AddToVVnList(Volume * vp, Vnode * vnp)
 /**
  * delete a vnode from the volume's vnode list.
  *
- * @pre VOL_LOCK held
+ * @pre VOL_LOCK and the vnode's chain lock held
  *
  * @internal volume package internal use only
  */
@@ -161,6 +189,8 @@ DeleteFromVVnList(Vnode * vnp)
  * @param[in] vcp  vnode class info object pointer
  * @param[in] vnp  vnode object pointer
  *
+ * @pre the vnode's chain lock held
+ *
  * @internal vnode package internal use only
  */
 void
@@ -170,6 +200,7 @@ AddToVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 	return;
     }
 
+    VN_LRU_LOCK(vcp);
     /* Add it to the circular LRU list */
     if (vcp->lruHead == NULL)
 	Abort("VPutVnode: vcp->lruHead==NULL");
@@ -185,6 +216,7 @@ AddToVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
      * will be reused immediately */
     if (vnp->delete)
 	vcp->lruHead = vnp->lruNext;
+    VN_LRU_UNLOCK(vcp);
 
     Vn_stateFlags(vnp) |= VN_ON_LRU;
 }
@@ -195,6 +227,8 @@ AddToVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
  * @param[in] vcp  vnode class info object pointer
  * @param[in] vnp  vnode object pointer
  *
+ * @pre the vnode's chain lock held
+ *
  * @internal vnode package internal use only
  */
 void
@@ -204,6 +238,7 @@ DeleteFromVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 	return;
     }
 
+    VN_LRU_LOCK(vcp);
     if (vnp == vcp->lruHead)
 	vcp->lruHead = vcp->lruHead->lruNext;
 
@@ -213,6 +248,7 @@ DeleteFromVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 
     vnp->lruPrev->lruNext = vnp->lruNext;
     vnp->lruNext->lruPrev = vnp->lruPrev;
+    VN_LRU_UNLOCK(vcp);
 
     Vn_stateFlags(vnp) &= ~(VN_ON_LRU);
 }
@@ -222,7 +258,9 @@ DeleteFromVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
  *
  * @param[in] vnp  vnode object pointer
  *
- * @pre VOL_LOCK held
+ * @pre VOL_LOCK held.
+ *      vnp->hashIndex set for the vnode's volume and vnode number, and that
+ *      chain's lock held.
  *
  * @post vnode on hash
  *
@@ -231,13 +269,9 @@ DeleteFromVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 void
 AddToVnHash(Vnode * vnp)
 {
-    unsigned int newHash;
-
     if (!(Vn_stateFlags(vnp) & VN_ON_HASH)) {
-	newHash = VNODE_HASH(Vn_volume(vnp), Vn_id(vnp));
-	vnp->hashNext = VnodeHashTable[newHash];
-	VnodeHashTable[newHash] = vnp;
-	vnp->hashIndex = newHash;
+	vnp->hashNext = VnodeHashTable[vnp->hashIndex];
+	VnodeHashTable[vnp->hashIndex] = vnp;
 
 	Vn_stateFlags(vnp) |= VN_ON_HASH;
     }
@@ -247,11 +281,11 @@ AddToVnHash(Vnode * vnp)
  * delete a vnode from the vnode hash table.
  *
  * @param[in] vnp
- * @param[in] hash
  *
- * @pre VOL_LOCK held
+ * @pre VOL_LOCK and the vnode's chain lock held
  *
- * @post vnode removed from hash
+ * @post vnode removed from hash; hashIndex is left alone, so the chain lock
+ *       still covers the vnode
  *
  * @internal vnode package internal use only
  */
@@ -272,7 +306,6 @@ DeleteFromVnHash(Vnode * vnp)
 	}
 
 	vnp->hashNext = NULL;
-	vnp->hashIndex = 0;
 	Vn_stateFlags(vnp) &= ~(VN_ON_HASH);
     }
 }
@@ -283,7 +316,7 @@ DeleteFromVnHash(Vnode * vnp)
  *
  * @param[in] avnode   vnode object pointer
  *
- * @pre VOL_LOCK held
+ * @pre VOL_LOCK and the vnode's chain lock held
  *
  * @post vnode metadata invalidated.
  *       vnode removed from hash table.
@@ -324,6 +357,17 @@ VInitVnodes(VnodeClass class, int nVnodes)
 {
     byte *va;
     struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+#ifdef AFS_PTHREAD_ENV
+    static int chainLocksInited = 0;
+    int i;
+
+    if (!chainLocksInited) {
+	for (i = 0; i < VNODE_HASH_TABLE_SIZE; i++)
+	    opr_mutex_init(&VnodeChainLocks[i]);
+	chainLocksInited = 1;
+    }
+    opr_mutex_init(&vcp->lruLock);
+#endif
 
     vcp->allocs = vcp->gets = vcp->reads = vcp->writes = 0;
     vcp->cacheSize = nVnodes;
@@ -401,7 +445,7 @@ VInitVnodes(VnodeClass class, int nVnodes)
  * @param[in] vp   volume pointer
  * @param[in] vnodeNumber new vnode number that the vnode will be used for
  *
- * @pre VOL_LOCK is held
+ * @pre VOL_LOCK is held; no chain lock held
  *
  * @post vnode object is removed from lru
  *       vnode is disassociated with its old volume, and associated with its
@@ -430,7 +474,20 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
 {
     Vnode *vnp;
 
-    vnp = vcp->lruHead->lruPrev;
+    /*
+     * The LRU lock comes after the chain locks, so pick the tail, then take
+     * its chain lock and make sure nobody has taken the vnode off the LRU in
+     * the meantime.  Its chain cannot change, since that needs VOL_LOCK.
+     */
+    for (;;) {
+	VN_LRU_LOCK(vcp);
+	vnp = vcp->lruHead->lruPrev;
+	VN_LRU_UNLOCK(vcp);
+	VN_LOCK(vnp);
+	if (Vn_stateFlags(vnp) & VN_ON_LRU)
+	    break;
+	VN_UNLOCK(vnp);
+    }
 #ifdef AFS_DEMAND_ATTACH_FS
     if (Vn_refcount(vnp) != 0 || VnIsExclusiveState(Vn_state(vnp)) ||
 	Vn_readers(vnp) != 0)
@@ -452,21 +509,29 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
     if (Vn_volume(vnp)) {
 	DeleteFromVVnList(vnp);
     }
+    VnCreateReservation_r(vnp);
+#ifdef AFS_DEMAND_ATTACH_FS
+    VnChangeState_r(vnp, VN_STATE_INVALID);
+#endif
+    VN_UNLOCK(vnp);
 
     /* we must re-hash the vnp _before_ we drop the glock again; otherwise,
      * someone else might try to grab the same vnode id, and we'll both alloc
      * a vnode object for the same vn id, bypassing vnode locking */
     Vn_id(vnp) = vnodeNumber;
-    VnCreateReservation_r(vnp);
+    vnp->hashIndex = VNODE_HASH(vp, vnodeNumber);
+    VN_LOCK(vnp);
     AddToVVnList(vp, vnp);
 #ifdef AFS_DEMAND_ATTACH_FS
+    if (vnp->handle)
+	VnChangeState_r(vnp, VN_STATE_RELEASING);
     AddToVnHash(vnp);
 #endif
+    VN_UNLOCK(vnp);
 
     /* drop the file descriptor */
     if (vnp->handle) {
 #ifdef AFS_DEMAND_ATTACH_FS
-	VnChangeState_r(vnp, VN_STATE_RELEASING);
 	VOL_UNLOCK;
 #endif
 	/* release is, potentially, a highly latent operation due to a couple
@@ -480,13 +545,12 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
 	IH_RELEASE(vnp->handle);
 #ifdef AFS_DEMAND_ATTACH_FS
 	VOL_LOCK;
+	VN_LOCK(vnp);
+	VnChangeState_r(vnp, VN_STATE_INVALID);
+	VN_UNLOCK(vnp);
 #endif
     }
 
-#ifdef AFS_DEMAND_ATTACH_FS
-    VnChangeState_r(vnp, VN_STATE_INVALID);
-#endif
-
     return vnp;
 }
 
@@ -497,7 +561,7 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
  * @param[in] vp       pointer to volume object
  * @param[in] vnodeId  vnode id
  *
- * @pre VOL_LOCK held
+ * @pre VOL_LOCK held, or the lock of the chain the vnode hashes to
  *
  * @post matching vnode object or NULL is returned
  *
@@ -566,6 +630,7 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
 
 #ifdef AFS_DEMAND_ATTACH_FS
     VolState vol_state_save;
+    VnState vn_state_save;
 #endif
 
     *ec = 0;
@@ -689,9 +754,15 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
 	 * so we may have to wait for it below */
 	VNLog(3, 2, vnodeNumber, (intptr_t)vnp, 0, 0);
 
+	VN_LOCK(vnp);
 	VnCreateReservation_r(vnp);
 	if (Vn_refcount(vnp) == 1) {
 	    /* we're the only user */
+#ifdef AFS_DEMAND_ATTACH_FS
+	    /* keep VGetVnodeFast off it while we reinitialize it */
+	    vn_state_save = VnChangeState_r(vnp, VN_STATE_EXCLUSIVE);
+#endif
+	    VN_UNLOCK(vnp);
 	    /* This won't block */
 	    VnLock(vnp, WRITE_LOCK, VOL_LOCK_HELD, WILL_NOT_DEADLOCK);
 	} else {
@@ -707,10 +778,13 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
 	    if (VIsErrorState(V_attachState(vp))) {
 		VnUnlock(vnp, WRITE_LOCK);
 		VnCancelReservation_r(vnp);
+		VN_UNLOCK(vnp);
 		*ec = DAFS_VSALVAGE;
 		return NULL;
 	    }
+	    vn_state_save = VnChangeState_r(vnp, VN_STATE_EXCLUSIVE);
 #endif
+	    VN_UNLOCK(vnp);
 
 	    /* other users present; follow locking hierarchy */
 	    VnLock(vnp, WRITE_LOCK, VOL_LOCK_HELD, MIGHT_DEADLOCK);
@@ -724,7 +798,12 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
 	     */
 	    if (Vn_volume(vnp)->cacheCheck != Vn_cacheCheck(vnp)) {
 		VnUnlock(vnp, WRITE_LOCK);
+		VN_LOCK(vnp);
+#ifdef AFS_DEMAND_ATTACH_FS
+		VnChangeState_r(vnp, vn_state_save);
+#endif
 		VnCancelReservation_r(vnp);
+		VN_UNLOCK(vnp);
 		goto vnrehash;
 	    }
 	}
@@ -740,9 +819,11 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
 	    *ec = EIO;
 	    VFreeBitMapEntry_r(&tmp, vp, &vp->vnodeIndex[class], bitNumber,
 		               VOL_FREE_BITMAP_WAIT);
+	    VN_LOCK(vnp);
 	    VInvalidateVnode_r(vnp);
 	    VnUnlock(vnp, WRITE_LOCK);
 	    VnCancelReservation_r(vnp);
+	    VN_UNLOCK(vnp);
 #ifdef AFS_DEMAND_ATTACH_FS
 	    VRequestSalvage_r(ec, vp, SALVSYNC_ERROR, 0);
 #else
@@ -760,7 +841,9 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
 	VnLock(vnp, WRITE_LOCK, VOL_LOCK_HELD, WILL_NOT_DEADLOCK);
 
 #ifdef AFS_DEMAND_ATTACH_FS
+	VN_LOCK(vnp);
 	VnChangeState_r(vnp, VN_STATE_ALLOC);
+	VN_UNLOCK(vnp);
 #endif
 
 	/* Sanity check:  is this vnode really not in use? */
@@ -853,9 +936,11 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
 		FDH_CLOSE(fdP);
 	    VOL_LOCK;
 	    VFreeBitMapEntry_r(&tmp, vp, &vp->vnodeIndex[class], bitNumber, 0 /*flags*/);
+	    VN_LOCK(vnp);
 	    VInvalidateVnode_r(vnp);
 	    VnUnlock(vnp, WRITE_LOCK);
 	    VnCancelReservation_r(vnp);
+	    VN_UNLOCK(vnp);
 #ifdef AFS_DEMAND_ATTACH_FS
 	    VRequestSalvage_r(ec, vp, SALVSYNC_ERROR, 0);
 	    VCancelReservation_r(vp);
@@ -867,7 +952,9 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
     sane:
 	VNLog(4, 2, vnodeNumber, (intptr_t)vnp, 0, 0);
 #ifndef AFS_DEMAND_ATTACH_FS
+	VN_LOCK(vnp);
 	AddToVnHash(vnp);
+	VN_UNLOCK(vnp);
 #endif
     }
 
@@ -883,7 +970,9 @@ VAllocVnode_r(Error * ec, Volume * vp, VnodeType type, VnodeId in_vnode, Unique
     vcp->allocs++;
     V_filecount(vp)++;
 #ifdef AFS_DEMAND_ATTACH_FS
+    VN_LOCK(vnp);
     VnChangeState_r(vnp, VN_STATE_EXCLUSIVE);
+    VN_UNLOCK(vnp);
 #endif
     return vnp;
 }
@@ -922,7 +1011,9 @@ VnLoad(Error * ec, Volume * vp, Vnode * vnp,
     vcp->reads++;
 
 #ifdef AFS_DEMAND_ATTACH_FS
+    VN_LOCK(vnp);
     VnChangeState_r(vnp, VN_STATE_LOAD);
+    VN_UNLOCK(vnp);
 #endif
 
     /* This will never block */
@@ -993,7 +1084,9 @@ VnLoad(Error * ec, Volume * vp, Vnode * vnp,
     IH_INIT(vnp->handle, V_device(vp), afs_printable_VolumeId_lu(V_parentId(vp)), VN_GET_INO(vnp));
     VnUnlock(vnp, WRITE_LOCK);
 #ifdef AFS_DEMAND_ATTACH_FS
+    VN_LOCK(vnp);
     VnChangeState_r(vnp, VN_STATE_ONLINE);
+    VN_UNLOCK(vnp);
 #endif
     return;
 
@@ -1016,8 +1109,10 @@ VnLoad(Error * ec, Volume * vp, Vnode * vnp,
 	    *ec = error;
     }
 
+    VN_LOCK(vnp);
     VInvalidateVnode_r(vnp);
     VnUnlock(vnp, WRITE_LOCK);
+    VN_UNLOCK(vnp);
 }
 
 /**
@@ -1045,6 +1140,7 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
     afs_foff_t offset;
     IHandle_t *ihP = vp->vnodeIndex[class].handle;
     FdHandle_t *fdP;
+    struct VnMap *map;
     afs_ino_str_t stmp;
 #ifdef AFS_DEMAND_ATTACH_FS
     VnState vn_state_save;
@@ -1053,18 +1149,25 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
     *ec = 0;
 
 #ifdef AFS_DEMAND_ATTACH_FS
+    VN_LOCK(vnp);
     vn_state_save = VnChangeState_r(vnp, VN_STATE_STORE);
+    VN_UNLOCK(vnp);
 #endif
 
     offset = vnodeIndexOffset(vcp, Vn_id(vnp));
+    map = VGetVnMap_r(vp);
     VOL_UNLOCK;
     fdP = IH_OPEN(ihP);
     if (fdP == NULL) {
 	Log("VnStore: can't open index file!\n");
 	goto error_encountered;
     }
+    /* The map must not claim a vnode is unchanged once the index says
+     * otherwise, so record the change before writing it */
+    VnMapStore(map, Vn_id(vnp), &vnp->disk);
     nBytes = FDH_PWRITE(fdP, &vnp->disk, vcp->diskSize, offset);
     if (nBytes != vcp->diskSize) {
+	VnMapInvalidate(map);
 	/* Don't force volume offline if the inumber is out of
 	 * range or the inode table is full.
 	 */
@@ -1076,7 +1179,9 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
 	    *ec = VIO;
 	    VOL_LOCK;
 #ifdef AFS_DEMAND_ATTACH_FS
+	    VN_LOCK(vnp);
 	    VnChangeState_r(vnp, VN_STATE_ERROR);
+	    VN_UNLOCK(vnp);
 #endif
 	} else {
 	    Log("VnStore: Couldn't write vnode %u, volume %" AFS_VOLID_FMT " (%s) (error %d)\n", Vn_id(vnp), afs_printable_VolumeId_lu(V_id(Vn_volume(vnp))), V_name(Vn_volume(vnp)), (int)nBytes);
@@ -1095,7 +1200,9 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
 
     VOL_LOCK;
 #ifdef AFS_DEMAND_ATTACH_FS
+    VN_LOCK(vnp);
     VnChangeState_r(vnp, vn_state_save);
+    VN_UNLOCK(vnp);
 #endif
     return;
 
@@ -1106,13 +1213,137 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
     if (fdP)
 	FDH_CLOSE(fdP);
     VOL_LOCK;
+    VN_LOCK(vnp);
     VnChangeState_r(vnp, VN_STATE_ERROR);
+    VN_UNLOCK(vnp);
     VRequestSalvage_r(ec, vp, SALVSYNC_ERROR, 0);
 #else
     opr_abort();
 #endif
 }
 
+#ifdef AFS_DEMAND_ATTACH_FS
+/**
+ * get a read handle to a cached vnode without VOL_LOCK.
+ *
+ * Only the common case is handled here: the fileserver reading a vnode
+ * which is cached, not busy, and in a volume which is attached.  Anything
+ * else is left to VGetVnode_r.
+ *
+ * @param[in]  vp           volume object
+ * @param[in]  vnodeNumber  vnode id
+ * @param[in]  locktype     type of lock to acquire
+ *
+ * @return vnode object pointer
+ *   @retval NULL  VGetVnode_r must be used instead
+ *
+ * @pre VOL_LOCK is NOT held.
+ *      heavyweight ref held on volume object.
+ *
+ * @internal vnode package internal use only
+ */
+static Vnode *
+VGetVnodeFast(Volume * vp, VnodeId vnodeNumber, int locktype)
+{
+    Vnode *vnp;
+    unsigned int hash;
+
+    if (locktype != READ_LOCK || programType != fileServer ||
+	vnodeNumber == 0 || !TrustVnodeCacheEntry)
+	return NULL;
+
+    /*
+     * Unlocked peeks at the volume.  Our heavyweight ref keeps the volume
+     * from being detached, and so its vnodes from being invalidated, so this
+     * only has to steer anything unusual to VGetVnode_r.
+     */
+    if (V_attachState(vp) != VOL_STATE_ATTACHED || !V_inUse(vp))
+	return NULL;
+
+    hash = VNODE_HASH(vp, vnodeNumber);
+    VN_CHAIN_LOCK(hash);
+    vnp = VLookupVnode(vp, vnodeNumber);
+    if (vnp == NULL ||
+	(Vn_state(vnp) != VN_STATE_ONLINE && Vn_state(vnp) != VN_STATE_READ) ||
+	vnp->disk.type == vNull) {
+	VN_CHAIN_UNLOCK(hash);
+	return NULL;
+    }
+    VnodeChainGets[hash][vnodeIdToClass(vnodeNumber)]++;
+    VnCreateReservation_r(vnp);
+    VnBeginRead_r(vnp);
+    VN_CHAIN_UNLOCK(hash);
+
+    if (VTryBumpVolumeUsage(vp)) {
+	VOL_LOCK;
+	VBumpVolumeUsage_r(vp);
+	VOL_UNLOCK;
+    }
+    return vnp;
+}
+
+/**
+ * put back a read handle to a vnode object without VOL_LOCK.
+ *
+ * @param[in]  vnp  vnode object pointer
+ *
+ * @return whether the handle was put back
+ *   @retval 0  VPutVnode_r must be used instead
+ *   @retval 1  ref dropped on vnode
+ *
+ * @pre VOL_LOCK is NOT held.
+ *      ref held on vnode.
+ *
+ * @internal vnode package internal use only
+ */
+static int
+VPutVnodeFast(Vnode * vnp)
+{
+    if (!TrustVnodeCacheEntry)
+	return 0;
+
+    VN_LOCK(vnp);
+    /* writers, and readers of invalidated vnodes, take the slow path */
+    if (Vn_state(vnp) != VN_STATE_READ) {
+	VN_UNLOCK(vnp);
+	return 0;
+    }
+    opr_Assert(Vn_refcount(vnp) != 0);
+    opr_Assert(vnp->disk.vnodeMagic == Vn_class(vnp)->magic);
+    if (vnp->changed_newTime || vnp->changed_oldTime || vnp->delete)
+	Abort("VPutVnode: Change or delete flag for vnode "
+	      "%p is set but vnode is not write locked!\n", vnp);
+    VnEndRead_r(vnp);
+    VnUnlock(vnp, READ_LOCK);
+    VnCancelReservation_r(vnp);
+    VN_UNLOCK(vnp);
+    return 1;
+}
+#endif /* AFS_DEMAND_ATTACH_FS */
+
+/**
+ * count the VGetVnode calls for a vnode class.
+ *
+ * @param[in] vclass  vnode class
+ *
+ * @return number of gets, including those made without VOL_LOCK
+ *
+ * @note the counters are read without their locks, so the sum is only
+ *       as current as any other statistic.
+ */
+int
+VCountVnodeGets(VnodeClass vclass)
+{
+    int gets = VnodeClassInfo[vclass].gets;
+#ifdef AFS_DEMAND_ATTACH_FS
+    int i;
+
+    for (i = 0; i < VNODE_HASH_TABLE_SIZE; i++)
+	gets += VnodeChainGets[i][vclass];
+#endif
+    return gets;
+}
+
 /**
  * get a handle to a vnode object.
  *
@@ -1129,6 +1360,13 @@ Vnode *
 VGetVnode(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 {				/* READ_LOCK or WRITE_LOCK, as defined in lock.h */
     Vnode *retVal;
+#ifdef AFS_DEMAND_ATTACH_FS
+    retVal = VGetVnodeFast(vp, vnodeNumber, locktype);
+    if (retVal) {
+	*ec = 0;
+	return retVal;
+    }
+#endif
     VOL_LOCK;
     retVal = VGetVnode_r(ec, vp, vnodeNumber, locktype);
     VOL_UNLOCK;
@@ -1213,35 +1451,9 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 	/* vnode is in cache */
 
 	VNLog(101, 2, vnodeNumber, (intptr_t)vnp, 0, 0);
+	VN_LOCK(vnp);
 	VnCreateReservation_r(vnp);
-
-#ifdef AFS_DEMAND_ATTACH_FS
-	/*
-	 * this is the one DAFS case where we may run into contention.
-	 * here's the basic control flow:
-	 *
-	 * if locktype is READ_LOCK:
-	 *   wait until vnode is not exclusive
-	 *   set to VN_STATE_READ
-	 *   increment read count
-	 *   done
-	 * else
-	 *   wait until vnode is quiescent
-	 *   set to VN_STATE_EXCLUSIVE
-	 *   done
-	 */
-	if (locktype == READ_LOCK) {
-	    VnWaitExclusiveState_r(vnp);
-	} else {
-	    VnWaitQuiescent_r(vnp);
-	}
-
-	if (VnIsErrorState(Vn_state(vnp))) {
-	    VnCancelReservation_r(vnp);
-	    *ec = VSALVAGE;
-	    return NULL;
-	}
-#endif /* AFS_DEMAND_ATTACH_FS */
+	VN_UNLOCK(vnp);
     } else {
 	/* vnode not cached */
 
@@ -1271,25 +1483,60 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 
 	VnLoad(ec, vp, vnp, vcp, class);
 	if (*ec) {
+	    VN_LOCK(vnp);
 	    VnCancelReservation_r(vnp);
+	    VN_UNLOCK(vnp);
 	    return NULL;
 	}
 #ifndef AFS_DEMAND_ATTACH_FS
+	VN_LOCK(vnp);
 	AddToVnHash(vnp);
+	VN_UNLOCK(vnp);
 #endif
 	/*
 	 * DAFS:
-	 * there is no possibility for contention. we "own" this vnode.
+	 * VGetVnodeFast may find the vnode as soon as VnLoad has put it
+	 * online, so it is waited for below just like a cached one.
 	 */
     }
 
+#ifdef AFS_DEMAND_ATTACH_FS
     /*
-     * DAFS:
-     * it is imperative that nothing drop vol lock between here
-     * and the VnBeginRead/VnChangeState stanza below
+     * this is the one DAFS case where we may run into contention.
+     * here's the basic control flow:
+     *
+     * if locktype is READ_LOCK:
+     *   wait until vnode is not exclusive
+     *   set to VN_STATE_READ
+     *   increment read count
+     *   done
+     * else
+     *   wait until vnode is quiescent
+     *   set to VN_STATE_EXCLUSIVE
+     *   done
+     *
+     * it is imperative that the chain lock is held from the wait
+     * through the VnBeginRead/VnChangeState stanza below.  VnLock
+     * only records the writer for DAFS, so it must come after the wait.
      */
+    VN_LOCK(vnp);
+    if (locktype == READ_LOCK) {
+	VnWaitExclusiveState_r(vnp);
+    } else {
+	VnWaitQuiescent_r(vnp);
+    }
 
+    if (VnIsErrorState(Vn_state(vnp))) {
+	VnCancelReservation_r(vnp);
+	VN_UNLOCK(vnp);
+	*ec = VSALVAGE;
+	return NULL;
+    }
+    VnLock(vnp, locktype, VOL_LOCK_HELD, MIGHT_DEADLOCK);
+#else /* !AFS_DEMAND_ATTACH_FS */
     VnLock(vnp, locktype, VOL_LOCK_HELD, MIGHT_DEADLOCK);
+    VN_LOCK(vnp);
+#endif /* !AFS_DEMAND_ATTACH_FS */
 
     /* Check that the vnode hasn't been removed while we were obtaining
      * the lock */
@@ -1297,6 +1544,7 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
     if ((vnp->disk.type == vNull) || (Vn_cacheCheck(vnp) == 0)) {
 	VnUnlock(vnp, locktype);
 	VnCancelReservation_r(vnp);
+	VN_UNLOCK(vnp);
 	*ec = VNOVNODE;
 	/* vnode is labelled correctly by now, so we don't have to invalidate it */
 	return NULL;
@@ -1309,6 +1557,7 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 	VnChangeState_r(vnp, VN_STATE_EXCLUSIVE);
     }
 #endif
+    VN_UNLOCK(vnp);
 
     if (programType == fileServer)
 	VBumpVolumeUsage_r(Vn_volume(vnp));	/* Hack; don't know where it should be
@@ -1317,12 +1566,115 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 }
 
 
+#ifdef FDH_WILLNEED
+/* Index entries closer together than this are prefetched as one range. */
+#define VN_PREFETCH_GAP 8192
+
+static int
+CompareOffsets(const void *a, const void *b)
+{
+    afs_foff_t x = *(const afs_foff_t *)a, y = *(const afs_foff_t *)b;
+
+    return (x > y) - (x < y);
+}
+#endif
+
+/**
+ * start reading the index entries of a batch of vnodes.
+ *
+ * @param[in] vp       volume object pointer
+ * @param[in] vnodes   array of vnode ids
+ * @param[in] nvnodes  number of entries in vnodes
+ *
+ * @pre VOL_LOCK is NOT held.
+ *      heavyweight ref held on volume object.
+ *
+ * @post reads have been issued for the index entries of those vnodes
+ *       which are not in the vnode cache; nothing waits for them.
+ *
+ * @note this is only a hint.  The vnodes are still loaded one at a time by
+ *       VGetVnode, but those reads are then satisfied from the buffer cache
+ *       instead of each waiting on the disk in turn.
+ */
+void
+VPrefetchVnodes(Volume * vp, VnodeId * vnodes, int nvnodes)
+{
+#ifdef FDH_WILLNEED
+    afs_foff_t *offsets[nVNODECLASSES];
+    int noffsets[nVNODECLASSES];
+    struct ih_range *ranges;
+    struct VnodeClassInfo *vcp;
+    FdHandle_t *fdP;
+    afs_foff_t start, end;
+    VnodeClass class;
+    int i, j, nranges;
+
+    if (nvnodes < 2)
+	return;
+
+    for (class = 0; class < nVNODECLASSES; class++) {
+	noffsets[class] = 0;
+	offsets[class] = malloc(nvnodes * sizeof(afs_foff_t));
+    }
+    ranges = malloc(nvnodes * sizeof(*ranges));
+    if (offsets[vLarge] == NULL || offsets[vSmall] == NULL || ranges == NULL)
+	goto done;
+
+    VOL_LOCK;
+    for (i = 0; i < nvnodes; i++) {
+	if (vnodes[i] == 0 || VLookupVnode(vp, vnodes[i]) != NULL)
+	    continue;
+	class = vnodeIdToClass(vnodes[i]);
+	vcp = &VnodeClassInfo[class];
+	offsets[class][noffsets[class]++] =
+	    vnodeIndexOffset(vcp, vnodes[i]);
+    }
+    VOL_UNLOCK;
+
+    for (class = 0; class < nVNODECLASSES; class++) {
+	if (noffsets[class] == 0 || vp->vnodeIndex[class].handle == NULL)
+	    continue;
+	vcp = &VnodeClassInfo[class];
+	fdP = IH_OPEN(vp->vnodeIndex[class].handle);
+	if (fdP == NULL)
+	    continue;
+	qsort(offsets[class], noffsets[class], sizeof(afs_foff_t),
+	      CompareOffsets);
+	nranges = 0;
+	for (i = 0; i < noffsets[class]; i = j) {
+	    start = offsets[class][i];
+	    end = start + vcp->diskSize;
+	    for (j = i + 1; j < noffsets[class]
+		 && offsets[class][j] <= end + VN_PREFETCH_GAP; j++)
+		end = offsets[class][j] + vcp->diskSize;
+	    ranges[nranges].offset = start;
+	    ranges[nranges].length = end - start;
+	    nranges++;
+	}
+	(void)FDH_WILLNEED(fdP, ranges, nranges);
+	FDH_CLOSE(fdP);
+    }
+
+  done:
+    for (class = 0; class < nVNODECLASSES; class++)
+	free(offsets[class]);
+    free(ranges);
+#endif /* FDH_WILLNEED */
+}
+
+
 int TrustVnodeCacheEntry = 1;
 /* This variable is bogus--when it's set to 0, the hash chains fill
    up with multiple versions of the same vnode.  Should fix this!! */
 void
 VPutVnode(Error * ec, Vnode * vnp)
 {
+#ifdef AFS_DEMAND_ATTACH_FS
+    if (VPutVnodeFast(vnp)) {
+	*ec = 0;
+	return;
+    }
+#endif
     VOL_LOCK;
     VPutVnode_r(ec, vnp);
     VOL_UNLOCK;
@@ -1427,25 +1779,28 @@ VPutVnode_r(Error * ec, Vnode * vnp)
 	    vcp->writes++;
 	    vnp->changed_newTime = vnp->changed_oldTime = 0;
 	}
-#ifdef AFS_DEMAND_ATTACH_FS
-	VnChangeState_r(vnp, VN_STATE_ONLINE);
-#endif
     } else {			/* Not write locked */
 	if (vnp->changed_newTime || vnp->changed_oldTime || vnp->delete)
 	    Abort
 		("VPutVnode: Change or delete flag for vnode "
 		 "%p is set but vnode is not write locked!\n",
 		 vnp);
-#ifdef AFS_DEMAND_ATTACH_FS
-	VnEndRead_r(vnp);
-#endif
     }
 
     /* Do not look at disk portion of vnode after this point; it may
      * have been deleted above */
+    VN_LOCK(vnp);
+#ifdef AFS_DEMAND_ATTACH_FS
+    if (writeLocked) {
+	VnChangeState_r(vnp, VN_STATE_ONLINE);
+    } else {
+	VnEndRead_r(vnp);
+    }
+#endif
     vnp->delete = 0;
     VnUnlock(vnp, ((writeLocked) ? WRITE_LOCK : READ_LOCK));
     VnCancelReservation_r(vnp);
+    VN_UNLOCK(vnp);
 }
 
 /*
@@ -1552,14 +1907,101 @@ VVnodeWriteToRead_r(Error * ec, Vnode * vnp)
 
     vnp->writer = 0;
 #ifdef AFS_DEMAND_ATTACH_FS
+    VN_LOCK(vnp);
     VnChangeState_r(vnp, VN_STATE_ONLINE);
     VnBeginRead_r(vnp);
+    VN_UNLOCK(vnp);
 #else
     ConvertWriteToReadLock(&vnp->lock);
 #endif
     return 0;
 }
 
+/*
+ * Write a write-locked vnode out to disk now, keeping the lock and the
+ * change flags, so that VPutVnode still writes its final state.
+ */
+void
+VSyncVnode(Error * ec, Vnode * vnp)
+{
+    VOL_LOCK;
+    VSyncVnode_r(ec, vnp);
+    VOL_UNLOCK;
+}
+
+/**
+ * write a vnode to disk without giving up exclusive access.
+ *
+ * Used where something on disk may only be freed once the vnode index
+ * no longer refers to it.
+ *
+ * @param[out] ec   client error code
+ * @param[in]  vnp  vnode object pointer
+ *
+ * @pre VOL_LOCK held.
+ *      ref held on vnode.
+ *      write lock held on vnode.
+ *
+ * @post vnode state is stored to disk.
+ *       vnode is still write locked, and its change flags are unchanged.
+ *
+ * @internal volume package internal use only
+ */
+void
+VSyncVnode_r(Error * ec, Vnode * vnp)
+{
+    VnodeClass class;
+    struct VnodeClassInfo *vcp;
+    Volume *vp = Vn_volume(vnp);
+#ifdef AFS_PTHREAD_ENV
+    pthread_t thisProcess;
+#else /* AFS_PTHREAD_ENV */
+    PROCESS thisProcess;
+#endif /* AFS_PTHREAD_ENV */
+
+    *ec = 0;
+    opr_Assert(Vn_refcount(vnp) != 0);
+    class = vnodeIdToClass(Vn_id(vnp));
+    vcp = &VnodeClassInfo[class];
+    opr_Assert(vnp->disk.vnodeMagic == vcp->magic);
+    VNLog(400, 2, Vn_id(vnp), (intptr_t) vnp, 0, 0);
+
+#ifdef AFS_DEMAND_ATTACH_FS
+    opr_Assert(Vn_state(vnp) == VN_STATE_EXCLUSIVE);
+#else
+    opr_Assert(WriteLocked(&vnp->lock));
+#endif
+#ifdef AFS_PTHREAD_ENV
+    thisProcess = pthread_self();
+#else /* AFS_PTHREAD_ENV */
+    LWP_CurrentProcess(&thisProcess);
+#endif /* AFS_PTHREAD_ENV */
+    if (thisProcess != vnp->writer)
+	Abort("VSyncVnode: Vnode at %p locked by another process!\n", vnp);
+    opr_Assert(!vnp->delete);
+    opr_Assert(Vn_cacheCheck(vnp) == vp->cacheCheck);
+
+    if (!V_inUse(vp)) {
+#ifdef AFS_DEMAND_ATTACH_FS
+	VRequestSalvage_r(ec, vp, SALVSYNC_ERROR, 0);
+#else
+	opr_Assert(V_needsSalvaged(vp));
+	*ec = VSALVAGE;
+#endif
+	return;
+    }
+    VnStore(ec, vp, vnp, vcp, class);
+#ifdef AFS_DEMAND_ATTACH_FS
+    /* the caller still owns the vnode, and will put it back */
+    if (*ec) {
+	VN_LOCK(vnp);
+	VnChangeState_r(vnp, VN_STATE_EXCLUSIVE);
+	VN_UNLOCK(vnp);
+    }
+#endif
+    vcp->writes++;
+}
+
 /**
  * initial size of ihandle pointer vector.
  *
@@ -1655,8 +2097,10 @@ restart_traversal:
 	    ih_vec[i++] = vnp->handle;
 	    vnp->handle = NULL;
 	}
+	VN_LOCK(vnp);
 	DeleteFromVVnList(vnp);
 	VInvalidateVnode_r(vnp);
+	VN_UNLOCK(vnp);
     }
 
  done:
@@ -80,6 +80,9 @@ struct VnodeClassInfo {
     int gets, reads;		/* Number of VGetVnodes and corresponding
 				 * reads */
     int writes;			/* Number of vnode writes */
+#ifdef AFS_PTHREAD_ENV
+    pthread_mutex_t lruLock;	/* Protects the LRU links of this class */
+#endif
 };
 
 extern struct VnodeClassInfo VnodeClassInfo[nVNODECLASSES];
@@ -332,10 +335,14 @@ extern Vnode *VGetVnode(Error * ec, struct Volume *vp, VnodeId vnodeNumber,
 			int locktype);
 extern Vnode *VGetVnode_r(Error * ec, struct Volume *vp, VnodeId vnodeNumber,
 			  int locktype);
+extern void VPrefetchVnodes(struct Volume *vp, VnodeId * vnodes,
+			    int nvnodes);
 extern void VPutVnode(Error * ec, Vnode * vnp);
 extern void VPutVnode_r(Error * ec, Vnode * vnp);
 extern int VVnodeWriteToRead(Error * ec, Vnode * vnp);
 extern int VVnodeWriteToRead_r(Error * ec, Vnode * vnp);
+extern void VSyncVnode(Error * ec, Vnode * vnp);
+extern void VSyncVnode_r(Error * ec, Vnode * vnp);
 extern Vnode *VAllocVnode(Error * ec, struct Volume *vp, VnodeType type,
 	VnodeId in_vnode, Unique in_unique);
 extern Vnode *VAllocVnode_r(Error * ec, struct Volume *vp, VnodeType type,
@@ -345,6 +352,7 @@ extern Vnode *VAllocVnode_r(Error * ec, struct Volume *vp, VnodeType type,
 extern Vnode *VGetFreeVnode_r(struct VnodeClassInfo *vcp, struct Volume *vp,
                               VnodeId vnodeNumber);
 extern Vnode *VLookupVnode(struct Volume * vp, VnodeId vnodeId);
+extern int VCountVnodeGets(VnodeClass vclass);
 
 extern void AddToVVnList(struct Volume * vp, Vnode * vnp);
 extern void DeleteFromVVnList(Vnode * vnp);
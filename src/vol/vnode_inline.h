@@ -12,6 +12,27 @@
 
 #include "vnode.h"
 
+/*
+ * Each vnode hash chain has a lock, which protects the chain's vnodes'
+ * reference counts, LRU membership, state flags, and (for DAFS) states and
+ * reader counts.  A vnode is covered by the lock of the chain named by its
+ * hashIndex.  VOL_LOCK, when held too, must be taken first; see vnode.c.
+ */
+#ifdef AFS_PTHREAD_ENV
+extern opr_mutex_t VnodeChainLocks[];
+# define VN_CHAIN_LOCK(idx) opr_mutex_enter(&VnodeChainLocks[(idx)])
+# define VN_CHAIN_UNLOCK(idx) opr_mutex_exit(&VnodeChainLocks[(idx)])
+# define VN_LRU_LOCK(vcp) opr_mutex_enter(&(vcp)->lruLock)
+# define VN_LRU_UNLOCK(vcp) opr_mutex_exit(&(vcp)->lruLock)
+#else
+# define VN_CHAIN_LOCK(idx) ((void)(idx))
+# define VN_CHAIN_UNLOCK(idx) ((void)(idx))
+# define VN_LRU_LOCK(vcp) ((void)(vcp))
+# define VN_LRU_UNLOCK(vcp) ((void)(vcp))
+#endif
+#define VN_LOCK(vnp) VN_CHAIN_LOCK((vnp)->hashIndex)
+#define VN_UNLOCK(vnp) VN_CHAIN_UNLOCK((vnp)->hashIndex)
+
 /***************************************************/
 /* demand attach vnode state machine routines      */
 /***************************************************/
@@ -23,7 +44,7 @@
  *
  * @internal vnode package internal use only
  *
- * @pre VOL_LOCK must be held
+ * @pre the vnode's chain lock must be held
  *
  * @post vnode refcount incremented
  *
@@ -45,7 +66,8 @@ extern int TrustVnodeCacheEntry;
  *
  * @param[in] vnp  vnode object pointer
  *
- * @pre VOL_LOCK held
+ * @pre the vnode's chain lock held.
+ *      VOL_LOCK held as well, unless TrustVnodeCacheEntry is set.
  *
  * @post refcount decremented; possibly re-added to vn lru
  *
@@ -152,7 +174,7 @@ VnUnlock(Vnode * vnp, int type)
  * @param[in] vnp        pointer to vnode object
  * @param[in] new_state  new vnode state value
  *
- * @pre VOL_LOCK held
+ * @pre the vnode's chain lock held
  *
  * @post vnode state changed
  *
@@ -243,14 +265,38 @@ VnIsValidState(VnState state)
     return 0;
 }
 
+/**
+ * wait for a notification on the vnode's state cv.
+ *
+ * @param[in] vnp  vnode object pointer
+ *
+ * @pre VOL_LOCK and the vnode's chain lock held; ref held on vnode
+ *
+ * @post VOL_LOCK and the vnode's chain lock held; both were dropped while
+ *       waiting
+ *
+ * @note DEMAND_ATTACH_FS only
+ */
+static_inline void
+VnStateWait_r(Vnode * vnp)
+{
+    VOL_UNLOCK;
+    opr_cv_wait(&Vn_stateCV(vnp), &VnodeChainLocks[vnp->hashIndex]);
+    /* VOL_LOCK comes before the chain lock */
+    VN_UNLOCK(vnp);
+    VOL_LOCK;
+    VN_LOCK(vnp);
+}
+
 /**
  * wait for the vnode to change states.
  *
  * @param[in] vnp  vnode object pointer
  *
- * @pre VOL_LOCK held; ref held on vnode
+ * @pre VOL_LOCK and the vnode's chain lock held; ref held on vnode
  *
- * @post VOL_LOCK held; vnode state has changed from previous value
+ * @post VOL_LOCK and the vnode's chain lock held; vnode state has changed
+ *       from previous value
  *
  * @note DEMAND_ATTACH_FS only
  */
@@ -261,7 +307,7 @@ VnWaitStateChange_r(Vnode * vnp)
 
     opr_Assert(Vn_refcount(vnp));
     do {
-	VOL_CV_WAIT(&Vn_stateCV(vnp));
+	VnStateWait_r(vnp);
     } while (Vn_state(vnp) == state_save);
     opr_Assert(!(Vn_stateFlags(vnp) & VN_ON_LRU));
 }
@@ -269,9 +315,10 @@ VnWaitStateChange_r(Vnode * vnp)
 /**
  * wait for blocking ops to end.
  *
- * @pre VOL_LOCK held; ref held on vnode
+ * @pre VOL_LOCK and the vnode's chain lock held; ref held on vnode
  *
- * @post VOL_LOCK held; vnode not in exclusive state
+ * @post VOL_LOCK and the vnode's chain lock held; vnode not in exclusive
+ *       state
  *
  * @param[in] vnp  vnode object pointer
  *
@@ -282,7 +329,7 @@ VnWaitExclusiveState_r(Vnode * vnp)
 {
     opr_Assert(Vn_refcount(vnp));
     while (VnIsExclusiveState(Vn_state(vnp))) {
-	VOL_CV_WAIT(&Vn_stateCV(vnp));
+	VnStateWait_r(vnp);
     }
     opr_Assert(!(Vn_stateFlags(vnp) & VN_ON_LRU));
 }
@@ -292,9 +339,10 @@ VnWaitExclusiveState_r(Vnode * vnp)
  *
  * @param[in] vnp  vnode object pointer
  *
- * @pre VOL_LOCK held; ref held on vnode
+ * @pre VOL_LOCK and the vnode's chain lock held; ref held on vnode
  *
- * @post VOL_LOCK held; vnode is in non-exclusive state and has no active readers
+ * @post VOL_LOCK and the vnode's chain lock held; vnode is in non-exclusive
+ *       state and has no active readers
  *
  * @note DEMAND_ATTACH_FS only
  */
@@ -304,7 +352,7 @@ VnWaitQuiescent_r(Vnode * vnp)
     opr_Assert(Vn_refcount(vnp));
     while (VnIsExclusiveState(Vn_state(vnp)) ||
 	   Vn_readers(vnp)) {
-	VOL_CV_WAIT(&Vn_stateCV(vnp));
+	VnStateWait_r(vnp);
     }
     opr_Assert(!(Vn_stateFlags(vnp) & VN_ON_LRU));
 }
@@ -314,7 +362,7 @@ VnWaitQuiescent_r(Vnode * vnp)
  *
  * @param[in] vnp  vnode object pointer
  *
- * @pre VOL_LOCK held.
+ * @pre the vnode's chain lock held.
  *      ref held on vnode.
  *      vnode in VN_STATE_READ or VN_STATE_ONLINE
  *
@@ -341,7 +389,7 @@ VnBeginRead_r(Vnode * vnp)
  *
  * @param[in] vnp  vnode object pointer
  *
- * @pre VOL_LOCK held.
+ * @pre the vnode's chain lock held.
  *      ref held on vnode.
  *      read ref held on vnode.
  *      vnode in VN_STATE_READ.
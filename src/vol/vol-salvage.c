@@ -162,6 +162,7 @@ Vnodes with 0 inode pointers in RW volumes are now deleted.
 #include "ihandle.h"
 #include "vnode.h"
 #include "volume.h"
+#include "vnmap.h"
 #include "partition.h"
 #include "daemon_com.h"
 #include "daemon_com_inline.h"
@@ -198,6 +199,8 @@ int ShowRootFiles;		/* -r flag */
 int RebuildDirs;		/* -sal flag */
 int Parallel = 4;		/* -para X flag */
 int PartsPerDisk = 8;		/* Salvage up to 8 partitions on same disk sequentially */
+int VGParallel = 1;		/* -vgparallel X flag */
+int SortMemory = SORTMEM_DEFAULT; /* -sortmem X flag, megabytes */
 int forceR = 0;			/* -b flag */
 int ShowLog = 0;		/* -showlog flag */
 char *ShowLogFilename = NULL;    /* log file name for -showlog */
@@ -256,6 +259,11 @@ struct SalvInfo {
                               *   in volume summary */
     struct InodeSummary *inodeSummary; /**< contains info on all the relevant
                                         *   inodes */
+    int maxVolumesInInodeFile; /**< Number of entries inodeSummary has room
+                                *   for */
+    struct InodeMerge *inodeMerge; /**< Merges the sorted runs of the inode
+                                    *   file while the salvage proceeds; NULL
+                                    *   once every volume is summarized */
 
     struct VnodeInfo vnodeInfo[nVNODECLASSES]; /**< contains info on all of the
                                                 *   vnodes in the volume that
@@ -267,6 +275,21 @@ struct SalvInfo {
 
 char *tmpdir = NULL;
 
+#ifndef AFS_NT40_ENV
+/*
+ * Volume groups being salvaged in parallel by child processes, when
+ * VGParallel is more than 1.  Each child logs to a file of its own, which is
+ * appended to the salvage log when the child exits, so that the messages
+ * for one volume group are kept together.
+ */
+struct vgJob {
+    int pid;			/* 0 if the slot is free */
+    VolumeId rwvid;		/* volume group being salvaged */
+};
+static struct vgJob vgJobs[MAXPARALLEL];
+static int vgJobsRunning;
+#endif
+
 
 
 /* Forward declarations */
@@ -276,7 +299,14 @@ static int IsVnodeOrphaned(struct SalvInfo *salvinfo, VnodeId vnode);
 static int AskVolumeSummary(struct SalvInfo *salvinfo,
                             VolumeId singleVolumeNumber);
 static void MaybeAskOnline(struct SalvInfo *salvinfo, VolumeId volumeId);
+static void AskOnlineBatch(struct SalvInfo *salvinfo, VolumeId *volumes,
+			   int nvolumes);
 static void AskError(struct SalvInfo *salvinfo, VolumeId volumeId);
+static int HaveInodeSummary(struct SalvInfo *salvinfo, int i);
+static void EndInodeMerge(struct SalvInfo *salvinfo);
+#ifndef AFS_NT40_ENV
+static void WaitVolumeGroups(void);
+#endif
 
 #ifdef AFS_DEMAND_ATTACH_FS
 static int LockVolume(struct SalvInfo *salvinfo, VolumeId volumeId);
@@ -699,7 +729,8 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
     static char tmpDevName[100];
     static char wpath[100];
     struct VolumeSummary *vsp, *esp;
-    int i, j;
+    int i, j, nvids;
+    VolumeId *vids;
     int code;
     int tries = 0;
     struct SalvInfo l_salvinfo;
@@ -840,6 +871,15 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 	Log("Error %d when trying to unlink %s\n", errno, inodeListPath);
     }
 
+    /* Release the inodes of deleted volumes the volserver has not got to
+     * yet, or we would count references it is about to drop */
+    if (!Testing) {
+	if (singleVolumeNumber)
+	    VReapVolumeGroup(salvinfo->fileSysPartition, singleVolumeNumber);
+	else
+	    VReapPartition(salvinfo->fileSysPartition, 0);
+    }
+
     if (GetInodeSummary(salvinfo, inodeFile, singleVolumeNumber) < 0) {
 	OS_CLOSE(inodeFile);
 	free(inodeListPath);
@@ -854,6 +894,9 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 
     OS_SEEK(salvinfo->inodeFd, 0L, SEEK_SET);
     if (ListInodeOption) {
+	/* Finish sorting the inode file */
+	while (HaveInodeSummary(salvinfo, salvinfo->nVolumesInInodeFile))
+	    ;
 	PrintInodeList(salvinfo);
 	if (singleVolumeNumber) {
 	    /* We've checked out the volume from the fileserver, and we need
@@ -872,6 +915,7 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
      * or read-only).
      */
     if (GetVolumeSummary(salvinfo, singleVolumeNumber)) {
+	EndInodeMerge(salvinfo);
 	goto retry;
     }
 
@@ -886,10 +930,10 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
     }
 
     for (i = j = 0, vsp = salvinfo->volumeSummaryp, esp = vsp + salvinfo->nVolumes;
-	 i < salvinfo->nVolumesInInodeFile; i = j) {
+	 HaveInodeSummary(salvinfo, i); i = j) {
 	VolumeId rwvid = salvinfo->inodeSummary[i].RWvolumeId;
 	for (j = i;
-	     j < salvinfo->nVolumesInInodeFile && salvinfo->inodeSummary[j].RWvolumeId == rwvid;
+	     HaveInodeSummary(salvinfo, j) && salvinfo->inodeSummary[j].RWvolumeId == rwvid;
 	     j++) {
 	    VolumeId vid = salvinfo->inodeSummary[j].volumeId;
 	    struct VolumeSummary *tsp;
@@ -922,6 +966,9 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 #endif /* AFS_NT40_ENV */
 
     }
+#ifndef AFS_NT40_ENV
+    WaitVolumeGroups();
+#endif
 
     /* Delete any additional volumes that were listed in the partition but which didn't have any corresponding inodes */
     for (; vsp < esp; vsp++) {
@@ -964,13 +1011,20 @@ SalvageFileSys1(struct DiskPartition64 *partP, VolumeId singleVolumeNumber)
 	    AskDelete(salvinfo, singleVolumeNumber);
 	}
 
-	for (j = 0; j < salvinfo->nVolumes; j++) {
+	vids = calloc(salvinfo->nVolumes, sizeof(*vids));
+	for (nvids = 0, j = 0; j < salvinfo->nVolumes; j++) {
 	    if (salvinfo->volumeSummaryp[j].header.id != singleVolumeNumber) {
 		if (!salvinfo->volumeSummaryp[j].deleted) {
-		    AskOnline(salvinfo, salvinfo->volumeSummaryp[j].header.id);
+		    if (vids)
+			vids[nvids++] = salvinfo->volumeSummaryp[j].header.id;
+		    else
+			AskOnline(salvinfo, salvinfo->volumeSummaryp[j].header.id);
 		}
 	    }
 	}
+	if (nvids > 0)
+	    AskOnlineBatch(salvinfo, vids, nvids);
+	free(vids);
     } else {
 	if (!Showmode)
 	    Log("SALVAGING OF PARTITION %s%s COMPLETED\n",
@@ -1114,42 +1168,321 @@ CompareInodes(const void *_p1, const void *_p2)
     return 0;
 }
 
-void
-CountVolumeInodes(struct ViceInodeInfo *ip, int maxInodes,
-		  struct InodeSummary *summary)
+int
+OnlyOneVolume(struct ViceInodeInfo *inodeinfo, VolumeId singleVolumeNumber, void *rock)
+{
+    if (inodeinfo->u.vnode.vnodeNumber == INODESPECIAL)
+	return (inodeinfo->u.special.parentId == singleVolumeNumber);
+    return (inodeinfo->u.vnode.volumeId == singleVolumeNumber);
+}
+
+/*
+ * The inode file is sorted in runs of at most SortMemory megabytes, and the
+ * runs are then merged back into the inode file.  The merge is done a volume
+ * at a time, as the salvage reaches each volume group, so that salvaging
+ * starts as soon as the runs are sorted.  When all the inodes fit in one run
+ * it is sorted in place, and there is nothing to merge; the run is read
+ * back a SCAN_INODES buffer at a time as the volumes are summarized.
+ */
+#define SCAN_INODES	8192
+struct InodeRun {
+    FD_t fd;
+    afs_foff_t next;		/* offset of the next inode to read */
+    afs_foff_t end;		/* offset of the end of the run */
+    struct ViceInodeInfo *buf;
+    int nbuf;			/* inodes in buf */
+    int pos;			/* next inode in buf */
+};
+
+struct InodeMerge {
+    int nRuns;
+    struct InodeRun *runs;
+    int *heap;			/* runs with inodes left, by their next inode */
+    int nHeap;
+    int bufInodes;		/* size of each buffer, in inodes */
+    FD_t runFile;		/* the runs, or INVALID_FD if sorted in place */
+    FD_t outFd;			/* the inode file, or INVALID_FD if in place */
+    afs_foff_t outOffset;
+    struct ViceInodeInfo *out;
+    int nOut;
+    int index;			/* inodes summarized so far */
+};
+
+/* The most inodes to sort in memory at once */
+static int
+SortRunInodes(void)
+{
+    afs_int64 n = (afs_int64)SortMemory * 1024 * 1024
+	/ sizeof(struct ViceInodeInfo);
+
+    return n > INT_MAX ? INT_MAX : (int)n;
+}
+
+/*
+ * Sort the inode file in runs of runInodes inodes.  If there is just one
+ * run it is sorted in place; otherwise each run is written to the same
+ * offset in runFile.
+ */
+static void
+SortInodeRuns(struct SalvInfo *salvinfo, FD_t runFile, int nInodes,
+	      int runInodes, char *dev)
+{
+    struct ViceInodeInfo *ip;
+    FD_t outFd;
+    afs_foff_t offset;
+    size_t size;
+    int n, done;
+
+    if (runInodes > nInodes)
+	runInodes = nInodes;
+    outFd = (runInodes == nInodes) ? salvinfo->inodeFd : runFile;
+    ip = malloc(runInodes * sizeof(struct ViceInodeInfo));
+    if (ip == NULL) {
+	Abort
+	    ("Unable to allocate enough space to read inode table; %s not salvaged\n",
+	     dev);
+    }
+    for (done = 0; done < nInodes; done += n) {
+	n = nInodes - done;
+	if (n > runInodes)
+	    n = runInodes;
+	size = n * sizeof(struct ViceInodeInfo);
+	offset = (afs_foff_t)done * sizeof(struct ViceInodeInfo);
+	if (OS_PREAD(salvinfo->inodeFd, ip, size, offset) != size) {
+	    Abort("Unable to read inode table; %s not salvaged\n", dev);
+	}
+	qsort(ip, n, sizeof(struct ViceInodeInfo), CompareInodes);
+	if (OS_PWRITE(outFd, ip, size, offset) != size) {
+	    Abort("Unable to rewrite inode table; %s not salvaged\n", dev);
+	}
+    }
+    free(ip);
+}
+
+/* Read the next part of a run; returns the number of inodes read */
+static int
+FillInodeRun(struct InodeMerge *m, struct InodeRun *r)
+{
+    afs_foff_t left = (r->end - r->next) / sizeof(struct ViceInodeInfo);
+    size_t size;
+
+    r->nbuf = left < m->bufInodes ? left : m->bufInodes;
+    r->pos = 0;
+    if (r->nbuf == 0)
+	return 0;
+    size = r->nbuf * sizeof(struct ViceInodeInfo);
+    if (OS_PREAD(r->fd, r->buf, size, r->next) != size) {
+	Abort("Unable to read inode table (errno = %d); not salvaged\n",
+	      errno);
+    }
+    r->next += size;
+    return r->nbuf;
+}
+
+static_inline struct ViceInodeInfo *
+InodeRunHead(struct InodeMerge *m, int run)
+{
+    return &m->runs[run].buf[m->runs[run].pos];
+}
+
+static_inline int
+InodeRunBefore(struct InodeMerge *m, int a, int b)
+{
+    int code = CompareInodes(InodeRunHead(m, a), InodeRunHead(m, b));
+
+    return code < 0 || (code == 0 && a < b);
+}
+
+static void
+SiftInodeRun(struct InodeMerge *m, int i)
+{
+    int child, tmp;
+
+    for (;;) {
+	child = 2 * i + 1;
+	if (child >= m->nHeap)
+	    break;
+	if (child + 1 < m->nHeap
+	    && InodeRunBefore(m, m->heap[child + 1], m->heap[child]))
+	    child++;
+	if (!InodeRunBefore(m, m->heap[child], m->heap[i]))
+	    break;
+	tmp = m->heap[i];
+	m->heap[i] = m->heap[child];
+	m->heap[child] = tmp;
+	i = child;
+    }
+}
+
+static void
+FlushInodeMerge(struct InodeMerge *m)
+{
+    size_t size = m->nOut * sizeof(struct ViceInodeInfo);
+
+    if (m->nOut == 0)
+	return;
+    if (OS_PWRITE(m->outFd, m->out, size, m->outOffset) != size) {
+	Abort("Unable to rewrite inode table (errno = %d); not salvaged\n",
+	      errno);
+    }
+    m->outOffset += size;
+    m->nOut = 0;
+}
+
+static void
+StartInodeMerge(struct SalvInfo *salvinfo, FD_t runFile, int nInodes,
+		int runInodes)
+{
+    struct InodeMerge *m;
+    struct InodeRun *r;
+    afs_foff_t runSize;
+    int i;
+
+    m = calloc(1, sizeof(*m));
+    opr_Assert(m != NULL);
+    m->runFile = runFile;
+    if (runInodes > nInodes)
+	runInodes = nInodes;
+    m->nRuns = (nInodes + runInodes - 1) / runInodes;
+    if (m->nRuns == 1) {
+	m->outFd = INVALID_FD;
+	m->bufInodes = SCAN_INODES;
+    } else {
+	m->outFd = salvinfo->inodeFd;
+	m->bufInodes = runInodes / (m->nRuns + 1);
+    }
+    if (m->bufInodes < 64)
+	m->bufInodes = 64;
+    m->runs = calloc(m->nRuns, sizeof(*m->runs));
+    m->heap = calloc(m->nRuns, sizeof(*m->heap));
+    opr_Assert(m->runs != NULL && m->heap != NULL);
+    if (m->outFd != INVALID_FD) {
+	m->out = malloc(m->bufInodes * sizeof(struct ViceInodeInfo));
+	opr_Assert(m->out != NULL);
+    }
+
+    runSize = (afs_foff_t)runInodes * sizeof(struct ViceInodeInfo);
+    for (i = 0; i < m->nRuns; i++) {
+	r = &m->runs[i];
+	r->fd = (m->nRuns == 1) ? salvinfo->inodeFd : runFile;
+	r->next = i * runSize;
+	r->end = (afs_foff_t)nInodes * sizeof(struct ViceInodeInfo);
+	if (r->end > r->next + runSize)
+	    r->end = r->next + runSize;
+	r->buf = malloc(m->bufInodes * sizeof(struct ViceInodeInfo));
+	opr_Assert(r->buf != NULL);
+	if (FillInodeRun(m, r) > 0)
+	    m->heap[m->nHeap++] = i;
+    }
+    for (i = m->nHeap / 2 - 1; i >= 0; i--)
+	SiftInodeRun(m, i);
+
+    if (m->nRuns > 1)
+	Log("Merging %d sorted runs of the inode table\n", m->nRuns);
+    salvinfo->inodeMerge = m;
+}
+
+static void
+EndInodeMerge(struct SalvInfo *salvinfo)
+{
+    struct InodeMerge *m = salvinfo->inodeMerge;
+    int i;
+
+    if (m == NULL)
+	return;
+    for (i = 0; i < m->nRuns; i++)
+	free(m->runs[i].buf);
+    free(m->runs);
+    free(m->heap);
+    free(m->out);
+    if (m->runFile != INVALID_FD)
+	OS_CLOSE(m->runFile);
+    free(m);
+    salvinfo->inodeMerge = NULL;
+}
+
+/*
+ * Merge the inodes of the next volume into the inode file and summarize
+ * them.  Returns 0 if there are no more volumes.
+ */
+static int
+NextInodeSummary(struct InodeMerge *m, struct InodeSummary *summary)
 {
-    VolumeId volume = ip->u.vnode.volumeId;
-    VolumeId rwvolume = volume;
-    int n, nSpecial;
-    Unique maxunique;
-    n = nSpecial = 0;
-    maxunique = 0;
-    while (maxInodes-- && volume == ip->u.vnode.volumeId) {
-	n++;
+    struct ViceInodeInfo *ip;
+    struct InodeRun *r;
+
+    if (m->nHeap == 0)
+	return 0;
+
+    memset(summary, 0, sizeof(*summary));
+    ip = InodeRunHead(m, m->heap[0]);
+    summary->volumeId = summary->RWvolumeId = ip->u.vnode.volumeId;
+    summary->index = m->index;
+
+    while (m->nHeap > 0) {
+	r = &m->runs[m->heap[0]];
+	ip = &r->buf[r->pos];
+	if (ip->u.vnode.volumeId != summary->volumeId)
+	    break;
+
+	summary->nInodes++;
 	if (ip->u.vnode.vnodeNumber == INODESPECIAL) {
-	    nSpecial++;
-	    rwvolume = ip->u.special.parentId;
+	    summary->nSpecialInodes++;
+	    summary->RWvolumeId = ip->u.special.parentId;
 	    /* This isn't quite right, as there could (in error) be different
 	     * parent inodes in different special vnodes */
-	} else {
-	    if (maxunique < ip->u.vnode.vnodeUniquifier)
-		maxunique = ip->u.vnode.vnodeUniquifier;
+	} else if (summary->maxUniquifier < ip->u.vnode.vnodeUniquifier) {
+	    summary->maxUniquifier = ip->u.vnode.vnodeUniquifier;
+	}
+	if (m->outFd != INVALID_FD) {
+	    m->out[m->nOut++] = *ip;
+	    if (m->nOut == m->bufInodes)
+		FlushInodeMerge(m);
 	}
-	ip++;
+
+	r->pos++;
+	if (r->pos == r->nbuf && FillInodeRun(m, r) == 0)
+	    m->heap[0] = m->heap[--m->nHeap];
+	SiftInodeRun(m, 0);
     }
-    summary->volumeId = volume;
-    summary->RWvolumeId = rwvolume;
-    summary->nInodes = n;
-    summary->nSpecialInodes = nSpecial;
-    summary->maxUniquifier = maxunique;
+
+    /* The volume's inodes must be in the file before it is salvaged */
+    if (m->outFd != INVALID_FD)
+	FlushInodeMerge(m);
+    m->index += summary->nInodes;
+    return 1;
 }
 
-int
-OnlyOneVolume(struct ViceInodeInfo *inodeinfo, VolumeId singleVolumeNumber, void *rock)
+/*
+ * Make sure inodeSummary[i] is there, merging more of the inode file if
+ * need be.  Returns 0 if there is no such volume.
+ */
+static int
+HaveInodeSummary(struct SalvInfo *salvinfo, int i)
 {
-    if (inodeinfo->u.vnode.vnodeNumber == INODESPECIAL)
-	return (inodeinfo->u.special.parentId == singleVolumeNumber);
-    return (inodeinfo->u.vnode.volumeId == singleVolumeNumber);
+    struct InodeSummary *isp;
+    int n;
+
+    while (i >= salvinfo->nVolumesInInodeFile && salvinfo->inodeMerge) {
+	n = salvinfo->nVolumesInInodeFile;
+	if (n == salvinfo->maxVolumesInInodeFile) {
+	    salvinfo->maxVolumesInInodeFile = n ? 2 * n : 1024;
+	    isp = realloc(salvinfo->inodeSummary,
+			  salvinfo->maxVolumesInInodeFile * sizeof(*isp));
+	    opr_Assert(isp != NULL);
+	    salvinfo->inodeSummary = isp;
+	}
+	if (!NextInodeSummary(salvinfo->inodeMerge,
+			      &salvinfo->inodeSummary[n])) {
+	    EndInodeMerge(salvinfo);
+	    Log("%d nVolumesInInodeFile %lu \n", n,
+		(unsigned long)(n * sizeof(struct InodeSummary)));
+	    break;
+	}
+	salvinfo->inodeSummary[n].volSummary = NULL;
+	salvinfo->nVolumesInInodeFile++;
+    }
+    return i < salvinfo->nVolumesInInodeFile;
 }
 
 /* GetInodeSummary
@@ -1163,10 +1496,9 @@ GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolume
 {
     int forceSal, err;
     int code;
-    struct ViceInodeInfo *ip, *ip_save;
-    struct InodeSummary summary;
-    char summaryFileName[50];
-    FD_t summaryFile = INVALID_FD;
+    char runFileName[50];
+    FD_t runFile = INVALID_FD;
+    int nInodes, runInodes;
 #ifdef AFS_NT40_ENV
     char *dev = salvinfo->fileSysPath;
     char *wpath = salvinfo->fileSysPath;
@@ -1176,7 +1508,6 @@ GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolume
 #endif
     char *part = salvinfo->fileSysPath;
     char *tdir;
-    int i;
     int retcode = 0;
     int deleted = 0;
     afs_sfsize_t st_size;
@@ -1203,40 +1534,46 @@ GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolume
         (st_size = OS_SIZE(salvinfo->inodeFd)) == -1) {
 	Abort("No inode description file for \"%s\"; not salvaged\n", dev);
     }
-    tdir = (tmpdir ? tmpdir : part);
+    nInodes = st_size / sizeof(struct ViceInodeInfo);
+    runInodes = SortRunInodes();
+    if (nInodes > runInodes) {
+	/* The inodes do not all fit in memory at once; sort them in runs,
+	 * kept in a temporary file, and merge those */
+	tdir = (tmpdir ? tmpdir : part);
 #ifdef AFS_NT40_ENV
-    (void)_putenv("TMP=");	/* If "TMP" is set, then that overrides tdir. */
-    (void)strcpy(summaryFileName, _tempnam(tdir, "salvage.temp."));
+	(void)_putenv("TMP=");	/* If "TMP" is set, then that overrides tdir. */
+	(void)strcpy(runFileName, _tempnam(tdir, "salvage.temp."));
 #else
-    snprintf(summaryFileName, sizeof summaryFileName,
-	     "%s" OS_DIRSEP "salvage.temp.%d", tdir, getpid());
+	snprintf(runFileName, sizeof runFileName,
+		 "%s" OS_DIRSEP "salvage.temp.%d", tdir, getpid());
 #endif
-    summaryFile = OS_OPEN(summaryFileName, O_RDWR|O_APPEND|O_CREAT, 0666);
-    if (summaryFile == INVALID_FD) {
-	Abort("Unable to create inode summary file\n");
-    }
+	runFile = OS_OPEN(runFileName, O_RDWR|O_TRUNC|O_CREAT, 0666);
+	if (runFile == INVALID_FD) {
+	    Abort("Unable to create inode sort file\n");
+	}
 
 #ifdef AFS_NT40_ENV
-    /* Using nt_unlink here since we're really using the delete on close
-     * semantics of unlink. In most places in the salvager, we really do
-     * mean to unlink the file at that point. Those places have been
-     * modified to actually do that so that the NT crt can be used there.
-     *
-     * jaltman - As commented elsewhere, this cannot work because fopen()
-     * does not open files with DELETE and FILE_SHARE_DELETE.
-     */
-    code = nt_unlink(summaryFileName);
+	/* Using nt_unlink here since we're really using the delete on close
+	 * semantics of unlink. In most places in the salvager, we really do
+	 * mean to unlink the file at that point. Those places have been
+	 * modified to actually do that so that the NT crt can be used there.
+	 *
+	 * jaltman - As commented elsewhere, this cannot work because fopen()
+	 * does not open files with DELETE and FILE_SHARE_DELETE.
+	 */
+	code = nt_unlink(runFileName);
 #else
-    code = unlink(summaryFileName);
+	code = unlink(runFileName);
 #endif
-    if (code < 0) {
-	Log("Error %d when trying to unlink %s\n", errno, summaryFileName);
+	if (code < 0) {
+	    Log("Error %d when trying to unlink %s\n", errno, runFileName);
+	}
     }
 
     if (!canfork || debug || Fork() == 0) {
-	int nInodes = st_size / sizeof(struct ViceInodeInfo);
 	if (nInodes == 0) {
-	    OS_CLOSE(summaryFile);
+	    if (runFile != INVALID_FD)
+		OS_CLOSE(runFile);
 	    if (!singleVolumeNumber)	/* Remove the FORCESALVAGE file */
 		RemoveTheForce(salvinfo->fileSysPath);
 	    else {
@@ -1275,73 +1612,25 @@ GetInodeSummary(struct SalvInfo *salvinfo, FD_t inodeFile, VolumeId singleVolume
 	    deleted = 1;
 	    goto error;
 	}
-	ip = malloc(nInodes*sizeof(struct ViceInodeInfo));
-	if (ip == NULL) {
-	    OS_CLOSE(summaryFile);
-	    Abort
-		("Unable to allocate enough space to read inode table; %s not salvaged\n",
-		 dev);
-	}
-	if (OS_READ(salvinfo->inodeFd, ip, st_size) != st_size) {
-	    OS_CLOSE(summaryFile);
-	    Abort("Unable to read inode table; %s not salvaged\n", dev);
-	}
-	qsort(ip, nInodes, sizeof(struct ViceInodeInfo), CompareInodes);
-	if (OS_SEEK(salvinfo->inodeFd, 0, SEEK_SET) == -1
-	    || OS_WRITE(salvinfo->inodeFd, ip, st_size) != st_size) {
-	    OS_CLOSE(summaryFile);
-	    Abort("Unable to rewrite inode table; %s not salvaged\n", dev);
-	}
-	summary.index = 0;
-	ip_save = ip;
-	while (nInodes) {
-	    CountVolumeInodes(ip, nInodes, &summary);
-	    if (OS_WRITE(summaryFile, &summary, sizeof(summary)) != sizeof(summary)) {
-		Log("Difficulty writing summary file (errno = %d); %s not salvaged\n", errno, dev);
-		OS_CLOSE(summaryFile);
-		retcode = -1;
-		goto error;
-	    }
-	    summary.index += (summary.nInodes);
-	    nInodes -= summary.nInodes;
-	    ip += summary.nInodes;
-	}
-	free(ip_save);
-	ip = ip_save = NULL;
-	/* Following fflush is not fclose, because if it was debug mode would not work */
-	if (OS_SYNC(summaryFile) == -1) {
-	    Log("Unable to write summary file (errno = %d); %s not salvaged\n", errno, dev);
-	    OS_CLOSE(summaryFile);
-	    retcode = -1;
-	    goto error;
-	}
+	SortInodeRuns(salvinfo, runFile, nInodes, runInodes, dev);
 	if (canfork && !debug) {
 	    QuietExit(0);
 	}
     } else {
 	if (Wait("Inode summary") == -1) {
-	    OS_CLOSE(summaryFile);
+	    if (runFile != INVALID_FD)
+		OS_CLOSE(runFile);
 	    Exit(1);		/* salvage of this partition aborted */
 	}
     }
 
-    st_size = OS_SIZE(summaryFile);
-    opr_Assert(st_size >= 0);
-    if (st_size != 0) {
-	int ret;
-	salvinfo->inodeSummary = malloc(st_size);
-	opr_Assert(salvinfo->inodeSummary != NULL);
-	/* For GNU we need to do lseek to get the file pointer moved. */
-	opr_Assert(OS_SEEK(summaryFile, 0, SEEK_SET) == 0);
-	ret = OS_READ(summaryFile, salvinfo->inodeSummary, st_size);
-	opr_Assert(ret == st_size);
-    }
-    salvinfo->nVolumesInInodeFile = st_size / sizeof(struct InodeSummary);
-    for (i = 0; i < salvinfo->nVolumesInInodeFile; i++) {
-	salvinfo->inodeSummary[i].volSummary = NULL;
-    }
-    Log("%d nVolumesInInodeFile %lu \n",salvinfo->nVolumesInInodeFile,(unsigned long)st_size);
-    OS_CLOSE(summaryFile);
+    /* The volumes are summarized as the salvage reaches them; see
+     * HaveInodeSummary */
+    salvinfo->nVolumesInInodeFile = 0;
+    if (nInodes > 0)
+	StartInodeMerge(salvinfo, runFile, nInodes, runInodes);
+    else if (runFile != INVALID_FD)
+	OS_CLOSE(runFile);
 
  error:
     if (retcode && singleVolumeNumber && !deleted) {
@@ -1975,6 +2264,174 @@ nt_SalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int n
 }
 #endif /* AFS_NT40_ENV */
 
+/*
+ * Link count corrections are queued and made many at a time, so that the
+ * link table is locked, written and synced once per batch rather than once
+ * per change.
+ */
+#define LINKFIX_MAX	1024
+
+struct LinkFixes {
+    IHandle_t *h;
+    int p1;			/* volume the queued inodes belong to */
+    int ndec;
+    int ninc;
+    Inode dec[LINKFIX_MAX];
+    Inode inc[LINKFIX_MAX];
+};
+
+static void
+ApplyLinkFixes(struct LinkFixes *lf, Inode * inos, int ninos, int inc)
+{
+    afs_ino_str_t stmp;
+    int done = 0;
+
+    while (done < ninos) {
+	if (inc)
+	    done += IH_INCMULTI(lf->h, inos + done, ninos - done, lf->p1);
+	else
+	    done += IH_DECMULTI(lf->h, inos + done, ninos - done, lf->p1);
+	if (done < ninos) {
+	    /* skip the one that failed and carry on with the rest */
+	    Log("%s failed. inode %s errno %d\n", inc ? "iinc" : "idec",
+		PrintInode(stmp, inos[done]), errno);
+	    done++;
+	}
+    }
+}
+
+static void
+FlushLinkFixes(struct LinkFixes *lf)
+{
+    ApplyLinkFixes(lf, lf->dec, lf->ndec, 0);
+    ApplyLinkFixes(lf, lf->inc, lf->ninc, 1);
+    lf->ndec = lf->ninc = 0;
+}
+
+static void
+QueueLinkFix(struct LinkFixes *lf, Inode ino, int p1, int delta)
+{
+    if (p1 != lf->p1) {
+	FlushLinkFixes(lf);
+	lf->p1 = p1;
+    }
+    /* a link count can be off by more than a batch holds */
+    for (; delta < 0; delta++) {
+	if (lf->ndec >= LINKFIX_MAX)
+	    FlushLinkFixes(lf);
+	lf->dec[lf->ndec++] = ino;
+    }
+    for (; delta > 0; delta--) {
+	if (lf->ninc >= LINKFIX_MAX)
+	    FlushLinkFixes(lf);
+	lf->inc[lf->ninc++] = ino;
+    }
+}
+
+#ifndef AFS_NT40_ENV
+/* The name of the log file for a volume group child, or NULL if the salvage
+ * log is not a file */
+static char *
+VGLogName(int slot)
+{
+    char *name;
+
+    if (GetLogDest() != logDest_file)
+	return NULL;
+    if (asprintf(&name, "%s.vg%d", GetLogFilename(), slot) < 0)
+	return NULL;
+    return name;
+}
+
+/* Wait for a volume group child to exit, and copy its log */
+static void
+WaitVolumeGroup(void)
+{
+    char *buf, *name;
+    FILE *vgLog;
+    int status, pid, slot;
+
+    pid = wait(&status);
+    opr_Assert(pid != -1);
+    for (slot = 0; slot < MAXPARALLEL; slot++) {
+	if (vgJobs[slot].pid == pid)
+	    break;
+    }
+    if (slot == MAXPARALLEL)
+	return;
+
+    name = VGLogName(slot);
+    if (name != NULL) {
+	buf = malloc(SALV_BUFFER_SIZE);
+	if (buf != NULL && (vgLog = afs_fopen(name, "r")) != NULL) {
+	    while (fgets(buf, SALV_BUFFER_SIZE, vgLog))
+		WriteLogBuffer(buf, strlen(buf));
+	    fclose(vgLog);
+	}
+	(void)unlink(name);
+	free(buf);
+	free(name);
+    }
+    if (WCOREDUMP(status))
+	Log("Salvage of volume group %" AFS_VOLID_FMT " core dumped!\n",
+	    afs_printable_VolumeId_lu(vgJobs[slot].rwvid));
+
+    vgJobs[slot].pid = 0;
+    vgJobsRunning--;
+}
+
+static void
+WaitVolumeGroups(void)
+{
+    while (vgJobsRunning > 0)
+	WaitVolumeGroup();
+}
+
+/*
+ * Fork a child to salvage a volume group.  Returns the child's pid in the
+ * parent, once the child has finished unless VGParallel allows more than
+ * one, and 0 in the child.
+ */
+static int
+ForkVolumeGroup(VolumeId rwvid)
+{
+    struct logOptions logopts;
+    char *name;
+    int pid, slot;
+
+    if (VGParallel <= 1) {
+	pid = Fork();
+	if (pid != 0)
+	    (void)Wait("Salvage volume group");
+	return pid;
+    }
+
+    while (vgJobsRunning >= VGParallel)
+	WaitVolumeGroup();
+    for (slot = 0; vgJobs[slot].pid != 0; slot++)
+	;
+
+    pid = Fork();
+    if (pid != 0) {
+	vgJobs[slot].pid = pid;
+	vgJobs[slot].rwvid = rwvid;
+	vgJobsRunning++;
+	return pid;
+    }
+
+    name = VGLogName(slot);
+    if (name != NULL) {
+	(void)unlink(name);
+	memset(&logopts, 0, sizeof(logopts));
+	logopts.lopt_dest = logDest_file;
+	logopts.lopt_filename = name;
+	OpenLog(&logopts);
+	free(name);
+    }
+    return 0;
+}
+#endif /* !AFS_NT40_ENV */
+
 void
 DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nVols)
 {
@@ -1996,10 +2453,10 @@ DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nV
     }
     if (ShowMounts && !haveRWvolume)
 	return;
-    if (canfork && !debug && Fork() != 0) {
-	(void)Wait("Salvage volume group");
+#ifndef AFS_NT40_ENV
+    if (canfork && !debug && ForkVolumeGroup(isp->RWvolumeId) != 0)
 	return;
-    }
+#endif
     for (i = 0, totalInodes = 0; i < nVols; i++)
 	totalInodes += isp[i].nInodes;
     size = totalInodes * sizeof(struct ViceInodeInfo);
@@ -2007,10 +2464,9 @@ DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nV
     allInodes = inodes - isp->index;	/* this would the base of all the inodes
 					 * for the partition, if all the inodes
 					 * had been read into memory */
-    opr_Verify(OS_SEEK
-	   (salvinfo->inodeFd, isp->index * sizeof(struct ViceInodeInfo),
-	    SEEK_SET) != -1);
-    opr_Verify(OS_READ(salvinfo->inodeFd, inodes, size) == size);
+    /* Other volume groups may be reading the inode file at the same time */
+    opr_Verify(OS_PREAD(salvinfo->inodeFd, inodes, size,
+			isp->index * sizeof(struct ViceInodeInfo)) == size);
 
     /* Don't try to salvage a read write volume if there isn't one on this
      * partition */
@@ -2103,6 +2559,10 @@ DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nV
 	if (!Showmode)
 	    Log("%s VOLUME %" AFS_VOLID_FMT "%s.\n", rw ? "SALVAGING" : "CHECKING CLONED",
 		afs_printable_VolumeId_lu(lisp->volumeId), (Testing ? "(READONLY mode)" : ""));
+	/* The salvager writes vnode indexes directly; drop the vnode map.
+	 * SalvageVolume builds the RW volume a new one when it is done. */
+	if (!Testing)
+	    VnMapDestroy(salvinfo->fileSysPathName, lisp->volumeId);
 	/* Check inodes twice.  The second time do things seriously.  This
 	 * way the whole RO volume can be deleted, below, if anything goes wrong */
 	for (check = 1; check >= 0; check--) {
@@ -2130,6 +2590,17 @@ DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nV
     /* Fix actual inode counts */
     if (!Showmode) {
 	afs_ino_str_t stmp;
+	struct LinkFixes *lf;
+#ifdef AFS_NAMEI_ENV
+	afs_uint64 lfUpdates0, lfCalls0, lfAvoided0;
+	afs_uint64 lfUpdates, lfCalls, lfAvoided;
+
+	namei_GetLinkBatchStats(&lfUpdates0, &lfCalls0, &lfAvoided0);
+#endif
+	lf = calloc(1, sizeof(*lf));
+	if (lf == NULL)
+	    Abort("Unable to allocate link count fixes\n");
+	lf->h = salvinfo->VGLinkH;
 	Log("totalInodes %d\n",totalInodes);
 	for (ip = inodes; totalInodes; ip++, totalInodes--) {
 	    static int TraceBadLinkCounts = 0;
@@ -2160,28 +2631,20 @@ DoSalvageVolumeGroup(struct SalvInfo *salvinfo, struct InodeSummary *isp, int nV
 	     * If we get an error while INC'ing or DEC'ing, that's a little
 	     * odd and indicates a bug, but try to continue anyway, so the
 	     * volume may still be made accessible. */
-	    while (ip->linkCount > 0) {
-		if (!Testing) {
-		    if (IH_DEC(salvinfo->VGLinkH, ip->inodeNumber, ip->u.param[0])) {
-			Log("idec failed. inode %s errno %d\n",
-			    PrintInode(stmp, ip->inodeNumber), errno);
-			break;
-		    }
-		}
-		ip->linkCount--;
-	    }
-	    while (ip->linkCount < 0) {
-		if (!Testing) {
-		    if (IH_INC(salvinfo->VGLinkH, ip->inodeNumber, ip->u.param[0])) {
-			Log("iinc failed. inode %s errno %d\n",
-			    PrintInode(stmp, ip->inodeNumber), errno);
-			break;
-		    }
-		}
-		ip->linkCount++;
-	    }
+	    if (ip->linkCount != 0 && !Testing)
+		QueueLinkFix(lf, ip->inodeNumber, ip->u.param[0],
+			     -ip->linkCount);
+	    ip->linkCount = 0;
 	}
+	FlushLinkFixes(lf);
+	free(lf);
 #ifdef AFS_NAMEI_ENV
+	namei_GetLinkBatchStats(&lfUpdates, &lfCalls, &lfAvoided);
+	if (lfUpdates > lfUpdates0)
+	    Log("Link table: %llu counts fixed in %llu calls, %llu calls saved\n",
+		lfUpdates - lfUpdates0, lfCalls - lfCalls0,
+		lfAvoided - lfAvoided0);
+
 	while (dec_VGLinkH > 0) {
 	    if (IH_DEC(salvinfo->VGLinkH, salvinfo->VGLinkH->ih_ino, VGLinkH_p1) < 0) {
 		Log("idec failed on link table, errno = %d\n", errno);
@@ -3984,6 +4447,7 @@ SalvageVolume(struct SalvInfo *salvinfo, struct InodeSummary *rwIsp, IHandle_t *
     afs_int32 v, pv;
     IHandle_t *h;
     afs_sfsize_t nBytes;
+    struct VnMap *map;
     AFSFid pa;
     VnodeId LFVnode, ThisVnode;
     Unique LFUnique, ThisUnique;
@@ -4327,6 +4791,14 @@ SalvageVolume(struct SalvInfo *salvinfo, struct InodeSummary *rwIsp, IHandle_t *
     if (!Testing) {
 	nBytes = IH_IWRITE(h, 0, (char *)&volHeader, sizeof(volHeader));
 	opr_Assert(nBytes == sizeof(volHeader));
+
+	/* The vnode indexes are final; track changes to them again */
+	map = VnMapCreate(salvinfo->fileSysPathName, vid);
+	if (map != NULL) {
+	    (void)VnMapRebuild(map, salvinfo->vnodeInfo[vLarge].handle,
+			       salvinfo->vnodeInfo[vSmall].handle);
+	    VnMapFree(map);
+	}
     }
     if (!Showmode) {
 	Log("%sSalvaged %s (%" AFS_VOLID_FMT "): %d files, %d blocks\n",
@@ -4649,6 +5121,33 @@ AskOnline(struct SalvInfo *salvinfo, VolumeId volumeId)
     }
 }
 
+/*
+ * bring a list of volumes online with as few requests to the fileserver as
+ * we can; volumes the fileserver does not take in a batch are retried one
+ * at a time.
+ */
+static void
+AskOnlineBatch(struct SalvInfo *salvinfo, VolumeId *volumes, int nvolumes)
+{
+    FSSYNC_VolBatch_result *results;
+    afs_int32 code;
+    int i;
+
+    results = calloc(nvolumes, sizeof(*results));
+    if (results == NULL) {
+	code = SYNC_FAILED;
+    } else {
+	code = FSYNC_VolOpBatch(volumes, nvolumes,
+				salvinfo->fileSysPartition->name,
+				FSYNC_VOL_ON, FSYNC_WHATEVER, results);
+    }
+    for (i = 0; i < nvolumes; i++) {
+	if (code != SYNC_OK && (results == NULL || results[i].response != SYNC_OK))
+	    AskOnline(salvinfo, volumes[i]);
+    }
+    free(results);
+}
+
 void
 AskDelete(struct SalvInfo *salvinfo, VolumeId volumeId)
 {
@@ -4749,13 +5248,14 @@ PrintInodeList(struct SalvInfo *salvinfo)
     free(buf);
 }
 
+/* Summarizes every volume left in the inode file first */
 void
 PrintInodeSummary(struct SalvInfo *salvinfo)
 {
     int i;
     struct InodeSummary *isp;
 
-    for (i = 0; i < salvinfo->nVolumesInInodeFile; i++) {
+    for (i = 0; HaveInodeSummary(salvinfo, i); i++) {
 	isp = &salvinfo->inodeSummary[i];
 	Log("VID:%" AFS_VOLID_FMT ", RW:%" AFS_VOLID_FMT ", index:%d, nInodes:%d, nSpecialInodes:%d, maxUniquifier:%u, volSummary\n", afs_printable_VolumeId_lu(isp->volumeId), afs_printable_VolumeId_lu(isp->RWvolumeId), isp->index, isp->nInodes, isp->nSpecialInodes, isp->maxUniquifier);
     }
@@ -126,6 +126,10 @@ extern int ShowRootFiles;		/* -r flag */
 extern int RebuildDirs;		        /* -sal flag */
 extern int Parallel;		        /* -para X flag */
 extern int PartsPerDisk;		/* Salvage up to 8 partitions on same disk sequentially */
+extern int VGParallel;		        /* -vgparallel X flag */
+extern int SortMemory;			/* -sortmem X flag, megabytes */
+#define SORTMEM_DEFAULT	512
+#define SORTMEM_MIN	16
 extern int forceR;			/* -b flag */
 extern int ShowLog;		        /* -showlog flag */
 extern int ShowSuid;		        /* -showsuid flag */
@@ -196,8 +200,6 @@ extern void ClearROInUseBit(struct VolumeSummary *summary);
 extern void CopyAndSalvage(struct SalvInfo *salvinfo, struct DirSummary *dir);
 extern int CopyInode(Device device, Inode inode1, Inode inode2, int rwvolume);
 extern void CopyOnWrite(struct SalvInfo *salvinfo, struct DirSummary *dir);
-extern void CountVolumeInodes(register struct ViceInodeInfo *ip, int maxInodes,
-		       register struct InodeSummary *summary);
 extern void DeleteExtraVolumeHeaderFile(struct SalvInfo *salvinfo,
                                         struct VolumeSummary *vsp);
 extern void DistilVnodeEssence(struct SalvInfo *salvinfo, VolumeId vid,
@@ -107,11 +107,15 @@
 #include "vnode.h"
 #include "volume.h"
 #include "ri-db.h"
+#include "vnmap.h"
 #include "partition.h"
 #include "volume_inline.h"
 #include "common.h"
 #include "vutils.h"
 #include <afs/dir.h>
+#ifdef AFS_DEMAND_ATTACH_FS
+# include "vg_cache.h"
+#endif
 
 #ifdef AFS_PTHREAD_ENV
 pthread_mutex_t vol_glock_mutex;
@@ -305,11 +309,13 @@ static int VAttachVolumesByPartition(struct DiskPartition64 *diskP,
 #ifdef AFS_DEMAND_ATTACH_FS
 /* demand attach fileserver extensions */
 
-/* XXX
- * in the future we will support serialization of VLRU state into the fs_state
- * disk dumps
+/*
+ * VLRU state saved to disk.
  *
- * these structures are the beginning of that effort
+ * Each partition has a VLRU_DISK_NAME file holding a VLRU_DiskHeader
+ * followed by one VLRU_DiskEntry for each volume that was on the VLRU,
+ * hottest first.  The file is only read by the fileserver that wrote it,
+ * so it is kept in host byte order.
  */
 struct VLRU_DiskHeader {
     struct versionStamp stamp;            /* magic and structure version number */
@@ -323,10 +329,17 @@ struct VLRU_DiskEntry {
     afs_uint32 last_get;                  /* timestamp of last get */
 };
 
+/* a saved entry, and the partition it was saved for */
+struct VLRU_StartupEntry {
+    struct VLRU_DiskEntry ent;
+    struct DiskPartition64 * dp;
+};
+
 struct VLRU_StartupQueue {
-    struct VLRU_DiskEntry * entry;
+    struct VLRU_StartupEntry * entry;
     int num_entries;
     int next_idx;
+    int n_threads;                        /* hot attach threads still running */
 };
 
 typedef struct vshutdown_thread_t {
@@ -351,6 +364,7 @@ static void * VShutdownThread(void * args);
 
 static Volume * VAttachVolumeByVp_r(Error * ec, Volume * vp, int mode);
 static int VCheckFree(Volume * vp);
+static void VFoldVolumeUsage_r(Volume * vp);
 
 /* VByP List */
 static void AddVolumeToVByPList_r(Volume * vp);
@@ -397,6 +411,11 @@ static void VLRU_Scan_r(int idx);
 static void VLRU_Promote_r(int idx);
 static void VLRU_Demote_r(int idx);
 static void VLRU_SwitchQueues(Volume * vp, int new_idx, int append);
+static void VLRU_SaveState_r(void);
+static struct VLRU_StartupQueue * VLRU_LoadState(void);
+static void VLRU_AttachHot(struct VLRU_StartupQueue * sq);
+static void VLRU_RestoreState(struct VLRU_StartupQueue * sq);
+static void * VLRU_HotAttachThread(void * args);
 
 /* soft detach */
 static int VCheckSoftDetach(Volume * vp, afs_uint32 thresh);
@@ -805,6 +824,8 @@ done:
 int
 VInitAttachVolumes(ProgramType pt)
 {
+    struct VLRU_StartupQueue *sq = NULL;
+
     opr_Assert(VInit==1);
     if (pt == fileServer) {
 
@@ -841,6 +862,12 @@ VInitAttachVolumes(ProgramType pt)
 					       PTHREAD_CREATE_DETACHED) == 0);
 
         Log("VInitVolumePackage: beginning parallel fileserver startup\n");
+
+	/* start attaching the volumes that were busiest before we
+	 * restarted before looking for any others */
+	sq = VLRU_LoadState();
+	VLRU_AttachHot(sq);
+
         Log("VInitVolumePackage: using %d threads to pre-attach volumes on %d partitions\n",
 		threads, parts);
 
@@ -877,6 +904,12 @@ VInitAttachVolumes(ProgramType pt)
     opr_cv_broadcast(&vol_init_attach_cond);
     VOL_UNLOCK;
 
+    if (pt == fileServer) {
+	/* the rest of the ranked volumes stay pre-attached until somebody
+	 * asks for them, but keep their place in the VLRU */
+	VLRU_RestoreState(sq);
+    }
+
     return 0;
 }
 
@@ -928,6 +961,7 @@ VInitVolumePackageThread(void *args)
             queue_Init(&vp->vnode_list);
             queue_Init(&vp->rx_call_list);
 	    opr_cv_init(&V_attachCV(vp));
+	    opr_mutex_init(&vp->usage_lock);
 
             vb->batch[vb->size++] = vp;
             if (vb->size == VINIT_BATCH_MAX_SIZE) {
@@ -1047,6 +1081,12 @@ VInitPreAttachVolumes(int nthreads, struct volume_init_queue *vq)
                 if (ec) {
                     Log("Error looking up volume, code=%d\n", ec);
                 }
+                else if (dup && V_partition(dup) == vp->partition) {
+                    /* already pre-attached by VLRU_AttachHot */
+                    opr_cv_destroy(&V_attachCV(vp));
+		    opr_mutex_destroy(&vp->usage_lock);
+                    free(vp);
+                }
                 else if (dup) {
                     Log("Warning: Duplicate volume id %" AFS_VOLID_FMT " detected.\n", afs_printable_VolumeId_lu(vp->hashid));
                 }
@@ -1199,6 +1239,9 @@ VShutdown_r(void)
         Log("VShutdown:  aborting attach volumes\n");
         vinit_attach_abort = 1;
         VOL_CV_WAIT(&vol_init_attach_cond);
+    } else if (programType == fileServer) {
+	/* the VLRU is emptied as volumes go offline, so save it first */
+	VLRU_SaveState_r();
     }
 
     for (params.n_parts=0, diskP = DiskPartitionList;
@@ -1308,6 +1351,12 @@ VShutdown_r(void)
 	}
     }
 
+#ifdef FSSYNC_BUILD_SERVER
+    if (programType == fileServer) {
+	VVGCache_checkpoint_r();
+    }
+#endif
+
     Log("VShutdown:  complete.\n");
 }
 
@@ -2247,6 +2296,7 @@ VPreAttachVolumeByVp_r(Error * ec,
 	queue_Init(&vp->vnode_list);
 	queue_Init(&vp->rx_call_list);
 	opr_cv_init(&V_attachCV(vp));
+	opr_mutex_init(&vp->usage_lock);
     }
 
     /* link the volume with its associated vice partition */
@@ -2478,6 +2528,7 @@ VAttachVolumeByName_r(Error * ec, char *partition, char *name, int mode)
       queue_Init(&vp->rx_call_list);
 #ifdef AFS_DEMAND_ATTACH_FS
       opr_cv_init(&V_attachCV(vp));
+      opr_mutex_init(&vp->usage_lock);
 #endif /* AFS_DEMAND_ATTACH_FS */
     }
 
@@ -3981,6 +4032,35 @@ VPutVolume(Volume * vp)
     VOL_UNLOCK;
 }
 
+/**
+ * Get the changed-vnode map state for a volume, creating it if need be.
+ *
+ * @param[in] vp  volume object
+ *
+ * @return map state, or NULL if it could not be allocated; the vnmap
+ *         routines treat a NULL map as a volume without a usable map
+ *
+ * @pre VOL_LOCK held
+ */
+struct VnMap *
+VGetVnMap_r(Volume * vp)
+{
+    if (vp->vnMap == NULL && V_partition(vp) != NULL)
+	vp->vnMap = VnMapCreate(VPartitionPath(V_partition(vp)), vp->hashid);
+    return vp->vnMap;
+}
+
+struct VnMap *
+VGetVnMap(Volume * vp)
+{
+    struct VnMap *map;
+
+    VOL_LOCK;
+    map = VGetVnMap_r(vp);
+    VOL_UNLOCK;
+    return map;
+}
+
 /**
  * Puts a volume reference obtained with VGetVolumeWithCall.
  *
@@ -4871,6 +4951,8 @@ VCloseVolumeHandles_r(Volume * vp)
 #endif /* AFS_NAMEI_ENV */
     }
 
+    VnMapClose(vp->vnMap, vp->vnodeIndex[vLarge].handle,
+	       vp->vnodeIndex[vSmall].handle);
     IH_REALLYCLOSE(vp->vnodeIndex[vLarge].handle);
     IH_REALLYCLOSE(vp->vnodeIndex[vSmall].handle);
     IH_REALLYCLOSE(vp->diskDataHandle);
@@ -4927,6 +5009,8 @@ VReleaseVolumeHandles_r(Volume * vp)
 #endif /* AFS_NAMEI_ENV */
     }
 
+    VnMapClose(vp->vnMap, vp->vnodeIndex[vLarge].handle,
+	       vp->vnodeIndex[vSmall].handle);
     IH_RELEASE(vp->vnodeIndex[vLarge].handle);
     IH_RELEASE(vp->vnodeIndex[vSmall].handle);
     IH_RELEASE(vp->diskDataHandle);
@@ -4976,6 +5060,7 @@ VUpdateVolume_r(Error * ec, Volume * vp, int flags)
     }
 
 #ifdef AFS_DEMAND_ATTACH_FS
+    VFoldVolumeUsage_r(vp);
     state_save = VChangeState_r(vp, VOL_STATE_UPDATING);
     VOL_UNLOCK;
 #endif
@@ -5081,10 +5166,12 @@ ReallyFreeVolume(Volume * vp)
     VChangeState_r(vp, VOL_STATE_FREED);
     if (vp->pending_vol_op)
 	free(vp->pending_vol_op);
+    opr_mutex_destroy(&vp->usage_lock);
 #endif /* AFS_DEMAND_ATTACH_FS */
     for (i = 0; i < nVNODECLASSES; i++)
 	if (vp->vnodeIndex[i].bitmap)
 	    free(vp->vnodeIndex[i].bitmap);
+    VnMapFree(vp->vnMap);
     FreeVolumeHeader(vp);
 #ifndef AFS_DEMAND_ATTACH_FS
     DeleteVolumeFromHashTable(vp);
@@ -6873,10 +6960,70 @@ VAdjustVolumeStatistics(Volume * vp)
     return retVal;
 }
 
+#ifdef AFS_DEMAND_ATTACH_FS
+/**
+ * add the usage counted by VTryBumpVolumeUsage to the volume header.
+ *
+ * @param[in] vp  volume object pointer
+ *
+ * @pre VOL_LOCK held
+ *
+ * @internal volume package internal use only
+ */
+static void
+VFoldVolumeUsage_r(Volume * vp)
+{
+    int pending;
+
+    opr_mutex_enter(&vp->usage_lock);
+    pending = vp->usage_bumps_pending;
+    vp->usage_bumps_pending = 0;
+    opr_mutex_exit(&vp->usage_lock);
+
+    V_dayUse(vp) += pending;
+    vp->usage_bumps_outstanding += pending;
+}
+
+/**
+ * count a volume access without VOL_LOCK, if that can be done.
+ *
+ * V_dayUse and V_accessDate need VOL_LOCK, but within the second of the
+ * last VBumpVolumeUsage_r call an access only adds one to V_dayUse, so
+ * those are counted here and added in by the next VBumpVolumeUsage_r or
+ * VUpdateVolume_r.
+ *
+ * @param[in] vp  volume object pointer
+ *
+ * @return whether the access was counted
+ *   @retval 0  access counted
+ *   @retval 1  caller must call VBumpVolumeUsage_r instead
+ *
+ * @pre VOL_LOCK is NOT held.
+ *      heavyweight ref held on vp.
+ */
+int
+VTryBumpVolumeUsage(Volume * vp)
+{
+    int code = 1;
+
+    opr_mutex_enter(&vp->usage_lock);
+    if (vp->usage_bump_date == FT_ApproxTime()) {
+	vp->usage_bumps_pending++;
+	code = 0;
+    }
+    opr_mutex_exit(&vp->usage_lock);
+    return code;
+}
+#endif /* AFS_DEMAND_ATTACH_FS */
+
 void
 VBumpVolumeUsage_r(Volume * vp)
 {
     unsigned int now = FT_ApproxTime();
+#ifdef AFS_DEMAND_ATTACH_FS
+    /* those accesses came before this one, and before any day rollover */
+    VFoldVolumeUsage_r(vp);
+#endif
     V_accessDate(vp) = now;
     if (now - V_dayUseDate(vp) > OneDay)
 	VAdjustVolumeStatistics_r(vp);
@@ -6893,6 +7040,11 @@ VBumpVolumeUsage_r(Volume * vp)
 	vp->usage_bumps_next_write = now + vol_opts.usage_rate_limit;
 	VUpdateVolume_r(&error, vp, VOL_UPDATE_WAIT);
     }
+#ifdef AFS_DEMAND_ATTACH_FS
+    opr_mutex_enter(&vp->usage_lock);
+    vp->usage_bump_date = now;
+    opr_mutex_exit(&vp->usage_lock);
+#endif
 }
 
 void
@@ -7105,6 +7257,8 @@ struct VLRU {
 
     int scanner_state;                                  /**< state of scanner thread */
     pthread_cond_t cv;                                  /**< state transition CV */
+
+    int saving;                                         /**< VLRU_SaveState_r in progress */
 };
 
 /** global VLRU state */
@@ -7124,6 +7278,7 @@ typedef enum {
 /* vlru disk data header stuff */
 #define VLRU_DISK_MAGIC      0x7a8b9cad        /**< vlru disk entry magic number */
 #define VLRU_DISK_VERSION    1                 /**< vlru disk entry version number */
+#define VLRU_DISK_NAME       "vlru.rank"       /**< vlru disk file in each partition */
 
 /** vlru default expiration time (for eventual fs state serialization of vlru data) */
 #define VLRU_DUMP_EXPIRATION_TIME   (60*60*24*7)  /* expire vlru data after 1 week */
@@ -7142,6 +7297,9 @@ static afs_uint32 VLRU_offline_max = VLRU_DEFAULT_OFFLINE_MAX;
 /** VLRU control flag.  non-zero value implies VLRU subsystem is activated. */
 static afs_uint32 VLRU_enabled = 1;
 
+/** maximum number of volumes to attach, hottest first, at fileserver startup. */
+static afs_uint32 VLRU_hot_attach = VLRU_DEFAULT_HOT_ATTACH;
+
 /* queue synchronization routines */
 static void VLRU_BeginExclusive_r(struct VLRU_q * q);
 static void VLRU_EndExclusive_r(struct VLRU_q * q);
@@ -7169,6 +7327,9 @@ static void VLRU_Wait_r(struct VLRU_q * q);
  *    @arg @c VLRU_SET_MAX
  *         set the max number of volumes to deallocate
  *         in one GC pass
+ *    @arg @c VLRU_SET_HOT_ATTACH
+ *         set the max number of volumes to attach at
+ *         startup from the saved VLRU state
  */
 void
 VLRU_SetOptions(int option, afs_uint32 val)
@@ -7181,6 +7342,8 @@ VLRU_SetOptions(int option, afs_uint32 val)
 	VLRU_offline_max = val;
     } else if (option == VLRU_SET_ENABLED) {
 	VLRU_enabled = val;
+    } else if (option == VLRU_SET_HOT_ATTACH) {
+	VLRU_hot_attach = val;
     }
     VLRU_ComputeConstants();
 }
@@ -7983,6 +8146,556 @@ VLRU_Wait_r(struct VLRU_q * q)
     }
 }
 
+/**
+ * rank a VLRU queue for the saved VLRU state.
+ *
+ * Volumes which have survived more promotions rank higher; soft detach
+ * candidates rank lowest.
+ *
+ * @param[in] idx  VLRU queue index
+ *
+ * @return rank; higher is hotter
+ *
+ * @internal VLRU internal use only.
+ */
+static int
+VLRU_Rank(afs_uint32 idx)
+{
+    switch (idx) {
+    case VLRU_QUEUE_OLD:
+    case VLRU_QUEUE_HELD:
+	return 3;
+    case VLRU_QUEUE_MID:
+	return 2;
+    case VLRU_QUEUE_NEW:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/* sort saved VLRU entries hottest first */
+static int
+VLRU_DiskEntryCompare(const void *a, const void *b)
+{
+    const struct VLRU_DiskEntry *ea = a, *eb = b;
+    int ra = VLRU_Rank(ea->idx), rb = VLRU_Rank(eb->idx);
+
+    if (ra != rb)
+	return rb - ra;
+    if (ea->last_get != eb->last_get)
+	return ea->last_get < eb->last_get ? 1 : -1;
+    if (ea->vid != eb->vid)
+	return ea->vid < eb->vid ? -1 : 1;
+    return 0;
+}
+
+static int
+VLRU_StartupEntryCompare(const void *a, const void *b)
+{
+    const struct VLRU_StartupEntry *ea = a, *eb = b;
+
+    return VLRU_DiskEntryCompare(&ea->ent, &eb->ent);
+}
+
+static int
+VLRU_DiskPath(struct DiskPartition64 * dp, char *path, size_t len)
+{
+    if (snprintf(path, len, "%s" OS_DIRSEP "%s", VPartitionPath(dp),
+		 VLRU_DISK_NAME) >= len)
+	return ENAMETOOLONG;
+    return 0;
+}
+
+/**
+ * collect the VLRU state of the volumes on a partition.
+ *
+ * Pre-attached volumes which were given a generation by
+ * VLRU_RestoreState, but have not been used since, are included, so that
+ * their rank survives another restart.
+ *
+ * @param[in]  dp       disk partition object
+ * @param[out] a_ents   entries, hottest first; the caller must free them
+ * @param[out] a_nents  number of entries
+ *
+ * @pre VOL_LOCK held
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval ENOMEM out of memory
+ *
+ * @note VOL_LOCK may be dropped internally
+ *
+ * @internal VLRU internal use only.
+ */
+static int
+VLRU_CollectPartition_r(struct DiskPartition64 * dp,
+			struct VLRU_DiskEntry ** a_ents, int * a_nents)
+{
+    struct rx_queue *qp, *nqp;
+    struct VLRU_DiskEntry *ents = NULL, *nents;
+    Volume *vp;
+    int n = 0, nalloc = 0;
+
+    VVByPListWait_r(dp);
+    for (queue_Scan(&dp->vol_list, qp, nqp, rx_queue)) {
+	vp = (Volume *)((char *)qp - offsetof(Volume, vol_list));
+	if (vp->vlru.idx >= VLRU_QUEUE_INVALID) {
+	    continue;
+	}
+	if (n == nalloc) {
+	    nalloc = nalloc ? 2 * nalloc : 256;
+	    nents = realloc(ents, nalloc * sizeof(*ents));
+	    if (nents == NULL) {
+		free(ents);
+		return ENOMEM;
+	    }
+	    ents = nents;
+	}
+	ents[n].vid = vp->hashid;
+	ents[n].idx = vp->vlru.idx;
+	ents[n].last_get = vp->stats.last_get;
+	n++;
+    }
+
+    qsort(ents, n, sizeof(*ents), VLRU_DiskEntryCompare);
+    *a_ents = ents;
+    *a_nents = n;
+    return 0;
+}
+
+/**
+ * write the VLRU state of a partition to disk.
+ *
+ * @param[in] dp     disk partition object
+ * @param[in] ents   entries, hottest first
+ * @param[in] nents  number of entries
+ *
+ * @pre VOL_LOCK is NOT held
+ *
+ * @return operation status
+ *    @retval 0 success
+ *
+ * @internal VLRU internal use only.
+ */
+static int
+VLRU_WritePartition(struct DiskPartition64 * dp,
+		    struct VLRU_DiskEntry * ents, int nents)
+{
+    char path[MAXPATHLEN], tpath[MAXPATHLEN];
+    struct VLRU_DiskHeader hdr;
+    size_t len = nents * sizeof(*ents);
+    int fd, code = 0;
+
+    /* a truncated name could be renamed over some other file */
+    if (VLRU_DiskPath(dp, path, sizeof(path)) != 0
+	|| snprintf(tpath, sizeof(tpath), "%s.new", path) >= sizeof(tpath)) {
+	Log("VLRU: path too long; not saving volume access ranking for %s\n",
+	    VPartitionPath(dp));
+	return ENAMETOOLONG;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.magic = VLRU_DISK_MAGIC;
+    hdr.stamp.version = VLRU_DISK_VERSION;
+    hdr.mtime = FT_ApproxTime();
+    hdr.num_records = nents;
+
+    fd = open(tpath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+	code = errno;
+	goto done;
+    }
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+	|| (len && write(fd, ents, len) != len)
+	|| fsync(fd) != 0) {
+	code = errno ? errno : EIO;
+    }
+    if (close(fd) != 0 && !code) {
+	code = errno;
+    }
+    if (!code && rename(tpath, path) != 0) {
+	code = errno;
+    }
+
+ done:
+    if (code) {
+	Log("VLRU: error %d saving volume access ranking to %s\n", code, path);
+	unlink(tpath);
+    }
+    return code;
+}
+
+/**
+ * save the VLRU state of every partition to disk.
+ *
+ * @pre VOL_LOCK held
+ *
+ * @note VOL_LOCK is dropped internally
+ *
+ * @note DAFS fileserver only
+ *
+ * @see VLRU_RestoreState
+ *
+ * @internal VLRU internal use only.
+ */
+static void
+VLRU_SaveState_r(void)
+{
+    struct DiskPartition64 *dp;
+    struct VLRU_DiskEntry *ents;
+    int nents, total = 0;
+
+    if (!VLRU_enabled || programType != fileServer)
+	return;
+
+    while (volume_LRU.saving) {
+	VOL_CV_WAIT(&volume_LRU.cv);
+    }
+    volume_LRU.saving = 1;
+
+    for (dp = DiskPartitionList; dp; dp = dp->next) {
+	if (VLRU_CollectPartition_r(dp, &ents, &nents)) {
+	    Log("VLRU: out of memory saving volume access ranking for %s\n",
+		VPartitionPath(dp));
+	    continue;
+	}
+	VOL_UNLOCK;
+	if (VLRU_WritePartition(dp, ents, nents) == 0) {
+	    total += nents;
+	}
+	VOL_LOCK;
+	free(ents);
+    }
+
+    volume_LRU.saving = 0;
+    opr_cv_broadcast(&volume_LRU.cv);
+
+    if (GetLogLevel() >= 5) {
+	Log("VLRU: saved access ranking of %d volumes\n", total);
+    }
+}
+
+/**
+ * save the VLRU state of every partition to disk.
+ *
+ * Called periodically, so that the access ranking survives a crash.
+ *
+ * @note DAFS fileserver only
+ */
+void
+VLRU_SaveState(void)
+{
+    VOL_LOCK;
+    if (VInit >= 2 && !vol_shutting_down) {
+	VLRU_SaveState_r();
+    }
+    VOL_UNLOCK;
+}
+
+/**
+ * read the saved VLRU state of a partition.
+ *
+ * @param[in]    dp    disk partition object
+ * @param[inout] sq    entries read are appended to sq->entry
+ *
+ * @pre VOL_LOCK is NOT held
+ *
+ * @internal VLRU internal use only.
+ */
+static void
+VLRU_ReadPartition(struct DiskPartition64 * dp,
+		   struct VLRU_StartupQueue * sq)
+{
+    char path[MAXPATHLEN];
+    struct VLRU_DiskHeader hdr;
+    struct VLRU_DiskEntry *ents = NULL;
+    struct VLRU_StartupEntry *nents;
+    struct afs_stat_st st;
+    size_t len;
+    int fd, i;
+
+    if (VLRU_DiskPath(dp, path, sizeof(path)) != 0) {
+	return;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	return;
+    }
+    if (afs_fstat(fd, &st) != 0
+	|| read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+	|| hdr.stamp.magic != VLRU_DISK_MAGIC
+	|| hdr.stamp.version != VLRU_DISK_VERSION
+	|| st.st_size != (afs_foff_t)(sizeof(hdr)
+				      + (size_t)hdr.num_records
+					* sizeof(*ents))) {
+	Log("VLRU: ignoring invalid volume access ranking %s\n", path);
+	goto done;
+    }
+    if (hdr.mtime + VLRU_DUMP_EXPIRATION_TIME < FT_ApproxTime()) {
+	Log("VLRU: ignoring stale volume access ranking %s\n", path);
+	goto done;
+    }
+    if (hdr.num_records == 0) {
+	goto done;
+    }
+
+    len = hdr.num_records * sizeof(*ents);
+    ents = malloc(len);
+    nents = realloc(sq->entry, (sq->num_entries + hdr.num_records)
+			       * sizeof(*nents));
+    if (ents == NULL || nents == NULL) {
+	Log("VLRU: out of memory reading volume access ranking %s\n", path);
+	if (nents != NULL) {
+	    sq->entry = nents;
+	}
+	goto done;
+    }
+    sq->entry = nents;
+    if (read(fd, ents, len) != len) {
+	Log("VLRU: error reading volume access ranking %s\n", path);
+	goto done;
+    }
+    for (i = 0; i < hdr.num_records; i++) {
+	nents[sq->num_entries].ent = ents[i];
+	nents[sq->num_entries].dp = dp;
+	sq->num_entries++;
+    }
+
+ done:
+    free(ents);
+    close(fd);
+}
+
+/**
+ * read the saved VLRU state of every partition.
+ *
+ * @return entries from all partitions, hottest first
+ *    @retval NULL nothing was saved, or the VLRU is disabled
+ *
+ * @pre VOL_LOCK is NOT held
+ *
+ * @internal VLRU internal use only.
+ */
+static struct VLRU_StartupQueue *
+VLRU_LoadState(void)
+{
+    struct DiskPartition64 *dp;
+    struct VLRU_StartupQueue *sq;
+
+    if (!VLRU_enabled)
+	return NULL;
+
+    sq = calloc(1, sizeof(*sq));
+    if (sq == NULL)
+	return NULL;
+
+    for (dp = DiskPartitionList; dp; dp = dp->next) {
+	VLRU_ReadPartition(dp, sq);
+    }
+    if (sq->num_entries == 0) {
+	free(sq->entry);
+	free(sq);
+	return NULL;
+    }
+
+    qsort(sq->entry, sq->num_entries, sizeof(*sq->entry),
+	  VLRU_StartupEntryCompare);
+    return sq;
+}
+
+/* give a pre-attached volume back its saved VLRU state */
+static void
+VLRU_RestoreEntry_r(Volume * vp, struct VLRU_DiskEntry * ent)
+{
+    if (V_attachState(vp) != VOL_STATE_PREATTACHED
+	|| vp->vlru.idx != VLRU_QUEUE_INVALID) {
+	return;
+    }
+    if (ent->idx < VLRU_QUEUE_CANDIDATE) {
+	vp->vlru.idx = ent->idx;
+    }
+    vp->stats.last_get = ent->last_get;
+}
+
+/**
+ * start attaching the hottest volumes from the saved VLRU state.
+ *
+ * Called before the partitions are scanned.  Up to VLRU_hot_attach of the
+ * saved volumes whose headers are still on the partition they were saved
+ * for are pre-attached, with their saved VLRU state, and then attached in
+ * the background, hottest first, by up to vol_attach_threads threads.  The
+ * partition scan pre-attaches the remaining volumes meanwhile.
+ *
+ * @param[in] sq  saved state from VLRU_LoadState, or NULL
+ *
+ * @pre VOL_LOCK is NOT held; VInit is 1
+ *
+ * @note DAFS fileserver only
+ *
+ * @internal VLRU internal use only.
+ */
+static void
+VLRU_AttachHot(struct VLRU_StartupQueue * sq)
+{
+    struct VLRU_StartupQueue *hq;
+    struct VLRU_StartupEntry *ent;
+    char name[VMAXPATHLEN], path[MAXPATHLEN];
+    struct afs_stat_st st;
+    pthread_t tid;
+    pthread_attr_t attrs;
+    Volume *vp;
+    Error ec;
+    int i, n, threads;
+
+    if (sq == NULL || VLRU_hot_attach == 0)
+	return;
+
+    n = min(sq->num_entries, VLRU_hot_attach);
+    hq = calloc(1, sizeof(*hq));
+    if (hq == NULL || (hq->entry = malloc(n * sizeof(*hq->entry))) == NULL) {
+	Log("VLRU: out of memory attaching the most active volumes\n");
+	free(hq);
+	return;
+    }
+
+    for (i = 0; i < n && !vinit_attach_abort; i++) {
+	ent = &sq->entry[i];
+	VolumeExternalName_r(ent->ent.vid, name, sizeof(name));
+	if (snprintf(path, sizeof(path), "%s" OS_DIRSEP "%s",
+		     VPartitionPath(ent->dp), name) >= sizeof(path)
+	    || afs_stat(path, &st) != 0) {
+	    continue;	/* moved or deleted since; the scan will tell */
+	}
+
+	VOL_LOCK;
+	vp = VLookupVolume_r(&ec, ent->ent.vid, NULL);
+	if (!ec && vp == NULL) {
+	    vp = VPreAttachVolumeByVp_r(&ec, ent->dp, NULL, ent->ent.vid);
+	}
+	if (!ec && vp != NULL && V_partition(vp) == ent->dp) {
+	    VLRU_RestoreEntry_r(vp, &ent->ent);
+	    hq->entry[hq->num_entries++] = *ent;
+	}
+	VOL_UNLOCK;
+    }
+
+    threads = min(hq->num_entries, vol_attach_threads);
+    if (threads < 1) {
+	free(hq->entry);
+	free(hq);
+	return;
+    }
+
+    Log("VLRU: attaching the %d most active volumes using %d thread%s\n",
+	hq->num_entries, threads, threads > 1 ? "s" : "");
+
+    opr_Verify(pthread_attr_init(&attrs) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&attrs,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    VOL_LOCK;
+    hq->n_threads = threads;
+    for (i = 0; i < threads; i++) {
+	AFS_SIGSET_DECL;
+	AFS_SIGSET_CLEAR();
+	opr_Verify(pthread_create(&tid, &attrs, &VLRU_HotAttachThread,
+				  hq) == 0);
+	AFS_SIGSET_RESTORE();
+    }
+    VOL_UNLOCK;
+    opr_Verify(pthread_attr_destroy(&attrs) == 0);
+}
+
+/**
+ * restore the saved VLRU state of the volumes found by the scan.
+ *
+ * Each pre-attached volume in the saved state gets back its last access
+ * time, and the generation it was in, so that it rejoins that generation
+ * when it is attached.  The hottest volumes were already given theirs by
+ * VLRU_AttachHot.
+ *
+ * @param[in] sq  saved state from VLRU_LoadState, or NULL; it is freed
+ *
+ * @pre VOL_LOCK is NOT held; VInit is 2
+ *
+ * @note DAFS fileserver only
+ *
+ * @internal VLRU internal use only.
+ */
+static void
+VLRU_RestoreState(struct VLRU_StartupQueue * sq)
+{
+    struct VLRU_StartupEntry *ent;
+    Volume *vp;
+    Error ec;
+    int i;
+
+    if (sq == NULL)
+	return;
+
+    VOL_LOCK;
+    for (i = 0; i < sq->num_entries && !vinit_attach_abort; i++) {
+	ent = &sq->entry[i];
+	vp = VLookupVolume_r(&ec, ent->ent.vid, NULL);
+	if (ec || vp == NULL) {
+	    continue;
+	}
+	VLRU_RestoreEntry_r(vp, &ent->ent);
+    }
+    VOL_UNLOCK;
+
+    free(sq->entry);
+    free(sq);
+}
+
+/**
+ * attach volumes from the saved VLRU state, hottest first.
+ *
+ * @param[in] args  VLRU_StartupQueue shared by all hot attach threads
+ *
+ * @note DAFS fileserver only
+ *
+ * @internal VLRU internal use only.
+ */
+static void *
+VLRU_HotAttachThread(void * args)
+{
+    struct VLRU_StartupQueue *sq = args;
+    struct VLRU_StartupEntry *ent;
+    Volume *vp, *nvp;
+    Error ec;
+
+    VOL_LOCK;
+    while (sq->next_idx < sq->num_entries && !vol_shutting_down
+	   && !vinit_attach_abort) {
+	ent = &sq->entry[sq->next_idx++];
+	vp = VLookupVolume_r(&ec, ent->ent.vid, NULL);
+	if (ec || vp == NULL || V_attachState(vp) != VOL_STATE_PREATTACHED
+	    || vp->specialStatus) {
+	    continue;
+	}
+
+	VCreateReservation_r(vp);
+	nvp = VAttachVolumeByVp_r(&ec, vp, 0);
+	if (nvp) {
+	    VPutVolume_r(nvp);
+	}
+	VCancelReservation_r(vp);
+	if (ec && GetLogLevel() >= 5) {
+	    Log("VLRU: volume %" AFS_VOLID_FMT " not attached; error %d\n",
+		afs_printable_VolumeId_lu(ent->ent.vid), ec);
+	}
+    }
+
+    if (--sq->n_threads == 0) {
+	Log("VLRU: finished attaching the most active volumes\n");
+	free(sq->entry);
+	free(sq);
+    }
+    VOL_UNLOCK;
+    return NULL;
+}
+
 /* demand attach fs
  * volume soft detach
  *
@@ -8990,9 +9703,9 @@ VPrintCacheStats_r(void)
 {
     struct VnodeClassInfo *vcp;
     vcp = &VnodeClassInfo[vLarge];
-    Log("Large vnode cache, %d entries, %d allocs, %d gets (%d reads), %d writes\n", vcp->cacheSize, vcp->allocs, vcp->gets, vcp->reads, vcp->writes);
+    Log("Large vnode cache, %d entries, %d allocs, %d gets (%d reads), %d writes\n", vcp->cacheSize, vcp->allocs, VCountVnodeGets(vLarge), vcp->reads, vcp->writes);
     vcp = &VnodeClassInfo[vSmall];
-    Log("Small vnode cache,%d entries, %d allocs, %d gets (%d reads), %d writes\n", vcp->cacheSize, vcp->allocs, vcp->gets, vcp->reads, vcp->writes);
+    Log("Small vnode cache,%d entries, %d allocs, %d gets (%d reads), %d writes\n", vcp->cacheSize, vcp->allocs, VCountVnodeGets(vSmall), vcp->reads, vcp->writes);
     Log("Volume header cache, %d entries, %"AFS_INT64_FMT" gets, "
         "%"AFS_INT64_FMT" replacements\n",
 	VStats.hdr_cache_size, VStats.hdr_gets, VStats.hdr_loads);
@@ -127,6 +127,14 @@ extern int (*vol_PollProc) (void);
 
 #define	DOPOLL	((vol_PollProc)? (*vol_PollProc)() : 0)
 
+/* Threads cloning each vnode index of a volume; see clone.c */
+#define CLONE_DEFAULT_THREADS	4
+#define CLONE_MAX_THREADS	32
+extern int vol_CloneThreads;
+
+/* Inodes per second released by the background reaper; see nuke.c */
+extern int vol_ReapRate;
+
 #ifdef AFS_DEMAND_ATTACH_FS
 /**
  * variable error return code based upon programType and DAFS presence
@@ -205,6 +213,7 @@ enum VolFlags {
 #define VLRU_SET_INTERVAL     2
 #define VLRU_SET_MAX          3
 #define VLRU_SET_ENABLED      4
+#define VLRU_SET_HOT_ATTACH   5
 
 /**
  * VLRU queue names.
@@ -223,6 +232,7 @@ typedef enum {
 #define VLRU_DEFAULT_OFFLINE_THRESH (60*60*2) /* 2 hours */
 #define VLRU_DEFAULT_OFFLINE_INTERVAL (60*2) /* 2 minutes */
 #define VLRU_DEFAULT_OFFLINE_MAX 8 /* 8 volumes */
+#define VLRU_DEFAULT_HOT_ATTACH 1000 /* 1000 volumes */
 
 
 /**
@@ -664,6 +674,7 @@ typedef struct Volume {
 				 * that stayed around while a volume was offline */
     short nUsers;		/* Number of users of this volume header */
     struct okv_dbhandle* ridb_hdl; /* Reverse-index database handle */
+    struct VnMap *vnMap;	/* Changed-vnode map; see vnmap.h */
 #define VOL_PUTBACK 1
 #define VOL_PUTBACK_DELETE 2
     byte needsPutBack;		/* For a volume utility, this flag is set to VOL_PUTBACK if we
@@ -699,6 +710,11 @@ typedef struct Volume {
 #endif /* AFS_DEMAND_ATTACH_FS */
     int usage_bumps_outstanding; /**< to rate limit the usage update i/o by accesses */
     int usage_bumps_next_write;  /**< to rate limit the usage update i/o by time */
+#ifdef AFS_DEMAND_ATTACH_FS
+    pthread_mutex_t usage_lock;  /**< protects the two fields below */
+    afs_uint32 usage_bump_date;  /**< second of the last locked usage bump */
+    int usage_bumps_pending;     /**< bumps since then, not yet in V_dayUse */
+#endif
 } Volume;
 
 struct volHeader {
@@ -786,6 +802,8 @@ extern Volume *VGetVolume_r(Error * ec, VolumeId volumeId);
 extern void VPutVolume(Volume *);
 extern void VPutVolumeWithCall(Volume *vp, struct VCallByVol *cbv);
 extern void VPutVolume_r(Volume *);
+extern struct VnMap *VGetVnMap(Volume * vp);
+extern struct VnMap *VGetVnMap_r(Volume * vp);
 extern void VOffline(Volume * vp, char *message);
 extern void VOffline_r(Volume * vp, char *message);
 extern int VConnectFS(void);
@@ -827,6 +845,9 @@ extern void VForceOffline(Volume * vp);
 extern void VForceOffline_r(Volume * vp, int flags);
 extern void VBumpVolumeUsage(Volume * vp);
 extern void VBumpVolumeUsage_r(Volume * vp);
+#ifdef AFS_DEMAND_ATTACH_FS
+extern int VTryBumpVolumeUsage(Volume * vp);
+#endif
 extern void VSetDiskUsage(void);
 extern void VPrintCacheStats(void);
 extern void VReleaseVnodeFiles_r(Volume * vp);
@@ -875,6 +896,7 @@ extern int VDisconnectSALV_r(void);
 extern void VPrintExtendedCacheStats(int flags);
 extern void VPrintExtendedCacheStats_r(int flags);
 extern void VLRU_SetOptions(int option, afs_uint32 val);
+extern void VLRU_SaveState(void);
 extern int VRequestSalvage_r(Error * ec, Volume * vp, int reason, int flags);
 extern int VUpdateSalvagePriority_r(Volume * vp);
 extern int VRegisterVolOp_r(Volume * vp, FSSYNC_VolOp_info * vopinfo);
@@ -897,6 +919,17 @@ extern int VVolOpSetVBusy_r(Volume * vp, FSSYNC_VolOp_info * vopinfo);
 
 extern void VPurgeVolume(Error * ec, Volume * vp);
 
+struct VReapRecord;
+extern int VReapCreate(Volume * vp, struct VReapRecord **a_rec);
+extern void VReapCommit(struct VReapRecord *rec);
+extern void VReapAbort(struct VReapRecord *rec);
+extern void VReapPartition(struct DiskPartition64 *dp, int rate);
+extern void VReapVolumeGroup(struct DiskPartition64 *dp, VolumeId parent);
+extern int VReapPending_r(struct DiskPartition64 *dp);
+#ifdef AFS_PTHREAD_ENV
+extern void VReapStart(void);
+#endif
+
 extern afs_int32 VCanScheduleSalvage(void);
 extern afs_int32 VCanUseFSSYNC(void);
 extern afs_int32 VCanUseSALVSYNC(void);
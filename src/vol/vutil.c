@@ -49,6 +49,7 @@
 #endif
 #include "vnode.h"
 #include "volume.h"
+#include "vnmap.h"
 #include "volume_inline.h"
 #include "partition.h"
 #include "viceinode.h"
@@ -56,6 +57,9 @@
 #include "volinodes.h"
 #include "vol_prototypes.h"
 #include "common.h"
+#ifdef AFS_DEMAND_ATTACH_FS
+# include "vg_cache.h"
+#endif
 
 #ifndef AFS_NT40_ENV
 # ifdef O_LARGEFILE
@@ -114,6 +118,7 @@ VCreateVolume_r(Error * ec, char *partname, VolumeId volumeId, VolumeId parentId
 {				/* Should be the same as volumeId if there is
 				 * no parent */
     VolumeDiskData vol;
+    Volume *vp;
     int i, rc;
     char headerName[VMAXPATHLEN], volumePath[VMAXPATHLEN + 1];
     Device device;
@@ -150,6 +155,15 @@ VCreateVolume_r(Error * ec, char *partname, VolumeId volumeId, VolumeId parentId
 	*ec = VNOVOL;
 	return NULL;
     }
+#ifdef AFS_NAMEI_ENV
+    /* A deleted volume in this group may still hold references on the
+     * inodes our vnodes will be given; see nuke.c */
+    if (VReapPending_r(partition)) {
+	VOL_UNLOCK;
+	VReapVolumeGroup(partition, parentId);
+	VOL_LOCK;
+    }
+#endif
 #if	defined(NEARINODE_HINT)
     nearInodeHash(volumeId, nearInode);
     nearInode %= partition->f_files;
@@ -320,7 +334,14 @@ VCreateVolume_r(Error * ec, char *partname, VolumeId volumeId, VolumeId parentId
 	VUnlockVolumeById(volumeId, partition);
     }
 # endif /* AFS_DEMAND_ATTACH_FS */
-    return (VAttachVolumeByName_r(ec, partname, headerName, V_SECRETLY));
+    vp = VAttachVolumeByName_r(ec, partname, headerName, V_SECRETLY);
+    if (vp != NULL) {
+	/* Start the new volume off with an empty vnode map, replacing any
+	 * left behind by an earlier volume of this number */
+	VnMapRebuild(VGetVnMap_r(vp), vp->vnodeIndex[vLarge].handle,
+		     vp->vnodeIndex[vSmall].handle);
+    }
+    return vp;
 }
 #endif /* FSSYNC_BUILD_CLIENT */
 
@@ -473,6 +494,30 @@ VReadVolumeDiskHeader(VolumeId volid,
 }
 
 #ifdef FSSYNC_BUILD_CLIENT
+#ifdef AFS_DEMAND_ATTACH_FS
+/**
+ * forget that a partition's saved volume group cache is clean.
+ *
+ * The fileserver only trusts the saved cache if no volume header changed
+ * while it was not running, so this must be done before any header is
+ * changed.
+ *
+ * @param[in] dp  disk partition object
+ */
+static void
+VInvalidateSavedVGCache(struct DiskPartition64 *dp)
+{
+    char path[MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s" OS_DIRSEP VVGC_CLEAN_NAME,
+	     VPartitionPath(dp));
+    if (unlink(path) != 0 && errno != ENOENT) {
+	Log("VInvalidateSavedVGCache: Couldn't unlink %s, error = %d\n",
+	    path, errno);
+    }
+}
+#endif /* AFS_DEMAND_ATTACH_FS */
+
 /**
  * write an existing volume disk header.
  *
@@ -503,6 +548,7 @@ _VWriteVolumeDiskHeader(VolumeDiskHeader_t * hdr,
     if (code) {
 	return EIO;
     }
+    VInvalidateSavedVGCache(dp);
 #endif /* AFS_DEMAND_ATTACH_FS */
 
     flags |= O_RDWR;
@@ -683,6 +729,10 @@ VDestroyVolumeDiskHeader(struct DiskPartition64 * dp,
     SYNC_response res;
 #endif /* AFS_DEMAND_ATTACH_FS */
 
+#ifdef AFS_DEMAND_ATTACH_FS
+    VInvalidateSavedVGCache(dp);
+#endif
+
     snprintf(path, sizeof(path), "%s" OS_DIRSEP VFORMAT,
              VPartitionPath(dp), afs_printable_VolumeId_lu(volid));
     code = unlink(path);
@@ -690,6 +740,7 @@ VDestroyVolumeDiskHeader(struct DiskPartition64 * dp,
 	Log("VDestroyVolumeDiskHeader: Couldn't unlink disk header, error = %d\n", errno);
 	goto done;
     }
+    VnMapDestroy(VPartitionPath(dp), volid);
 
 #ifdef AFS_DEMAND_ATTACH_FS
     /* Remove the volume entry from the fileserver's volume group cache, if found. */
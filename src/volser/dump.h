@@ -24,6 +24,12 @@
 #define D_VNODE		3
 #define D_DUMPEND	4
 
+/* A compressed dump starts with D_COMPRESSED, DUMPCOMPRESSMAGIC and a
+ * one-byte method; everything after that is the compressed dump itself */
+#define D_COMPRESSED	5
+#define DUMPCOMPRESSMAGIC	0x5A4C4942
+#define DUMPCOMPRESS_ZLIB	1
+
 #define D_MAX		20
 
 #define MAXDUMPTIMES	50
@@ -67,6 +73,7 @@ struct DumpHeader {
  *     1       0x01    D_DUMPHEADER
  *     2       0x02    D_VOLUMEHEADER
  *     4       0x04    D_DUMPEND
+ *     5       0x05    D_COMPRESSED (first byte only)
  *     'n'     0x6e    V_name
  *     't'     0x74    fromtime, V_backupDate
  *     'v'     0x76    V_id / V_parentId               *
@@ -15,6 +15,11 @@
 #include <ctype.h>
 
 #include <afs/opr.h>
+#ifdef AFS_PTHREAD_ENV
+# include <opr/lock.h>
+#else
+# include <opr/lockstub.h>
+#endif
 #include <rx/rx.h>
 #include <rx/rx_queue.h>
 #include <afs/afsint.h>
@@ -25,6 +30,7 @@
 #include <afs/ihandle.h>
 #include <afs/vnode.h>
 #include <afs/volume.h>
+#include <afs/vnmap.h>
 #include <afs/partition.h>
 #include <afs/daemon_com.h>
 #include <afs/fssync.h>
@@ -32,6 +38,10 @@
 #include <afs/com_err.h>
 #include <afs/vol_prototypes.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "dump.h"
 #include "volser.h"
 #include "volint.h"
@@ -58,9 +68,10 @@ static int DumpDumpHeader(struct iod *iodp, Volume * vp,
 			  afs_int32 fromtime);
 static int DumpPartial(struct iod *iodp, Volume * vp,
 		       afs_int32 fromtime, int dumpAllDirs);
+struct dumpAhead;
 static int DumpVnodeIndex(struct iod *iodp, Volume * vp,
 			  VnodeClass class, afs_int32 fromtime,
-			  int forcedump);
+			  int forcedump, struct dumpAhead *da);
 static int DumpVnode(struct iod *iodp, struct VnodeDiskObject *v,
 		     VolumeId volid, int vnodeNumber, int dumpEverything);
 static int ReadDumpHeader(struct iod *iodp, struct DumpHeader *hp);
@@ -84,6 +95,20 @@ static int SizeDumpVnodeIndex(struct iod *iodp, Volume * vp,
 static int SizeDumpVnode(struct iod *iodp, struct VnodeDiskObject *v,
 			 VolumeId volid, int vnodeNumber, int dumpEverything,
 			 struct volintSize *size);
+static int DumpChangedVnodes(struct iod *iodp, Volume * vp,
+			     VnodeClass class, afs_int32 fromtime,
+			     struct volintSize *size, struct dumpAhead *da,
+			     int *used);
+static struct dumpAhead *DumpAheadCreate(struct iod *iodp, Volume * vp);
+static void DumpAheadDestroy(struct dumpAhead *da);
+static void DumpAheadStart(struct dumpAhead *da, VnodeClass class,
+			   FdHandle_t *indexFdP, afs_int32 fromtime,
+			   struct VnMap *map);
+static int DumpAheadAdd(struct dumpAhead *da, struct iod *iodp,
+			VnodeId vnodeNumber, struct VnodeDiskObject *v,
+			int dumpEverything, struct VnMapEntry *entry);
+static int DumpAheadEnd(struct dumpAhead *da, struct iod *iodp, int code);
+static VnodeId DumpAheadMapBad(struct dumpAhead *da, int reset);
 
 #define MAX_SECTIONS    3
 
@@ -136,6 +161,7 @@ iod_Init(struct iod *iodp, struct rx_call *call)
     iodp->haveOldChar = 0;
     iodp->ncalls = 1;
     iodp->calls = (struct rx_call **)0;
+    iodp->zip = NULL;
 }
 
 static void
@@ -148,11 +174,9 @@ iod_InitMulti(struct iod *iodp, struct rx_call **calls, int ncalls,
     iodp->ncalls = ncalls;
     iodp->codes = codes;
     iodp->call = (struct rx_call *)0;
+    iodp->zip = NULL;
 }
 
-/* N.B. iod_Read doesn't check for oldchar (see previous comment) */
-#define iod_Read(iodp, buf, nbytes) rx_Read((iodp)->call, buf, nbytes)
-
 /* For the single dump case, it's ok to just return the "bytes written"
  * that rx_Write returns, since all the callers of iod_Write abort when
  * the returned value is less than they expect.  For the multi dump case,
@@ -160,7 +184,7 @@ iod_InitMulti(struct iod *iodp, struct rx_call **calls, int ncalls,
  * connection timed out, but if they all time out, then we should give up.
  */
 static int
-iod_Write(struct iod *iodp, char *buf, int nbytes)
+iod_RawWrite(struct iod *iodp, char *buf, int nbytes)
 {
     int code, i;
     int one_success = 0;
@@ -191,6 +215,330 @@ iod_Write(struct iod *iodp, char *buf, int nbytes)
 	return 0;
 }
 
+/*
+ * Stream compression.
+ *
+ * When both ends agree to it, everything the dump code writes through
+ * iod_Write is deflated before it goes out on the call(s), and everything
+ * the restore code reads through iod_Read and iod_getc is inflated as it
+ * comes in.  The dump format itself is unchanged; a compressed stream is
+ * just a normal dump behind a short header (see D_COMPRESSED in dump.h),
+ * which RestoreVolume recognizes on its own.
+ *
+ * Small writes and reads are gathered in buffers so that zlib is called
+ * once per buffer, not once per tag.
+ */
+#define IOD_ZIPBUFSIZE	32768
+
+struct iodZip {
+#ifdef HAVE_ZLIB
+    z_stream stream;
+#endif
+    int deflating;		/* 1 if dumping, 0 if restoring */
+    int eof;			/* end of the compressed stream seen */
+    afs_uint64 rawBytes;	/* dump bytes in or out */
+    afs_uint64 zipBytes;	/* compressed bytes sent or received */
+    afs_uint64 cpuNsec;		/* CPU time spent in zlib */
+    int inLen;			/* bytes waiting in inBuf, if dumping */
+    int outPos, outLen;		/* unread bytes in outBuf, if restoring */
+    unsigned char inBuf[IOD_ZIPBUFSIZE];
+    unsigned char outBuf[IOD_ZIPBUFSIZE];
+};
+
+/* CPU time used by this thread, in nanoseconds, or 0 if unknown */
+static afs_uint64
+ZipCpuTime(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+	return (afs_uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return 0;
+}
+
+/**
+ * Work out the compression level asked for by a set of dump flags.
+ *
+ * @param[in] flags  VOLDUMPV2_* flags
+ *
+ * @return compression level to use, or 0 not to compress (including when
+ *         this volserver was built without zlib)
+ */
+int
+DumpCompressLevel(afs_int32 flags)
+{
+#ifdef HAVE_ZLIB
+    int level;
+
+    if (!(flags & VOLDUMPV2_COMPRESS))
+	return 0;
+    level = (flags & VOLDUMPV2_LEVELMASK) >> VOLDUMPV2_LEVELSHIFT;
+    if (level == 0)
+	level = 6;		/* zlib's own default */
+    else if (level > Z_BEST_COMPRESSION)
+	level = Z_BEST_COMPRESSION;
+    return level;
+#else
+    return 0;
+#endif
+}
+
+#ifdef HAVE_ZLIB
+/* Deflate whatever is in inBuf and send the result */
+static int
+iod_ZipDeflate(struct iod *iodp, int flush)
+{
+    struct iodZip *zip = iodp->zip;
+    afs_uint64 start;
+    int code, n;
+
+    zip->stream.next_in = zip->inBuf;
+    zip->stream.avail_in = zip->inLen;
+    zip->rawBytes += zip->inLen;
+    zip->inLen = 0;
+    do {
+	zip->stream.next_out = zip->outBuf;
+	zip->stream.avail_out = IOD_ZIPBUFSIZE;
+	start = ZipCpuTime();
+	code = deflate(&zip->stream, flush);
+	zip->cpuNsec += ZipCpuTime() - start;
+	if (code == Z_STREAM_ERROR)
+	    return -1;
+	n = IOD_ZIPBUFSIZE - zip->stream.avail_out;
+	if (n > 0 && iod_RawWrite(iodp, (char *)zip->outBuf, n) != n)
+	    return -1;
+	zip->zipBytes += n;
+    } while (zip->stream.avail_out == 0);
+
+    if (flush == Z_FINISH && code != Z_STREAM_END)
+	return -1;
+    return 0;
+}
+
+static int
+iod_ZipWrite(struct iod *iodp, char *buf, int nbytes)
+{
+    struct iodZip *zip = iodp->zip;
+    int left = nbytes, n;
+
+    while (left > 0) {
+	n = IOD_ZIPBUFSIZE - zip->inLen;
+	if (n > left)
+	    n = left;
+	memcpy(zip->inBuf + zip->inLen, buf, n);
+	zip->inLen += n;
+	buf += n;
+	left -= n;
+	if (zip->inLen == IOD_ZIPBUFSIZE && iod_ZipDeflate(iodp, Z_NO_FLUSH))
+	    return 0;
+    }
+    return nbytes;
+}
+
+static int
+iod_ZipRead(struct iod *iodp, char *buf, int nbytes)
+{
+    struct iodZip *zip = iodp->zip;
+    afs_uint64 start;
+    int done = 0, n, code;
+
+    while (done < nbytes) {
+	if (zip->outPos < zip->outLen) {
+	    n = zip->outLen - zip->outPos;
+	    if (n > nbytes - done)
+		n = nbytes - done;
+	    memcpy(buf + done, zip->outBuf + zip->outPos, n);
+	    zip->outPos += n;
+	    done += n;
+	    continue;
+	}
+	if (zip->eof)
+	    break;
+
+	/* Inflate more of the stream into outBuf */
+	zip->stream.next_out = zip->outBuf;
+	zip->stream.avail_out = IOD_ZIPBUFSIZE;
+	while (zip->stream.avail_out == IOD_ZIPBUFSIZE && !zip->eof) {
+	    if (zip->stream.avail_in == 0) {
+		n = rx_Read(iodp->call, (char *)zip->inBuf, IOD_ZIPBUFSIZE);
+		if (n <= 0) {
+		    /* truncated; the caller will notice the short read */
+		    zip->eof = 1;
+		    break;
+		}
+		zip->zipBytes += n;
+		zip->stream.next_in = zip->inBuf;
+		zip->stream.avail_in = n;
+	    }
+	    start = ZipCpuTime();
+	    code = inflate(&zip->stream, Z_NO_FLUSH);
+	    zip->cpuNsec += ZipCpuTime() - start;
+	    if (code == Z_STREAM_END)
+		zip->eof = 1;
+	    else if (code != Z_OK && code != Z_BUF_ERROR) {
+		Log("1 Volser: RestoreVolume: corrupt compressed dump (zlib "
+		    "error %d)\n", code);
+		zip->eof = 1;
+	    }
+	}
+	zip->outPos = 0;
+	zip->outLen = IOD_ZIPBUFSIZE - zip->stream.avail_out;
+	zip->rawBytes += zip->outLen;
+    }
+    return done;
+}
+#endif /* HAVE_ZLIB */
+
+/**
+ * Start compressing everything written to an iod.
+ *
+ * @param[in] iodp   iod for a dump that has not written anything yet
+ * @param[in] level  compression level, from DumpCompressLevel
+ *
+ * @return 0 on success, VOLSERDUMPERROR if the header could not be sent or
+ *         zlib could not be set up
+ */
+static int
+iod_ZipBegin(struct iod *iodp, int level)
+{
+#ifdef HAVE_ZLIB
+    struct iodZip *zip;
+    char header[6];
+    afs_uint32 magic = htonl(DUMPCOMPRESSMAGIC);
+
+    header[0] = D_COMPRESSED;
+    memcpy(&header[1], &magic, sizeof(magic));
+    header[5] = DUMPCOMPRESS_ZLIB;
+    if (iod_RawWrite(iodp, header, sizeof(header)) != sizeof(header))
+	return VOLSERDUMPERROR;
+
+    zip = calloc(1, sizeof(*zip));
+    if (zip == NULL)
+	return VOLSERDUMPERROR;
+    if (deflateInit(&zip->stream, level) != Z_OK) {
+	free(zip);
+	return VOLSERDUMPERROR;
+    }
+    zip->deflating = 1;
+    iodp->zip = zip;
+    return 0;
+#else
+    return VOLSERDUMPERROR;
+#endif
+}
+
+/**
+ * Start inflating everything read from an iod.
+ *
+ * @param[in] iodp  iod whose D_COMPRESSED tag has just been read
+ *
+ * @return 0 on success, VOLSERREAD_DUMPERROR if the header is not one we
+ *         understand
+ */
+static int
+iod_UnzipBegin(struct iod *iodp)
+{
+#ifdef HAVE_ZLIB
+    struct iodZip *zip;
+    unsigned char header[5];
+    afs_uint32 magic;
+
+    if (rx_Read(iodp->call, (char *)header, sizeof(header)) != sizeof(header))
+	return VOLSERREAD_DUMPERROR;
+    memcpy(&magic, header, sizeof(magic));
+    if (ntohl(magic) != DUMPCOMPRESSMAGIC || header[4] != DUMPCOMPRESS_ZLIB) {
+	Log("1 Volser: RestoreVolume: unknown dump compression method %d\n",
+	    header[4]);
+	return VOLSERREAD_DUMPERROR;
+    }
+
+    zip = calloc(1, sizeof(*zip));
+    if (zip == NULL)
+	return VOLSERREAD_DUMPERROR;
+    if (inflateInit(&zip->stream) != Z_OK) {
+	free(zip);
+	return VOLSERREAD_DUMPERROR;
+    }
+    iodp->zip = zip;
+    return 0;
+#else
+    Log("1 Volser: RestoreVolume: dump is compressed, but this volserver "
+	"was built without zlib\n");
+    return VOLSERREAD_DUMPERROR;
+#endif
+}
+
+/**
+ * Finish with compression on an iod, if it was in use.
+ *
+ * When dumping, this sends whatever compressed data is still buffered.  In
+ * either direction, it logs how well the stream compressed and how much
+ * CPU time that took.
+ *
+ * @param[in] iodp   iod
+ * @param[in] volid  volume being dumped or restored, for the log
+ * @param[in] code   result of the dump or restore so far
+ *
+ * @return code, or VOLSERDUMPERROR if the dump could not be finished
+ */
+static int
+iod_ZipEnd(struct iod *iodp, VolumeId volid, int code)
+{
+#ifdef HAVE_ZLIB
+    struct iodZip *zip = iodp->zip;
+
+    if (zip == NULL)
+	return code;
+
+    if (zip->deflating) {
+	if (!code && iod_ZipDeflate(iodp, Z_FINISH))
+	    code = VOLSERDUMPERROR;
+	deflateEnd(&zip->stream);
+    } else {
+	inflateEnd(&zip->stream);
+    }
+
+    if (!code) {
+	Log("1 Volser: %s volume %" AFS_VOLID_FMT ": %llu bytes %s %llu "
+	    "(%llu%%), %llu.%03llu s CPU\n",
+	    zip->deflating ? "Dump of" : "Restore of",
+	    afs_printable_VolumeId_lu(volid),
+	    zip->deflating ? zip->rawBytes : zip->zipBytes,
+	    zip->deflating ? "compressed to" : "decompressed to",
+	    zip->deflating ? zip->zipBytes : zip->rawBytes,
+	    zip->rawBytes ? zip->zipBytes * 100 / zip->rawBytes : 0,
+	    zip->cpuNsec / 1000000000, (zip->cpuNsec / 1000000) % 1000);
+    }
+
+    free(zip);
+    iodp->zip = NULL;
+#endif
+    return code;
+}
+
+static int
+iod_Write(struct iod *iodp, char *buf, int nbytes)
+{
+#ifdef HAVE_ZLIB
+    if (iodp->zip)
+	return iod_ZipWrite(iodp, buf, nbytes);
+#endif
+    return iod_RawWrite(iodp, buf, nbytes);
+}
+
+/* N.B. iod_Read doesn't check for oldchar (see previous comment) */
+static int
+iod_Read(struct iod *iodp, char *buf, int nbytes)
+{
+#ifdef HAVE_ZLIB
+    if (iodp->zip)
+	return iod_ZipRead(iodp, buf, nbytes);
+#endif
+    return rx_Read(iodp->call, buf, nbytes);
+}
+
 static void
 iod_ungetc(struct iod *iodp, int achar)
 {
@@ -700,6 +1048,20 @@ DumpStandardTagLen(struct iod *iodp, char tag, afs_uint32 section,
     return 0;
 }
 
+static int
+DumpFileLength(struct iod *iodp, afs_sfsize_t length)
+{
+    afs_uint32 hi, lo;
+
+    SplitInt64(length, hi, lo);
+    if (hi == 0L)
+	return DumpInt32(iodp, 'f', lo);
+    return DumpDouble(iodp, 'h', hi, lo);
+}
+
+/* Blocks of a file DumpFile reads at once */
+#define DUMPFILE_READS	16
+
 static int
 DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
 {
@@ -708,8 +1070,9 @@ DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
     ssize_t n = 0;
     afs_foff_t howFar = 0;
     byte *p;
-    afs_uint32 hi, lo;
     afs_ino_str_t stmp;
+    struct ih_io ios[DUMPFILE_READS];
+    int i, nios;
 
     code = FDH_BLOCKSIZE(handleP, &howBig, &howMany);
     if (code != 0) {
@@ -718,52 +1081,60 @@ DumpFile(struct iod *iodp, int vnode, FdHandle_t * handleP)
 	return VOLSERDUMPERROR;
     }
 
-    SplitInt64(howBig, hi, lo);
-    if (hi == 0L) {
-	code = DumpInt32(iodp, 'f', lo);
-    } else {
-	code = DumpDouble(iodp, 'h', hi, lo);
-    }
+    code = DumpFileLength(iodp, howBig);
     if (code) {
 	return VOLSERDUMPERROR;
     }
 
-    p = malloc(howMany);
+    p = malloc(howMany * DUMPFILE_READS);
     if (!p) {
-	Log("1 Volser: DumpFile: not enough memory to allocate %u bytes\n", (unsigned)howMany);
+	Log("1 Volser: DumpFile: not enough memory to allocate %u bytes\n", (unsigned)(howMany * DUMPFILE_READS));
 	return VOLSERDUMPERROR;
     }
 
     for (nbytes = howBig; (nbytes && !error); ) {
-	if (nbytes < howMany)
-	    howMany = nbytes;
-
-	/* Read the data */
-	n = FDH_PREAD(handleP, p, howMany, howFar);
-	if (n < 0) {
-	    Log("1 Volser: DumpFile: Error reading inode %s for vnode %d: %s\n",
-		PrintInode(stmp, handleP->fd_ih->ih_ino), vnode,
-		afs_error_message(errno));
-	    error = VOLSERDUMPERROR;
-
-	} else if (n == 0) {
-	    Log("1 Volser: DumpFile: Premature EOF reading inode %s for vnode %d\n",
-		PrintInode(stmp, handleP->fd_ih->ih_ino), vnode);
-	    error = VOLSERDUMPERROR;
+	/* Read the next few blocks together */
+	for (nios = 0; nios < DUMPFILE_READS && nbytes > 0; nios++) {
+	    ios[nios].buf = p + nios * howMany;
+	    ios[nios].length = (nbytes < howMany) ? nbytes : howMany;
+	    ios[nios].offset = howFar;
+	    howFar += ios[nios].length;
+	    nbytes -= ios[nios].length;
 	}
-	if (error != 0) {
-	    break;
-	}
-
-	howFar += n;
-	nbytes -= n;
+	FDH_PREADM(handleP, ios, nios);
+
+	for (i = 0; i < nios; i++) {
+	    n = ios[i].result;
+	    if (n < 0) {
+		Log("1 Volser: DumpFile: Error reading inode %s for vnode %d: %s\n",
+		    PrintInode(stmp, handleP->fd_ih->ih_ino), vnode,
+		    afs_error_message(ios[i].error));
+		error = VOLSERDUMPERROR;
+
+	    } else if (n == 0) {
+		Log("1 Volser: DumpFile: Premature EOF reading inode %s for vnode %d\n",
+		    PrintInode(stmp, handleP->fd_ih->ih_ino), vnode);
+		error = VOLSERDUMPERROR;
+	    }
+	    if (error != 0) {
+		break;
+	    }
 
-	/* Now write the data out */
-	if (iod_Write(iodp, (char *)p, n) != n)
-	    error = VOLSERDUMPERROR;
+	    /* Now write the data out */
+	    if (iod_Write(iodp, ios[i].buf, n) != n) {
+		error = VOLSERDUMPERROR;
+		break;
+	    }
 #ifndef AFS_PTHREAD_ENV
-	IOMGR_Poll();
+	    IOMGR_Poll();
 #endif
+	    if ((size_t)n < ios[i].length) {
+		/* Short read; carry on from where it stopped */
+		howFar = ios[i].offset + n;
+		nbytes = howBig - howFar;
+		break;
+	    }
+	}
     }
 
     free(p);
@@ -849,16 +1220,19 @@ DumpEnd(struct iod *iodp)
 
 /* Guts of the dump code */
 
-/* Dump a whole volume */
+/* Dump a whole volume, compressing it if compressLevel is nonzero */
 int
 DumpVolume(struct rx_call *call, Volume * vp,
-	   afs_int32 fromtime, int dumpAllDirs)
+	   afs_int32 fromtime, int dumpAllDirs, int compressLevel)
 {
     struct iod iod;
     int code = 0;
     struct iod *iodp = &iod;
     iod_Init(iodp, call);
 
+    if (compressLevel)
+	code = iod_ZipBegin(iodp, compressLevel);
+
     if (!code)
 	code = DumpDumpHeader(iodp, vp, fromtime);
 
@@ -869,30 +1243,34 @@ DumpVolume(struct rx_call *call, Volume * vp,
     if (rx_Error(iodp->call)) {
 	Log("1 Volser: DumpVolume: Rx call failed during dump, error %d\n",
 	    rx_Error(iodp->call));
+	iod_ZipEnd(iodp, V_id(vp), VOLSERDUMPERROR);
 	return VOLSERDUMPERROR;
     }
     if (!code)
 	code = DumpEnd(iodp);
 
-    return code;
+    return iod_ZipEnd(iodp, V_id(vp), code);
 }
 
 /* Dump a volume to multiple places*/
 int
 DumpVolMulti(struct rx_call **calls, int ncalls, Volume * vp,
-	     afs_int32 fromtime, int dumpAllDirs, int *codes)
+	     afs_int32 fromtime, int dumpAllDirs, int compressLevel,
+	     int *codes)
 {
     struct iod iod;
     int code = 0;
     iod_InitMulti(&iod, calls, ncalls, codes);
 
+    if (compressLevel)
+	code = iod_ZipBegin(&iod, compressLevel);
     if (!code)
 	code = DumpDumpHeader(&iod, vp, fromtime);
     if (!code)
 	code = DumpPartial(&iod, vp, fromtime, dumpAllDirs);
     if (!code)
 	code = DumpEnd(&iod);
-    return code;
+    return iod_ZipEnd(&iod, V_id(vp), code);
 }
 
 /* A partial dump (no dump header) */
@@ -901,18 +1279,22 @@ DumpPartial(struct iod *iodp, Volume * vp,
 	    afs_int32 fromtime, int dumpAllDirs)
 {
     int code = 0;
+    struct dumpAhead *da;
+
+    da = DumpAheadCreate(iodp, vp);
     if (!code)
 	code = DumpVolumeHeader(iodp, vp);
     if (!code)
-	code = DumpVnodeIndex(iodp, vp, vLarge, fromtime, dumpAllDirs);
+	code = DumpVnodeIndex(iodp, vp, vLarge, fromtime, dumpAllDirs, da);
     if (!code)
-	code = DumpVnodeIndex(iodp, vp, vSmall, fromtime, 0);
+	code = DumpVnodeIndex(iodp, vp, vSmall, fromtime, 0, da);
+    DumpAheadDestroy(da);
     return code;
 }
 
 static int
 DumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
-	       afs_int32 fromtime, int forcedump)
+	       afs_int32 fromtime, int forcedump, struct dumpAhead *da)
 {
     int code = 0;
     struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
@@ -923,6 +1305,13 @@ DumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
     afs_sfsize_t size, nVnodes;
     int flag;
     int vnodeIndex;
+    int used;
+
+    if (!forcedump && fromtime > 0) {
+	code = DumpChangedVnodes(iodp, vp, class, fromtime, NULL, da, &used);
+	if (used)
+	    return code;
+    }
 
     fdP = IH_OPEN(vp->vnodeIndex[class].handle);
     opr_Assert(fdP != NULL);
@@ -936,6 +1325,8 @@ DumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
 	opr_Assert(STREAM_ASEEK(file, vcp->diskSize) == 0);
     } else
 	nVnodes = 0;
+    if (da != NULL)
+	DumpAheadStart(da, class, fdP, fromtime, NULL);
     for (vnodeIndex = 0;
 	 nVnodes && STREAM_READ(vnode, vcp->diskSize, 1, file) == 1 && !code;
 	 nVnodes--, vnodeIndex++) {
@@ -943,7 +1334,11 @@ DumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
 	/* Note:  the >= test is very important since some old volumes may not have
 	 * a serverModifyTime.  For an epoch dump, this results in 0>=0 test, which
 	 * does dump the file! */
-	if (!code)
+	if (!code && da != NULL)
+	    code =
+		DumpAheadAdd(da, iodp, bitNumberToVnodeNumber(vnodeIndex, class),
+			     vnode, flag, NULL);
+	else if (!code)
 	    code =
 		DumpVnode(iodp, vnode, V_id(vp),
 			  bitNumberToVnodeNumber(vnodeIndex, class), flag);
@@ -952,11 +1347,201 @@ DumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
 	    IOMGR_Poll();	/* if we dont' xfr data, but scan instead, could lose conn */
 #endif
     }
+    if (da != NULL)
+	code = DumpAheadEnd(da, iodp, code);
     STREAM_CLOSE(file);
     FDH_CLOSE(fdP);
     return code;
 }
 
+/* Index entries read at a time to check map entries against */
+#define INDEX_CHECK_CHUNK 256
+
+struct indexCheck {
+    FdHandle_t *fdP;
+    struct VnodeClassInfo *vcp;
+    int first;			/* vnode index of the first entry in buf */
+    int count;			/* entries in buf */
+    char buf[INDEX_CHECK_CHUNK * SIZEOF_LARGEDISKVNODE];
+};
+
+/* Get a vnode from the index, in order; returns NULL on a read error */
+static struct VnodeDiskObject *
+IndexCheckGet(struct indexCheck *ic, int vnodeIndex)
+{
+    ssize_t nBytes;
+
+    if (vnodeIndex < ic->first || vnodeIndex >= ic->first + ic->count) {
+	ic->first = vnodeIndex;
+	nBytes = FDH_PREAD(ic->fdP, ic->buf,
+			   INDEX_CHECK_CHUNK * ic->vcp->diskSize,
+			   (afs_foff_t)(vnodeIndex + 1) * ic->vcp->diskSize);
+	if (nBytes < ic->vcp->diskSize) {
+	    ic->count = 0;
+	    return NULL;
+	}
+	ic->count = nBytes / ic->vcp->diskSize;
+    }
+    return (struct VnodeDiskObject *)
+	(ic->buf + (vnodeIndex - ic->first) * ic->vcp->diskSize);
+}
+
+/*
+ * Incremental dump of a vnode index using the volume's vnode map: every
+ * vnode is still listed, but only those the map says have changed since
+ * fromtime are dumped in full.  Sets *used to 0, without dumping anything,
+ * if the volume has no usable map.  Sizes the dump instead if v_size is
+ * not NULL.  With read-ahead, the changed vnodes are read by the read-ahead
+ * workers.
+ *
+ * The map is only trusted as far as it agrees with the index, so every
+ * entry the dump relies on without reading the vnode, an unchanged or
+ * unused one, is checked against the index first.  Once a vnode is found
+ * not to match the map, the map is discarded and the rest of the index is
+ * dumped as for a full scan; see DumpAheadNext.
+ */
+static int
+DumpChangedVnodes(struct iod *iodp, Volume * vp, VnodeClass class,
+		  afs_int32 fromtime, struct volintSize *v_size,
+		  struct dumpAhead *da, int *used)
+{
+    int code = 0;
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    char buf[SIZEOF_LARGEDISKVNODE];
+    struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)buf;
+    struct VnodeDiskObject stub;
+    struct VnodeDiskObject *v;
+    struct VnMap *map;
+    struct VnMapReader *reader;
+    struct VnMapEntry entry;
+    struct indexCheck *ic;
+    struct VnodeDiskObject *iv;
+    FdHandle_t *fdP;
+    afs_sfsize_t size, nVnodes;
+    VnodeId vnodeNumber;
+    int vnodeIndex;
+    int flag, changed;
+    int trusted = 1;
+
+    map = VGetVnMap(vp);
+    reader = VnMapOpenRead(map);
+    *used = (reader != NULL);
+    if (reader == NULL)
+	return 0;
+    ic = calloc(1, sizeof(*ic));
+    if (ic == NULL) {
+	VnMapCloseRead(reader);
+	*used = 0;
+	return 0;
+    }
+
+    fdP = IH_OPEN(vp->vnodeIndex[class].handle);
+    opr_Assert(fdP != NULL);
+    ic->fdP = fdP;
+    ic->vcp = vcp;
+    size = FDH_SIZE(fdP);
+    opr_Assert(size != -1);
+    nVnodes = (size / vcp->diskSize) - 1;
+    if (da != NULL)
+	DumpAheadStart(da, class, fdP, fromtime, map);
+
+    memset(&stub, 0, sizeof(stub));
+    vnodeIndex = 0;
+  again:
+    for (; vnodeIndex < nVnodes && !code; vnodeIndex++) {
+	if (da != NULL && DumpAheadMapBad(da, 0))
+	    break;
+	vnodeNumber = bitNumberToVnodeNumber(vnodeIndex, class);
+	if (!trusted || VnMapRead(reader, vnodeNumber, &entry) != 0) {
+	    entry.type = vNull;		/* unknown; go by the index */
+	    changed = 1;
+	} else {
+	    changed = (entry.type != vNull
+		       && entry.serverModifyTime >= fromtime);
+	    if (!changed) {
+		iv = IndexCheckGet(ic, vnodeIndex);
+		if (iv == NULL) {
+		    Log("1 Volser: DumpChangedVnodes: error reading vnode %u "
+			"(volume %" AFS_VOLID_FMT ")\n", vnodeNumber,
+			afs_printable_VolumeId_lu(V_id(vp)));
+		    code = VOLSERREAD_DUMPERROR;
+		    break;
+		}
+		if (!VnMapEntryMatches(&entry, iv)) {
+		    Log("1 Volser: DumpChangedVnodes: vnode map for volume %"
+			AFS_VOLID_FMT " disagrees with vnode %u; discarding "
+			"it\n", afs_printable_VolumeId_lu(V_id(vp)),
+			vnodeNumber);
+		    VnMapInvalidate(map);
+		    trusted = 0;
+		    entry.type = vNull;
+		    changed = 1;
+		} else if (entry.type == vNull) {
+		    continue;
+		}
+	    }
+	}
+
+	if (!changed) {
+	    /* Only the vnode's number and uniquifier are dumped */
+	    stub.type = entry.type;
+	    stub.uniquifier = entry.uniquifier;
+	    v = &stub;
+	    flag = 0;
+	} else if (da != NULL) {
+	    code = DumpAheadAdd(da, iodp, vnodeNumber, NULL, 0,
+				entry.type != vNull ? &entry : NULL);
+	    continue;
+	} else {
+	    if (FDH_PREAD(fdP, vnode, vcp->diskSize,
+			  vnodeIndexOffset(vcp, vnodeNumber)) != vcp->diskSize) {
+		Log("1 Volser: DumpChangedVnodes: error reading vnode %u "
+		    "(volume %" AFS_VOLID_FMT ")\n", vnodeNumber,
+		    afs_printable_VolumeId_lu(V_id(vp)));
+		code = VOLSERREAD_DUMPERROR;
+		break;
+	    }
+	    if (entry.type != vNull
+		&& (vnode->type != entry.type
+		    || vnode->uniquifier != entry.uniquifier)) {
+		/* Go by the index for the rest of this dump */
+		Log("1 Volser: DumpChangedVnodes: vnode map for volume %"
+		    AFS_VOLID_FMT " disagrees with vnode %u; discarding it\n",
+		    afs_printable_VolumeId_lu(V_id(vp)), vnodeNumber);
+		VnMapInvalidate(map);
+		trusted = 0;
+	    }
+	    v = vnode;
+	    flag = (vnode->serverModifyTime >= fromtime);
+	}
+
+	if (v_size != NULL)
+	    code = SizeDumpVnode(iodp, v, V_id(vp), vnodeNumber, flag, v_size);
+	else if (da != NULL)
+	    code = DumpAheadAdd(da, iodp, vnodeNumber, v, flag, NULL);
+	else
+	    code = DumpVnode(iodp, v, V_id(vp), vnodeNumber, flag);
+#ifndef AFS_PTHREAD_ENV
+	if (!flag)
+	    IOMGR_Poll();
+#endif
+    }
+    if (da != NULL) {
+	code = DumpAheadEnd(da, iodp, code);
+	vnodeNumber = DumpAheadMapBad(da, 1);
+	if (!code && vnodeNumber != 0) {
+	    /* What was queued after the bad vnode has been dropped */
+	    vnodeIndex = vnodeIdToBitNumber(vnodeNumber) + 1;
+	    trusted = 0;
+	    goto again;
+	}
+    }
+    FDH_CLOSE(fdP);
+    free(ic);
+    VnMapCloseRead(reader);
+    return code;
+}
+
 static int
 DumpDumpHeader(struct iod *iodp, Volume * vp,
 	       afs_int32 fromtime)
@@ -996,21 +1581,13 @@ DumpDumpHeader(struct iod *iodp, Volume * vp,
     return code;
 }
 
+/* The attributes of a vnode dumped in full, up to its contents */
 static int
-DumpVnode(struct iod *iodp, struct VnodeDiskObject *v, VolumeId volid,
-	  int vnodeNumber, int dumpEverything)
+DumpVnodeAttrs(struct iod *iodp, struct VnodeDiskObject *v, VolumeId volid,
+	       int vnodeNumber)
 {
     int code = 0;
-    IHandle_t *ihP;
-    FdHandle_t *fdP;
-    afs_ino_str_t stmp;
 
-    if (!v || v->type == vNull)
-	return code;
-    if (!code)
-	code = DumpDouble(iodp, D_VNODE, vnodeNumber, v->uniquifier);
-    if (!dumpEverything)
-	return code;
     if (!code)
 	code = DumpByte(iodp, 't', (byte) v->type);
     if (!code)
@@ -1042,6 +1619,26 @@ DumpVnode(struct iod *iodp, struct VnodeDiskObject *v, VolumeId volid,
 		DumpByteString(iodp, 'A', (byte *) VVnodeDiskACL(v),
 			       VAclDiskSize(v));
     }
+    return code;
+}
+
+static int
+DumpVnode(struct iod *iodp, struct VnodeDiskObject *v, VolumeId volid,
+	  int vnodeNumber, int dumpEverything)
+{
+    int code = 0;
+    IHandle_t *ihP;
+    FdHandle_t *fdP;
+    afs_ino_str_t stmp;
+
+    if (!v || v->type == vNull)
+	return code;
+    if (!code)
+	code = DumpDouble(iodp, D_VNODE, vnodeNumber, v->uniquifier);
+    if (!dumpEverything)
+	return code;
+    if (!code)
+	code = DumpVnodeAttrs(iodp, v, volid, vnodeNumber);
     if (VNDISK_GET_INO(v)) {
 	afs_sfsize_t indexlen, disklen;
 	IH_INIT(ihP, iodp->device, iodp->parentId, VNDISK_GET_INO(v));
@@ -1075,6 +1672,396 @@ DumpVnode(struct iod *iodp, struct VnodeDiskObject *v, VolumeId volid,
 }
 
 
+/*
+ * Dump read-ahead.
+ *
+ * A dump of a volume full of small files spends its time waiting for the
+ * disk to seek to each file, not moving data.  To overlap those reads, the
+ * thread making the dump queues the vnodes it is about to dump, in dump
+ * order, and a few worker threads, shared by all dumps, read the contents
+ * of small files (and, for incremental dumps driven by the vnode map, the
+ * vnodes themselves) into a bounded number of slots.  The dumping thread
+ * remains the only writer, and emits each vnode in turn exactly as
+ * DumpVnode would.
+ * Anything a worker could not read is left to DumpVnode, so that errors
+ * are reported as before.
+ */
+
+int DumpReadAheadThreads = DUMPAHEAD_DEFAULT_THREADS;
+
+#define DUMPAHEAD_SLOTS		32	/* vnodes queued at once */
+#define DUMPAHEAD_MAXFILE	(64 * 1024)	/* largest file read ahead */
+
+enum dumpAheadState {
+    DA_FREE,
+    DA_QUEUED,			/* waiting for a worker */
+    DA_LOADING,			/* being read by a worker */
+    DA_READY			/* ready to be dumped */
+};
+
+struct dumpAheadSlot {
+    enum dumpAheadState state;
+    VnodeId vnodeNumber;
+    int load;			/* read the vnode itself from the index */
+    int dumpEverything;
+    int error;			/* the vnode could not be read */
+    afs_uint32 mapType;		/* if not vNull, what the vnode map said */
+    afs_uint32 mapUnique;
+    int haveData;		/* data holds the file's contents */
+    afs_sfsize_t length;
+    byte *data;			/* allocated by the worker; freed once dumped */
+    char vnode[SIZEOF_LARGEDISKVNODE];
+};
+
+struct dumpAhead {
+    struct rx_queue q;		/* on dumpAheadList */
+    Device device;
+    VolumeId parentId;
+    VolumeId volumeId;
+
+    /* The vnode index being dumped; set only while no slots are in use */
+    struct VnodeClassInfo *vcp;
+    FdHandle_t *indexFdP;
+    afs_int32 fromtime;
+    struct VnMap *map;
+    VnodeId mapBad;		/* vnode that disagreed with the map, or 0 */
+
+    int head;			/* oldest slot in use */
+    int count;			/* slots in use */
+    struct dumpAheadSlot slots[DUMPAHEAD_SLOTS];
+};
+
+#ifdef AFS_PTHREAD_ENV
+/*
+ * The workers are shared by all dumps, and started with the first one.
+ * dumpAheadLock protects the list of dumps and the state of their slots.
+ */
+static opr_mutex_t dumpAheadLock;
+static opr_cv_t dumpAheadCV;	/* signalled on any slot state change */
+static struct rx_queue dumpAheadList;	/* dumps using read-ahead */
+static int dumpAheadThreads;	/* workers running */
+static pthread_once_t dumpAheadOnce = PTHREAD_ONCE_INIT;
+
+/* Called by a worker, without the lock, on a slot it has claimed */
+static void
+DumpAheadLoad(struct dumpAhead *da, struct dumpAheadSlot *slot)
+{
+    struct VnodeDiskObject *v = (struct VnodeDiskObject *)slot->vnode;
+    IHandle_t *ihP;
+    FdHandle_t *fdP;
+    afs_sfsize_t length;
+    afs_foff_t off;
+    ssize_t n;
+
+    if (slot->load) {
+	if (FDH_PREAD(da->indexFdP, v, da->vcp->diskSize,
+		      vnodeIndexOffset(da->vcp, slot->vnodeNumber))
+	    != da->vcp->diskSize) {
+	    slot->error = 1;
+	    return;
+	}
+	slot->dumpEverything = (v->serverModifyTime >= da->fromtime);
+    }
+
+    if (!slot->dumpEverything || v->type == vNull || !VNDISK_GET_INO(v))
+	return;
+    VNDISK_GET_LEN(length, v);
+    if (length > DUMPAHEAD_MAXFILE)
+	return;
+
+    IH_INIT(ihP, da->device, da->parentId, VNDISK_GET_INO(v));
+    fdP = IH_OPEN(ihP);
+    if (fdP != NULL) {
+	if (FDH_SIZE(fdP) == length
+	    && (slot->data = malloc(length + 1)) != NULL) {
+	    for (off = 0; off < length; off += n) {
+		n = FDH_PREAD(fdP, slot->data + off, length - off, off);
+		if (n <= 0)
+		    break;
+	    }
+	    if (off == length) {
+		slot->length = length;
+		slot->haveData = 1;
+	    }
+	}
+	FDH_CLOSE(fdP);
+    }
+    IH_RELEASE(ihP);
+}
+
+/* The oldest slot of a dump that is waiting for a worker, if any */
+static struct dumpAheadSlot *
+DumpAheadQueued(struct dumpAhead *da)
+{
+    struct dumpAheadSlot *slot;
+    int i;
+
+    for (i = 0; i < da->count; i++) {
+	slot = &da->slots[(da->head + i) % DUMPAHEAD_SLOTS];
+	if (slot->state == DA_QUEUED)
+	    return slot;
+    }
+    return NULL;
+}
+
+static void *
+DumpAheadWorker(void *rock)
+{
+    struct dumpAhead *da, *nda;
+    struct dumpAheadSlot *slot;
+
+    opr_mutex_enter(&dumpAheadLock);
+    for (;;) {
+	slot = NULL;
+	for (queue_Scan(&dumpAheadList, da, nda, dumpAhead)) {
+	    slot = DumpAheadQueued(da);
+	    if (slot != NULL)
+		break;
+	}
+	if (slot == NULL) {
+	    opr_cv_wait(&dumpAheadCV, &dumpAheadLock);
+	    continue;
+	}
+	slot->state = DA_LOADING;
+	/* Serve the other dumps before this one again */
+	queue_Remove(da);
+	queue_Append(&dumpAheadList, da);
+	opr_mutex_exit(&dumpAheadLock);
+
+	DumpAheadLoad(da, slot);
+
+	opr_mutex_enter(&dumpAheadLock);
+	slot->state = DA_READY;
+	opr_cv_broadcast(&dumpAheadCV);
+    }
+    AFS_UNREACHED(opr_mutex_exit(&dumpAheadLock));
+    AFS_UNREACHED(return NULL);
+}
+
+static void
+DumpAheadInit(void)
+{
+    pthread_t tid;
+    int i, nthreads;
+
+    opr_mutex_init(&dumpAheadLock);
+    opr_cv_init(&dumpAheadCV);
+    queue_Init(&dumpAheadList);
+
+    nthreads = DumpReadAheadThreads;
+    if (nthreads > DUMPAHEAD_MAX_THREADS)
+	nthreads = DUMPAHEAD_MAX_THREADS;
+    for (i = 0; i < nthreads; i++) {
+	if (pthread_create(&tid, NULL, DumpAheadWorker, NULL) != 0) {
+	    Log("1 Volser: DumpVolume: started only %d of %d dump read-ahead "
+		"threads\n", i, nthreads);
+	    break;
+	}
+	opr_Verify(pthread_detach(tid) == 0);
+	dumpAheadThreads++;
+    }
+}
+#endif /* AFS_PTHREAD_ENV */
+
+/*
+ * Set up read-ahead for a dump.  Returns NULL, and the dump is made
+ * without read-ahead, if it is disabled or no workers could be started.
+ */
+static struct dumpAhead *
+DumpAheadCreate(struct iod *iodp, Volume * vp)
+{
+#ifdef AFS_PTHREAD_ENV
+    struct dumpAhead *da;
+
+    if (DumpReadAheadThreads <= 0)
+	return NULL;
+    opr_Verify(pthread_once(&dumpAheadOnce, DumpAheadInit) == 0);
+    if (dumpAheadThreads == 0)
+	return NULL;
+
+    da = calloc(1, sizeof(*da));
+    if (da == NULL)
+	return NULL;
+    da->device = iodp->device;
+    da->parentId = iodp->parentId;
+    da->volumeId = V_id(vp);
+
+    opr_mutex_enter(&dumpAheadLock);
+    queue_Append(&dumpAheadList, da);
+    opr_mutex_exit(&dumpAheadLock);
+    return da;
+#else
+    return NULL;
+#endif
+}
+
+/* Stop reading ahead for a dump; no vnodes may be queued */
+static void
+DumpAheadDestroy(struct dumpAhead *da)
+{
+    if (da == NULL)
+	return;
+    opr_mutex_enter(&dumpAheadLock);
+    opr_Assert(da->count == 0);
+    queue_Remove(da);
+    opr_mutex_exit(&dumpAheadLock);
+    free(da);
+}
+
+/* Set up to dump a vnode index; no vnodes may be queued */
+static void
+DumpAheadStart(struct dumpAhead *da, VnodeClass class, FdHandle_t *indexFdP,
+	       afs_int32 fromtime, struct VnMap *map)
+{
+    opr_mutex_enter(&dumpAheadLock);
+    opr_Assert(da->count == 0);
+    da->vcp = &VnodeClassInfo[class];
+    da->indexFdP = indexFdP;
+    da->fromtime = fromtime;
+    da->map = map;
+    da->mapBad = 0;
+    opr_mutex_exit(&dumpAheadLock);
+}
+
+/*
+ * Dump, or just discard, the oldest queued vnode.  A vnode that does not
+ * match the vnode map is still dumped as read from the index, but stubs for
+ * the vnodes after it may already be queued from the same map.  The map is
+ * discarded, and everything queued after the vnode is dropped without being
+ * dumped; DumpChangedVnodes then goes on from the next vnode by the index.
+ */
+static int
+DumpAheadNext(struct dumpAhead *da, struct iod *iodp, int dump)
+{
+    struct dumpAheadSlot *slot = &da->slots[da->head];
+    struct VnodeDiskObject *v = (struct VnodeDiskObject *)slot->vnode;
+    int code = 0;
+
+    opr_mutex_enter(&dumpAheadLock);
+    while (slot->state != DA_READY)
+	opr_cv_wait(&dumpAheadCV, &dumpAheadLock);
+    opr_mutex_exit(&dumpAheadLock);
+
+    if (!dump || da->mapBad)
+	goto done;
+    if (slot->error) {
+	Log("1 Volser: DumpVnode: error reading vnode %u (volume %"
+	    AFS_VOLID_FMT ")\n", slot->vnodeNumber,
+	    afs_printable_VolumeId_lu(da->volumeId));
+	code = VOLSERREAD_DUMPERROR;
+	goto done;
+    }
+    if (slot->mapType != vNull
+	&& (v->type != slot->mapType || v->uniquifier != slot->mapUnique)) {
+	Log("1 Volser: DumpChangedVnodes: vnode map for volume %"
+	    AFS_VOLID_FMT " disagrees with vnode %u; discarding it\n",
+	    afs_printable_VolumeId_lu(da->volumeId), slot->vnodeNumber);
+	VnMapInvalidate(da->map);
+	da->mapBad = slot->vnodeNumber;
+    }
+    if (!slot->haveData) {
+	code = DumpVnode(iodp, v, da->volumeId, slot->vnodeNumber,
+			 slot->dumpEverything);
+	goto done;
+    }
+    code = DumpDouble(iodp, D_VNODE, slot->vnodeNumber, v->uniquifier);
+    if (!code)
+	code = DumpVnodeAttrs(iodp, v, da->volumeId, slot->vnodeNumber);
+    if (!code)
+	code = DumpFileLength(iodp, slot->length);
+    if (!code
+	&& iod_Write(iodp, (char *)slot->data, slot->length) != slot->length)
+	code = VOLSERDUMPERROR;
+
+  done:
+    free(slot->data);
+    slot->data = NULL;
+    opr_mutex_enter(&dumpAheadLock);
+    slot->state = DA_FREE;
+    da->head = (da->head + 1) % DUMPAHEAD_SLOTS;
+    da->count--;
+    opr_mutex_exit(&dumpAheadLock);
+    return code;
+}
+
+/*
+ * Queue a vnode to be dumped.  If v is NULL, the vnode is read from the
+ * index by a worker, and compared with the map entry if one is given.
+ * Otherwise v is the vnode, and only its contents may need reading.  If
+ * the queue is full, the oldest vnode is dumped first.
+ */
+static int
+DumpAheadAdd(struct dumpAhead *da, struct iod *iodp, VnodeId vnodeNumber,
+	     struct VnodeDiskObject *v, int dumpEverything,
+	     struct VnMapEntry *entry)
+{
+    struct dumpAheadSlot *slot;
+    int code = 0;
+
+    if (v != NULL && v->type == vNull)
+	return 0;
+    if (da->count == DUMPAHEAD_SLOTS) {
+	code = DumpAheadNext(da, iodp, 1);
+	if (code)
+	    return code;
+    }
+
+    slot = &da->slots[(da->head + da->count) % DUMPAHEAD_SLOTS];
+    slot->vnodeNumber = vnodeNumber;
+    slot->load = (v == NULL);
+    slot->dumpEverything = dumpEverything;
+    slot->error = 0;
+    slot->haveData = 0;
+    slot->mapType = entry != NULL ? entry->type : vNull;
+    slot->mapUnique = entry != NULL ? entry->uniquifier : 0;
+    if (v != NULL)
+	memcpy(slot->vnode, v, dumpEverything ? da->vcp->diskSize
+					      : sizeof(struct VnodeDiskObject));
+
+    opr_mutex_enter(&dumpAheadLock);
+    if (slot->load || (dumpEverything && VNDISK_GET_INO(v))) {
+	slot->state = DA_QUEUED;
+	opr_cv_broadcast(&dumpAheadCV);
+    } else {
+	slot->state = DA_READY;
+    }
+    da->count++;
+    opr_mutex_exit(&dumpAheadLock);
+    return 0;
+}
+
+/*
+ * Finish a vnode index: dump everything still queued, or if code says the
+ * dump has already failed, discard it.
+ */
+static int
+DumpAheadEnd(struct dumpAhead *da, struct iod *iodp, int code)
+{
+    int dcode;
+
+    while (da->count > 0) {
+	dcode = DumpAheadNext(da, iodp, code == 0);
+	if (!code)
+	    code = dcode;
+    }
+    return code;
+}
+
+/*
+ * The vnode found not to match the vnode map, or 0 if none has been; reset
+ * says to forget it, once whatever was queued after it has been dropped.
+ */
+static VnodeId
+DumpAheadMapBad(struct dumpAhead *da, int reset)
+{
+    VnodeId vnodeNumber = da->mapBad;
+
+    if (reset)
+	da->mapBad = 0;
+    return vnodeNumber;
+}
+
+
 int
 ProcessIndex(Volume * vp, VnodeClass class, afs_foff_t ** Bufp, int *sizep,
 	     int del)
@@ -1190,20 +2177,36 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
 	CopyVolumeStats(&V_disk(vp), &saved_header);
     }
 
+    /* A compressed dump is recognized by its first byte */
+    tag = iod_getc(iodp);
+    if (tag == D_COMPRESSED) {
+	if (iod_UnzipBegin(iodp))
+	    return VOLSERREAD_DUMPERROR;
+    } else {
+	iod_ungetc(iodp, tag);
+    }
+
     if (!ReadDumpHeader(iodp, &header)) {
 	Log("1 Volser: RestoreVolume: Error reading header file for dump; aborted\n");
-	return VOLSERREAD_DUMPERROR;
+	error = VOLSERREAD_DUMPERROR;
+	goto out;
     }
     if (iod_getc(iodp) != D_VOLUMEHEADER) {
 	Log("1 Volser: RestoreVolume: Volume header missing from dump; not restored\n");
-	return VOLSERREAD_DUMPERROR;
+	error = VOLSERREAD_DUMPERROR;
+	goto out;
     }
     if (ReadVolumeHeader(iodp, &vol) == VOLSERREAD_DUMPERROR) {
 	Log("1 Volser: RestoreVolume: Error reading volume header (id: %u); aborted\n",
 	    V_id(vp));
-	return VOLSERREAD_DUMPERROR;
+	error = VOLSERREAD_DUMPERROR;
+	goto out;
     }
 
+    /* The vnode indexes are written directly from here on, so the volume's
+     * vnode map is rebuilt at the end */
+    VnMapInvalidate(VGetVnMap(vp));
+
     if (!delo)
 	delo = ProcessIndex(vp, vLarge, &b1, &s1, 0);
     if (!delo)
@@ -1263,6 +2266,8 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
 	    goto clean;
 	}
     }
+    VnMapRebuild(VGetVnMap(vp), vp->vnodeIndex[vLarge].handle,
+		 vp->vnodeIndex[vSmall].handle);
 
   clean:
     if (DoPreserveVolumeStats) {
@@ -1305,7 +2310,7 @@ RestoreVolume(struct rx_call *call, Volume * avp, struct restoreCookie *cookie)
 	free(b1);
     if (b2)
 	free(b2);
-    return error;
+    return iod_ZipEnd(iodp, V_id(vp), error);
 }
 
 static int
@@ -1877,6 +2882,14 @@ SizeDumpVnodeIndex(struct iod *iodp, Volume * vp, VnodeClass class,
     afs_sfsize_t size, nVnodes;
     int flag;
     int vnodeIndex;
+    int used;
+
+    if (!forcedump && fromtime > 0) {
+	code = DumpChangedVnodes(iodp, vp, class, fromtime, v_size, NULL,
+				 &used);
+	if (used)
+	    return code;
+    }
 
     fdP = IH_OPEN(vp->vnodeIndex[class].handle);
     opr_Assert(fdP != NULL);
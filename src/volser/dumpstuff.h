@@ -29,11 +29,18 @@ struct iod {
     int *codes;			/* one return code for each call */
     char haveOldChar;		/* state for pushing back a character */
     char oldChar;
+    struct iodZip *zip;		/* compression state, if compressing */
 };
 
-extern int DumpVolume(struct rx_call *call, Volume *vp, afs_int32, int);
+/* Threads reading ahead for dumps; 0 disables read-ahead */
+#define DUMPAHEAD_DEFAULT_THREADS	4
+#define DUMPAHEAD_MAX_THREADS		16
+extern int DumpReadAheadThreads;
+
+extern int DumpCompressLevel(afs_int32 flags);
+extern int DumpVolume(struct rx_call *call, Volume *vp, afs_int32, int, int);
 extern int DumpVolMulti(struct rx_call **, int, Volume *, afs_int32, int,
-		        int *);
+		        int, int *);
 extern int RestoreVolume(struct rx_call *, Volume *, struct restoreCookie *);
 extern int SizeDumpVolume(struct rx_call *, Volume *, afs_int32, int,
 			  struct volintSize *);
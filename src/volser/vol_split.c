@@ -26,6 +26,7 @@
 #include <afs/ihandle.h>
 #include <afs/vnode.h>
 #include <afs/volume.h>
+#include <afs/vnmap.h>
 #include <afs/partition.h>
 #include <afs/viceinode.h>
 
@@ -716,6 +717,10 @@ split_volume(struct rx_call *call, Volume *vol, Volume *newvol,
     m->call = call;
     m->verbose = verbose;
 
+    /* Both volumes' vnode indexes are written directly */
+    VnMapInvalidate(VGetVnMap(vol));
+    VnMapInvalidate(VGetVnMap(newvol));
+
     /*
      *  First step: planning
      *
@@ -53,6 +53,7 @@
 #include "volser.h"
 #include "volint.h"
 #include "volser_internal.h"
+#include "dumpstuff.h"
 
 #define VolserVersion "2.0"
 #define N_SECURITY_OBJECTS 3
@@ -255,7 +256,11 @@ enum optionsList {
     OPT_config,
     OPT_restricted_query,
     OPT_transarc_logs,
-    OPT_s2s_crypt
+    OPT_s2s_crypt,
+    OPT_dump_readahead,
+    OPT_clone_threads,
+    OPT_io_uring,
+    OPT_reap_rate
 };
 
 static int
@@ -319,6 +324,15 @@ ParseArgs(int argc, char **argv) {
 	    CMD_SINGLE, CMD_OPTIONAL, "anyuser | admin");
     cmd_AddParmAtOffset(opts, OPT_s2s_crypt, "-s2scrypt",
 	    CMD_SINGLE, CMD_OPTIONAL, "always | inherit | never");
+    cmd_AddParmAtOffset(opts, OPT_dump_readahead, "-dump-readahead",
+	    CMD_SINGLE, CMD_OPTIONAL, "threads reading ahead for each dump");
+    cmd_AddParmAtOffset(opts, OPT_clone_threads, "-clone-threads",
+	    CMD_SINGLE, CMD_OPTIONAL, "threads cloning each volume");
+    cmd_AddParmAtOffset(opts, OPT_io_uring, "-io-uring",
+	    CMD_FLAG, CMD_OPTIONAL, "use io_uring for file I/O");
+    cmd_AddParmAtOffset(opts, OPT_reap_rate, "-reap-rate",
+	    CMD_SINGLE, CMD_OPTIONAL,
+	    "inodes per second to release in the background after deletes");
 
     code = cmd_Parse(argc, argv, &opts);
     if (code == CMD_HELP) {
@@ -397,6 +411,10 @@ ParseArgs(int argc, char **argv) {
 	    return -1;
 	}
     }
+    if (cmd_OptionPresent(opts, OPT_io_uring) && ih_UseIOUring()) {
+	printf("-io-uring is not supported on this platform\n");
+	return -1;
+    }
     if (cmd_OptionAsString(opts, OPT_config, &configDir) == 0) {
 	configDirExplicit = configDir;
     }
@@ -426,6 +444,32 @@ ParseArgs(int argc, char **argv) {
 	}
 	free(s2s_crypt_behavior);
     }
+    if (cmd_OptionAsInt(opts, OPT_dump_readahead, &DumpReadAheadThreads) == 0) {
+	if (DumpReadAheadThreads < 0
+	    || DumpReadAheadThreads > DUMPAHEAD_MAX_THREADS) {
+	    printf("invalid argument for -dump-readahead: %d (0 to %d)\n",
+		   DumpReadAheadThreads, DUMPAHEAD_MAX_THREADS);
+	    return -1;
+	}
+    }
+    if (cmd_OptionAsInt(opts, OPT_clone_threads, &vol_CloneThreads) == 0) {
+	if (vol_CloneThreads < 1 || vol_CloneThreads > CLONE_MAX_THREADS) {
+	    printf("invalid argument for -clone-threads: %d (1 to %d)\n",
+		   vol_CloneThreads, CLONE_MAX_THREADS);
+	    return -1;
+	}
+    }
+    if (cmd_OptionAsInt(opts, OPT_reap_rate, &vol_ReapRate) == 0) {
+#ifndef AFS_PTHREAD_ENV
+	printf("-reap-rate is not supported by this volserver\n");
+	return -1;
+#endif
+	if (vol_ReapRate < 0 || vol_ReapRate > 1000000) {
+	    printf("invalid argument for -reap-rate: %d (0 to 1000000)\n",
+		   vol_ReapRate);
+	    return -1;
+	}
+    }
 
     return 0;
 }
@@ -582,6 +626,12 @@ main(int argc, char **argv)
 #endif
     }
 
+#ifdef AFS_PTHREAD_ENV
+    /* Also finishes deletes left over from before a restart */
+    if (vol_ReapRate > 0)
+	VReapStart();
+#endif
+
     /* Create a single security object, in this case the null security object, for unauthenticated connections, which will be used to control security on connections made to this server */
 
     tdir = afsconf_Open(configDir);
@@ -37,6 +37,7 @@
 #include <afs/vnode.h>
 #include <afs/volume.h>
 #include <afs/volume_inline.h>
+#include <afs/vnmap.h>
 #include <afs/partition.h>
 #include "vol.h"
 #include <afs/daemon_com.h>
@@ -94,7 +95,7 @@ static afs_int32 VolGetFlags(struct rx_call *, afs_int32, afs_int32 *);
 static afs_int32 VolSetFlags(struct rx_call *, afs_int32, afs_int32 );
 static afs_int32 VolForward(struct rx_call *, afs_int32, afs_int32,
 			    struct destServer *destination, afs_int32,
-			    struct restoreCookie *cookie);
+			    afs_int32, struct restoreCookie *cookie);
 static afs_int32 VolDump(struct rx_call *, afs_int32, afs_int32, afs_int32);
 static afs_int32 VolRestore(struct rx_call *, afs_int32, struct restoreCookie *);
 static afs_int32 VolEndTrans(struct rx_call *, afs_int32, afs_int32 *);
@@ -359,6 +360,10 @@ ViceCreateRoot(Volume *vp)
     vnode->parent = 0;
     vnode->vnodeMagic = vcp->magic;
 
+    /* The volume's vnode map was built from its empty indexes; record the
+     * root in it, as VnStore would */
+    VnMapStore(VGetVnMap(vp), 1, vnode);
+
     IH_INIT(h, vp->device, V_parentId(vp),
 	    vp->vnodeIndex[vLarge].handle->ih_ino);
     fdP = IH_OPEN(h);
@@ -1219,12 +1224,46 @@ SAFSVolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     afs_int32 code;
 
     code =
-	VolForward(acid, fromTrans, fromDate, destination, destTrans, cookie);
+	VolForward(acid, fromTrans, fromDate, destination, destTrans, 0,
+		   cookie);
     osi_auditU(acid, VS_ForwardEvent, code, AUD_LONG, fromTrans, AUD_HOST,
 	       htonl(destination->destHost), AUD_LONG, destTrans, AUD_END);
     return code;
 }
 
+/* As Forward, but taking VOLDUMPV2_* flags.  The dump is only compressed if
+ * the destination says it can restore a compressed dump.
+ */
+afs_int32
+SAFSVolForwardV2(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
+		 struct destServer *destination, afs_int32 destTrans,
+		 afs_int32 flags, struct restoreCookie *cookie)
+{
+    afs_int32 code;
+
+    code =
+	VolForward(acid, fromTrans, fromDate, destination, destTrans, flags,
+		   cookie);
+    osi_auditU(acid, VS_ForwardEvent, code, AUD_LONG, fromTrans, AUD_HOST,
+	       htonl(destination->destHost), AUD_LONG, destTrans, AUD_END);
+    return code;
+}
+
+/* Ask another volserver for its capabilities; old ones have none */
+static afs_uint32
+DestCapabilities(struct rx_connection *tcon)
+{
+    volCapabilities caps;
+    afs_uint32 bits = 0;
+
+    memset(&caps, 0, sizeof(caps));
+    if (AFSVolGetCapabilities(tcon, &caps) == 0
+	&& caps.volCapabilities_len > 0)
+	bits = caps.volCapabilities_val[0];
+    xdr_free((xdrproc_t) xdr_volCapabilities, &caps);
+    return bits;
+}
+
 static_inline afs_int32
 MakeClient(struct rx_call *acid, struct rx_securityClass **securityObject,
 	   afs_int32 *securityIndex)
@@ -1257,10 +1296,11 @@ MakeClient(struct rx_call *acid, struct rx_securityClass **securityObject,
 static afs_int32
 VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
 	       struct destServer *destination, afs_int32 destTrans,
-	       struct restoreCookie *cookie)
+	       afs_int32 flags, struct restoreCookie *cookie)
 {
     struct volser_trans *tt;
     afs_int32 code;
+    int compressLevel;
     struct rx_connection *tcon;
     struct rx_call *tcall;
     struct Volume *vp;
@@ -1303,6 +1343,10 @@ VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
 	TRELE(tt);
 	return ENOTCONN;
     }
+    compressLevel = DumpCompressLevel(flags);
+    if (compressLevel
+	&& !(DestCapabilities(tcon) & VOLSER_CAPABILITY_COMPRESS))
+	compressLevel = 0;
     tcall = rx_NewCall(tcon);
     TSetRxCall(tt, tcall, "Forward");
     /* start restore going.  fromdate == 0 --> doing an incremental dump/restore */
@@ -1312,7 +1356,7 @@ VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     }
 
     /* these next calls implictly call rx_Write when writing out data */
-    code = DumpVolume(tcall, vp, fromDate, 0);	/* last field = don't dump all dirs */
+    code = DumpVolume(tcall, vp, fromDate, 0, compressLevel);	/* 0 = don't dump all dirs */
     if (code)
 	goto fail;
     EndAFSVolRestore(tcall);	/* probably doesn't do much */
@@ -1351,7 +1395,7 @@ VolForward(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
  */
 afs_int32
 SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
-		       fromDate, manyDests *destinations, afs_int32 spare,
+		       fromDate, manyDests *destinations, afs_int32 flags,
 		       struct restoreCookie *cookie, manyResults *results)
 {
     afs_int32 securityIndex;
@@ -1362,7 +1406,7 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
     struct rx_connection **tcons;
     struct rx_call **tcalls;
     struct Volume *vp;
-    int i, is_incremental;
+    int i, is_incremental, compressLevel;
 
     if (results) {
 	memset(results, 0, sizeof(manyResults));
@@ -1388,6 +1432,10 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
     /* (fromDate == 0) ==> full dump */
     is_incremental = (fromDate ? 1 : 0);
 
+    /* One stream goes to every destination, so it is only compressed if
+     * they can all restore it */
+    compressLevel = DumpCompressLevel(flags);
+
     tcons = malloc(i * sizeof(struct rx_connection *));
     if (!tcons) {
 	return ENOMEM;
@@ -1414,6 +1462,9 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
 	if (!tcons[i]) {
 	    codes[i] = ENOTCONN;
 	} else {
+	    if (compressLevel
+		&& !(DestCapabilities(tcons[i]) & VOLSER_CAPABILITY_COMPRESS))
+		compressLevel = 0;
 	    if (!(tcalls[i] = rx_NewCall(tcons[i])))
 		codes[i] = ENOTCONN;
 	    else {
@@ -1434,7 +1485,7 @@ SAFSVolForwardMultiple(struct rx_call *acid, afs_int32 fromTrans, afs_int32
     RXS_Close(securityObject);
 
     /* these next calls implictly call rx_Write when writing out data */
-    code = DumpVolMulti(tcalls, i, vp, fromDate, 0, codes);
+    code = DumpVolMulti(tcalls, i, vp, fromDate, 0, compressLevel, codes);
 
 
   fail:
@@ -1510,7 +1561,7 @@ VolDump(struct rx_call *acid, afs_int32 fromTrans, afs_int32 fromDate,
     }
     TSetRxCall(tt, acid, "Dump");
     code = DumpVolume(acid, tt->volume, fromDate, (flags & VOLDUMPV2_OMITDIRS)
-		      ? 0 : 1);	/* squirt out the volume's data, too */
+		      ? 0 : 1, DumpCompressLevel(flags));	/* squirt out the volume's data, too */
     if (code) {
         TClearRxCall(tt);
 	TRELE(tt);
@@ -3163,6 +3214,20 @@ SAFSVolSplitVolume(struct rx_call *acall, afs_uint32 ovid, afs_uint32 onew,
 #endif
 }
 
+/* Tell the caller which optional features this volserver supports */
+afs_int32
+SAFSVolGetCapabilities(struct rx_call *acid, volCapabilities *capabilities)
+{
+    capabilities->volCapabilities_val = calloc(1, sizeof(afs_uint32));
+    if (capabilities->volCapabilities_val == NULL)
+	return ENOMEM;
+    capabilities->volCapabilities_len = 1;
+
+    if (DumpCompressLevel(VOLDUMPV2_COMPRESS))
+	capabilities->volCapabilities_val[0] |= VOLSER_CAPABILITY_COMPRESS;
+    return 0;
+}
+
 /* GetPartName - map partid (a decimal number) into pname (a string)
  * Since for NT we actually want to return the drive name, we map through the
  * partition struct.
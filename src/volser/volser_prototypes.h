@@ -28,6 +28,7 @@ extern int UV_DeleteVolume(afs_uint32 aserver, afs_int32 apart,
 
 extern int UV_SetSecurity(struct rx_securityClass *as,
                           afs_int32 aindex);
+extern void UV_SetCompression(int compress, int level);
 
 extern int UV_ListOneVolume(afs_uint32 aserver, afs_int32 apart,
 			    afs_uint32 volid, struct volintInfo **resultPtr);
@@ -2182,6 +2182,29 @@ DeleteVolume(struct cmd_syndesc *as, void *arock)
     return 0;
 }
 
+/* Handle the -deflate option of the commands that send dumps around */
+static int
+SetCompression(struct cmd_syndesc *as, int parm)
+{
+    afs_int32 level = 0;
+    char *str;
+
+    if (!cmd_OptionPresent(as, parm)) {
+	UV_SetCompression(0, 0);
+	return 0;
+    }
+    str = as->parms[parm].items->data;
+    if (str != NULL
+	&& (util_GetInt32(str, &level) || level < 0 || level > 9)) {
+	fprintf(STDERR,
+		"vos: invalid compression level '%s'; it must be a number "
+		"from 0 to 9\n", str);
+	return EINVAL;
+    }
+    UV_SetCompression(1, level);
+    return 0;
+}
+
 #define TESTM	0		/* set for move space tests, clear for production */
 static int
 MoveVolume(struct cmd_syndesc *as, void *arock)
@@ -2196,6 +2219,10 @@ MoveVolume(struct cmd_syndesc *as, void *arock)
     struct diskPartition64 partition;	/* for space check */
     volintInfo *p;
 
+    code = SetCompression(as, 6);
+    if (code)
+	return code;
+
     volid = vsu_GetVolumeID(as->parms[0].items->data, cstruct, &err);
     if (volid == 0) {
 	if (err)
@@ -2323,6 +2350,10 @@ CopyVolume(struct cmd_syndesc *as, void *arock)
     struct diskPartition64 partition;	/* for space check */
     volintInfo *p;
 
+    code = SetCompression(as, 9);
+    if (code)
+	return code;
+
     volid = vsu_GetVolumeID(as->parms[0].items->data, cstruct, &err);
     if (volid == 0) {
 	if (err)
@@ -2470,6 +2501,10 @@ ShadowVolume(struct cmd_syndesc *as, void *arock)
     struct diskPartition64 partition;	/* for space check */
     volintInfo *p, *q;
 
+    code = SetCompression(as, 11);
+    if (code)
+	return code;
+
     p = (volintInfo *) 0;
     q = (volintInfo *) 0;
 
@@ -2843,6 +2878,10 @@ ReleaseVolume(struct cmd_syndesc *as, void *arock)
     afs_int32 apart, vtype, code, err;
     int flags = 0;
 
+    code = SetCompression(as, 4);
+    if (code)
+	return code;
+
     if (as->parms[1].items) /* -force */
 	flags |= (REL_COMPLETE | REL_FULLDUMPS);
     if (as->parms[2].items) { /* -stayonline */
@@ -2897,6 +2936,10 @@ DumpVolumeCmd(struct cmd_syndesc *as, void *arock)
     char filename[MAXPATHLEN];
     struct nvldbentry entry;
 
+    code = SetCompression(as, 7);
+    if (code)
+	return code;
+
     rx_SetRxDeadTime(60 * 10);
     for (i = 0; i < MAXSERVERS; i++) {
 	struct rx_connection *rxConn = ubik_GetRPCConn(cstruct, i);
@@ -5985,6 +6028,8 @@ main(int argc, char **argv)
 		"partition name on destination");
     cmd_AddParm(ts, "-live", CMD_FLAG, CMD_OPTIONAL,
 		"copy live volume without cloning");
+    cmd_AddParm(ts, "-deflate", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compression level");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("copy", CopyVolume, NULL, 0, "copy a volume");
@@ -6003,6 +6048,8 @@ main(int argc, char **argv)
 		"make new volume read-only");
     cmd_AddParm(ts, "-live", CMD_FLAG, CMD_OPTIONAL,
 		"copy live volume without cloning");
+    cmd_AddParm(ts, "-deflate", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compression level");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("shadow", ShadowVolume, NULL, 0,
@@ -6027,6 +6074,8 @@ main(int argc, char **argv)
 		"copy live volume without cloning");
     cmd_AddParm(ts, "-incremental", CMD_FLAG, CMD_OPTIONAL,
 		"do incremental update if target exists");
+    cmd_AddParm(ts, "-deflate", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compression level");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("backup", BackupVolume, NULL, 0,
@@ -6061,6 +6110,8 @@ main(int argc, char **argv)
 		"release to cloned temp vol, then clone back to repsite RO");
     cmd_AddParm(ts, "-force-reclone", CMD_FLAG, CMD_OPTIONAL,
 		"force a reclone and complete release with incremental dumps");
+    cmd_AddParm(ts, "-deflate", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compression level");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("dump", DumpVolumeCmd, NULL, 0, "dump a volume");
@@ -6073,6 +6124,8 @@ main(int argc, char **argv)
 		"dump a clone of the volume");
     cmd_AddParm(ts, "-omitdirs", CMD_FLAG, CMD_OPTIONAL,
 		"omit unchanged directories from an incremental dump");
+    cmd_AddParm(ts, "-deflate", CMD_SINGLE_OR_FLAG, CMD_OPTIONAL,
+		"compression level");
     COMMONPARMS;
 
     ts = cmd_CreateSyntax("restore", RestoreVolumeCmd, NULL, 0,
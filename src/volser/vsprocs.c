@@ -425,6 +425,37 @@ UV_SetSecurity(struct rx_securityClass *as, afs_int32 aindex)
     return 0;
 }
 
+static afs_int32 uvDumpFlags = 0;
+/* called by vos to ask the volservers to compress the dumps they send */
+void
+UV_SetCompression(int compress, int level)
+{
+    if (compress)
+	uvDumpFlags = VOLDUMPV2_COMPRESS
+	    | ((level << VOLDUMPV2_LEVELSHIFT) & VOLDUMPV2_LEVELMASK);
+    else
+	uvDumpFlags = 0;
+}
+
+/* Forward a dump, compressed if that has been asked for.  Volservers too old
+ * to know about ForwardV2 send it uncompressed. */
+static afs_int32
+ForwardVolume(struct rx_connection *fromconn, afs_int32 fromtid,
+	      afs_int32 fromdate, struct destServer *destination,
+	      afs_int32 totid, struct restoreCookie *cookie)
+{
+    afs_int32 code;
+
+    if (uvDumpFlags) {
+	code = AFSVolForwardV2(fromconn, fromtid, fromdate, destination,
+			       totid, uvDumpFlags, cookie);
+	if (code != RXGEN_OPCODE)
+	    return code;
+    }
+    return AFSVolForward(fromconn, fromtid, fromdate, destination, totid,
+			 cookie);
+}
+
 /* bind to volser on <port> <aserver> */
 /* takes server address in network order, port in host order.  dumb */
 struct rx_connection *
@@ -1691,7 +1722,7 @@ UV_MoveVolume2(afs_uint32 afromvol, afs_uint32 afromserver, afs_int32 afrompart,
 	VPRINT2("Dumping from clone %u on source to volume %u on destination ...",
 		newVol, afromvol);
 	code =
-	    AFSVolForward(fromconn, clonetid, 0, &destination, totid,
+	    ForwardVolume(fromconn, clonetid, 0, &destination, totid,
 			  &cookie);
 	EGOTO1(mfail, code, "Failed to move data for the volume %u\n", volid);
 	VDONE;
@@ -1726,7 +1757,7 @@ UV_MoveVolume2(afs_uint32 afromvol, afs_uint32 afromserver, afs_int32 afrompart,
 	 (flags & RV_NOCLONE) ? "" : " incremental",
 	 afromvol);
     code =
-	AFSVolForward(fromconn, fromtid, fromDate, &destination, totid,
+	ForwardVolume(fromconn, fromtid, fromDate, &destination, totid,
 		      &cookie);
     EGOTO1(mfail, code,
 	   "Failed to do the%s dump from rw volume on old site to rw volume on newsite\n",
@@ -2384,7 +2415,7 @@ cpincr:
 	VPRINT2("Dumping from clone %u on source to volume %u on destination ...",
 	    cloneVol, newVol);
 	code =
-	    AFSVolForward(fromconn, clonetid, cloneFromDate, &destination,
+	    ForwardVolume(fromconn, clonetid, cloneFromDate, &destination,
 			  totid, &cookie);
 	EGOTO1(mfail, code, "Failed to move data for the volume %u\n",
 	       newVol);
@@ -2420,7 +2451,7 @@ cpincr:
 	 (flags & RV_NOCLONE) ? "" : " incremental",
 	 afromvol);
     code =
-	AFSVolForward(fromconn, fromtid, fromDate, &destination, totid,
+	ForwardVolume(fromconn, fromtid, fromDate, &destination, totid,
 		      &cookie);
     EGOTO1(mfail, code,
 	   "Failed to do the%s dump from old site to new site\n",
@@ -3133,7 +3164,7 @@ SimulateForwardMultiple(struct rx_connection *fromconn, afs_int32 fromtid,
 
     for (i = 0; i < tr->manyDests_len; i++) {
 	results->manyResults_val[i] =
-	    AFSVolForward(fromconn, fromtid, fromdate,
+	    ForwardVolume(fromconn, fromtid, fromdate,
 			  &(tr->manyDests_val[i].server),
 			  tr->manyDests_val[i].trans, cookie);
     }
@@ -3921,7 +3952,7 @@ UV_ReleaseVolume(afs_uint32 afromvol, afs_uint32 afromserver,
 	tr.manyDests_len = results.manyResults_len = volcount;
 	code =
 	    AFSVolForwardMultiple(fromconn, fromtid, fromdate, &tr,
-				  0 /*spare */ , &cookie, &results);
+				  uvDumpFlags, &cookie, &results);
 	if (code == RXGEN_OPCODE) {	/* RPC Interface Mismatch */
 	    code =
 		SimulateForwardMultiple(fromconn, fromtid, fromdate, &tr,
@@ -4180,7 +4211,8 @@ UV_DumpVolume(afs_uint32 afromvol, afs_uint32 afromserver, afs_int32 afrompart,
     fromcall = rx_NewCall(fromconn);
 
     VEPRINT1("Starting volume dump on volume %u...", afromvol);
-    if (flags & VOLDUMPV2_OMITDIRS)
+    flags |= uvDumpFlags;
+    if (flags & (VOLDUMPV2_OMITDIRS | VOLDUMPV2_COMPRESS))
 	code = StartAFSVolDumpV2(fromcall, fromtid, fromdate, flags);
     else
 	code = StartAFSVolDump(fromcall, fromtid, fromdate);
@@ -4330,7 +4362,8 @@ UV_DumpClonedVolume(afs_uint32 afromvol, afs_uint32 afromserver,
     fromcall = rx_NewCall(fromconn);
 
     VEPRINT1("Starting volume dump from cloned volume %u...", clonevol);
-    if (flags & VOLDUMPV2_OMITDIRS)
+    flags |= uvDumpFlags;
+    if (flags & (VOLDUMPV2_OMITDIRS | VOLDUMPV2_COMPRESS))
 	code = StartAFSVolDumpV2(fromcall, clonetid, fromdate, flags);
     else
 	code = StartAFSVolDump(fromcall, clonetid, fromdate);
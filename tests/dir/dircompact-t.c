@@ -0,0 +1,94 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Tests for directory compaction: remove most of a directory's entries,
+ * compact it into another, and check that the copy is dense, passes the
+ * salvager's checks, and holds exactly the remaining entries.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <tests/tap/basic.h>
+
+#include "dirtest.h"
+
+#define NENTRIES 15000
+#define NAMEFORMAT "compact-%d-somewhat-longer-name"
+
+/* The directory salvager logs through the volume salvager's Log() */
+void
+Log(const char *format, ...)
+{
+    va_list ap;
+    char buf[256];
+
+    va_start(ap, format);
+    vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    diag("%s", buf);
+}
+
+int
+main(void)
+{
+    struct memdir mem, mem2;
+    DirHandle dir, dir2;
+    afs_int32 fid[3];
+    char name[64];
+    int i, code, pages, newpages, freeblobs, bad;
+
+    plan(6);
+
+    DInit(64);
+
+    dirtest_makedir(&dir, 200, &mem, NENTRIES, NAMEFORMAT);
+
+    for (bad = 0, i = 0; i < NENTRIES; i++) {
+	snprintf(name, sizeof(name), NAMEFORMAT, i);
+	if (i % 4 != 0 && afs_dir_Delete(&dir, name) != 0)
+	    bad++;
+    }
+    is_int(0, bad, "removed three entries in four");
+    DFlush();
+    afs_dir_Usage(&dir, &pages, &freeblobs);
+
+    memset(&mem2, 0, sizeof(mem2));
+    memset(&dir2, 0, sizeof(dir2));
+    dir2.vid = dir.vid;
+    dir2.ino = dir.ino + 1;
+    dir2.mem = &mem2;
+    code = afs_dir_Compact(&dir, &dir2);
+    is_int(0, code, "compacted directory");
+    DFlush();
+    newpages = afs_dir_Length(&dir2) / PAGESIZE;
+    diag("%d pages, %d free blobs in the first %d, to %d pages",
+	 pages, freeblobs, pages < MAXPAGES ? pages : MAXPAGES, newpages);
+    ok(newpages <= pages / 3 + 1, "compacted directory is dense");
+    ok(DirOK(&dir2) == 1, "compacted directory passes DirOK");
+
+    for (bad = 0, i = 0; i < NENTRIES; i++) {
+	snprintf(name, sizeof(name), NAMEFORMAT, i);
+	code = afs_dir_Lookup(&dir2, name, fid);
+	if (i % 4 != 0 ? code != ENOENT
+		       : (code != 0 || fid[1] != 2 * i + 2 || fid[2] != i + 7))
+	    bad++;
+    }
+    if (afs_dir_Lookup(&dir2, "..", fid) != 0 || fid[1] != 1)
+	bad++;
+    is_int(0, bad, "compacted directory holds the remaining entries");
+
+    DZap(&dir2);
+    free(mem2.data);
+    free(mem.data);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Tests for the directory name index.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <tests/tap/basic.h>
+
+#include "dirtest.h"
+
+#define NENTRIES 5000
+
+/* Check every name found by walking the hash chains with lookups that may
+ * be answered by the index. */
+static int
+CheckEntry(void *hook, char *name, afs_int32 vnode, afs_int32 unique)
+{
+    DirHandle *dir = hook;
+    afs_int32 fid[3];
+
+    if (afs_dir_Lookup(dir, name, fid) != 0 || fid[1] != vnode
+	|| fid[2] != unique) {
+	diag("lookup of %s disagrees with the hash chains", name);
+	dir->pad++;
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    struct memdir mem1, mem2;
+    DirHandle dir1, dir2;
+    afs_int32 fid[3], newfid[2];
+    char name[32];
+    int i, code, bad;
+    int dirs, entries, hits, misses, builds, evicts, stale;
+
+    plan(21);
+
+    DInit(64);
+    DInitIndex(NENTRIES + NENTRIES / 2, 4);
+
+    dirtest_makedir(&dir1, 100, &mem1, NENTRIES, "file%d");
+
+    code = afs_dir_Lookup(&dir1, "file1234", fid);
+    ok(code == 0 && fid[1] == 2470 && fid[2] == 1241, "indexed lookup");
+    DIndexStat(&dirs, &entries, &hits, &misses, &builds, &evicts, &stale);
+    is_int(1, builds, "index built once the directory grew");
+    is_int(NENTRIES + 2, entries, "index holds every entry");
+
+    is_int(ENOENT, afs_dir_Lookup(&dir1, "nosuchfile", fid),
+	   "lookup of missing name");
+    fid[1] = fid[2] = 1;
+    is_int(EEXIST, afs_dir_Create(&dir1, "file17", fid),
+	   "create of existing name");
+
+    for (bad = 0, i = 0; i < NENTRIES; i += 3) {
+	snprintf(name, sizeof(name), "file%d", i);
+	if (afs_dir_Delete(&dir1, name) != 0)
+	    bad++;
+    }
+    is_int(0, bad, "deleted every third entry");
+
+    for (bad = 0, i = 0; i < NENTRIES; i++) {
+	snprintf(name, sizeof(name), "file%d", i);
+	code = afs_dir_Lookup(&dir1, name, fid);
+	if (i % 3 == 0 ? code != ENOENT
+		       : (code != 0 || fid[1] != 2 * i + 2)) {
+	    bad++;
+	}
+    }
+    is_int(0, bad, "lookups after deletes");
+
+    for (bad = 0, i = 0; i < NENTRIES; i += 3) {
+	snprintf(name, sizeof(name), "new%d", i);
+	fid[1] = 3 * i + 3;
+	fid[2] = 1;
+	if (afs_dir_Create(&dir1, name, fid) != 0)
+	    bad++;
+    }
+    is_int(0, bad, "reused freed blobs");
+
+    fid[1] = 2 * 5 + 2;
+    fid[2] = 5 + 7;
+    newfid[0] = 99999;
+    newfid[1] = 42;
+    afs_dir_ChangeFid(&dir1, "file5", (afs_uint32 *)&fid[1],
+		      (afs_uint32 *)newfid);
+    code = afs_dir_Lookup(&dir1, "file5", fid);
+    ok(code == 0 && fid[1] == 99999 && fid[2] == 42, "lookup after ChangeFid");
+
+    dir1.pad = 0;
+    afs_dir_EnumerateDir(&dir1, CheckEntry, &dir1);
+    is_int(0, dir1.pad, "index agrees with the hash chains");
+    DIndexStat(&dirs, &entries, &hits, &misses, &builds, &evicts, &stale);
+    is_int(0, stale, "no stale index hits");
+
+    /* A second big directory does not fit alongside the first. */
+    dirtest_makedir(&dir2, 200, &mem2, NENTRIES, "file%d");
+    ok(afs_dir_Lookup(&dir2, "file1", fid) == 0, "lookup in second directory");
+    DIndexStat(&dirs, &entries, &hits, &misses, &builds, &evicts, &stale);
+    ok(dirs == 1 && evicts == 1, "first index evicted");
+
+    /* Discarding the directory's buffers drops its index too. */
+    DFlush();
+    DZap(&dir2);
+    DIndexStat(&dirs, &entries, &hits, &misses, &builds, &evicts, &stale);
+    is_int(0, dirs, "DZap drops the index");
+
+    code = afs_dir_Lookup(&dir2, "file3", fid);
+    ok(code == 0 && fid[1] == 8, "lookup after DZap");
+    DIndexStat(&dirs, &entries, &hits, &misses, &builds, &evicts, &stale);
+    ok(dirs == 1 && builds == 3, "index rebuilt");
+
+    /* A name the index has lost is still found on its hash chain. */
+    DIndexRemove(&dir2, "file3", 0);
+    code = afs_dir_Lookup(&dir2, "file3", fid);
+    ok(code == 0 && fid[1] == 8, "lookup of a name the index lacks");
+    DIndexStat(&dirs, &entries, &hits, &misses, &builds, &evicts, &stale);
+    ok(dirs == 0 && stale == 1, "index lacking a name is dropped");
+
+    DFlushVolume(dir2.vid);
+    DIndexStat(&dirs, &entries, &hits, &misses, &builds, &evicts, &stale);
+    is_int(0, dirs, "DFlushVolume drops the index");
+
+    free(mem1.data);
+    free(mem2.data);
+    return 0;
+}
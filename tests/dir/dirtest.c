@@ -0,0 +1,120 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Common code for the directory tests.  Directories are held in memory;
+ * the buffer package callbacks below stand in for the fileserver's
+ * physio.c.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <tests/tap/basic.h>
+
+#include "dirtest.h"
+
+int
+ReallyRead(DirHandle *dir, int block, char *data, int *physerr)
+{
+    if (physerr != NULL)
+	*physerr = 0;
+    if (block >= dir->mem->npages)
+	return EIO;
+    memcpy(data, dir->mem->data + block * PAGESIZE, PAGESIZE);
+    return 0;
+}
+
+int
+ReallyWrite(DirHandle *dir, int block, char *data)
+{
+    struct memdir *mem = dir->mem;
+
+    if (block >= mem->npages) {
+	mem->data = realloc(mem->data, (block + 1) * PAGESIZE);
+	memset(mem->data + mem->npages * PAGESIZE, 0,
+	       (block + 1 - mem->npages) * PAGESIZE);
+	mem->npages = block + 1;
+    }
+    memcpy(mem->data + block * PAGESIZE, data, PAGESIZE);
+    return 0;
+}
+
+void
+FidZap(DirHandle *dir)
+{
+    memset(dir, 0, sizeof(*dir));
+}
+
+void
+FidZero(DirHandle *dir)
+{
+    memset(dir, 0, sizeof(*dir));
+}
+
+int
+FidEq(DirHandle *a, DirHandle *b)
+{
+    return a->vid == b->vid && a->dev == b->dev && a->ino == b->ino;
+}
+
+int
+FidVolEq(DirHandle *a, afs_int32 vid)
+{
+    return a->vid == vid;
+}
+
+void
+FidCpy(DirHandle *to, DirHandle *from)
+{
+    *to = *from;
+}
+
+void
+Die(const char *msg)
+{
+    bail("%s", msg);
+}
+
+/**
+ * Make a directory in memory and fill it with entries.  Entry i is named
+ * by printing i with format, and has vnode 2i+2 and uniquifier i+7.
+ *
+ * @param[out] dir     handle for the new directory
+ * @param[in]  ino     inode number to give it, to tell directories apart
+ * @param[out] mem     where its pages are kept
+ * @param[in]  n       number of entries
+ * @param[in]  format  printf format for entry names, taking one int
+ */
+void
+dirtest_makedir(DirHandle *dir, int ino, struct memdir *mem, int n,
+		const char *format)
+{
+    afs_int32 me[3] = { 0, 1, 1 };
+    afs_int32 fid[3];
+    char name[64];
+    int i, code = 0;
+
+    memset(mem, 0, sizeof(*mem));
+    memset(dir, 0, sizeof(*dir));
+    dir->vid = 536870912;
+    dir->ino = ino;
+    dir->mem = mem;
+
+    code = afs_dir_MakeDir(dir, me, me);
+    for (i = 0; i < n && code == 0; i++) {
+	snprintf(name, sizeof(name), format, i);
+	fid[1] = 2 * i + 2;
+	fid[2] = i + 7;
+	code = afs_dir_Create(dir, name, fid);
+    }
+    is_int(0, code, "created directory with %d entries", n);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+#ifndef OPENAFS_DIRTEST_H
+#define OPENAFS_DIRTEST_H
+
+#include <afs/dir.h>
+
+#define PAGESIZE 2048
+
+/* A directory held in memory, one page after another */
+struct memdir {
+    char *data;
+    int npages;
+};
+
+/* The first ints must be volume, device and inode; see dir/buffer.c. */
+typedef struct DirHandle {
+    afs_int32 vid;
+    afs_int32 dev;
+    afs_int32 ino;
+    afs_int32 pad;
+    struct memdir *mem;
+} DirHandle;
+
+void dirtest_makedir(DirHandle *dir, int ino, struct memdir *mem, int n,
+		     const char *format);
+
+#endif /* OPENAFS_DIRTEST_H */
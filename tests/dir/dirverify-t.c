@@ -0,0 +1,228 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Tests for batched name hashing and for the directory checks made by the
+ * salvager, comparing them with the scalar code.  Directories are held in
+ * memory; the buffer package callbacks in dirtest.c stand in for physio.c.
+ *
+ * The timings reported with diag() are for information only.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <tests/tap/basic.h>
+
+#include "dirtest.h"
+
+#define NENTRIES 15000
+#define NNAMES 50000
+#define ROUNDS 20
+
+/* The directory salvager logs through the volume salvager's Log(); keep
+ * the first message of each check. */
+static char logbuf[256];
+
+void
+Log(const char *format, ...)
+{
+    va_list ap;
+
+    if (logbuf[0] != '\0')
+	return;
+    va_start(ap, format);
+    vsnprintf(logbuf, sizeof(logbuf), format, ap);
+    va_end(ap);
+}
+
+static double
+Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Return the blob number of the first entry on a hash chain. */
+static int
+ChainHead(struct memdir *mem, int chain)
+{
+    struct DirHeader *dhp = (struct DirHeader *)mem->data;
+
+    return ntohs(dhp->hashTable[chain]);
+}
+
+static struct DirEntry *
+Blob(struct memdir *mem, int blob)
+{
+    return (struct DirEntry *)(mem->data + 32 * blob);
+}
+
+/* Run both directory checks after a corruption, make sure that both find
+ * it for the expected reason, then undo it. */
+static void
+CheckCorrupt(DirHandle *dir, char *saved, const char *what,
+	     const char *expect)
+{
+    struct memdir *mem = dir->mem;
+    int code1, code2, found1, found2;
+
+    DZap(dir);
+    logbuf[0] = '\0';
+    code1 = DirOK(dir);
+    found1 = (strstr(logbuf, expect) != NULL);
+    if (!found1)
+	diag("DirOK: %s", logbuf);
+    logbuf[0] = '\0';
+    code2 = DirOKByBlob(dir);
+    found2 = (strstr(logbuf, expect) != NULL);
+    if (!found2)
+	diag("DirOKByBlob: %s", logbuf);
+    ok(code1 == 0 && code2 == 0 && found1 && found2, "%s is caught", what);
+
+    memcpy(mem->data, saved, mem->npages * PAGESIZE);
+    DZap(dir);
+}
+
+static void
+TestHash(void)
+{
+    char **names;
+    int *lens, *hashes;
+    int i, j, len, bad;
+    double t0, t1, t2;
+
+    names = malloc(NNAMES * sizeof(*names));
+    lens = malloc(NNAMES * sizeof(*lens));
+    hashes = malloc(NNAMES * sizeof(*hashes));
+    for (i = 0; i < NNAMES; i++) {
+	len = i % 97;
+	names[i] = malloc(len + 1);
+	for (j = 0; j < len; j++)
+	    names[i][j] = 1 + (i * 31 + j * 7) % 255;
+	names[i][len] = '\0';
+	lens[i] = len;
+    }
+
+    afs_dir_DirHashBatch(names, NULL, NNAMES, hashes);
+    for (bad = 0, i = 0; i < NNAMES; i++) {
+	if (hashes[i] != afs_dir_DirHash(names[i]))
+	    bad++;
+    }
+    is_int(0, bad, "batch hash matches afs_dir_DirHash");
+
+    memset(hashes, 0, NNAMES * sizeof(*hashes));
+    afs_dir_DirHashBatch(names, lens, NNAMES, hashes);
+    for (bad = 0, i = 0; i < NNAMES; i++) {
+	if (hashes[i] != afs_dir_DirHash(names[i]))
+	    bad++;
+    }
+    is_int(0, bad, "batch hash with lengths matches afs_dir_DirHash");
+
+    t0 = Now();
+    for (j = 0; j < ROUNDS; j++) {
+	for (i = 0; i < NNAMES; i++)
+	    hashes[i] = afs_dir_DirHash(names[i]);
+    }
+    t1 = Now();
+    for (j = 0; j < ROUNDS; j++)
+	afs_dir_DirHashBatch(names, lens, NNAMES, hashes);
+    t2 = Now();
+    diag("hash: scalar %.1f ns/name, batch %.1f ns/name",
+	 (t1 - t0) * 1e9 / (ROUNDS * NNAMES),
+	 (t2 - t1) * 1e9 / (ROUNDS * NNAMES));
+
+    for (i = 0; i < NNAMES; i++)
+	free(names[i]);
+    free(names);
+    free(lens);
+    free(hashes);
+}
+
+int
+main(void)
+{
+    struct memdir mem;
+    DirHandle dir;
+    struct DirEntry *ep;
+    struct PageHeader *pp;
+    struct DirHeader *dhp;
+    char *saved;
+    int i, blob, okay;
+    double t0, t1, t2;
+
+    plan(11);
+
+    DInit(64);
+    DInitIndex(NENTRIES + NENTRIES / 2, 4);
+
+    TestHash();
+
+    dirtest_makedir(&dir, 200, &mem, NENTRIES,
+		    "verify-%d-somewhat-longer-name");
+    DFlush();
+    DZap(&dir);
+    ok(DirOK(&dir) == 1, "DirOK accepts a good directory");
+    ok(DirOKByBlob(&dir) == 1, "DirOKByBlob accepts a good directory");
+
+    t0 = Now();
+    for (okay = 1, i = 0; i < ROUNDS; i++)
+	okay &= DirOKByBlob(&dir);
+    t1 = Now();
+    for (i = 0; i < ROUNDS; i++)
+	okay &= DirOK(&dir);
+    t2 = Now();
+    diag("check %d pages: by blob %.2f ms, in memory %.2f ms", mem.npages,
+	 (t1 - t0) * 1000 / ROUNDS, (t2 - t1) * 1000 / ROUNDS);
+
+    saved = malloc(mem.npages * PAGESIZE);
+    memcpy(saved, mem.data, mem.npages * PAGESIZE);
+
+    /* A name changed so that it hashes to another chain. */
+    ep = Blob(&mem, ChainHead(&mem, 5));
+    ep->name[0] ^= 0x01;
+    CheckCorrupt(&dir, saved, "an entry in the wrong hash chain",
+		 "should be in hash bucket");
+
+    /* Each page after the first holds 31 two-blob entries after its header,
+     * so its last blob is free.  Put a name there that runs off the end of
+     * the page, at the head of a chain. */
+    blob = 3 * EPP - 1;
+    ep = Blob(&mem, blob);
+    ok(ep->flag == 0, "last blob of page 2 is free");
+    ep->flag = FFIRST;
+    ep->next = htons(ChainHead(&mem, 7));
+    memset(ep->name, 'x', PAGESIZE - ((char *)ep->name - mem.data) % PAGESIZE);
+    dhp = (struct DirHeader *)mem.data;
+    dhp->hashTable[7] = htons(blob);
+    CheckCorrupt(&dir, saved, "an unterminated name", "too-long name");
+
+    /* A freebitmap bit, and the alloMap to match, for a free blob. */
+    pp = (struct PageHeader *)(mem.data + 3 * PAGESIZE);
+    pp->freebitmap[EPP / 8 - 1] |= (char)0x80;
+    dhp->alloMap[3]--;
+    CheckCorrupt(&dir, saved, "a freebitmap mismatch", "freebitmap error");
+
+    /* A hash chain that loops. */
+    ep = Blob(&mem, ChainHead(&mem, 9));
+    while (ep->next != 0)
+	ep = Blob(&mem, ntohs(ep->next));
+    ep->next = htons(ChainHead(&mem, 9));
+    CheckCorrupt(&dir, saved, "a circular hash chain", "is circular");
+
+    ok(okay && DirOK(&dir) == 1, "directory is good again");
+
+    free(saved);
+    free(mem.data);
+    return 0;
+}
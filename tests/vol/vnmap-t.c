@@ -0,0 +1,323 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * Tests for vnode maps: a map built, read back, updated and closed keeps
+ * its on-disk format, and one left unclean or too long to name is never
+ * used.  The maps are made in a scratch directory standing in for a
+ * partition; no vnode indexes are involved.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#include "rx/rx_queue.h"
+#include <afs/afsint.h>
+#include "nfs.h"
+#include "lock.h"
+#include "ihandle.h"
+#include "voldefs.h"
+#include "vnode.h"
+#include "vnmap.h"
+
+#include "common.h"
+
+#define VOLID		536870915
+#define NVNODES		10000	/* vnode numbers span more than one chunk */
+
+/* On-disk layout; see vnmap.c */
+#define HDR_MAGIC	0x766e6d70
+#define HDR_VERSION	1
+#define HDR_CLEAN	0x1
+#define HDR_SIZE	16
+#define ENTRY_SIZE	12
+
+/* vnmap.o calls these only with real vnode indexes, which these tests do
+ * not give it */
+struct VnodeClassInfo VnodeClassInfo[nVNODECLASSES];
+
+void
+Log(const char *format, ...)
+{
+}
+
+FdHandle_t *
+ih_open(IHandle_t *ihP)
+{
+    return NULL;
+}
+
+int
+fd_close(FdHandle_t *fdP)
+{
+    return 0;
+}
+
+afs_sfsize_t
+ih_size(FD_t fd)
+{
+    return -1;
+}
+
+StreamHandle_t *
+stream_fdopen(FD_t fd)
+{
+    return NULL;
+}
+
+int
+stream_aseek(StreamHandle_t *streamP, afs_foff_t offset)
+{
+    return -1;
+}
+
+afs_sfsize_t
+stream_read(void *ptr, afs_fsize_t size, afs_fsize_t nitems,
+	    StreamHandle_t *streamP)
+{
+    return 0;
+}
+
+int
+stream_close(StreamHandle_t *streamP, int reallyClose)
+{
+    return 0;
+}
+
+/* What each vnode number was given; vNull if nothing */
+static struct VnMapEntry expect[NVNODES + 1];
+
+static void
+MakeVnode(VnodeDiskObject *vnode, VnodeId vnodeNumber, afs_uint32 mtime)
+{
+    memset(vnode, 0, sizeof(*vnode));
+    vnode->type = (vnodeNumber & 1) ? vDirectory : vFile;
+    vnode->uniquifier = vnodeNumber * 7 + 1;
+    vnode->serverModifyTime = mtime;
+
+    expect[vnodeNumber].type = vnode->type;
+    expect[vnodeNumber].uniquifier = vnode->uniquifier;
+    expect[vnodeNumber].serverModifyTime = mtime;
+}
+
+/* Every vnode number reads back as expected, including past the end */
+static int
+CheckEntries(struct VnMap *map)
+{
+    struct VnMapReader *reader;
+    struct VnMapEntry entry;
+    VnodeId vn;
+    int bad = 0;
+
+    reader = VnMapOpenRead(map);
+    if (reader == NULL)
+	return 0;
+    for (vn = 1; vn <= NVNODES + 100; vn++) {
+	if (VnMapRead(reader, vn, &entry) != 0) {
+	    bad++;
+	    continue;
+	}
+	if (vn > NVNODES) {
+	    if (entry.type != vNull)
+		bad++;
+	    continue;
+	}
+	if (entry.type != expect[vn].type
+	    || (entry.type != vNull
+		&& (entry.uniquifier != expect[vn].uniquifier
+		    || entry.serverModifyTime
+		       != expect[vn].serverModifyTime)))
+	    bad++;
+    }
+    VnMapCloseRead(reader);
+    return bad == 0;
+}
+
+/* Read a map file's header straight from disk; returns 0 on success */
+static int
+ReadHeader(char *path, afs_uint32 *hdr)
+{
+    int fd, code = -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return -1;
+    if (pread(fd, hdr, HDR_SIZE, 0) == HDR_SIZE)
+	code = 0;
+    close(fd);
+    return code;
+}
+
+int
+main(int argc, char **argv)
+{
+    char *dirname, *path, *longname;
+    struct VnMap *map;
+    struct VnMapBuilder *builder;
+    struct VnMapReader *reader;
+    struct VnMapEntry entry;
+    VnodeDiskObject vnode;
+    afs_uint32 hdr[HDR_SIZE / sizeof(afs_uint32)];
+    afs_uint32 raw[ENTRY_SIZE / sizeof(afs_uint32)];
+    struct stat st;
+    VnodeId vn;
+    int fd;
+
+    plan(24);
+
+    opr_Assert(sizeof(struct VnMapEntry) == ENTRY_SIZE);
+    dirname = afstest_mkdtemp();
+    if (dirname == NULL)
+	sysbail("afstest_mkdtemp");
+    if (asprintf(&path, "%s/V%010u.vnmap", dirname, (unsigned)VOLID) < 0)
+	sysbail("asprintf");
+
+    map = VnMapCreate(dirname, VOLID);
+    opr_Assert(map != NULL);
+    ok(!VnMapIsValid(map) && VnMapOpenRead(map) == NULL,
+       "no map before one is built");
+
+    /* Build one, a class at a time, as clone does */
+    builder = VnMapBuildBegin(map);
+    ok(builder != NULL, "map build begins");
+    for (vn = 1; vn <= NVNODES; vn += 2) {
+	if (vn % 5 == 0)
+	    continue;		/* some unused vnodes */
+	MakeVnode(&vnode, vn, 1000 + vn);
+	VnMapBuildAdd(builder, vn, &vnode);
+    }
+    for (vn = 2; vn <= NVNODES; vn += 2) {
+	if (vn % 5 == 0)
+	    continue;
+	MakeVnode(&vnode, vn, 1000 + vn);
+	VnMapBuildAdd(builder, vn, &vnode);
+    }
+    is_int(0, VnMapBuildEnd(builder, NULL, NULL, 1), "map build commits");
+    ok(VnMapIsValid(map), "built map is valid");
+    ok(CheckEntries(map), "built map reads back");
+
+    /* The file is laid out as documented */
+    is_int(0, ReadHeader(path, hdr), "map file has a header");
+    ok(hdr[0] == HDR_MAGIC && hdr[1] == HDR_VERSION && hdr[2] == VOLID
+       && (hdr[3] & HDR_CLEAN), "header has magic, version, volume, clean");
+    fd = open(path, O_RDONLY);
+    opr_Assert(fd >= 0);
+    opr_Assert(pread(fd, raw, sizeof(raw), HDR_SIZE + 9999 * ENTRY_SIZE)
+	       == sizeof(raw));
+    close(fd);
+    ok(raw[0] == expect[9999].uniquifier
+       && raw[1] == expect[9999].serverModifyTime
+       && raw[2] == expect[9999].type, "entries are indexed by vnode number");
+
+    /* An update marks the map unclean until it is closed */
+    MakeVnode(&vnode, 3, 5000);
+    VnMapStore(map, 3, &vnode);
+    is_int(0, ReadHeader(path, hdr), "header still there while updating");
+    ok(!(hdr[3] & HDR_CLEAN), "map is unclean while being updated");
+    ok(CheckEntries(map), "update reads back before close");
+    VnMapClose(map, NULL, NULL);
+    is_int(0, ReadHeader(path, hdr), "header still there after close");
+    ok((hdr[3] & HDR_CLEAN) && CheckEntries(map),
+       "map is clean and current after close");
+
+    /* One never closed, as after a crash, is not used, and is removed */
+    MakeVnode(&vnode, 4, 6000);
+    VnMapStore(map, 4, &vnode);
+    VnMapFree(map);
+    map = VnMapCreate(dirname, VOLID);
+    opr_Assert(map != NULL);
+    ok(!VnMapIsValid(map) && VnMapOpenRead(map) == NULL,
+       "unclean map is not used");
+    VnMapStore(map, 4, &vnode);
+    ok(stat(path, &st) != 0 && errno == ENOENT,
+       "unclean map is removed on the next update");
+    VnMapFree(map);
+
+    /* Invalidating removes the map */
+    map = VnMapCreate(dirname, VOLID);
+    opr_Assert(map != NULL);
+    builder = VnMapBuildBegin(map);
+    MakeVnode(&vnode, 1, 1);
+    VnMapBuildAdd(builder, 1, &vnode);
+    opr_Verify(VnMapBuildEnd(builder, NULL, NULL, 1) == 0);
+    VnMapInvalidate(map);
+    ok(!VnMapIsValid(map) && stat(path, &st) != 0,
+       "invalidated map is removed");
+    VnMapFree(map);
+
+    /* A new volume: the map is built from its empty indexes, and the root
+     * is then written straight to the large index, as ViceCreateRoot does */
+    memset(expect, 0, sizeof(expect));
+    map = VnMapCreate(dirname, VOLID);
+    opr_Assert(map != NULL);
+    builder = VnMapBuildBegin(map);
+    opr_Verify(VnMapBuildEnd(builder, NULL, NULL, 1) == 0);
+    MakeVnode(&vnode, 1, 2000);
+    VnMapStore(map, 1, &vnode);
+    VnMapClose(map, NULL, NULL);
+    VnMapFree(map);
+    map = VnMapCreate(dirname, VOLID);
+    opr_Assert(map != NULL);
+    ok(VnMapIsValid(map), "new volume's map is valid");
+    ok(CheckEntries(map), "new volume's root is in its map");
+    VnMapFree(map);
+
+    /* A clean map made stale by rewriting the index behind its back, as a
+     * dump must notice before trusting any entry */
+    memset(expect, 0, sizeof(expect));
+    map = VnMapCreate(dirname, VOLID);
+    opr_Assert(map != NULL);
+    builder = VnMapBuildBegin(map);
+    opr_Assert(builder != NULL);
+    for (vn = 1; vn <= 4; vn++) {
+	MakeVnode(&vnode, vn, 3000);
+	VnMapBuildAdd(builder, vn, &vnode);
+    }
+    opr_Verify(VnMapBuildEnd(builder, NULL, NULL, 1) == 0);
+    VnMapFree(map);
+    map = VnMapCreate(dirname, VOLID);
+    opr_Assert(map != NULL);
+    reader = VnMapOpenRead(map);
+    opr_Assert(reader != NULL);
+    MakeVnode(&vnode, 2, 3000);
+    ok(VnMapRead(reader, 2, &entry) == 0 && VnMapEntryMatches(&entry, &vnode),
+       "unchanged vnode matches its entry");
+    vnode.uniquifier++;
+    ok(VnMapRead(reader, 2, &entry) == 0 && !VnMapEntryMatches(&entry, &vnode),
+       "reused vnode does not match a stale entry");
+    memset(&vnode, 0, sizeof(vnode));
+    ok(VnMapRead(reader, 3, &entry) == 0 && !VnMapEntryMatches(&entry, &vnode),
+       "freed vnode does not match a stale entry");
+    MakeVnode(&vnode, 8, 3000);
+    ok(VnMapRead(reader, 8, &entry) == 0 && !VnMapEntryMatches(&entry, &vnode),
+       "new vnode does not match a stale unused entry");
+    VnMapCloseRead(reader);
+    VnMapFree(map);
+
+    /* A partition path too long to name the map with */
+    longname = malloc(VMAXPATHLEN + 1);
+    opr_Assert(longname != NULL);
+    memset(longname, 'x', VMAXPATHLEN);
+    longname[0] = '/';
+    longname[VMAXPATHLEN] = '\0';
+    map = VnMapCreate(longname, VOLID);
+    opr_Assert(map != NULL);
+    ok(VnMapBuildBegin(map) == NULL, "no map is built under a long path");
+    ok(!VnMapIsValid(map) && VnMapOpenRead(map) == NULL,
+       "no map is read under a long path");
+    VnMapFree(map);
+    free(longname);
+
+    free(path);
+    afstest_rmdtemp(dirname);
+    return 0;
+}